@@ -0,0 +1,79 @@
+#ifndef CXXFOOZZ_INCLUDE_CHECKPOINT_HPP_
+#define CXXFOOZZ_INCLUDE_CHECKPOINT_HPP_
+
+#include <istream>
+#include <map>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "execution.hpp"
+#include "program-context.hpp"
+#include "sequencegen.hpp"
+#include "type.hpp"
+
+/**
+ * Encoding of campaign state for checkpoints: integers and length-prefixed strings separated by spaces, test cases
+ * as statement lists whose references are statement indices. Types are encoded by name and executables by their
+ * position in the ProgramContext, so a checkpoint can only be read back by a run on the same analysis result.
+ */
+
+namespace cxxfoozz {
+
+class CheckpointWriter {
+ public:
+  CheckpointWriter(std::ostream &out, const std::shared_ptr<ProgramContext> &program_ctx);
+  void WriteInt(long long int value);
+  void WriteBool(bool value);
+  void WriteString(const std::string &value);
+  void WriteOptionalString(const bpstd::optional<std::string> &value);
+  void WriteOptionalText(const std::shared_ptr<const std::string> &value);
+  void WriteRaw(const std::string &encoded);
+  void WriteIntList(const std::vector<int> &values);
+  void WriteType(const TypeWithModifier &type);
+  bool CanWriteTestCase(const TestCase &tc) const;
+  void WriteTestCase(const TestCase &tc);
+  void WriteMemo(const TCMemo &memo);
+  void WriteSites(const CoverageDelta &sites);
+  void WriteReport(const CoverageReport &report);
+ private:
+  void WriteBaseType(const std::shared_ptr<Type> &type);
+  void WriteOperand(const Operand &operand, const std::map<std::shared_ptr<Statement>, int> &stmt_idxs);
+  void WriteOperands(const std::vector<Operand> &operands, const std::map<std::shared_ptr<Statement>, int> &stmt_idxs);
+  void WriteTemplateTypeContext(const std::shared_ptr<TemplateTypeContext> &tt_ctx);
+  std::ostream &out_;
+  std::map<const Executable *, int> executable_idxs_; // executables, then creators
+};
+
+// Reads never throw: the first malformed or unknown entry fails the reader and later reads return defaults.
+class CheckpointReader {
+ public:
+  CheckpointReader(std::istream &in, const std::shared_ptr<ProgramContext> &program_ctx);
+  bool IsGood() const;
+  void Fail(const std::string &reason);
+  long long int ReadInt();
+  bool ReadBool();
+  std::string ReadString();
+  bpstd::optional<std::string> ReadOptionalString();
+  std::vector<int> ReadIntList();
+  TypeWithModifier ReadType();
+  TestCase ReadTestCase();
+  TCMemo ReadMemo();
+  CoverageDelta ReadSites();
+  CoverageReport ReadReport();
+ private:
+  long long int GetRemainingSize();
+  std::shared_ptr<Type> ReadBaseType();
+  Operand ReadOperand(const std::vector<std::shared_ptr<Statement>> &statements);
+  std::vector<Operand> ReadOperands(const std::vector<std::shared_ptr<Statement>> &statements);
+  std::shared_ptr<TemplateTypeContext> ReadTemplateTypeContext();
+  std::istream &in_;
+  std::vector<std::shared_ptr<Executable>> executables_; // executables, then creators
+  std::map<std::string, std::shared_ptr<TemplateTypenameType>> typenames_; // one instance per name and checkpoint
+  bool good_ = true;
+};
+
+} // namespace cxxfoozz
+
+#endif //CXXFOOZZ_INCLUDE_CHECKPOINT_HPP_
@@ -32,6 +32,56 @@ class CLIParsedArgs {
   void SetMaxDepth(int max_depth);
   int GetFuzzTimeoutInSeconds() const;
   void SetFuzzTimeoutInSeconds(int fuzz_timeout);
+  int GetJobs() const;
+  void SetJobs(int jobs);
+  bool IsUseHarness() const;
+  void SetUseHarness(bool use_harness);
+  bool IsUseForkServer() const;
+  void SetUseForkServer(bool use_fork_server);
+  bool IsUseShmCov() const;
+  void SetUseShmCov(bool use_shm_cov);
+  bool IsUsePch() const;
+  void SetUsePch(bool use_pch);
+  bool IsUseMinimalIncludes() const;
+  void SetUseMinimalIncludes(bool use_minimal_includes);
+  bool IsUsePrelink() const;
+  void SetUsePrelink(bool use_prelink);
+  int GetBatchSize() const;
+  void SetBatchSize(int batch_size);
+  int GetBuildCacheSizeInMiB() const;
+  void SetBuildCacheSizeInMiB(int build_cache_size_in_mib);
+  bool IsUseDedupMutants() const;
+  void SetUseDedupMutants(bool use_dedup_mutants);
+  bool IsUseLearnCompileFailures() const;
+  void SetUseLearnCompileFailures(bool use_learn_compile_failures);
+  int GetRepairBudget() const;
+  void SetRepairBudget(int repair_budget);
+  bool IsUseMinimizeCorpus() const;
+  void SetUseMinimizeCorpus(bool use_minimize_corpus);
+  bool IsUseEnergySchedule() const;
+  void SetUseEnergySchedule(bool use_energy_schedule);
+  int GetStatsIntervalInSeconds() const;
+  void SetStatsIntervalInSeconds(int stats_interval_in_seconds);
+  int GetMinimizeBudget() const;
+  void SetMinimizeBudget(int minimize_budget);
+  int GetCheckpointIntervalInSeconds() const;
+  void SetCheckpointIntervalInSeconds(int checkpoint_interval_in_seconds);
+  bool IsResume() const;
+  void SetResume(bool resume);
+  bool IsUseCrashReport() const;
+  void SetUseCrashReport(bool use_crash_report);
+  int GetTriageWorkers() const;
+  void SetTriageWorkers(int triage_workers);
+  int GetExecTimeoutInMsec() const;
+  void SetExecTimeoutInMsec(int exec_timeout_in_msec);
+  bool IsUseAdaptiveTimeout() const;
+  void SetUseAdaptiveTimeout(bool use_adaptive_timeout);
+  int GetQueueMemoryInMiB() const;
+  void SetQueueMemoryInMiB(int queue_memory_in_mib);
+  bool IsStreamOutput() const;
+  void SetStreamOutput(bool stream_output);
+  const std::string &GetCovTool() const;
+  void SetCovTool(const std::string &cov_tool);
 
  private:
   std::string target_class_name_;
@@ -44,6 +94,31 @@ class CLIParsedArgs {
   std::string func_complexity_ext_file_;
   int max_depth_;
   int fuzz_timeout_in_seconds_; // in seconds
+  int jobs_ = 1;
+  bool use_harness_ = false;
+  bool use_fork_server_ = false;
+  bool use_shm_cov_ = false;
+  bool use_pch_ = false;
+  bool use_minimal_includes_ = false;
+  bool use_prelink_ = false;
+  int batch_size_ = 1;
+  int build_cache_size_in_mib_ = 0; // 0 = no build cache
+  bool use_dedup_mutants_ = false;
+  bool use_learn_compile_failures_ = false;
+  int repair_budget_ = 0;
+  bool use_minimize_corpus_ = false;
+  bool use_energy_schedule_ = false;
+  int stats_interval_in_seconds_ = 10; // 0 = no fuzzer_stats file
+  int minimize_budget_ = 0; // 0 = no test case minimization
+  int checkpoint_interval_in_seconds_ = 300; // 0 = no checkpoint
+  bool resume_ = false;
+  bool use_crash_report_ = false;
+  int triage_workers_ = 0; // 0 = crashes are triaged on the fuzzing threads
+  int exec_timeout_in_msec_ = 5000; // the upper bound when adaptive
+  bool use_adaptive_timeout_ = false;
+  int queue_memory_in_mib_ = 0; // 0 = the whole queue stays in memory
+  bool stream_output_ = false;
+  std::string cov_tool_ = "gcov"; // gcov = native gcno/gcda reader, lcov = lcov-filt; unused with --shm-cov
 
 };
 
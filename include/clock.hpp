@@ -22,6 +22,7 @@ class CPUClock : public DebuggingClock {
   ~CPUClock();
   static CPUClock ForLogging(const std::string& message);
   long long int MeasureElapsedInMsec() const;
+  long long int MeasureElapsedInUsec() const;
  private:
   clock_t start_;
 };
@@ -32,6 +33,8 @@ class WallClock : public DebuggingClock {
   ~WallClock();
   static WallClock ForLogging(const std::string& message);
   long long int MeasureElapsedInMsec() const;
+  long long int MeasureElapsedInUsec() const;
+  void Rewind(long long int elapsed_in_msec);
   static long long int GetCurrentMillis();
  private:
   std::chrono::steady_clock::time_point start_;
@@ -0,0 +1,52 @@
+#ifndef CXXFOOZZ_INCLUDE_COMPILE_FAILURE_CACHE_HPP_
+#define CXXFOOZZ_INCLUDE_COMPILE_FAILURE_CACHE_HPP_
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "statement.hpp"
+
+/**
+ * Negative cache of call shapes (an executable, plus the type and the creator of each operand) that the
+ * compiler rejected in earlier drivers. Generation consults it to avoid producing the same failure again.
+ */
+
+namespace cxxfoozz {
+
+class TestCase;
+
+class CompileFailureCache {
+ public:
+  CompileFailureCache();
+  static const std::shared_ptr<CompileFailureCache> &GetInstance();
+  bool IsEnabled() const;
+  void SetEnabled(bool enabled);
+  static uint64_t ComputeCallShape(const std::shared_ptr<CallStatement> &call_stmt);
+  static std::vector<int> ExtractErrorLines(const std::string &compiler_output, const std::string &source_file);
+  bool RecordFailure(const std::shared_ptr<Statement> &stmt);
+  void RecordSuccess(const TestCase &tc);
+  bool IsKnownFailure(const std::shared_ptr<Statement> &stmt) const;
+  bool IsBlocked(const std::shared_ptr<Executable> &executable) const;
+  std::vector<std::shared_ptr<Executable>> FilterBlocked(
+    const std::vector<std::shared_ptr<Executable>> &executables
+  ) const;
+  size_t GetShapeCount() const;
+  static const int kBlockAfterFailedShapes;
+  static const size_t kMaxShapes;
+ private:
+  static std::shared_ptr<CompileFailureCache> instance_;
+  bool enabled_ = false;
+  mutable std::mutex mutex_; // failures are recorded by the fuzzing workers, generation reads on the main thread
+  std::set<uint64_t> failed_shapes_;
+  std::map<const Executable *, int> failed_shape_count_; // distinct failing shapes per executable
+  std::set<const Executable *> compiled_; // appeared in a driver that compiled, never blocked
+};
+
+} // namespace cxxfoozz
+
+#endif //CXXFOOZZ_INCLUDE_COMPILE_FAILURE_CACHE_HPP_
@@ -2,18 +2,39 @@
 #define CXXFOOZZ_INCLUDE_COMPILER_HPP_
 
 #include "bpstd/optional.hpp"
+#include <atomic>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
 #include <set>
 #include <string>
+#include <unordered_map>
 #include <vector>
 #include "clock.hpp"
 
 namespace cxxfoozz {
 
+class GcovCoverage;
+class GcovCoverageReader;
+
 class ObjectFileLocator {
  public:
   std::string Lookup(const std::string &target_dir, int max_depth = 1);
 };
 
+// Links the target objects into one relocatable object (ld -r) that drivers link instead of every object.
+// Artifacts are cached by the paths, sizes, mtimes and contents of the objects.
+class ObjectPrelinker {
+ public:
+  explicit ObjectPrelinker(std::string cache_dir);
+  bpstd::optional<std::string> Prelink(const std::string &object_files);
+  static const std::string &kPrelinkedObjectPrefix;
+ private:
+  bpstd::optional<std::string> ComputeKey(const std::vector<std::string> &objects) const;
+  std::string cache_dir_;
+};
+
 class SysProcessReport {
  public:
   SysProcessReport(bool success, std::string command, std::string output);
@@ -46,14 +67,20 @@ class SourceCompiler {
     const std::string &target_o,
     const std::string &target_exe
   );
+  SysProcessReport BuildPrecompiledHeader(const std::string &prelude_hpp, const std::string &target_pch);
+  SysProcessReport CheckHeader(const std::string &header_file);
+  std::string GetBuildSignature() const;
   static const std::string &kTmpDriverCppFilename;
   static const std::string &kTmpDriverObjectFilename;
   static const std::string &kTmpDriverExeFilename;
+  static const std::string &kPreludeHPPFilename;
+  static const std::string &kPreludePCHFilename;
  private:
   SysProcessReport Compile(const std::string &target_cpp, const std::string &target_o);
   SysProcessReport Link(const std::string &target_o, const std::string &target_exe);
   std::string cxx_compiler_;
   std::string object_files_;
+  std::string precompiled_header_; // empty = drivers parse their prelude themselves
   const std::vector<std::string> &additional_compile_flags_;
   const std::vector<std::string> &additional_ld_flags_;
 };
@@ -78,30 +105,171 @@ class CoverageReport {
   int func_cov_, func_tot_;
 };
 
+// Sites first covered by one execution: gcov line/branch/function ids, or edge ids of the shared memory map.
+class CoverageDelta {
+ public:
+  CoverageDelta();
+  std::vector<int> &GetLines();
+  std::vector<int> &GetBranches();
+  std::vector<int> &GetFunctions();
+  std::vector<int> &GetEdges();
+  const std::vector<int> &GetLines() const;
+  const std::vector<int> &GetBranches() const;
+  const std::vector<int> &GetFunctions() const;
+  const std::vector<int> &GetEdges() const;
+  bool IsEmpty() const;
+  std::string ToPrettyString() const;
+ private:
+  std::vector<int> lines_;
+  std::vector<int> branches_;
+  std::vector<int> functions_;
+  std::vector<int> edges_;
+};
+
 class ExecutionResult {
  public:
   ExecutionResult(
     int return_code,
     const bpstd::optional<CoverageReport> &cov_report,
-    bool interesting
+    bool interesting,
+    CoverageDelta delta = CoverageDelta()
   );
   int GetReturnCode() const;
   const bpstd::optional<CoverageReport> &GetCovReport() const;
   bool IsInteresting() const;
+  const CoverageDelta &GetDelta() const;
+  const CoverageDelta &GetCoveredSites() const;
+  void SetCoveredSites(CoverageDelta covered_sites);
   bool IsSuccessful() const;
   bool HasCaughtException() const;
+  bool IsTimedOut() const;
+  long long int GetExecTimeInUsec() const;
+  void SetExecTimeInUsec(long long int exec_time_in_usec);
  public:
   static const int kExceptionReturnCode;
  private:
   int return_code_;
   bpstd::optional<CoverageReport> cov_report_;
   bool interesting_;
+  CoverageDelta delta_;
+  CoverageDelta covered_sites_; // every site of the run, in the encoding of delta_; only for interesting runs
+  long long int exec_time_in_usec_ = 0;
+};
+
+// Coverage reached by the campaign so far. Shared by the observers of all fuzzing workers;
+// when a tracefile is given, each worker merges its own lcov tracefile into it.
+class CoverageBaseline {
+ public:
+  CoverageBaseline();
+  explicit CoverageBaseline(std::string tracefile);
+  std::mutex &GetMutex();
+  const std::string &GetTracefile() const;
+  bool IsMergedFromWorkers() const;
+  int GetTracefileVersion() const;
+  void ReplaceTracefile(const std::string &merged_tracefile);
+  const CoverageReport &GetReport() const;
+  void SetReport(const CoverageReport &report);
+  int MergeEdges(const unsigned char *trace, size_t size, std::vector<int> *added = nullptr);
+  int GetSeenEdgeCount() const;
+  CoverageReport MergeSites(const GcovCoverage &sites, CoverageDelta *delta = nullptr);
+  CoverageDelta GetCoveredSites() const;
+  void RestoreCoveredSites(const CoverageDelta &sites, const CoverageReport &report);
+ private:
+  std::mutex mutex_;
+  std::string tracefile_;
+  int tracefile_version_;
+  CoverageReport report_;
+  std::shared_ptr<GcovCoverage> sites_; // native gcov mode only
+  std::vector<unsigned char> seen_edges_; // shared memory mode only
+  int seen_edge_count_;
+};
+
+// Edge map shared with the executed target. Object files built with -fsanitize-coverage=trace-pc-guard record
+// every hit edge into it through the callbacks of kGuardRuntimeSource, which is linked into every driver.
+class SharedCoverageMap {
+ public:
+  SharedCoverageMap();
+  ~SharedCoverageMap();
+  SharedCoverageMap(const SharedCoverageMap &) = delete;
+  SharedCoverageMap &operator=(const SharedCoverageMap &) = delete;
+  bool IsAttached() const;
+  int GetShmId() const;
+  void Reset();
+  const unsigned char *GetEdges() const;
+  int GetGuardCount() const;
+  static std::string BuildRuntime(const std::string &cxx_compiler, const std::string &output_dir);
+  static const std::string &kGuardRuntimeSource;
+  static const std::string &kShmEnvVar;
+  static const size_t kMapSize;
+ private:
+  int shm_id_ = -1;
+  unsigned char *region_ = nullptr; // guard count header, then kMapSize edge bytes
+};
+
+// Fatal signal handler linked into every driver with --crash-report. It unwinds the crashing thread and writes the
+// signal and the frame addresses to the file named by kReportEnvVar, which CrashTCHandler symbolizes instead of
+// running the driver again under gdb.
+class CrashReportRuntime {
+ public:
+  static std::string BuildRuntime(const std::string &cxx_compiler, const std::string &output_dir);
+  static const std::string &kHandlerRuntimeSource;
+  static const std::string &kReportEnvVar;
+};
+
+// Client side of the fork server compiled into drivers (kForkServerDriverSource). The target is exec'd once
+// without a shell, every run request then forks a fresh child from the already initialized process.
+class ForkServerClient {
+ public:
+  ForkServerClient(std::string target_exe, std::vector<std::string> args, std::map<std::string, std::string> env);
+  ~ForkServerClient();
+  ForkServerClient(const ForkServerClient &) = delete;
+  ForkServerClient &operator=(const ForkServerClient &) = delete;
+  bool Start();
+  void Stop();
+  bool IsAlive() const;
+  int Run(long long int timeout_in_msec, int request = kOwnArgsRequest);
+  long long int GetLastRunLatencyInUsec() const;
+  static const std::string &kForkServerDriverSource;
+  static const std::string &kForkServerEnvVar;
+  static const int kTimeoutReturnCode;
+  static const int kServerFailureReturnCode;
+  static const int kOwnArgsRequest;
+ private:
+  std::string target_exe_;
+  std::vector<std::string> args_;
+  std::map<std::string, std::string> env_;
+  int server_pid_ = -1;
+  int ctl_fd_ = -1; // fuzzer -> server
+  int st_fd_ = -1; // server -> fuzzer
+  long long int last_run_latency_in_usec_ = 0;
 };
 
 enum class CoverageMeasurementTool {
   kGCOVR = 0,
   kLCOV,
   kLCOVFILT,
+  kSharedMemory, // lcov-filt is still used for the final report
+  kNativeGcov,
+};
+
+// Per-campaign execution timeout: kTimeoutMultiplier times the 99th percentile of the run times of the last
+// kMaxSamples valid seeds, within kMinTimeoutInMsec and the configured timeout. The configured timeout applies
+// until kMinSamples seeds were measured.
+class ExecTimeoutCalibrator {
+ public:
+  explicit ExecTimeoutCalibrator(long long int max_timeout_in_msec);
+  void RecordSeedRunTime(long long int exec_time_in_usec);
+  long long int GetTimeoutInMsec() const;
+  long long int GetMaxTimeoutInMsec() const;
+  static const long long int kTimeoutMultiplier;
+  static const long long int kMinTimeoutInMsec;
+  static const size_t kMinSamples;
+  static const size_t kMaxSamples;
+ private:
+  long long int max_timeout_in_msec_;
+  std::mutex mutex_;
+  std::deque<long long int> run_times_in_usec_;
+  std::atomic<long long int> timeout_in_msec_;
 };
 
 class CoverageObserver {
@@ -111,20 +279,45 @@ class CoverageObserver {
     std::string object_files_dir,
     std::string source_files_dir,
     CoverageMeasurementTool measurement_tool,
-    long long int exec_timeout_in_msec = 5000ll
+    long long int exec_timeout_in_msec = 5000ll,
+    std::string gcov_prefix = "",
+    std::shared_ptr<CoverageBaseline> baseline = nullptr,
+    std::shared_ptr<GcovCoverageReader> gcov_reader = nullptr
+  );
+  ExecutionResult ExecuteAndMeasureCov(const std::string &target_exe, const std::string &exe_args = "");
+  ExecutionResult ExecuteAndMeasureCov(
+    ForkServerClient &fork_server,
+    int request = ForkServerClient::kOwnArgsRequest
   );
-  ExecutionResult ExecuteAndMeasureCov(const std::string &target_exe);
+  ExecutionResult ExecuteAndCollectSites(const std::string &target_exe, const std::string &exe_args = "");
   CoverageReport MeasureCoverage();
+  CoverageReport MeasureFinalReport();
   void CleanCovInfo();
   bool IsGCNOFileExisted();
+  void PrepareGcovPrefix();
+  std::map<std::string, std::string> GetEnv() const;
+  const std::shared_ptr<CoverageBaseline> &GetBaseline() const;
+  void EnableCrashReport();
+  long long int GetExecTimeoutInMsec() const;
+  void SetExecTimeoutInMsec(long long int exec_timeout_in_msec);
  private:
-  int Execute(const std::string &target_exe);
-  CoverageReport prev_success_;
+  int Execute(const std::string &target_exe, const std::string &exe_args);
+  void ResetCounters();
+  ExecutionResult MeasureAfterExecution(int rc);
+  CoverageDelta CollectCoveredSites() const;
+  std::string GetGcdaDir() const;
+  CoverageReport MergeIntoBaseline(const CoverageReport &report);
   std::string object_files_dir_;
   std::string source_files_dir_;
   long long int exec_timeout_in_msec_;
   std::string output_dir_;
   CoverageMeasurementTool measurement_tool_;
+  std::string gcov_prefix_; // empty = gcda files are written next to the object files
+  std::shared_ptr<CoverageBaseline> baseline_;
+  std::shared_ptr<SharedCoverageMap> shm_map_; // kSharedMemory only
+  std::shared_ptr<GcovCoverageReader> gcov_reader_; // kNativeGcov only, shared by all workers
+  std::shared_ptr<GcovCoverage> last_sites_; // sites of the last kNativeGcov measurement
+  std::string crash_report_file_; // empty = drivers do not report their crashes
 };
 
 class TCMemo;
@@ -132,26 +325,62 @@ class TCMemo;
 class CrashTCHandler {
  public:
   CrashTCHandler();
+  explicit CrashTCHandler(std::string gdb_command_file);
   ~CrashTCHandler();
-  TCMemo ExecuteInGDBEnv(const std::string &target_exe, const std::string &src_dir);
+  CrashTCHandler(const CrashTCHandler &) = delete;
+  CrashTCHandler &operator=(const CrashTCHandler &) = delete;
+  TCMemo TriageCrash(
+    const std::string &target_exe,
+    const std::string &src_dir,
+    const std::map<std::string, std::string> &env = {},
+    const std::string &exe_args = ""
+  );
+  TCMemo ExecuteInGDBEnv(
+    const std::string &target_exe,
+    const std::string &src_dir,
+    const std::map<std::string, std::string> &env = {},
+    const std::string &exe_args = ""
+  );
   bool RegisterIfNewCrash(const std::string &squashed_stack_trace);
+  const std::set<std::string> &GetUniqueCrashes() const;
  private:
+  bpstd::optional<TCMemo> ReadCrashReport(
+    const std::string &report_file,
+    const std::string &target_exe,
+    const std::string &src_dir
+  );
+  TCMemo BuildMemoFromLocations(const std::vector<std::string> &locations, const std::string &src_dir);
   void WriteGDBCommandFile();
   void DeleteGDBCommandFile();
   std::string SquashStackTrace(const std::vector<std::string> &stack_trace_ids);
   bool IsNewCrash(const std::string &squashed_stack_trace) const;
+  std::string gdb_command_file_;
   std::set<std::string> unique_crashes_;
 };
 
+// Compiler diagnostics and gdb outputs repeat across test cases, e.g. the output of a batch build is attached to
+// every failed test case of the batch. Each distinct text is kept once while a memo refers to it.
+class TextInterner {
+ public:
+  static const std::shared_ptr<TextInterner> &GetInstance();
+  std::shared_ptr<const std::string> Intern(const std::string &text);
+  size_t GetTextCount();
+ private:
+  void RemoveExpired();
+  std::mutex mutex_;
+  std::unordered_map<size_t, std::vector<std::weak_ptr<const std::string>>> texts_; // by hash of the text
+  size_t interned_since_cleanup_ = 0;
+};
+
 class TCMemo {
  public:
   TCMemo();
   bool IsValidCrash() const;
   const bpstd::optional<std::string> &GetFingerprint() const;
-  const bpstd::optional<std::string> &GetGdbOutput() const;
+  const std::shared_ptr<const std::string> &GetGdbOutput() const; // nullptr if none
   const bpstd::optional<std::string> &GetLocation() const;
   const bpstd::optional<int> &GetCrashLineNum() const;
-  const bpstd::optional<std::string> &GetCompilationOutput() const;
+  const std::shared_ptr<const std::string> &GetCompilationOutput() const; // nullptr if none
 
   void SetValidCrash(bool valid_crash);
   void SetFingerprint(const bpstd::optional<std::string> &fingerprint);
@@ -163,10 +392,69 @@ class TCMemo {
  private:
   bool valid_crash_ = true;
   bpstd::optional<std::string> fingerprint_; // for identifying crash, taken src location from non-library call stack
-  bpstd::optional<std::string> gdb_output_; // for gdb output
+  std::shared_ptr<const std::string> gdb_output_; // for gdb output, interned
   bpstd::optional<std::string> location_; // for bottommost-level call stack
   bpstd::optional<int> crash_line_num_;
-  bpstd::optional<std::string> compilation_output_; // for incompilable
+  std::shared_ptr<const std::string> compilation_output_; // for incompilable, interned
+};
+
+// Build and run outcome of one driver source.
+class CachedDriverBuild {
+ public:
+  CachedDriverBuild(CompilationResult compile_result, std::string compile_output);
+  CompilationResult GetCompileResult() const;
+  const std::string &GetCompileOutput() const;
+  const std::string &GetExecutable() const;
+  void SetExecutable(const std::string &executable);
+  unsigned long long int GetSizeInBytes() const;
+  void SetSizeInBytes(unsigned long long int size_in_bytes);
+  const bpstd::optional<int> &GetReturnCode() const;
+  const bpstd::optional<TCMemo> &GetCrashMemo() const;
+  void SetExecution(int return_code, const bpstd::optional<TCMemo> &crash_memo);
+ private:
+  CompilationResult compile_result_;
+  std::string compile_output_;
+  std::string executable_; // empty = not kept (build failed or too large for the cache)
+  unsigned long long int size_in_bytes_ = 0;
+  bpstd::optional<int> return_code_; // set once the driver ran with a reproducible outcome
+  bpstd::optional<TCMemo> crash_memo_;
+};
+
+// Reuses builds and run outcomes of byte-identical drivers, keyed by the driver source and the build flags.
+// Least recently used entries are evicted above the size bound; the cache dir is removed on destruction.
+class DriverBuildCache {
+ public:
+  DriverBuildCache(std::string cache_dir, unsigned long long int max_size_in_bytes);
+  ~DriverBuildCache();
+  DriverBuildCache(const DriverBuildCache &) = delete;
+  DriverBuildCache &operator=(const DriverBuildCache &) = delete;
+  static std::string SelectCacheDir(const std::string &fallback_dir);
+  bpstd::optional<std::string> ComputeKey(const std::string &driver_cpp, const std::string &build_signature) const;
+  bpstd::optional<CachedDriverBuild> Lookup(const std::string &key);
+  void StoreBuild(
+    const std::string &key,
+    CompilationResult compile_result,
+    const std::string &compile_output,
+    const std::string &target_exe
+  );
+  void StoreExecution(const std::string &key, int return_code, const bpstd::optional<TCMemo> &crash_memo = {});
+  bool RestoreExecutable(const CachedDriverBuild &build, const std::string &target_exe) const;
+  std::string ToPrettyString();
+  static const std::string &kTmpfsDir;
+ private:
+  void Touch(const std::string &key);
+  void Erase(const std::string &key);
+  void EvictIfNeeded();
+  std::string cache_dir_;
+  unsigned long long int max_size_in_bytes_;
+  unsigned long long int size_in_bytes_ = 0;
+  std::map<std::string, CachedDriverBuild> entries_;
+  std::map<std::string, long long int> last_used_; // key -> tick
+  std::map<long long int, std::string> lru_; // tick -> key, oldest first
+  long long int tick_ = 0;
+  long long int hits_ = 0;
+  long long int misses_ = 0;
+  std::mutex mutex_;
 };
 }
 
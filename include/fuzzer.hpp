@@ -8,8 +8,26 @@
 #include "program-context.hpp"
 #include "execution.hpp"
 
+#include <atomic>
+#include <condition_variable>
+#include <csignal>
+#include <deque>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <thread>
+
 namespace cxxfoozz {
 
+class CoverageLogger;
+class CrashTriagePool;
+class InterpreterHarness;
+class MinimizationJob;
+class StreamingQueueWriter;
+class TestCaseMinimizer;
+class TestCaseSpillStore;
+class TestCaseWriter;
+
 class CompilationContext {
  public:
   CompilationContext(
@@ -52,40 +70,189 @@ class FlushableTestCase {
  public:
   explicit FlushableTestCase(TestCase tc);
   FlushableTestCase(TestCase tc, const TCMemo &memo);
+  FlushableTestCase(int id, TestCase tc, const TCMemo &memo);
   int GetId() const;
   bool IsFlushed() const;
   const TestCase &GetTc() const;
+  void SetTc(const TestCase &tc);
   void SetFlushed(bool flushed);
   const TCMemo &GetMemo() const;
+  void SetMemo(const TCMemo &memo);
   int GetReturnCode() const;
   void SetReturnCode(int return_code);
   int GetTimestamp() const;
   void SetTimestamp(int timestamp);
+  const CoverageDelta &GetCoverageDelta() const;
+  void SetCoverageDelta(const CoverageDelta &coverage_delta);
+  int GetParentId() const;
+  void SetParentId(int parent_id);
+  long long int GetCostInUsec() const;
+  void SetCostInUsec(long long int cost_in_usec);
+  int GetFuzzCount() const;
+  void IncrementFuzzCount();
+  void SetFuzzCount(int fuzz_count);
+  long long int GetChildrenCoverage() const;
+  void AddChildrenCoverage(long long int coverage);
+  const CoverageDelta &GetCoveredSites() const;
+  void SetCoveredSites(const CoverageDelta &covered_sites);
+  size_t GetStatementCount() const;
+  bool IsSpilled() const;
+  void Spill();
+  void Restore(const TestCase &tc, const TCMemo &memo);
+  bool HasSpilledCopy() const;
+  void SetSpilledCopy(bool spilled_copy);
+  long long int GetLastAccess() const;
+  void SetLastAccess(long long int last_access);
+  unsigned long long int EstimateResidentBytes() const;
+  static int GetLastId();
+  static void SetLastId(int last_id);
 
  private:
   static int kGlobalTCId;
   int id_;
   int timestamp_;
-  bool flushed_ = false; // allow destruction only if flushed_ = true :)
+  bool flushed_ = false; // its current test case is written out, reset when the test case is replaced
   TestCase tc_;
   TCMemo memo_;
   int return_code_;
+  CoverageDelta coverage_delta_; // sites this test case added to the campaign coverage
+  int parent_id_ = -1; // seed this test case was mutated from, -1 if generated from scratch
+  long long int cost_in_usec_ = 0; // compile + execution of the attempt that found it
+  int fuzz_count_ = 0; // times it was picked as a seed
+  long long int children_coverage_ = 0; // coverage added by test cases mutated from it
+  CoverageDelta covered_sites_; // every site of its run, empty unless coverage is measured per site
+  size_t statement_count_ = 0; // also known while spilled
+  bool spilled_ = false; // tc_ and the memo texts are only in the spill store
+  bool spilled_copy_ = false; // the spill store has the current tc_ and memo_
+  long long int last_access_ = 0; // queue tick of its admission or last pick as a seed
+};
+
+// Loads a spilled test case for the lifetime of the scope and spills it again at its end, outputs are written one
+// entry at a time instead of bringing the whole queue back into memory. No-op for resident test cases.
+class ResidentTestCaseScope {
+ public:
+  ResidentTestCaseScope(FlushableTestCase &ftc, TestCaseSpillStore *spill_store);
+  ~ResidentTestCaseScope();
+  ResidentTestCaseScope(const ResidentTestCaseScope &) = delete;
+  ResidentTestCaseScope &operator=(const ResidentTestCaseScope &) = delete;
+  bool IsResident() const;
+ private:
+  FlushableTestCase &ftc_;
+  bool loaded_ = false;
+};
+
+// Greedy set cover over the sites covered by each test case: the kept test cases cover the same sites as the
+// input, preferring the ones covering most uncovered sites, then the shorter ones.
+class CorpusMinimizer {
+ public:
+  static bool HasCoveredSites(const std::vector<FlushableTestCase> &tcs);
+  static std::vector<FlushableTestCase> Minimize(const std::vector<FlushableTestCase> &tcs);
 };
 
 class TestCaseQueue {
  public:
   std::vector<FlushableTestCase> &GetValid();
   std::vector<FlushableTestCase> GetValidByTimestamp(int last_ts_in_sec);
+  std::vector<FlushableTestCase> &GetSubsumed();
   std::vector<FlushableTestCase> &GetCrashes();
   std::vector<FlushableTestCase> &GetIncompilable();
+  std::vector<FlushableTestCase> &GetHangs();
   FlushableTestCase &AddValid(const TestCase &tc);
   FlushableTestCase &AddCrashes(const TestCase &tc, const TCMemo &memo);
   FlushableTestCase &AddIncompilable(const TestCase &tc, const TCMemo &memo);
+  FlushableTestCase &AddHang(const TestCase &tc, const TCMemo &memo);
+  bool IsNewHang(const std::string &fingerprint) const;
+  FlushableTestCase *FindValid(int id);
+  FlushableTestCase *FindCrash(int id);
+  std::vector<FlushableTestCase> GetAllValid() const;
+  size_t MinimizeValid();
   void PrintSummary();
+  void EnableSpill(std::shared_ptr<TestCaseSpillStore> spill_store, unsigned long long int memory_budget_in_bytes);
+  const std::shared_ptr<TestCaseSpillStore> &GetSpillStore() const;
+  bool MakeResident(FlushableTestCase &ftc);
+  size_t SpillColdEntries();
  private:
   std::vector<FlushableTestCase> valid_;
+  std::vector<FlushableTestCase> subsumed_; // valid test cases dropped by a minimization, kept for the partitions
   std::vector<FlushableTestCase> crashes_;
   std::vector<FlushableTestCase> incompilable_;
+  std::vector<FlushableTestCase> hangs_; // one per fingerprint
+  std::shared_ptr<TestCaseSpillStore> spill_store_; // only with --queue-memory
+  unsigned long long int memory_budget_in_bytes_ = 0;
+  long long int access_tick_ = 0;
+};
+
+// Scratch files and coverage observer owned by one fuzzing worker.
+class FuzzingWorker {
+ public:
+  FuzzingWorker(int worker_id, std::string scratch_dir, std::shared_ptr<CoverageObserver> observer);
+  int GetWorkerId() const;
+  const std::string &GetScratchDir() const;
+  std::string GetTmpDriverCpp() const;
+  std::string GetTmpDriverObject() const;
+  std::string GetTmpDriverExe() const;
+  std::string GetHarnessInput() const;
+  CoverageObserver &GetObserver() const;
+  bool IsHarnessInputReady() const;
+  void SetHarnessInputReady(bool harness_input_ready);
+  const std::vector<int> &GetBatchFirstLines() const;
+  void SetBatchFirstLines(const std::vector<int> &batch_first_lines);
+  const std::vector<int> &GetParentIds() const;
+  void SetParentIds(const std::vector<int> &parent_ids);
+  ForkServerClient *AcquireHarnessServer(const std::string &harness_exe);
+ private:
+  int worker_id_;
+  std::string scratch_dir_;
+  std::shared_ptr<CoverageObserver> observer_;
+  bool harness_input_ready_ = false; // set by the dispatching thread before each attempt
+  std::vector<int> batch_first_lines_; // header line of each test case function in the batch driver
+  std::vector<int> parent_ids_; // seed of each dispatched test case, -1 if generated from scratch
+  std::shared_ptr<ForkServerClient> harness_server_; // persistent, reads GetHarnessInput() on every run
+};
+
+// Runs compile/execute attempts on a fixed set of workers. With a single worker,
+// attempts run synchronously on the dispatching thread.
+class FuzzingWorkerPool {
+ public:
+  using AttemptFn = std::function<void(FuzzingWorker &, const std::vector<TestCase> &)>;
+  FuzzingWorkerPool(std::vector<std::shared_ptr<FuzzingWorker>> workers, AttemptFn attempt_fn);
+  ~FuzzingWorkerPool();
+  FuzzingWorkerPool(const FuzzingWorkerPool &) = delete;
+  FuzzingWorkerPool &operator=(const FuzzingWorkerPool &) = delete;
+  std::shared_ptr<FuzzingWorker> AcquireIdleWorker();
+  void Dispatch(const std::shared_ptr<FuzzingWorker> &worker, const std::vector<TestCase> &tcs);
+  void Join();
+ private:
+  void RunWorker(const std::shared_ptr<FuzzingWorker> &worker);
+  std::vector<std::shared_ptr<FuzzingWorker>> workers_;
+  AttemptFn attempt_fn_;
+  std::vector<std::thread> threads_;
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::deque<std::shared_ptr<FuzzingWorker>> idle_;
+  std::map<int, std::vector<TestCase>> pending_; // worker id -> dispatched test cases, more than one for batches
+  bool joining_ = false;
+};
+
+// Power schedule over the valid queue: fast, small seeds whose children found coverage get more mutations, and
+// the energy of a seed decays as it keeps being picked. Also balances generating from scratch against mutating
+// seeds by how often each of them found coverage recently.
+class SeedScheduler {
+ public:
+  SeedScheduler();
+  bool ShouldGenerateFromScratch(const std::vector<FlushableTestCase> &seeds);
+  size_t SelectSeed(const std::vector<FlushableTestCase> &seeds);
+  void RecordAttempt(bool from_scratch);
+  void RecordFind(bool from_scratch);
+  static double ComputeEnergy(const FlushableTestCase &seed, double avg_cost_in_usec, double avg_size);
+  static const double kMinScratchProbability;
+  static const double kMaxScratchProbability;
+  static const long long int kRateHalfLife;
+ private:
+  double scratch_attempts_ = 0.0;
+  double scratch_finds_ = 0.0;
+  double seed_attempts_ = 0.0;
+  double seed_finds_ = 0.0;
 };
 
 class MainFuzzer {
@@ -94,16 +261,106 @@ class MainFuzzer {
   const TestCaseQueue &GetQueue() const;
   void MainLoop(const FuzzingMainLoopSpec &spec);
   static void SignalHandling(int signum);
+  static void MinimizationSignalHandling(int signum);
  private:
-  TestCase LoadTestCase(const TestCaseGenerator &tcgen, const std::vector<std::shared_ptr<Executable>> &class_methods);
+  TestCase LoadTestCase(
+    const TestCaseGenerator &tcgen,
+    const std::vector<std::shared_ptr<Executable>> &class_methods,
+    int &parent_id
+  );
   bpstd::optional<TestCase> LoadTestCaseDeterministically(
     const TestCaseGenerator &tcgen,
     const std::vector<std::shared_ptr<Executable>> &executables
     );
+  void RunAttempt(
+    FuzzingWorker &worker,
+    const TestCase &mutation,
+    SourceCompiler &compiler,
+    TestCaseWriter &tc_writer,
+    CrashTCHandler &crash_tc_handler,
+    CoverageLogger &cov_logger,
+    const WallClock &fuzzing_clock,
+    const std::string &src_dir_abs,
+    const std::shared_ptr<InterpreterHarness> &harness
+  );
+  void RunBatchAttempt(
+    FuzzingWorker &worker,
+    const std::vector<TestCase> &mutations,
+    SourceCompiler &compiler,
+    TestCaseWriter &tc_writer,
+    CrashTCHandler &crash_tc_handler,
+    CoverageLogger &cov_logger,
+    const WallClock &fuzzing_clock,
+    const std::string &src_dir_abs
+  );
+  ExecutionResult ExecuteAndMeasureCov(
+    CoverageObserver &observer,
+    ForkServerClient *fork_server,
+    const std::string &target_exe,
+    const std::string &exe_args = "",
+    int server_request = ForkServerClient::kOwnArgsRequest
+  );
+  void HandleNormalExecution(
+    const TestCase &mutation,
+    const ExecutionResult &exec_result,
+    CoverageLogger &cov_logger,
+    const WallClock &fuzzing_clock,
+    int parent_id,
+    long long int cost_in_usec
+  );
+  void HandleCrashingExecution(const TestCase &mutation, const TCMemo &memo, CrashTCHandler &crash_tc_handler);
+  void HandleHangingExecution(const TestCase &mutation);
+  void LearnCompileFailure(const TestCase &mutation, TestCaseWriter &tc_writer, const std::vector<int> &error_lines);
+  bpstd::optional<TestCase> RepairTestCase(
+    FuzzingWorker &worker,
+    const TestCase &mutation,
+    SourceCompiler &compiler,
+    TestCaseWriter &tc_writer,
+    std::pair<CompilationResult, std::string> &build_result,
+    std::vector<bool> &dropped
+  );
+  void WriteFuzzerStats(const std::string &stats_filename, int jobs, int batch_size);
+  bool WriteCheckpoint(
+    const std::string &checkpoint_filename,
+    const std::shared_ptr<ProgramContext> &program_ctx,
+    CoverageBaseline &baseline,
+    const CrashTCHandler &crash_tc_handler,
+    const CoverageLogger &cov_logger,
+    long long int elapsed_in_msec
+  );
+  bool ReadCheckpoint(
+    const std::string &checkpoint_filename,
+    const std::shared_ptr<ProgramContext> &program_ctx,
+    CoverageBaseline &baseline,
+    CrashTCHandler &crash_tc_handler,
+    CoverageLogger &cov_logger,
+    long long int &elapsed_in_msec
+  );
+  void SubmitMinimizationJobs();
+  void ApplyMinimization(const MinimizationJob &job);
+  void StreamQueue(StreamingQueueWriter &streaming_writer);
  private:
   TestCaseQueue queue_;
+  std::mutex queue_mutex_; // guards queue_ and crash/coverage bookkeeping shared by workers
   unsigned int seed_scheduling_counter_;
+  bool use_energy_schedule_ = false;
+  SeedScheduler seed_scheduler_; // guarded by queue_mutex_
+  bool use_fork_server_ = false;
+  std::atomic<long long int> served_runs_{0};
+  std::atomic<long long int> served_run_latency_in_usec_{0};
+  std::shared_ptr<DriverBuildCache> build_cache_; // only with --build-cache
+  int repair_budget_ = 0; // rebuilds allowed per incompilable test case
+  std::atomic<long long int> repaired_tcs_{0};
+  std::shared_ptr<CrashTriagePool> triage_pool_; // only with --triage-workers
+  std::shared_ptr<ExecTimeoutCalibrator> timeout_calibrator_; // only with --adaptive-timeout
+  long long int exec_timeout_in_msec_ = 5000LL;
+  std::atomic<long long int> early_hangs_{0}; // over the calibrated timeout, under the configured one
+  std::shared_ptr<TestCaseMinimizer> minimizer_; // only with --minimize-budget
+  bool minimize_seeds_ = false; // seeds need per-site coverage
+  std::vector<int> pending_seed_minimizations_; // guarded by queue_mutex_, cloned on the dispatching thread
+  std::vector<int> pending_crash_minimizations_; // guarded by queue_mutex_
   static bool interrupt;
+  static volatile std::sig_atomic_t minimization_requested; // set by the SIGUSR1 handler
 };
 
 } // namespace cxxfoozz
@@ -0,0 +1,95 @@
+#ifndef CXXFOOZZ_INCLUDE_GCOV_HPP_
+#define CXXFOOZZ_INCLUDE_GCOV_HPP_
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "execution.hpp"
+
+/**
+ * In-process reader for the gcov notes (.gcno) and counter (.gcda) files written by clang --coverage.
+ * Notes are parsed once; a measurement only reads the arc counters and sets the covered sites.
+ */
+
+namespace cxxfoozz {
+
+class SiteBitset {
+ public:
+  SiteBitset();
+  explicit SiteBitset(size_t size);
+  size_t GetSize() const;
+  void Set(size_t site);
+  bool Test(size_t site) const;
+  int Count() const;
+  std::vector<int> GetSetSites() const;
+  int MergeFrom(const SiteBitset &other, std::vector<int> *added = nullptr); // returns the number of newly set sites
+ private:
+  size_t size_;
+  std::vector<uint64_t> words_;
+};
+
+// Covered line, branch and function sites, indexed by the ids assigned by GcovCoverageReader.
+class GcovCoverage {
+ public:
+  GcovCoverage();
+  GcovCoverage(size_t line_tot, size_t branch_tot, size_t func_tot);
+  SiteBitset &GetLines();
+  SiteBitset &GetBranches();
+  SiteBitset &GetFunctions();
+  const SiteBitset &GetLines() const;
+  const SiteBitset &GetBranches() const;
+  const SiteBitset &GetFunctions() const;
+  CoverageReport ToReport() const;
+  void MergeFrom(const GcovCoverage &other, CoverageDelta *delta = nullptr);
+ private:
+  SiteBitset lines_;
+  SiteBitset branches_;
+  SiteBitset functions_;
+};
+
+class GcovBuffer {
+ public:
+  explicit GcovBuffer(std::vector<char> data);
+  static bpstd::optional<GcovBuffer> FromFile(const std::string &filename);
+  bool ReadWord(uint32_t &value);
+  bool ReadInt64(uint64_t &value);
+  bool ReadString(int version, std::string &value);
+  size_t Tell() const;
+  void Seek(size_t pos);
+ private:
+  std::vector<char> data_;
+  size_t pos_;
+};
+
+struct GcovNotesFile;
+
+class GcovCoverageReader {
+ public:
+  explicit GcovCoverageReader(std::string object_files_dir);
+  ~GcovCoverageReader();
+  GcovCoverageReader(const GcovCoverageReader &) = delete;
+  GcovCoverageReader &operator=(const GcovCoverageReader &) = delete;
+  bool Load();
+  GcovCoverage Read(const std::string &gcda_dir) const;
+  void RemoveCounters(const std::string &gcda_dir) const;
+  size_t GetLineTot() const;
+  size_t GetBranchTot() const;
+  size_t GetFuncTot() const;
+  static const std::vector<std::string> &kExcludedPathPrefixes;
+ private:
+  bool LoadNotes(const std::string &gcno_path, const std::string &gcda_relative_path);
+  void ReadCounters(const GcovNotesFile &notes, const std::string &gcda_path, GcovCoverage &coverage) const;
+  int AssignSite(std::map<std::string, size_t> &site_ids, const std::string &filename, const std::string &key);
+  std::string object_files_dir_;
+  std::vector<std::unique_ptr<GcovNotesFile>> notes_;
+  std::map<std::string, size_t> line_ids_; // "file:line", sites in system headers are never assigned an id
+  std::map<std::string, size_t> branch_ids_;
+  std::map<std::string, size_t> func_ids_;
+};
+
+} // namespace cxxfoozz
+
+#endif //CXXFOOZZ_INCLUDE_GCOV_HPP_
@@ -0,0 +1,78 @@
+#ifndef CXXFOOZZ_INCLUDE_HARNESS_HPP_
+#define CXXFOOZZ_INCLUDE_HARNESS_HPP_
+
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "execution.hpp"
+#include "program-context.hpp"
+#include "sequencegen.hpp"
+#include "writer.hpp"
+
+/**
+ * Compile-once interpreter harness: a single executable per target holding a call stub for every supported
+ * Executable/Creator. Test cases are shipped to it as bytecode instead of being compiled one by one.
+ */
+
+namespace cxxfoozz {
+
+class HarnessStub {
+ public:
+  HarnessStub(std::shared_ptr<Executable> executable, bool has_invoking_obj, bool returns_value);
+  const std::shared_ptr<Executable> &GetExecutable() const;
+  bool HasInvokingObj() const;
+  bool IsReturnsValue() const;
+ private:
+  std::shared_ptr<Executable> executable_;
+  bool has_invoking_obj_;
+  bool returns_value_; // false = the result is discarded, statements cannot refer to it
+};
+
+class InterpreterHarness {
+ public:
+  InterpreterHarness(
+    std::shared_ptr<ImportWriter> import_writer,
+    std::shared_ptr<ProgramContext> program_ctx,
+    std::string harness_dir
+  );
+  bool Build(SourceCompiler &compiler, int max_attempts = 16);
+  bool IsReady() const;
+  std::string GetExecutable() const;
+  int GetStubCount() const;
+  bool WriteBytecode(const TestCase &tc, const std::string &filename) const;
+  static const std::string &kHarnessCppFilename;
+  static const std::string &kHarnessObjectFilename;
+  static const std::string &kHarnessExeFilename;
+ private:
+  void CollectStubs();
+  void WriteToFile(const std::string &filename);
+  bpstd::optional<std::string> StubAsString(const HarnessStub &stub, int stub_idx) const;
+  bool DropStubsByDiagnostics(CompilationResult result, const std::string &output);
+  bool EncodeStatement(
+    const std::shared_ptr<Statement> &stmt,
+    const std::map<std::shared_ptr<Statement>, int> &slots,
+    std::vector<bool> &has_value,
+    std::string &out
+  ) const;
+  bool EncodeOperand(
+    const Operand &operand,
+    const TypeWithModifier &type_rq,
+    const std::map<std::shared_ptr<Statement>, int> &slots,
+    const std::vector<bool> &has_value,
+    std::string &out
+  ) const;
+ private:
+  std::shared_ptr<ImportWriter> import_writer_;
+  std::shared_ptr<ProgramContext> program_ctx_;
+  std::string harness_dir_;
+  std::vector<HarnessStub> stubs_;
+  std::vector<std::pair<int, int>> stub_lines_; // [first, last] line of each stub in the harness source
+  std::map<std::shared_ptr<Executable>, int> stub_index_;
+  bool ready_ = false;
+};
+
+} // namespace cxxfoozz
+
+#endif //CXXFOOZZ_INCLUDE_HARNESS_HPP_
@@ -1,6 +1,7 @@
 #ifndef CXXFOOZZ_INCLUDE_LOGGER_HPP_
 #define CXXFOOZZ_INCLUDE_LOGGER_HPP_
 
+#include <fstream>
 #include <string>
 #include <vector>
 #include "fuzzer.hpp"
@@ -68,9 +69,12 @@ class CoverageLogger {
     int time_gap,
     TestCaseQueue &queue
   );
+  void StreamTo(const std::string &output_dir);
 
  private:
+  void PrintFooter(std::ofstream &target, long long int max_timestamp_in_sec, TestCaseQueue &queue);
   std::vector<CoverageLoggingEntry> entries_;
+  std::ofstream stream_; // out_report.csv while fuzzing, each entry is appended as it is logged
 };
 } // namespace cxxfoozz
 
@@ -0,0 +1,98 @@
+#ifndef CXXFOOZZ_INCLUDE_MINIMIZER_HPP_
+#define CXXFOOZZ_INCLUDE_MINIMIZER_HPP_
+
+#include "execution.hpp"
+#include "sequencegen.hpp"
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * Statement-level delta debugging of admitted test cases, on a background thread with its own scratch dir and
+ * coverage observer. Seeds must keep every site of their original run, crashes must keep their fingerprint.
+ */
+
+namespace cxxfoozz {
+
+class FuzzingWorker;
+class TestCaseWriter;
+
+enum class MinimizationTarget {
+  kSeed = 0,
+  kCrash,
+};
+
+// Statements of a job are deep copies, owned by the minimizer until the job is handed back.
+class MinimizationJob {
+ public:
+  MinimizationJob(int tc_id, MinimizationTarget target, TestCase tc, TCMemo memo);
+  int GetTcId() const;
+  MinimizationTarget GetTarget() const;
+  const TestCase &GetTc() const;
+  void SetTc(const TestCase &tc);
+  const TCMemo &GetMemo() const;
+  void SetMemo(const TCMemo &memo);
+ private:
+  int tc_id_;
+  MinimizationTarget target_;
+  TestCase tc_;
+  TCMemo memo_; // crashes only, the fingerprint to keep
+};
+
+class TestCaseMinimizer {
+ public:
+  using ResultFn = std::function<void(const MinimizationJob &)>;
+  TestCaseMinimizer(
+    std::shared_ptr<FuzzingWorker> worker,
+    SourceCompiler &compiler,
+    std::shared_ptr<TestCaseWriter> tc_writer,
+    CrashTCHandler &crash_tc_handler,
+    std::string src_dir,
+    int budget,
+    ResultFn result_fn
+  );
+  ~TestCaseMinimizer();
+  TestCaseMinimizer(const TestCaseMinimizer &) = delete;
+  TestCaseMinimizer &operator=(const TestCaseMinimizer &) = delete;
+  static TestCase DeepClone(const TestCase &tc);
+  static TestCase BuildCandidate(const TestCase &tc, std::vector<bool> &kept);
+  void Submit(const MinimizationJob &job);
+  void Finish();
+  long long int GetMinimizedCount() const;
+  long long int GetRemovedStatementCount() const;
+ private:
+  void Run();
+  bool Minimize(MinimizationJob &job);
+  bpstd::optional<ExecutionResult> BuildAndRun(const TestCase &tc);
+  bool IsReproduced(
+    const MinimizationJob &job,
+    const ExecutionResult &reference,
+    const ExecutionResult &exec_result,
+    TCMemo &memo
+  );
+  std::shared_ptr<FuzzingWorker> worker_;
+  SourceCompiler &compiler_;
+  std::shared_ptr<TestCaseWriter> tc_writer_; // not shared with the dispatching thread
+  CrashTCHandler &crash_tc_handler_;
+  std::string src_dir_;
+  int budget_; // candidate builds per test case
+  ResultFn result_fn_;
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::deque<MinimizationJob> crash_jobs_; // run first, they are written out at the end of the campaign
+  std::deque<MinimizationJob> seed_jobs_;
+  bool finishing_ = false;
+  std::atomic<long long int> minimized_count_{0};
+  std::atomic<long long int> removed_statement_count_{0};
+  std::thread thread_;
+};
+
+} // namespace cxxfoozz
+
+#endif //CXXFOOZZ_INCLUDE_MINIMIZER_HPP_
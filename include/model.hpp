@@ -225,6 +225,8 @@ class Executable {
   bool IsExcluded() const;
   void SetExcluded(bool excluded);
   std::string GetMangledName() const;
+  const clang::SourceLocation &GetDeclLocation() const;
+  void SetDeclLocation(const clang::SourceLocation &decl_location);
 
   bool IsMember() const;
   virtual std::string DebugString() const;
@@ -242,6 +244,7 @@ class Executable {
   bool is_conversion_decl_ = false;
   bool excluded_ = false;
   std::string mangled_name_;
+  clang::SourceLocation decl_location_; // invalid for implicit executables
 };
 
 enum class CreatorVariant {
@@ -0,0 +1,97 @@
+#ifndef CXXFOOZZ_INCLUDE_PIPELINE_STATS_HPP_
+#define CXXFOOZZ_INCLUDE_PIPELINE_STATS_HPP_
+
+#include "clock.hpp"
+
+#include <array>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+/**
+ * Wall time spent in each stage of the fuzzing pipeline, and attempt throughput over the whole campaign and over
+ * sliding windows. Periodically written to a key/value "fuzzer_stats" file that can be scraped during a run.
+ */
+
+namespace cxxfoozz {
+
+enum class PipelineStage {
+  kGenerate = 0,
+  kMutate,
+  kWrite,
+  kCompile,
+  kLink,
+  kExecute,
+  kCoverage,
+  kCrashTriage,
+};
+
+// Log-scale histogram of durations, four buckets per power of two: percentiles are within 25% and memory is fixed.
+class DurationHistogram {
+ public:
+  DurationHistogram();
+  void Record(long long int elapsed_in_usec);
+  long long int GetCount() const;
+  long long int GetTotalInUsec() const;
+  long long int GetMaxInUsec() const;
+  long long int GetPercentileInUsec(double percentile) const;
+  static const int kBucketCount = 256;
+ private:
+  static int ToBucket(long long int elapsed_in_usec);
+  static long long int BucketUpperBound(int bucket);
+  std::array<long long int, kBucketCount> buckets_{};
+  long long int count_ = 0;
+  long long int total_in_usec_ = 0;
+  long long int max_in_usec_ = 0;
+};
+
+class PipelineStats {
+ public:
+  PipelineStats();
+  static const std::shared_ptr<PipelineStats> &GetInstance();
+  static std::string GetStageName(PipelineStage stage);
+  bool IsEnabled() const;
+  void Start();
+  void Stop();
+  void RecordStage(PipelineStage stage, long long int elapsed_in_usec);
+  void RecordAttempts(int attempts);
+  long long int GetTotalAttempts() const;
+  double GetAttemptsPerSec(int window_in_sec) const;
+  bool WriteStatsFile(
+    const std::string &filename,
+    const std::vector<std::pair<std::string, std::string>> &extra_entries
+  ) const;
+  void PrintSummary() const;
+  static const int kStageCount = 8;
+  static const int kWindowSlots = 300; // one per second, the longest sliding window
+ private:
+  static std::shared_ptr<PipelineStats> instance_;
+  std::atomic<bool> enabled_{false}; // read without the lock by every recording thread
+  mutable std::mutex mutex_; // stages are recorded by the fuzzing workers
+  long long int start_millis_ = 0; // unix time, for the stats file
+  WallClock campaign_clock_;
+  CPUClock cpu_clock_;
+  std::array<DurationHistogram, kStageCount> stages_;
+  long long int total_attempts_ = 0;
+  std::array<long long int, kWindowSlots> window_attempts_{};
+  std::array<long long int, kWindowSlots> window_second_{}; // campaign second a slot currently counts for
+};
+
+// Records the wall time of a stage when it goes out of scope.
+class StageTimer {
+ public:
+  explicit StageTimer(PipelineStage stage);
+  ~StageTimer();
+  StageTimer(const StageTimer &) = delete;
+  StageTimer &operator=(const StageTimer &) = delete;
+ private:
+  PipelineStage stage_;
+  WallClock clock_;
+};
+
+} // namespace cxxfoozz
+
+#endif //CXXFOOZZ_INCLUDE_PIPELINE_STATS_HPP_
@@ -0,0 +1,73 @@
+#ifndef CXXFOOZZ_INCLUDE_PROCESS_HPP_
+#define CXXFOOZZ_INCLUDE_PROCESS_HPP_
+
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+/**
+ * Runs programs without a shell: children are forked and exec'd from an argv vector, their output is
+ * collected through non-blocking pipes on an epoll loop and they are killed at millisecond deadlines.
+ */
+
+namespace cxxfoozz {
+
+class ProcessSpec {
+ public:
+  explicit ProcessSpec(std::vector<std::string> argv);
+  static ProcessSpec FromShellCommand(const std::string &command);
+  const std::vector<std::string> &GetArgv() const;
+  const std::map<std::string, std::string> &GetEnv() const;
+  void SetEnv(const std::map<std::string, std::string> &env);
+  long long int GetTimeoutInMsec() const;
+  void SetTimeoutInMsec(long long int timeout_in_msec);
+  const std::vector<std::pair<int, unsigned long long int>> &GetResourceLimits() const;
+  void AddResourceLimit(int resource, unsigned long long int limit);
+  bool IsCaptureStderr() const;
+  void SetCaptureStderr(bool capture_stderr);
+  std::string ToString() const;
+ private:
+  std::vector<std::string> argv_;
+  std::map<std::string, std::string> env_; // on top of the environment of the fuzzer
+  long long int timeout_in_msec_ = 0; // 0 = no deadline
+  std::vector<std::pair<int, unsigned long long int>> resource_limits_; // RLIMIT_* -> soft and hard limit
+  bool capture_stderr_ = true; // false = stderr goes to /dev/null
+};
+
+// Child side of a spawn, prepared from a ProcessSpec before fork and applied between fork and exec with
+// async-signal-safe calls only: own process group, default signal dispositions and an empty mask, /dev/null on
+// stdin, then the resource limits. Apply returns 0, or the errno of the call that failed.
+class ChildProcessSetup {
+ public:
+  explicit ChildProcessSetup(const ProcessSpec &spec);
+  int Apply(int out_fd, int err_fd) const; // -1 = /dev/null
+ private:
+  std::vector<std::pair<int, unsigned long long int>> resource_limits_;
+};
+
+class ProcessResult {
+ public:
+  ProcessResult(int return_code, bool timed_out, std::string output, long long int elapsed_in_usec);
+  int GetReturnCode() const;
+  bool IsTimedOut() const;
+  const std::string &GetOutput() const;
+  long long int GetElapsedInUsec() const;
+  static const int kTimeoutReturnCode;
+  static const int kSpawnFailureReturnCode;
+ private:
+  int return_code_; // exit status, or 128 + signal like a shell would report
+  bool timed_out_;
+  std::string output_;
+  long long int elapsed_in_usec_;
+};
+
+class ProcessSupervisor {
+ public:
+  static ProcessResult Run(const ProcessSpec &spec);
+  static std::vector<ProcessResult> RunAll(const std::vector<ProcessSpec> &specs);
+};
+
+} // namespace cxxfoozz
+
+#endif //CXXFOOZZ_INCLUDE_PROCESS_HPP_
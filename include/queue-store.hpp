@@ -0,0 +1,46 @@
+#ifndef CXXFOOZZ_INCLUDE_QUEUE_STORE_HPP_
+#define CXXFOOZZ_INCLUDE_QUEUE_STORE_HPP_
+
+#include <fstream>
+#include <map>
+#include <memory>
+#include <string>
+#include <utility>
+
+#include "checkpoint.hpp"
+#include "execution.hpp"
+#include "program-context.hpp"
+#include "sequencegen.hpp"
+
+/**
+ * On-disk store of cold queue entries: their test cases and memos in the checkpoint encoding, appended to one
+ * file. Guarded by the queue mutex like the queue itself.
+ */
+
+namespace cxxfoozz {
+
+class TestCaseSpillStore {
+ public:
+  TestCaseSpillStore(std::string filename, std::shared_ptr<ProgramContext> program_ctx);
+  TestCaseSpillStore(const TestCaseSpillStore &) = delete;
+  TestCaseSpillStore &operator=(const TestCaseSpillStore &) = delete;
+  bool CanStore(const TestCase &tc) const;
+  bool Store(int tc_id, const TestCase &tc, const TCMemo &memo);
+  bpstd::optional<std::pair<TestCase, TCMemo>> Load(int tc_id);
+  bpstd::optional<std::pair<long long int, long long int>> FindEncoded(int tc_id) const;
+  bpstd::optional<std::string> ReadEncodedAt(const std::pair<long long int, long long int> &location) const;
+  size_t GetEntryCount() const;
+  long long int GetSizeInBytes();
+ private:
+  std::string filename_;
+  std::shared_ptr<ProgramContext> program_ctx_;
+  std::ofstream out_;
+  std::ifstream in_;
+  CheckpointWriter writer_;
+  std::unique_ptr<CheckpointReader> reader_; // kept across loads, template typenames stay shared like in memory
+  std::map<int, std::pair<long long int, long long int>> entries_; // test case id -> offset and length of its copy
+};
+
+} // namespace cxxfoozz
+
+#endif //CXXFOOZZ_INCLUDE_QUEUE_STORE_HPP_
@@ -24,6 +24,8 @@ class Random {
   double NextDouble(double min, double max);
   double NextGaussian();
   std::string NextString(int minLen = 0, int exclusiveMaxLen = 11);
+  std::string SaveState() const;
+  bool RestoreState(const std::string &state);
 
   template<typename T>
   std::string NextIntGen();
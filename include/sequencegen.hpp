@@ -5,6 +5,8 @@
 #include "type.hpp"
 #include "program-context.hpp"
 
+#include <cstdint>
+
 namespace cxxfoozz {
 
 class TestCase {
@@ -18,6 +20,7 @@ class TestCase {
   const std::shared_ptr<TemplateTypeContext> &GetTemplateTypeContext() const;
   std::string DebugString(const std::shared_ptr<ProgramContext> &prog_ctx) const;
   bool Verify() const;
+  uint64_t ComputeStructuralHash() const;
  private:
   std::vector<std::shared_ptr<Statement>> statements_;
   std::shared_ptr<TemplateTypeContext> template_type_context_; // TODO: Do we need tt_ctx in TC level?
@@ -0,0 +1,77 @@
+#ifndef CXXFOOZZ_INCLUDE_TRIAGE_HPP_
+#define CXXFOOZZ_INCLUDE_TRIAGE_HPP_
+
+#include "execution.hpp"
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ * Crash triage off the fuzzing threads. Crashing executables are copied aside together with the crash report of
+ * their run, then triaged by a bounded pool of threads that each run gdb with their own command file.
+ */
+
+namespace cxxfoozz {
+
+class CrashTriageJob {
+ public:
+  using ResultFn = std::function<void(const TCMemo &)>;
+  CrashTriageJob(
+    std::string target_exe,
+    std::string exe_args,
+    std::map<std::string, std::string> env,
+    ResultFn result_fn
+  );
+  const std::string &GetTargetExe() const;
+  const std::string &GetExeArgs() const;
+  const std::map<std::string, std::string> &GetEnv() const;
+  const ResultFn &GetResultFn() const;
+ private:
+  std::string target_exe_; // a copy owned by the job, the worker rebuilds its own executable meanwhile
+  std::string exe_args_;
+  std::map<std::string, std::string> env_;
+  ResultFn result_fn_;
+};
+
+class CrashTriagePool {
+ public:
+  CrashTriagePool(std::string scratch_dir, std::string src_dir, int thread_count);
+  ~CrashTriagePool();
+  CrashTriagePool(const CrashTriagePool &) = delete;
+  CrashTriagePool &operator=(const CrashTriagePool &) = delete;
+  void Submit(
+    const std::string &target_exe,
+    const std::map<std::string, std::string> &env,
+    const std::string &exe_args,
+    const CrashTriageJob::ResultFn &result_fn
+  );
+  void Finish();
+  long long int GetTriagedCount() const;
+  static const int kQueueCapacityPerThread;
+ private:
+  void Run(int thread_id);
+  std::string scratch_dir_;
+  std::string src_dir_;
+  std::vector<std::unique_ptr<CrashTCHandler>> handlers_; // one per thread, only their gdb command files differ
+  std::mutex mutex_;
+  std::condition_variable not_empty_cv_;
+  std::condition_variable not_full_cv_;
+  std::deque<CrashTriageJob> jobs_;
+  size_t capacity_; // Submit blocks when full, the fuzzing threads then wait instead of losing crashes
+  long long int submitted_count_ = 0; // names the copies of the jobs
+  bool finishing_ = false;
+  std::atomic<long long int> triaged_count_{0};
+  std::vector<std::thread> threads_;
+};
+
+} // namespace cxxfoozz
+
+#endif //CXXFOOZZ_INCLUDE_TRIAGE_HPP_
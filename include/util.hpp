@@ -1,6 +1,7 @@
 #ifndef CXXFOOZZ_INCLUDE_UTIL_HPP_
 #define CXXFOOZZ_INCLUDE_UTIL_HPP_
 
+#include <cstdint>
 #include <string>
 #include <vector>
 
@@ -9,5 +10,30 @@ std::string StringJoin(const std::vector<std::string> &tokens, const std::string
 std::string StringStrip(const std::string &input_string);
 
 std::string ReplaceFirstOccurrence(std::string input, const std::string &keyword, const std::string &repl);
+std::vector<std::string> SplitCommandLine(const std::string &command_line); // shell-like quoting, no expansion
+
+const uint64_t kFnv1aOffsetBasis = 14695981039346656037ULL;
+uint64_t Fnv1aHash(const char *data, size_t size, uint64_t hash = kFnv1aOffsetBasis);
+uint64_t Fnv1aHash(const std::string &data, uint64_t hash = kFnv1aOffsetBasis);
+std::string ToHexString(uint64_t value);
+
+// Approximate set of 64-bit hashes: no false negatives, and false positives at about the given rate
+// as long as no more than the expected number of hashes are inserted.
+class BloomFilter {
+ public:
+  BloomFilter(size_t expected_items, double false_positive_rate);
+  bool Contains(uint64_t hash) const;
+  bool Insert(uint64_t hash); // false if the hash was (probably) inserted before
+  size_t GetInsertedCount() const;
+  size_t GetExpectedItems() const;
+  void Clear();
+ private:
+  size_t BitIndex(uint64_t hash, int probe) const;
+  size_t expected_items_;
+  size_t bit_count_;
+  int probe_count_;
+  size_t inserted_count_ = 0;
+  std::vector<uint64_t> words_;
+};
 
 #endif //CXXFOOZZ_INCLUDE_UTIL_HPP_
@@ -23,10 +23,23 @@ class ImportWriter {
     const std::shared_ptr<ClassTypeModel> &target
   );
   int GetLineUsage() const;
+  void EnableMinimalIncludes(
+    const clang::SourceManager *src_manager,
+    std::function<bool(const std::string &)> is_self_contained,
+    std::vector<std::string> always_included
+  );
+  void WriteHeader(std::ofstream &out, const TestCase &tc);
 
  private:
+  bool CollectDeclLocations(const TestCase &tc, std::vector<clang::SourceLocation> &locations) const;
+  bpstd::optional<std::string> ResolveHeader(const clang::SourceLocation &location);
+  bool IsSelfContained(const std::string &header_file);
   std::vector<std::string> header_files_;
-
+  const clang::SourceManager *src_manager_ = nullptr; // null = always write every header
+  std::function<bool(const std::string &)> is_self_contained_;
+  std::vector<std::string> always_included_;
+  std::map<unsigned, bpstd::optional<std::string>> resolved_headers_; // raw SourceLocation -> header
+  std::map<std::string, bool> self_contained_;
 };
 
 class ScaffoldingHPPFileWriter {
@@ -43,24 +56,40 @@ class ScaffoldingHPPFileWriter {
   static bool kUseScaffoldingHPP;
 };
 
+enum class TmpDriverPurpose {
+  kOneShot = 0,
+  kForkServer, // batch drivers are served by a fork server, one-shot drivers stay plain executables
+};
+
 class TestCaseWriter {
  public:
   TestCaseWriter(
     std::shared_ptr<ImportWriter> import_writer,
-    const std::shared_ptr<ProgramContext> &context
+    const std::shared_ptr<ProgramContext> &context,
+    TmpDriverPurpose purpose = TmpDriverPurpose::kOneShot
   );
   const std::shared_ptr<ImportWriter> &GetImportWriter() const;
   void WriteToFile(const TestCase &tc, const std::string &filename);
+  std::vector<int> WriteBatchToFile(const std::vector<TestCase> &tcs, const std::string &filename);
+  bpstd::optional<std::pair<int, int>> LocateBatchLine(const std::vector<int> &first_lines, int src_linenum) const;
+  void BlankBatchFunctions(
+    const std::string &filename,
+    const std::vector<int> &first_lines,
+    const std::set<int> &tc_idxs
+  );
+  void BlankStatements(const std::string &filename, const std::set<int> &stmt_idxs);
   static int LineNumberToStmtIdx(int src_linenum, int import_line_count, bool has_exception); // stmtIdx: 0-based idx
   bpstd::optional<std::shared_ptr<Statement>> GetStatementByLineNumber(
     const TestCase &tc,
     int src_linenum,
     bool has_exception
   );
+  static const std::string &kBatchFunctionPrefix;
 
  private:
   std::shared_ptr<ImportWriter> import_writer_;
   const std::shared_ptr<ProgramContext> &context_;
+  TmpDriverPurpose purpose_;
 };
 
 class GoogleTestWriter {
@@ -71,13 +100,18 @@ class GoogleTestWriter {
     std::vector<std::string> compile_flags,
     std::vector<std::string> ld_flags,
     int max_depth,
-    const std::shared_ptr<ProgramContext> &context
+    const std::shared_ptr<ProgramContext> &context,
+    std::string prelinked_object = ""
   );
   void WriteToFile(
     std::vector<FlushableTestCase> &flushable_tcs,
     const std::string &filename,
     const std::string &suite_name = "CxxFoozzTestSuite"
   );
+  void WriteHeader(std::ofstream &target);
+  void WriteTest(std::ofstream &target, FlushableTestCase &ftc, const std::string &suite_name = "CxxFoozzTestSuite");
+  void WriteFooter(std::ofstream &target, const std::string &filename);
+  void SetSpillStore(const std::shared_ptr<TestCaseSpillStore> &spill_store);
  private:
   void AppendCompileInstruction(std::ofstream &target, const std::string &filename);
  private:
@@ -87,6 +121,8 @@ class GoogleTestWriter {
   std::vector<std::string> ld_flags_;
   int max_depth_;
   const std::shared_ptr<ProgramContext> &context_;
+  std::string prelinked_object_; // empty = link every object found under target_dir_
+  std::shared_ptr<TestCaseSpillStore> spill_store_; // loads spilled test cases while they are written
 };
 
 enum class ReplayDriverPurpose {
@@ -103,12 +139,17 @@ class ReplayDriverWriter {
     std::vector<std::string> ld_flags,
     int max_depth,
     const std::shared_ptr<ProgramContext> &context,
-    ReplayDriverPurpose purpose
+    ReplayDriverPurpose purpose,
+    std::string prelinked_object = ""
   );
   void WriteToDirectory(
     std::vector<FlushableTestCase> &flushable_tcs,
     const std::string &dir_name
   );
+  void WriteDriver(const FlushableTestCase &ftc, const std::string &dir_name);
+  void SetSpillStore(const std::shared_ptr<TestCaseSpillStore> &spill_store);
+  static std::string GetDriverFilename(int tc_id);
+  static const std::vector<int> kPartitionHours; // <dir_name>/<h> replays the valid test cases of the first h hours
  private:
   void AppendLibFuzzerHelperFunctions(std::ofstream &target);
   void AppendCompileInstruction(std::ofstream &target, const std::string &filename);
@@ -120,6 +161,47 @@ class ReplayDriverWriter {
   int max_depth_;
   const std::shared_ptr<ProgramContext> &context_;
   ReplayDriverPurpose purpose_;
+  std::string prelinked_object_; // empty = link every object found under target_dir_
+  std::shared_ptr<TestCaseSpillStore> spill_store_; // loads spilled test cases while they are written
+};
+
+// Writes the outputs of the valid and crashing test cases while fuzzing, as they are admitted to the queue. Finish
+// only completes the suites and drops the drivers of test cases removed meanwhile, FlushQueue writes the rest.
+class StreamingQueueWriter {
+ public:
+  StreamingQueueWriter(
+    GoogleTestWriter gtest_writer,
+    ReplayDriverWriter replay_writer,
+    ReplayDriverWriter libfuzzer_writer,
+    std::string output_dir
+  );
+  StreamingQueueWriter(const StreamingQueueWriter &) = delete;
+  StreamingQueueWriter &operator=(const StreamingQueueWriter &) = delete;
+  void Open();
+  void Append(std::vector<FlushableTestCase> &valid, std::vector<FlushableTestCase> &crashes);
+  void Finish(TestCaseQueue &queue, bool minimize_corpus);
+  long long int GetStreamedCount() const;
+ private:
+  void AppendToSuite(std::ofstream &suite, std::set<int> &suite_ids, bool &suite_rewrite, FlushableTestCase &ftc);
+  void FinishSuite(
+    std::ofstream &suite,
+    const std::string &filename,
+    bool suite_rewrite,
+    std::vector<FlushableTestCase> &tcs
+  );
+  void RemoveDrivers(const std::string &dir_name, const std::vector<FlushableTestCase> &kept, int last_ts_in_sec);
+  GoogleTestWriter gtest_writer_;
+  ReplayDriverWriter replay_writer_;
+  ReplayDriverWriter libfuzzer_writer_;
+  std::string output_dir_;
+  std::ofstream valid_suite_;
+  std::ofstream crash_suite_;
+  std::set<int> valid_suite_ids_;
+  std::set<int> crash_suite_ids_;
+  bool valid_suite_rewrite_ = false; // a test case changed after it was appended, GoogleTest rejects a second TEST
+  bool crash_suite_rewrite_ = false;
+  std::map<int, int> streamed_drivers_; // test case id -> timestamp, i.e. the partitions having its driver
+  long long int streamed_count_ = 0;
 };
 
 } // namespace cxxfoozz
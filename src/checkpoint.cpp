@@ -0,0 +1,532 @@
+#include "checkpoint.hpp"
+#include "logger.hpp"
+#include "statement.hpp"
+
+namespace cxxfoozz {
+
+std::map<const Executable *, int> IndexCheckpointExecutables(const std::shared_ptr<ProgramContext> &program_ctx) {
+  std::map<const Executable *, int> executable_idxs;
+  int idx = 0;
+  for (const auto &executable : program_ctx->GetExecutables())
+    executable_idxs.emplace(executable.get(), idx++);
+  for (const auto &creator : program_ctx->GetCreators())
+    executable_idxs.emplace(creator.get(), idx++);
+  return executable_idxs;
+}
+
+// ##########
+// # CheckpointWriter
+// #####
+
+CheckpointWriter::CheckpointWriter(std::ostream &out, const std::shared_ptr<ProgramContext> &program_ctx)
+  : out_(out), executable_idxs_(IndexCheckpointExecutables(program_ctx)) {}
+void CheckpointWriter::WriteInt(long long int value) {
+  out_ << value << ' ';
+}
+void CheckpointWriter::WriteBool(bool value) {
+  WriteInt(value ? 1 : 0);
+}
+void CheckpointWriter::WriteString(const std::string &value) {
+  out_ << value.size() << ':' << value << ' ';
+}
+void CheckpointWriter::WriteOptionalString(const bpstd::optional<std::string> &value) {
+  WriteBool(value.has_value());
+  if (value.has_value())
+    WriteString(value.value());
+}
+// Same encoding as an optional string.
+void CheckpointWriter::WriteOptionalText(const std::shared_ptr<const std::string> &value) {
+  WriteBool(value != nullptr);
+  if (value != nullptr)
+    WriteString(*value);
+}
+// Entries written by another CheckpointWriter of the same ProgramContext, e.g. spilled test cases.
+void CheckpointWriter::WriteRaw(const std::string &encoded) {
+  out_ << encoded;
+}
+void CheckpointWriter::WriteIntList(const std::vector<int> &values) {
+  WriteInt((long long int) values.size());
+  for (int value : values)
+    WriteInt(value);
+}
+
+void CheckpointWriter::WriteBaseType(const std::shared_ptr<Type> &type) {
+  if (type == nullptr) {
+    WriteInt(-1);
+    return;
+  }
+  TypeVariant variant = type->GetVariant();
+  WriteInt((int) variant);
+  switch (variant) {
+    case TypeVariant::kPrimitive: {
+      const auto &primitive_type = std::static_pointer_cast<PrimitiveType>(type);
+      WriteInt((int) primitive_type->GetPrimitiveTypeVariant());
+      break;
+    }
+    case TypeVariant::kClass:
+    case TypeVariant::kEnum:
+    case TypeVariant::kTemplateTypename:
+    case TypeVariant::kSTL:
+      WriteString(type->GetName());
+      break;
+    case TypeVariant::kTemplateTypenameSpc: {
+      const auto &spc_type = std::static_pointer_cast<TemplateTypenameSpcType>(type);
+      WriteBaseType(spc_type->GetTargetType());
+      const std::vector<TemplateTypeInstantiation> &insts = spc_type->GetInstList().GetInstantiations();
+      WriteInt((long long int) insts.size());
+      for (const auto &inst : insts) {
+        WriteInt((int) inst.GetVariant());
+        switch (inst.GetVariant()) {
+          case TemplateTypeInstVariant::kType: WriteType(inst.GetType());
+            break;
+          case TemplateTypeInstVariant::kIntegral: WriteInt(inst.GetIntegral());
+            break;
+          case TemplateTypeInstVariant::kNullptr: break;
+        }
+      }
+      break;
+    }
+  }
+}
+void CheckpointWriter::WriteType(const TypeWithModifier &type) {
+  WriteBool(type.IsBottomType());
+  WriteBaseType(type.GetType());
+  WriteInt((long long int) type.GetModifiers().size());
+  for (Modifier modifier : type.GetModifiers())
+    WriteInt((int) modifier);
+}
+
+void CheckpointWriter::WriteOperand(
+  const Operand &operand,
+  const std::map<std::shared_ptr<Statement>, int> &stmt_idxs
+) {
+  WriteType(operand.GetType());
+  const auto &find_it = stmt_idxs.find(operand.GetRef());
+  WriteInt(find_it == stmt_idxs.end() ? -1 : find_it->second);
+  WriteOptionalString(operand.GetConstantLiteral());
+}
+void CheckpointWriter::WriteOperands(
+  const std::vector<Operand> &operands,
+  const std::map<std::shared_ptr<Statement>, int> &stmt_idxs
+) {
+  WriteInt((long long int) operands.size());
+  for (const auto &operand : operands)
+    WriteOperand(operand, stmt_idxs);
+}
+void CheckpointWriter::WriteTemplateTypeContext(const std::shared_ptr<TemplateTypeContext> &tt_ctx) {
+  WriteBool(tt_ctx != nullptr);
+  if (tt_ctx == nullptr)
+    return;
+  const std::map<std::string, TypeWithModifier> &inst_mapping = tt_ctx->GetMapping().GetInstMapping();
+  WriteInt((long long int) inst_mapping.size());
+  for (const auto &entry : inst_mapping) {
+    WriteString(entry.first);
+    WriteType(entry.second);
+  }
+}
+
+// Calls to executables created during generation, e.g. implicit constructors, cannot be resolved on load.
+bool CheckpointWriter::CanWriteTestCase(const TestCase &tc) const {
+  for (const auto &stmt : tc.GetStatements()) {
+    if (stmt->GetVariant() != StatementVariant::kCall)
+      continue;
+    const auto &call_stmt = std::static_pointer_cast<CallStatement>(stmt);
+    if (executable_idxs_.count(call_stmt->GetTarget().get()) == 0)
+      return false;
+  }
+  return true;
+}
+
+void CheckpointWriter::WriteTestCase(const TestCase &tc) {
+  const std::vector<std::shared_ptr<Statement>> &statements = tc.GetStatements();
+  std::map<std::shared_ptr<Statement>, int> stmt_idxs;
+  WriteTemplateTypeContext(tc.GetTemplateTypeContext());
+  WriteInt((long long int) statements.size());
+  for (const auto &stmt : statements) {
+    StatementVariant variant = stmt->GetVariant();
+    WriteInt((int) variant);
+    WriteType(stmt->GetType());
+    switch (variant) {
+      case StatementVariant::kPrimitiveAssignment: {
+        const auto &prim_stmt = std::static_pointer_cast<PrimitiveAssignmentStatement>(stmt);
+        WriteInt((int) prim_stmt->GetOp());
+        WriteOperands(prim_stmt->GetOperands(), stmt_idxs);
+        break;
+      }
+      case StatementVariant::kCall: {
+        const auto &call_stmt = std::static_pointer_cast<CallStatement>(stmt);
+        WriteInt(executable_idxs_.at(call_stmt->GetTarget().get()));
+        WriteString(call_stmt->GetTarget()->GetQualifiedName());
+        WriteOperands(call_stmt->GetOperands(), stmt_idxs);
+        const bpstd::optional<Operand> &invoking_obj = call_stmt->GetInvokingObj();
+        WriteBool(invoking_obj.has_value());
+        if (invoking_obj.has_value())
+          WriteOperand(invoking_obj.value(), stmt_idxs);
+        WriteTemplateTypeContext(call_stmt->GetTemplateTypeContext());
+        break;
+      }
+      case StatementVariant::kSTLConstruction: {
+        const auto &stl_stmt = std::static_pointer_cast<STLStatement>(stmt);
+        const STLElement &elements = stl_stmt->GetElements();
+        WriteString(stl_stmt->GetTarget()->GetName());
+        WriteBool(elements.IsRegContainerElements());
+        if (elements.IsRegContainerElements())
+          WriteOperands(elements.GetRegContainerElmts(), stmt_idxs);
+        WriteBool(elements.IsKeyValueElements());
+        if (elements.IsKeyValueElements()) {
+          const std::vector<std::pair<Operand, Operand>> &kv_elmts = elements.GetKeyValueElmts();
+          WriteInt((long long int) kv_elmts.size());
+          for (const auto &kv : kv_elmts) {
+            WriteOperand(kv.first, stmt_idxs);
+            WriteOperand(kv.second, stmt_idxs);
+          }
+        }
+        break;
+      }
+      case StatementVariant::kArrayInitialization: {
+        const auto &array_stmt = std::static_pointer_cast<ArrayInitStatement>(stmt);
+        const bpstd::optional<int> &capacity = array_stmt->GetCapacity();
+        WriteBool(capacity.has_value());
+        if (capacity.has_value())
+          WriteInt(capacity.value());
+        const bpstd::optional<Operand> &string_literal = array_stmt->GetStringLiteral();
+        WriteBool(string_literal.has_value());
+        if (string_literal.has_value())
+          WriteOperand(string_literal.value(), stmt_idxs);
+        const bpstd::optional<std::vector<Operand>> &elements = array_stmt->GetElements();
+        WriteBool(elements.has_value());
+        if (elements.has_value())
+          WriteOperands(elements.value(), stmt_idxs);
+        break;
+      }
+    }
+    int stmt_idx = (int) stmt_idxs.size();
+    stmt_idxs.emplace(stmt, stmt_idx);
+  }
+}
+
+void CheckpointWriter::WriteMemo(const TCMemo &memo) {
+  WriteBool(memo.IsValidCrash());
+  WriteOptionalString(memo.GetFingerprint());
+  WriteOptionalText(memo.GetGdbOutput());
+  WriteOptionalString(memo.GetLocation());
+  const bpstd::optional<int> &crash_line_num = memo.GetCrashLineNum();
+  WriteBool(crash_line_num.has_value());
+  if (crash_line_num.has_value())
+    WriteInt(crash_line_num.value());
+  WriteOptionalText(memo.GetCompilationOutput());
+}
+void CheckpointWriter::WriteSites(const CoverageDelta &sites) {
+  WriteIntList(sites.GetLines());
+  WriteIntList(sites.GetBranches());
+  WriteIntList(sites.GetFunctions());
+  WriteIntList(sites.GetEdges());
+}
+void CheckpointWriter::WriteReport(const CoverageReport &report) {
+  WriteInt(report.GetLineCov());
+  WriteInt(report.GetBranchCov());
+  WriteInt(report.GetLineTot());
+  WriteInt(report.GetBranchTot());
+  WriteInt(report.GetFuncCov());
+  WriteInt(report.GetFuncTot());
+}
+
+// ##########
+// # CheckpointReader
+// #####
+
+std::vector<std::shared_ptr<Executable>> ListCheckpointExecutables(const std::shared_ptr<ProgramContext> &program_ctx) {
+  std::vector<std::shared_ptr<Executable>> executables = program_ctx->GetExecutables();
+  executables.insert(executables.end(), program_ctx->GetCreators().begin(), program_ctx->GetCreators().end());
+  return executables;
+}
+
+CheckpointReader::CheckpointReader(std::istream &in, const std::shared_ptr<ProgramContext> &program_ctx)
+  : in_(in), executables_(ListCheckpointExecutables(program_ctx)), typenames_() {}
+bool CheckpointReader::IsGood() const {
+  return good_;
+}
+void CheckpointReader::Fail(const std::string &reason) {
+  if (good_)
+    Logger::Warn("[CheckpointReader]", "Invalid checkpoint: " + reason);
+  good_ = false;
+}
+long long int CheckpointReader::ReadInt() {
+  long long int value = 0;
+  if (good_ && !(in_ >> value))
+    Fail("truncated");
+  return good_ ? value : 0;
+}
+bool CheckpointReader::ReadBool() {
+  return ReadInt() != 0;
+}
+std::string CheckpointReader::ReadString() {
+  long long int length = 0;
+  char sep = 0;
+  if (good_ && (!(in_ >> length) || !in_.get(sep) || sep != ':' || length < 0))
+    Fail("malformed string");
+  long long int remaining = GetRemainingSize();
+  if (good_ && remaining >= 0 && length > remaining)
+    Fail("string longer than the rest of the input");
+  if (!good_)
+    return "";
+  std::string value((size_t) length, '\0');
+  if (!in_.read(&value[0], length)) {
+    Fail("truncated string");
+    return "";
+  }
+  return value;
+}
+// -1 if the stream cannot seek. A corrupt length is rejected before the string is allocated.
+long long int CheckpointReader::GetRemainingSize() {
+  std::streampos pos = in_.tellg();
+  if (pos < 0)
+    return -1;
+  in_.seekg(0, std::ios::end);
+  std::streampos end = in_.tellg();
+  in_.seekg(pos);
+  return end < 0 ? -1 : (long long int) (end - pos);
+}
+bpstd::optional<std::string> CheckpointReader::ReadOptionalString() {
+  if (!ReadBool())
+    return bpstd::nullopt;
+  return ReadString();
+}
+std::vector<int> CheckpointReader::ReadIntList() {
+  long long int count = ReadInt();
+  std::vector<int> values;
+  for (long long int idx = 0; idx < count && good_; ++idx)
+    values.push_back((int) ReadInt());
+  return values;
+}
+
+std::shared_ptr<PrimitiveType> FindCheckpointPrimitiveType(PrimitiveTypeVariant variant) {
+  switch (variant) {
+    case PrimitiveTypeVariant::kVoid: return PrimitiveType::kVoid;
+    case PrimitiveTypeVariant::kBoolean: return PrimitiveType::kBoolean;
+    case PrimitiveTypeVariant::kShort: return PrimitiveType::kShort;
+    case PrimitiveTypeVariant::kCharacter: return PrimitiveType::kCharacter;
+    case PrimitiveTypeVariant::kInteger: return PrimitiveType::kInteger;
+    case PrimitiveTypeVariant::kLong: return PrimitiveType::kLong;
+    case PrimitiveTypeVariant::kLongLong: return PrimitiveType::kLongLong;
+    case PrimitiveTypeVariant::kFloat: return PrimitiveType::kFloat;
+    case PrimitiveTypeVariant::kDouble: return PrimitiveType::kDouble;
+    case PrimitiveTypeVariant::kWideCharacter: return PrimitiveType::kWideCharacter;
+    case PrimitiveTypeVariant::kNullptrType: return PrimitiveType::kNullptrType;
+  }
+  return nullptr;
+}
+
+std::shared_ptr<Type> CheckpointReader::ReadBaseType() {
+  long long int variant = ReadInt();
+  if (!good_ || variant == -1)
+    return nullptr;
+  switch ((TypeVariant) variant) {
+    case TypeVariant::kPrimitive: {
+      long long int primitive_variant = ReadInt();
+      if (primitive_variant < 0 || primitive_variant > (int) PrimitiveTypeVariant::kNullptrType) {
+        Fail("unknown primitive type");
+        return nullptr;
+      }
+      return FindCheckpointPrimitiveType((PrimitiveTypeVariant) primitive_variant);
+    }
+    case TypeVariant::kClass: {
+      const std::string &name = ReadString();
+      const std::shared_ptr<ClassType> &class_type = ClassType::GetTypeByQualNameLifted(name);
+      if (good_ && class_type == nullptr)
+        Fail("unknown class type " + name);
+      return class_type;
+    }
+    case TypeVariant::kEnum: {
+      const std::string &name = ReadString();
+      const std::shared_ptr<EnumType> &enum_type = EnumType::GetTypeByQualName(name);
+      if (good_ && enum_type == nullptr)
+        Fail("unknown enum type " + name);
+      return enum_type;
+    }
+    case TypeVariant::kTemplateTypename: {
+      const std::string &name = ReadString();
+      std::shared_ptr<TemplateTypenameType> &typename_type = typenames_[name];
+      if (typename_type == nullptr)
+        typename_type = std::make_shared<TemplateTypenameType>(name);
+      return typename_type;
+    }
+    case TypeVariant::kSTL: {
+      const std::string &name = ReadString();
+      const std::shared_ptr<STLType> &stl_type = STLType::IsInstalledSTLType(name);
+      if (good_ && stl_type == nullptr)
+        Fail("unknown STL type " + name);
+      return stl_type;
+    }
+    case TypeVariant::kTemplateTypenameSpc: {
+      const std::shared_ptr<Type> &target_type = ReadBaseType();
+      long long int inst_count = ReadInt();
+      std::vector<TemplateTypeInstantiation> insts;
+      for (long long int idx = 0; idx < inst_count && good_; ++idx) {
+        long long int inst_variant = ReadInt();
+        switch ((TemplateTypeInstVariant) inst_variant) {
+          case TemplateTypeInstVariant::kType: insts.push_back(TemplateTypeInstantiation::ForType(ReadType()));
+            break;
+          case TemplateTypeInstVariant::kIntegral:
+            insts.push_back(TemplateTypeInstantiation::ForIntegral((int) ReadInt()));
+            break;
+          case TemplateTypeInstVariant::kNullptr: insts.push_back(TemplateTypeInstantiation::ForNullptr());
+            break;
+          default: Fail("unknown template instantiation");
+        }
+      }
+      if (!good_ || target_type == nullptr) {
+        Fail("specialization without a target type");
+        return nullptr;
+      }
+      return TemplateTypenameSpcType::From(target_type, TemplateTypeInstList(insts));
+    }
+  }
+  Fail("unknown type variant");
+  return nullptr;
+}
+TypeWithModifier CheckpointReader::ReadType() {
+  bool bottom = ReadBool();
+  const std::shared_ptr<Type> &type = ReadBaseType();
+  long long int modifier_count = ReadInt();
+  std::multiset<Modifier> modifiers;
+  for (long long int idx = 0; idx < modifier_count && good_; ++idx)
+    modifiers.insert((Modifier) ReadInt());
+  if (bottom || !good_)
+    return TypeWithModifier::Bottom();
+  return TypeWithModifier{type, modifiers};
+}
+
+Operand CheckpointReader::ReadOperand(const std::vector<std::shared_ptr<Statement>> &statements) {
+  const TypeWithModifier &type = ReadType();
+  long long int ref_idx = ReadInt();
+  const bpstd::optional<std::string> &constant_literal = ReadOptionalString();
+  if (ref_idx < -1 || ref_idx >= (long long int) statements.size())
+    Fail("dangling reference");
+  std::shared_ptr<Statement> ref = good_ && ref_idx >= 0 ? statements[ref_idx] : nullptr;
+  return Operand{type, ref, constant_literal};
+}
+std::vector<Operand> CheckpointReader::ReadOperands(const std::vector<std::shared_ptr<Statement>> &statements) {
+  long long int count = ReadInt();
+  std::vector<Operand> operands;
+  for (long long int idx = 0; idx < count && good_; ++idx)
+    operands.push_back(ReadOperand(statements));
+  return operands;
+}
+std::shared_ptr<TemplateTypeContext> CheckpointReader::ReadTemplateTypeContext() {
+  if (!ReadBool())
+    return nullptr;
+  long long int count = ReadInt();
+  std::map<std::string, TypeWithModifier> inst_mapping;
+  for (long long int idx = 0; idx < count && good_; ++idx) {
+    const std::string &name = ReadString();
+    inst_mapping.emplace(name, ReadType());
+  }
+  return std::make_shared<TemplateTypeContext>(TemplateTypeInstMapping(inst_mapping));
+}
+
+TestCase CheckpointReader::ReadTestCase() {
+  const std::shared_ptr<TemplateTypeContext> &tt_ctx = ReadTemplateTypeContext();
+  long long int stmt_count = ReadInt();
+  std::vector<std::shared_ptr<Statement>> statements;
+  for (long long int stmt_idx = 0; stmt_idx < stmt_count && good_; ++stmt_idx) {
+    long long int variant = ReadInt();
+    const TypeWithModifier &type = ReadType();
+    std::shared_ptr<Statement> stmt;
+    switch ((StatementVariant) variant) {
+      case StatementVariant::kPrimitiveAssignment: {
+        auto op = (GeneralPrimitiveOp) ReadInt();
+        const std::vector<Operand> &operands = ReadOperands(statements);
+        stmt = std::make_shared<PrimitiveAssignmentStatement>(type, op, operands);
+        break;
+      }
+      case StatementVariant::kCall: {
+        long long int executable_idx = ReadInt();
+        const std::string &qual_name = ReadString();
+        bool known = executable_idx >= 0 && executable_idx < (long long int) executables_.size();
+        if (!known || executables_[executable_idx]->GetQualifiedName() != qual_name)
+          Fail("unknown executable " + qual_name);
+        const std::vector<Operand> &operands = ReadOperands(statements);
+        bpstd::optional<Operand> invoking_obj;
+        if (ReadBool())
+          invoking_obj = ReadOperand(statements);
+        const std::shared_ptr<TemplateTypeContext> &call_tt_ctx = ReadTemplateTypeContext();
+        if (good_) {
+          const std::shared_ptr<Executable> &target = executables_[executable_idx];
+          stmt = std::make_shared<CallStatement>(type, target, operands, invoking_obj, call_tt_ctx);
+        }
+        break;
+      }
+      case StatementVariant::kSTLConstruction: {
+        const std::string &target_name = ReadString();
+        const std::shared_ptr<STLType> &target = STLType::IsInstalledSTLType(target_name);
+        if (good_ && target == nullptr)
+          Fail("unknown STL type " + target_name);
+        bpstd::optional<std::vector<Operand>> reg_elmts;
+        if (ReadBool())
+          reg_elmts = ReadOperands(statements);
+        bpstd::optional<std::vector<std::pair<Operand, Operand>>> kv_elmts;
+        if (ReadBool()) {
+          long long int kv_count = ReadInt();
+          std::vector<std::pair<Operand, Operand>> kvs;
+          for (long long int idx = 0; idx < kv_count && good_; ++idx) {
+            const Operand &key = ReadOperand(statements);
+            kvs.emplace_back(key, ReadOperand(statements));
+          }
+          kv_elmts = kvs;
+        }
+        stmt = std::make_shared<STLStatement>(type, target, STLElement(reg_elmts, kv_elmts));
+        break;
+      }
+      case StatementVariant::kArrayInitialization: {
+        bpstd::optional<int> capacity;
+        if (ReadBool())
+          capacity = (int) ReadInt();
+        bpstd::optional<Operand> string_literal;
+        if (ReadBool())
+          string_literal = ReadOperand(statements);
+        bpstd::optional<std::vector<Operand>> elements;
+        if (ReadBool())
+          elements = ReadOperands(statements);
+        stmt = std::make_shared<ArrayInitStatement>(type, capacity, string_literal, elements);
+        break;
+      }
+      default: Fail("unknown statement variant");
+    }
+    statements.push_back(stmt);
+  }
+  if (!good_)
+    return TestCase{{}, nullptr};
+  return TestCase{statements, tt_ctx};
+}
+
+TCMemo CheckpointReader::ReadMemo() {
+  TCMemo memo;
+  memo.SetValidCrash(ReadBool());
+  memo.SetFingerprint(ReadOptionalString());
+  memo.SetGdbOutput(ReadOptionalString());
+  memo.SetLocation(ReadOptionalString());
+  if (ReadBool())
+    memo.SetCrashLineNum((int) ReadInt());
+  memo.SetCompilationOutput(ReadOptionalString());
+  return memo;
+}
+CoverageDelta CheckpointReader::ReadSites() {
+  CoverageDelta sites;
+  sites.GetLines() = ReadIntList();
+  sites.GetBranches() = ReadIntList();
+  sites.GetFunctions() = ReadIntList();
+  sites.GetEdges() = ReadIntList();
+  return sites;
+}
+CoverageReport CheckpointReader::ReadReport() {
+  int line_cov = (int) ReadInt();
+  int branch_cov = (int) ReadInt();
+  int line_tot = (int) ReadInt();
+  int branch_tot = (int) ReadInt();
+  int func_cov = (int) ReadInt();
+  int func_tot = (int) ReadInt();
+  return CoverageReport{line_cov, branch_cov, line_tot, branch_tot, func_cov, func_tot};
+}
+
+} // namespace cxxfoozz
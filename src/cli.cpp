@@ -1,6 +1,7 @@
 #include "cli.hpp"
 #include "logger.hpp"
 
+#include <algorithm>
 #include <utility>
 #include <experimental/filesystem>
 
@@ -81,6 +82,156 @@ const std::string &CLIParsedArgs::GetFuncComplexityExtFile() const {
 void CLIParsedArgs::SetFuncComplexityExtFile(const std::string &func_complexity_ext_file) {
   func_complexity_ext_file_ = func_complexity_ext_file;
 }
+int CLIParsedArgs::GetJobs() const {
+  return jobs_;
+}
+void CLIParsedArgs::SetJobs(int jobs) {
+  jobs_ = jobs;
+}
+bool CLIParsedArgs::IsUseHarness() const {
+  return use_harness_;
+}
+void CLIParsedArgs::SetUseHarness(bool use_harness) {
+  use_harness_ = use_harness;
+}
+bool CLIParsedArgs::IsUseForkServer() const {
+  return use_fork_server_;
+}
+void CLIParsedArgs::SetUseForkServer(bool use_fork_server) {
+  use_fork_server_ = use_fork_server;
+}
+bool CLIParsedArgs::IsUseShmCov() const {
+  return use_shm_cov_;
+}
+void CLIParsedArgs::SetUseShmCov(bool use_shm_cov) {
+  use_shm_cov_ = use_shm_cov;
+}
+bool CLIParsedArgs::IsUsePch() const {
+  return use_pch_;
+}
+void CLIParsedArgs::SetUsePch(bool use_pch) {
+  use_pch_ = use_pch;
+}
+bool CLIParsedArgs::IsUseMinimalIncludes() const {
+  return use_minimal_includes_;
+}
+void CLIParsedArgs::SetUseMinimalIncludes(bool use_minimal_includes) {
+  use_minimal_includes_ = use_minimal_includes;
+}
+bool CLIParsedArgs::IsUsePrelink() const {
+  return use_prelink_;
+}
+void CLIParsedArgs::SetUsePrelink(bool use_prelink) {
+  use_prelink_ = use_prelink;
+}
+int CLIParsedArgs::GetBatchSize() const {
+  return batch_size_;
+}
+void CLIParsedArgs::SetBatchSize(int batch_size) {
+  batch_size_ = batch_size;
+}
+int CLIParsedArgs::GetBuildCacheSizeInMiB() const {
+  return build_cache_size_in_mib_;
+}
+void CLIParsedArgs::SetBuildCacheSizeInMiB(int build_cache_size_in_mib) {
+  build_cache_size_in_mib_ = build_cache_size_in_mib;
+}
+bool CLIParsedArgs::IsUseDedupMutants() const {
+  return use_dedup_mutants_;
+}
+void CLIParsedArgs::SetUseDedupMutants(bool use_dedup_mutants) {
+  use_dedup_mutants_ = use_dedup_mutants;
+}
+bool CLIParsedArgs::IsUseLearnCompileFailures() const {
+  return use_learn_compile_failures_;
+}
+void CLIParsedArgs::SetUseLearnCompileFailures(bool use_learn_compile_failures) {
+  use_learn_compile_failures_ = use_learn_compile_failures;
+}
+int CLIParsedArgs::GetRepairBudget() const {
+  return repair_budget_;
+}
+void CLIParsedArgs::SetRepairBudget(int repair_budget) {
+  repair_budget_ = repair_budget;
+}
+bool CLIParsedArgs::IsUseMinimizeCorpus() const {
+  return use_minimize_corpus_;
+}
+void CLIParsedArgs::SetUseMinimizeCorpus(bool use_minimize_corpus) {
+  use_minimize_corpus_ = use_minimize_corpus;
+}
+bool CLIParsedArgs::IsUseEnergySchedule() const {
+  return use_energy_schedule_;
+}
+void CLIParsedArgs::SetUseEnergySchedule(bool use_energy_schedule) {
+  use_energy_schedule_ = use_energy_schedule;
+}
+int CLIParsedArgs::GetStatsIntervalInSeconds() const {
+  return stats_interval_in_seconds_;
+}
+void CLIParsedArgs::SetStatsIntervalInSeconds(int stats_interval_in_seconds) {
+  stats_interval_in_seconds_ = stats_interval_in_seconds;
+}
+int CLIParsedArgs::GetMinimizeBudget() const {
+  return minimize_budget_;
+}
+void CLIParsedArgs::SetMinimizeBudget(int minimize_budget) {
+  minimize_budget_ = minimize_budget;
+}
+int CLIParsedArgs::GetCheckpointIntervalInSeconds() const {
+  return checkpoint_interval_in_seconds_;
+}
+void CLIParsedArgs::SetCheckpointIntervalInSeconds(int checkpoint_interval_in_seconds) {
+  checkpoint_interval_in_seconds_ = checkpoint_interval_in_seconds;
+}
+bool CLIParsedArgs::IsResume() const {
+  return resume_;
+}
+void CLIParsedArgs::SetResume(bool resume) {
+  resume_ = resume;
+}
+bool CLIParsedArgs::IsUseCrashReport() const {
+  return use_crash_report_;
+}
+void CLIParsedArgs::SetUseCrashReport(bool use_crash_report) {
+  use_crash_report_ = use_crash_report;
+}
+int CLIParsedArgs::GetTriageWorkers() const {
+  return triage_workers_;
+}
+void CLIParsedArgs::SetTriageWorkers(int triage_workers) {
+  triage_workers_ = triage_workers;
+}
+int CLIParsedArgs::GetExecTimeoutInMsec() const {
+  return exec_timeout_in_msec_;
+}
+void CLIParsedArgs::SetExecTimeoutInMsec(int exec_timeout_in_msec) {
+  exec_timeout_in_msec_ = exec_timeout_in_msec;
+}
+bool CLIParsedArgs::IsUseAdaptiveTimeout() const {
+  return use_adaptive_timeout_;
+}
+void CLIParsedArgs::SetUseAdaptiveTimeout(bool use_adaptive_timeout) {
+  use_adaptive_timeout_ = use_adaptive_timeout;
+}
+int CLIParsedArgs::GetQueueMemoryInMiB() const {
+  return queue_memory_in_mib_;
+}
+void CLIParsedArgs::SetQueueMemoryInMiB(int queue_memory_in_mib) {
+  queue_memory_in_mib_ = queue_memory_in_mib;
+}
+bool CLIParsedArgs::IsStreamOutput() const {
+  return stream_output_;
+}
+void CLIParsedArgs::SetStreamOutput(bool stream_output) {
+  stream_output_ = stream_output;
+}
+const std::string &CLIParsedArgs::GetCovTool() const {
+  return cov_tool_;
+}
+void CLIParsedArgs::SetCovTool(const std::string &cov_tool) {
+  cov_tool_ = cov_tool;
+}
 
 // ##########
 // # CLIArgumentParser
@@ -152,10 +303,223 @@ static llvm::cl::opt<int> kOptFuzzingTimeout(
   llvm::cl::init(30),
   llvm::cl::cat(kCxxfoozzOptions));
 
+static llvm::cl::opt<int> kOptJobs(
+  "jobs",
+  llvm::cl::desc(
+    "Specify the number of fuzzing workers compiling and executing test cases in parallel. Default = 1"),
+  llvm::cl::value_desc("int"),
+  llvm::cl::init(1),
+  llvm::cl::cat(kCxxfoozzOptions));
+
+static llvm::cl::opt<bool> kOptHarness(
+  "harness",
+  llvm::cl::desc(
+    "Build a single interpreter harness for the target and execute supported test cases as bytecode "
+    "instead of compiling a driver per test case"),
+  llvm::cl::init(false),
+  llvm::cl::cat(kCxxfoozzOptions));
+
+static llvm::cl::opt<bool> kOptForkServer(
+  "fork-server",
+  llvm::cl::desc(
+    "Run drivers and the interpreter harness through a fork server instead of a shell and timeout(1) per run"),
+  llvm::cl::init(false),
+  llvm::cl::cat(kCxxfoozzOptions));
+
+static llvm::cl::opt<bool> kOptShmCov(
+  "shm-cov",
+  llvm::cl::desc(
+    "Measure edge coverage through a shared memory map, object files must be built with "
+    "-fsanitize-coverage=trace-pc-guard. lcov is only used for the final report"),
+  llvm::cl::init(false),
+  llvm::cl::cat(kCxxfoozzOptions));
+
+static llvm::cl::opt<bool> kOptPch(
+  "pch",
+  llvm::cl::desc("Precompile the header prelude of the generated drivers once and compile drivers with -include-pch"),
+  llvm::cl::init(false),
+  llvm::cl::cat(kCxxfoozzOptions));
+
+static llvm::cl::opt<bool> kOptPrelink(
+  "prelink",
+  llvm::cl::desc(
+    "Link the target object files into one relocatable object at startup (cached across campaigns) "
+    "and link drivers against it"),
+  llvm::cl::init(false),
+  llvm::cl::cat(kCxxfoozzOptions));
+
+static llvm::cl::opt<int> kOptBatch(
+  "batch",
+  llvm::cl::desc(
+    "Specify the number of test cases compiled and linked together into one driver, each of them still runs "
+    "in its own process. Default = 1"),
+  llvm::cl::value_desc("int"),
+  llvm::cl::init(1),
+  llvm::cl::cat(kCxxfoozzOptions));
+
+static llvm::cl::opt<int> kOptBuildCache(
+  "build-cache",
+  llvm::cl::desc(
+    "Reuse the executable and the run outcome of byte-identical drivers, keeping at most the given size of "
+    "executables (on /dev/shm when it is a tmpfs). Default = 0 (disabled)"),
+  llvm::cl::value_desc("MiB"),
+  llvm::cl::init(0),
+  llvm::cl::cat(kCxxfoozzOptions));
+
+static llvm::cl::opt<bool> kOptDedupMutants(
+  "dedup-mutants",
+  llvm::cl::desc(
+    "Skip mutants that only differ from an earlier one in variable names or unused primitive statements, "
+    "before they are written and compiled"),
+  llvm::cl::init(false),
+  llvm::cl::cat(kCxxfoozzOptions));
+
+static llvm::cl::opt<bool> kOptLearnCompileFailures(
+  "learn-compile-failures",
+  llvm::cl::desc(
+    "Remember the call shapes that compile errors point at and avoid generating them again, executables that "
+    "never compile are eventually no longer selected"),
+  llvm::cl::init(false),
+  llvm::cl::cat(kCxxfoozzOptions));
+
+static llvm::cl::opt<int> kOptRepairBudget(
+  "repair-budget",
+  llvm::cl::desc(
+    "Specify how many times an incompilable test case is rebuilt without the statement of its first compile "
+    "error and the statements depending on it. Default = 0 (no repair)"),
+  llvm::cl::value_desc("int"),
+  llvm::cl::init(0),
+  llvm::cl::cat(kCxxfoozzOptions));
+
+static llvm::cl::opt<bool> kOptMinimizeCorpus(
+  "minimize-corpus",
+  llvm::cl::desc(
+    "Before flushing, keep only the valid test cases needed to reach the same coverage (greedy set cover over "
+    "the sites of each test case, needs native gcov or --shm-cov). SIGUSR1 prunes the seeds the same way "
+    "during the campaign"),
+  llvm::cl::init(false),
+  llvm::cl::cat(kCxxfoozzOptions));
+
+static llvm::cl::opt<bool> kOptEnergySchedule(
+  "energy-schedule",
+  llvm::cl::desc(
+    "Pick seeds by energy (fast, small seeds whose mutants found coverage first) and balance generating from "
+    "scratch against mutating seeds by their recent finds, instead of round-robin seeds and a coin flip"),
+  llvm::cl::init(false),
+  llvm::cl::cat(kCxxfoozzOptions));
+
+static llvm::cl::opt<int> kOptStatsInterval(
+  "stats-interval",
+  llvm::cl::desc(
+    "Specify how often the per-stage timings and the throughput are written to <output>/fuzzer_stats. "
+    "Default = 10 (0 = never)"),
+  llvm::cl::value_desc("seconds"),
+  llvm::cl::init(10),
+  llvm::cl::cat(kCxxfoozzOptions));
+
+static llvm::cl::opt<int> kOptMinimizeBudget(
+  "minimize-budget",
+  llvm::cl::desc(
+    "Specify how many reduced variants of each new seed and unique crash are built to remove statements in the "
+    "background (delta debugging), keeping the coverage of seeds and the fingerprint of crashes. Crashes are "
+    "minimized before they are written out. Default = 0 (no minimization)"),
+  llvm::cl::value_desc("int"),
+  llvm::cl::init(0),
+  llvm::cl::cat(kCxxfoozzOptions));
+
+static llvm::cl::opt<int> kOptCheckpointInterval(
+  "checkpoint-interval",
+  llvm::cl::desc(
+    "Specify how often the queue, the coverage baseline, the unique crashes and the coverage log are saved to "
+    "<output>/checkpoint. Also saved when the campaign ends. Default = 300 (0 = never)"),
+  llvm::cl::value_desc("seconds"),
+  llvm::cl::init(300),
+  llvm::cl::cat(kCxxfoozzOptions));
+
+static llvm::cl::opt<bool> kOptResume(
+  "resume",
+  llvm::cl::desc(
+    "Continue the campaign saved in <output>/checkpoint instead of starting over. The time budget counts the "
+    "time already spent"),
+  llvm::cl::init(false),
+  llvm::cl::cat(kCxxfoozzOptions));
+
+static llvm::cl::opt<bool> kOptCrashReport(
+  "crash-report",
+  llvm::cl::desc(
+    "Link a signal handler into the drivers that reports the stack of a crash, which is then symbolized with "
+    "addr2line instead of running the driver again under gdb"),
+  llvm::cl::init(false),
+  llvm::cl::cat(kCxxfoozzOptions));
+
+static llvm::cl::opt<int> kOptTriageWorkers(
+  "triage-workers",
+  llvm::cl::desc(
+    "Specify the number of background threads that triage crashes, so that fuzzing goes on while crashing drivers "
+    "are replayed under gdb. Default = 0 (triage on the fuzzing threads)"),
+  llvm::cl::value_desc("int"),
+  llvm::cl::init(0),
+  llvm::cl::cat(kCxxfoozzOptions));
+
+static llvm::cl::opt<int> kOptExecTimeout(
+  "exec-timeout",
+  llvm::cl::desc(
+    "Specify the timeout (in milliseconds) of one driver run, runs over it are kept as hangs. Default = 5000"),
+  llvm::cl::value_desc("msec"),
+  llvm::cl::init(5000),
+  llvm::cl::cat(kCxxfoozzOptions));
+
+static llvm::cl::opt<bool> kOptAdaptiveTimeout(
+  "adaptive-timeout",
+  llvm::cl::desc(
+    "Lower the timeout of driver runs to 5 times the 99th percentile of the run times of valid seeds, at most "
+    "--exec-timeout. Runs over it count as hangs"),
+  llvm::cl::init(false),
+  llvm::cl::cat(kCxxfoozzOptions));
+
+static llvm::cl::opt<int> kOptQueueMemory(
+  "queue-memory",
+  llvm::cl::desc(
+    "Specify the memory budget (in MiB) of the test case queue. Over it, the test cases least recently picked as "
+    "seeds are moved to a spill file in the output directory and loaded back on use. Default = 0 (no limit)"),
+  llvm::cl::value_desc("MiB"),
+  llvm::cl::init(0),
+  llvm::cl::cat(kCxxfoozzOptions));
+
+static llvm::cl::opt<bool> kOptStreamOutput(
+  "stream-output",
+  llvm::cl::desc(
+    "Write the valid and crashing test cases to the output suites and replay drivers as they are found, and the "
+    "coverage report rows as they are logged, instead of all at once when fuzzing ends"),
+  llvm::cl::init(false),
+  llvm::cl::cat(kCxxfoozzOptions));
+
+static llvm::cl::opt<std::string> kOptCovTool(
+  "cov-tool",
+  llvm::cl::desc(
+    "Coverage measurement without --shm-cov: 'gcov' reads the gcno/gcda files natively, 'lcov' runs lcov-filt "
+    "after each run. Default = gcov"),
+  llvm::cl::value_desc("gcov|lcov"),
+  llvm::cl::init("gcov"),
+  llvm::cl::cat(kCxxfoozzOptions));
+
+static llvm::cl::opt<bool> kOptMinimalIncludes(
+  "min-includes",
+  llvm::cl::desc(
+    "Include only the headers declaring the types and functions used by each generated driver. Not with --pch"),
+  llvm::cl::init(false),
+  llvm::cl::cat(kCxxfoozzOptions));
+
 CLIParsedArgs CLIArgumentParser::ParseProgramOpt() {
   const std::experimental::filesystem::path &working_dir = std::experimental::filesystem::current_path();
   const std::string &wd_str = working_dir.string();
 
+  // The precompiled prelude holds every header: it would hide the headers missing from a minimal set and save nothing
+  if (kOptPch.getValue() && kOptMinimalIncludes.getValue())
+    Logger::Error("[CLIArgumentParser]", "--pch cannot be combined with --min-includes");
+  if (kOptCovTool.getValue() != "gcov" && kOptCovTool.getValue() != "lcov")
+    Logger::Error("[CLIArgumentParser]", "Unknown --cov-tool: " + kOptCovTool.getValue() + ", expected gcov or lcov");
+
   CLIParsedArgs result;
   result.SetTargetClassName(kOptTargetClass.c_str());
   result.SetOutputPrefix(kOptOutputPrefix.c_str());
@@ -164,6 +528,31 @@ CLIParsedArgs CLIArgumentParser::ParseProgramOpt() {
   result.SetSourceFilesDir(kOptSrcFileDirectory.c_str());
   result.SetMaxDepth(kOptMaxTraversalDepth.getValue());
   result.SetFuzzTimeoutInSeconds(kOptFuzzingTimeout.getValue());
+  result.SetJobs(std::max(1, kOptJobs.getValue()));
+  result.SetUseHarness(kOptHarness.getValue());
+  result.SetUseForkServer(kOptForkServer.getValue());
+  result.SetUseShmCov(kOptShmCov.getValue());
+  result.SetUsePch(kOptPch.getValue());
+  result.SetUseMinimalIncludes(kOptMinimalIncludes.getValue());
+  result.SetUsePrelink(kOptPrelink.getValue());
+  result.SetBatchSize(std::max(1, kOptBatch.getValue()));
+  result.SetBuildCacheSizeInMiB(std::max(0, kOptBuildCache.getValue()));
+  result.SetUseDedupMutants(kOptDedupMutants.getValue());
+  result.SetUseLearnCompileFailures(kOptLearnCompileFailures.getValue());
+  result.SetRepairBudget(std::max(0, kOptRepairBudget.getValue()));
+  result.SetUseMinimizeCorpus(kOptMinimizeCorpus.getValue());
+  result.SetUseEnergySchedule(kOptEnergySchedule.getValue());
+  result.SetStatsIntervalInSeconds(std::max(0, kOptStatsInterval.getValue()));
+  result.SetMinimizeBudget(std::max(0, kOptMinimizeBudget.getValue()));
+  result.SetCheckpointIntervalInSeconds(std::max(0, kOptCheckpointInterval.getValue()));
+  result.SetResume(kOptResume.getValue());
+  result.SetUseCrashReport(kOptCrashReport.getValue());
+  result.SetTriageWorkers(std::max(0, kOptTriageWorkers.getValue()));
+  result.SetExecTimeoutInMsec(std::max(1, kOptExecTimeout.getValue()));
+  result.SetUseAdaptiveTimeout(kOptAdaptiveTimeout.getValue());
+  result.SetQueueMemoryInMiB(std::max(0, kOptQueueMemory.getValue()));
+  result.SetStreamOutput(kOptStreamOutput.getValue());
+  result.SetCovTool(kOptCovTool.getValue());
 
   if (!kOptExtraCXXFlags.empty())
     result.SetExtraCxxFlags(kOptExtraCXXFlags.c_str());
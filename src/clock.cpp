@@ -30,6 +30,11 @@ long long int CPUClock::MeasureElapsedInMsec() const {
   clock_t diff = now - start_;
   return 1000ll * diff / CLOCKS_PER_SEC;
 }
+long long int CPUClock::MeasureElapsedInUsec() const {
+  clock_t now = std::clock();
+  clock_t diff = now - start_;
+  return 1000000ll * diff / CLOCKS_PER_SEC;
+}
 CPUClock CPUClock::ForLogging(const std::string &message) {
   CPUClock cpu_clock;
   cpu_clock.logging_ = true;
@@ -53,6 +58,14 @@ long long int WallClock::MeasureElapsedInMsec() const {
   auto diff = std::chrono::duration_cast<std::chrono::duration<double, std::milli>>(now - start_);
   return (long long int) diff.count();
 }
+long long int WallClock::MeasureElapsedInUsec() const {
+  const auto now = std::chrono::steady_clock::now();
+  return std::chrono::duration_cast<std::chrono::microseconds>(now - start_).count();
+}
+// Moves the start back, as if the clock had been running for elapsed_in_msec longer.
+void WallClock::Rewind(long long int elapsed_in_msec) {
+  start_ -= std::chrono::milliseconds(elapsed_in_msec);
+}
 WallClock WallClock::ForLogging(const std::string &message) {
   WallClock wall_clock;
   wall_clock.logging_ = true;
@@ -0,0 +1,145 @@
+#include "compile-failure-cache.hpp"
+#include "sequencegen.hpp"
+#include "util.hpp"
+
+#include <cstdlib>
+
+namespace cxxfoozz {
+
+// ##########
+// # CompileFailureCache
+// #####
+
+const int CompileFailureCache::kBlockAfterFailedShapes = 8;
+const size_t CompileFailureCache::kMaxShapes = 1 << 16;
+std::shared_ptr<CompileFailureCache> CompileFailureCache::instance_ = nullptr;
+CompileFailureCache::CompileFailureCache() = default;
+const std::shared_ptr<CompileFailureCache> &CompileFailureCache::GetInstance() {
+  if (instance_ == nullptr)
+    instance_ = std::make_shared<CompileFailureCache>();
+  return instance_;
+}
+bool CompileFailureCache::IsEnabled() const {
+  return enabled_;
+}
+void CompileFailureCache::SetEnabled(bool enabled) {
+  enabled_ = enabled;
+}
+
+uint64_t HashShapeValue(long long int value, uint64_t hash) {
+  return Fnv1aHash((const char *) &value, sizeof(value), hash);
+}
+
+// Types and executables are interned for the whole campaign, so their addresses identify them.
+uint64_t HashShapeOperand(const Operand &operand, uint64_t hash) {
+  const TypeWithModifier &type = operand.GetType();
+  hash = HashShapeValue((long long int) (uintptr_t) type.GetType().get(), hash);
+  for (const auto &modifier : type.GetModifiers())
+    hash = HashShapeValue((int) modifier, hash);
+
+  const std::shared_ptr<Statement> &ref = operand.GetRef();
+  const Executable *creator = nullptr;
+  if (ref != nullptr && ref->GetVariant() == StatementVariant::kCall)
+    creator = std::static_pointer_cast<CallStatement>(ref)->GetTarget().get();
+  hash = HashShapeValue((long long int) (uintptr_t) creator, hash);
+  return HashShapeValue(ref == nullptr ? (long long int) operand.IsNullPtr() : -1, hash);
+}
+
+// Constant values are left out: literals of the right type rarely make a call ill-formed, nullptr aside.
+uint64_t CompileFailureCache::ComputeCallShape(const std::shared_ptr<CallStatement> &call_stmt) {
+  uint64_t hash = HashShapeValue((long long int) (uintptr_t) call_stmt->GetTarget().get(), kFnv1aOffsetBasis);
+  const bpstd::optional<Operand> &invoking_obj = call_stmt->GetInvokingObj();
+  hash = HashShapeValue(invoking_obj.has_value(), hash);
+  if (invoking_obj.has_value())
+    hash = HashShapeOperand(invoking_obj.value(), hash);
+  for (const auto &operand : call_stmt->GetOperands())
+    hash = HashShapeOperand(operand, hash);
+  const std::shared_ptr<TemplateTypeContext> &tt_ctx = call_stmt->GetTemplateTypeContext();
+  if (tt_ctx != nullptr) {
+    for (const auto &binding : tt_ctx->GetMapping().GetInstMapping()) {
+      hash = Fnv1aHash(binding.first, hash);
+      hash = HashShapeValue((long long int) (uintptr_t) binding.second.GetType().get(), hash);
+    }
+  }
+  return hash;
+}
+
+// Lines of "<source_file>:<line>:<col>: error: ..." diagnostics. Notes and warnings are skipped, they point
+// at declarations or at statements that compile.
+std::vector<int> CompileFailureCache::ExtractErrorLines(
+  const std::string &compiler_output,
+  const std::string &source_file
+) {
+  std::vector<int> error_lines;
+  const std::string &loc_prefix = source_file + ':';
+  for (const auto &diag : SplitStringIntoVector(compiler_output, "\n")) {
+    if (diag.compare(0, loc_prefix.size(), loc_prefix) != 0)
+      continue;
+    const char *location = diag.c_str() + loc_prefix.size();
+    char *end = nullptr;
+    long line = std::strtol(location, &end, 10);
+    if (end == location || line <= 0)
+      continue;
+    size_t severity_pos = diag.find(": ", (size_t) (end - diag.c_str()));
+    if (severity_pos != std::string::npos && diag.compare(severity_pos, 9, ": error: ") == 0)
+      error_lines.push_back((int) line);
+  }
+  return error_lines;
+}
+// Returns true if the shape was not known yet.
+bool CompileFailureCache::RecordFailure(const std::shared_ptr<Statement> &stmt) {
+  if (!enabled_ || stmt->GetVariant() != StatementVariant::kCall)
+    return false;
+  const std::shared_ptr<CallStatement> &call_stmt = std::static_pointer_cast<CallStatement>(stmt);
+  uint64_t shape = ComputeCallShape(call_stmt);
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (failed_shapes_.size() >= kMaxShapes || !failed_shapes_.insert(shape).second)
+    return false;
+  ++failed_shape_count_[call_stmt->GetTarget().get()];
+  return true;
+}
+void CompileFailureCache::RecordSuccess(const TestCase &tc) {
+  if (!enabled_)
+    return;
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (const auto &stmt : tc.GetStatements()) {
+    if (stmt->GetVariant() == StatementVariant::kCall)
+      compiled_.insert(std::static_pointer_cast<CallStatement>(stmt)->GetTarget().get());
+  }
+}
+bool CompileFailureCache::IsKnownFailure(const std::shared_ptr<Statement> &stmt) const {
+  if (!enabled_ || stmt->GetVariant() != StatementVariant::kCall)
+    return false;
+  uint64_t shape = ComputeCallShape(std::static_pointer_cast<CallStatement>(stmt));
+  std::lock_guard<std::mutex> lock(mutex_);
+  return failed_shapes_.count(shape) != 0;
+}
+// Executables that failed with many different operands and never compiled are likely unusable from a driver
+// (inaccessible, deleted or ill-formed once instantiated).
+bool CompileFailureCache::IsBlocked(const std::shared_ptr<Executable> &executable) const {
+  if (!enabled_)
+    return false;
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (compiled_.count(executable.get()) != 0)
+    return false;
+  const auto &it = failed_shape_count_.find(executable.get());
+  return it != failed_shape_count_.end() && it->second >= kBlockAfterFailedShapes;
+}
+// Falls back to all executables rather than leaving nothing to choose from.
+std::vector<std::shared_ptr<Executable>> CompileFailureCache::FilterBlocked(
+  const std::vector<std::shared_ptr<Executable>> &executables
+) const {
+  std::vector<std::shared_ptr<Executable>> result;
+  for (const auto &executable : executables) {
+    if (!IsBlocked(executable))
+      result.push_back(executable);
+  }
+  return result.empty() ? executables : result;
+}
+size_t CompileFailureCache::GetShapeCount() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return failed_shapes_.size();
+}
+
+} // namespace cxxfoozz
@@ -1,10 +1,16 @@
 #include "execution.hpp"
+#include "gcov.hpp"
 #include "logger.hpp"
+#include "pipeline-stats.hpp"
+#include "process.hpp"
 #include "util.hpp"
 
 #include <algorithm>
-#include <array>
 #include <cassert>
+#include <cctype>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
 #include <cstdlib>
 #include <fstream>
 #include <iostream>
@@ -12,28 +18,43 @@
 #include <sstream>
 #include <utility>
 #include <experimental/filesystem>
+#include <fcntl.h>
+#include <linux/magic.h>
+#include <poll.h>
+#include <sys/resource.h>
+#include <sys/shm.h>
+#include <sys/statfs.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 namespace cxxfoozz {
 
-std::pair<int, std::string> ExecuteCommand(const std::string &cmd) {
-  std::string redirected_cerr = cmd + " 2>&1";
-  FILE *pipe = popen(redirected_cerr.c_str(), "r");
-  if (!pipe) {
-    std::cerr << "[ExecuteCommand] Unable to execute: " << cmd << '\n';
-    exit(1);
-  }
+// Runs a command line made of plain (possibly quoted) arguments, without a shell.
+std::pair<int, std::string> ExecuteArgs(const std::string &command_line, bool capture_stderr = true) {
+  ProcessSpec spec{SplitCommandLine(command_line)};
+  spec.SetCaptureStderr(capture_stderr);
+  const ProcessResult &result = ProcessSupervisor::Run(spec);
+  return std::make_pair(result.GetReturnCode(), result.GetOutput());
+}
 
-  std::array<char, 128> buffer{};
-  std::string result;
-  while (fgets(buffer.data(), buffer.size(), pipe) != nullptr)
-    result += buffer.data();
+SysProcessReport ExecuteTool(const ProcessSpec &spec) {
+  const ProcessResult &result = ProcessSupervisor::Run(spec);
+  return {
+    result.GetReturnCode() == EXIT_SUCCESS,
+    spec.ToString(),
+    result.GetOutput(),
+  };
+}
 
-  int ret_code = pclose(pipe);
-  int return_code = WEXITSTATUS(ret_code);
-//  if (return_code != EXIT_SUCCESS) {
-//    std::cerr << "[ExecuteCommand] Warning! non-successful return code from: " << cmd << '\n';
-//  }
-  return std::make_pair(return_code, result);
+// Each flag string may hold several shell-quoted arguments (from compile_commands.json or the CLI).
+void AppendFlags(std::vector<std::string> &argv, const std::vector<std::string> &flags) {
+  for (const auto &flag : flags) {
+    const std::vector<std::string> &args = SplitCommandLine(flag);
+    argv.insert(argv.end(), args.begin(), args.end());
+  }
 }
 
 // ##########
@@ -42,6 +63,8 @@ std::pair<int, std::string> ExecuteCommand(const std::string &cmd) {
 const std::string &SourceCompiler::kTmpDriverCppFilename = "tmp.cpp";
 const std::string &SourceCompiler::kTmpDriverObjectFilename = "tmp.o";
 const std::string &SourceCompiler::kTmpDriverExeFilename = "tmp";
+const std::string &SourceCompiler::kPreludeHPPFilename = "prelude.hpp";
+const std::string &SourceCompiler::kPreludePCHFilename = "prelude.hpp.pch";
 SourceCompiler::SourceCompiler(
   std::string cxx_compiler,
   std::string object_files,
@@ -50,49 +73,65 @@ SourceCompiler::SourceCompiler(
 )
   : object_files_(std::move(object_files)),
     cxx_compiler_(std::move(cxx_compiler)),
+    precompiled_header_(),
     additional_compile_flags_(additional_compile_flags),
     additional_ld_flags_(additional_ld_flags) {}
 SysProcessReport SourceCompiler::Compile(const std::string &target_cpp, const std::string &target_o) {
-  std::stringstream ss;
-  ss << cxx_compiler_ << " -g -c -o " << target_o << " " << target_cpp;
-  for (const auto &flag : additional_compile_flags_) {
-    ss << ' ' << flag;
+  std::vector<std::string> argv{cxx_compiler_, "-g", "-c", "-o", target_o, target_cpp};
+  if (!precompiled_header_.empty()) {
+    argv.emplace_back("-include-pch");
+    argv.push_back(precompiled_header_);
   }
-  const std::string &cmd_to_exec = ss.str();
-  const std::pair<int, std::string> &result = ExecuteCommand(cmd_to_exec);
-  return {
-    result.first == EXIT_SUCCESS,
-    cmd_to_exec,
-    result.second,
-  };
+  AppendFlags(argv, additional_compile_flags_);
+  return ExecuteTool(ProcessSpec{argv});
 }
 SysProcessReport SourceCompiler::Link(const std::string &target_o, const std::string &target_exe) {
-  std::stringstream ss;
-  ss << cxx_compiler_ << " -g -o " << target_exe << " " << target_o << " " << object_files_
-     << " --coverage -fsanitize=fuzzer-no-link";
-  for (const auto &flag : additional_ld_flags_) {
-    ss << ' ' << flag;
-  }
-  const std::string &cmd_to_exec = ss.str();
-  const std::pair<int, std::string> &result = ExecuteCommand(cmd_to_exec);
-  return {
-    result.first == EXIT_SUCCESS,
-    cmd_to_exec,
-    result.second,
-  };
+  std::vector<std::string> argv{cxx_compiler_, "-g", "-o", target_exe, target_o};
+  AppendFlags(argv, {object_files_, "--coverage -fsanitize=fuzzer-no-link"});
+  AppendFlags(argv, additional_ld_flags_);
+  return ExecuteTool(ProcessSpec{argv});
+}
+// Same flags as Compile, so clang accepts the PCH for every driver. Drivers keep their #include lines,
+// include guards turn them into no-ops once the prelude is loaded from the PCH.
+SysProcessReport SourceCompiler::BuildPrecompiledHeader(const std::string &prelude_hpp, const std::string &target_pch) {
+  std::vector<std::string> argv{cxx_compiler_, "-g", "-x", "c++-header", "-o", target_pch, prelude_hpp};
+  AppendFlags(argv, additional_compile_flags_);
+  const SysProcessReport &report = ExecuteTool(ProcessSpec{argv});
+  if (report.IsSuccess())
+    precompiled_header_ = target_pch;
+  return report;
+}
+// Parses a header on its own, without the PCH, to tell whether a driver may include it alone.
+SysProcessReport SourceCompiler::CheckHeader(const std::string &header_file) {
+  std::vector<std::string> argv{cxx_compiler_, "-fsyntax-only", "-x", "c++", header_file};
+  AppendFlags(argv, additional_compile_flags_);
+  return ExecuteTool(ProcessSpec{argv});
+}
+// Everything besides the driver source that determines the built executable.
+std::string SourceCompiler::GetBuildSignature() const {
+  std::vector<std::string> parts{cxx_compiler_, object_files_, precompiled_header_};
+  parts.insert(parts.end(), additional_compile_flags_.begin(), additional_compile_flags_.end());
+  parts.emplace_back("--");
+  parts.insert(parts.end(), additional_ld_flags_.begin(), additional_ld_flags_.end());
+  return StringJoin(parts, "\n");
 }
 std::pair<CompilationResult, std::string> SourceCompiler::CompileAndLink(
   const std::string &target_cpp,
   const std::string &target_o,
   const std::string &target_exe
 ) {
+  const std::shared_ptr<PipelineStats> &stats = PipelineStats::GetInstance();
+  WallClock compile_clock;
   const auto &compile_rc = Compile(target_cpp, target_o);
+  stats->RecordStage(PipelineStage::kCompile, compile_clock.MeasureElapsedInUsec());
   if (!compile_rc.IsSuccess()) {
 //    std::cerr << "[SourceCompiler::CompileAndLink] Compilation failed\n";
     const std::string &compile_error_msg = compile_rc.GetOutput();
     return {CompilationResult::kCompileFailed, compile_error_msg};
   }
+  WallClock link_clock;
   const auto &link_rc = Link(target_o, target_exe);
+  stats->RecordStage(PipelineStage::kLink, link_clock.MeasureElapsedInUsec());
   if (!link_rc.IsSuccess()) {
     const std::string &linking_cmd = link_rc.GetCommand();
 //    Logger::Error(
@@ -161,8 +200,9 @@ int CoverageReport::GetFuncTot() const {
 ExecutionResult::ExecutionResult(
   int return_code,
   const bpstd::optional<CoverageReport> &cov_report,
-  bool interesting
-) : return_code_(return_code), cov_report_(cov_report), interesting_(interesting) {}
+  bool interesting,
+  CoverageDelta delta
+) : return_code_(return_code), cov_report_(cov_report), interesting_(interesting), delta_(std::move(delta)) {}
 int ExecutionResult::GetReturnCode() const {
   return return_code_;
 }
@@ -179,6 +219,64 @@ const int ExecutionResult::kExceptionReturnCode = 180;
 bool ExecutionResult::HasCaughtException() const {
   return return_code_ == kExceptionReturnCode;
 }
+bool ExecutionResult::IsTimedOut() const {
+  return return_code_ == ProcessResult::kTimeoutReturnCode; // also the code of the fork server
+}
+long long int ExecutionResult::GetExecTimeInUsec() const {
+  return exec_time_in_usec_;
+}
+void ExecutionResult::SetExecTimeInUsec(long long int exec_time_in_usec) {
+  exec_time_in_usec_ = exec_time_in_usec;
+}
+const CoverageDelta &ExecutionResult::GetDelta() const {
+  return delta_;
+}
+const CoverageDelta &ExecutionResult::GetCoveredSites() const {
+  return covered_sites_;
+}
+void ExecutionResult::SetCoveredSites(CoverageDelta covered_sites) {
+  covered_sites_ = std::move(covered_sites);
+}
+
+// ##########
+// # CoverageDelta
+// #####
+
+CoverageDelta::CoverageDelta() : lines_(), branches_(), functions_(), edges_() {}
+std::vector<int> &CoverageDelta::GetLines() {
+  return lines_;
+}
+std::vector<int> &CoverageDelta::GetBranches() {
+  return branches_;
+}
+std::vector<int> &CoverageDelta::GetFunctions() {
+  return functions_;
+}
+std::vector<int> &CoverageDelta::GetEdges() {
+  return edges_;
+}
+const std::vector<int> &CoverageDelta::GetLines() const {
+  return lines_;
+}
+const std::vector<int> &CoverageDelta::GetBranches() const {
+  return branches_;
+}
+const std::vector<int> &CoverageDelta::GetFunctions() const {
+  return functions_;
+}
+const std::vector<int> &CoverageDelta::GetEdges() const {
+  return edges_;
+}
+bool CoverageDelta::IsEmpty() const {
+  return lines_.empty() && branches_.empty() && functions_.empty() && edges_.empty();
+}
+std::string CoverageDelta::ToPrettyString() const {
+  std::stringstream ss;
+  ss << lines_.size() << " lines, " << branches_.size() << " branches, " << functions_.size() << " functions";
+  if (!edges_.empty())
+    ss << ", " << edges_.size() << " edges";
+  return ss.str();
+}
 
 // ##########
 // # CoverageObserver
@@ -259,15 +357,23 @@ CoverageReport ParseFromLCOVOutput(const std::string &output) {
   };
 }
 
-int CoverageObserver::Execute(const std::string &target_exe) {
+const unsigned long long int kDriverAddressSpaceLimit = 4ULL << 30;
+// Same limits for drivers run by the supervisor and for fork servers.
+void LimitDriverResources(ProcessSpec &spec) {
+  spec.AddResourceLimit(RLIMIT_CORE, 0);
+  spec.AddResourceLimit(RLIMIT_AS, kDriverAddressSpaceLimit);
+}
+int CoverageObserver::Execute(const std::string &target_exe, const std::string &exe_args) {
   std::experimental::filesystem::path as_fs_path(target_exe);
-  int timeout_s = (int) exec_timeout_in_msec_ / 1000;
-  const std::string &to_str = std::to_string(timeout_s);
-  std::string timeout_cmd = "timeout " + to_str + "s ";
-
   bool is_absolute_path = as_fs_path.is_absolute();
-  std::string final_cmd = timeout_cmd + (is_absolute_path ? "" : "./") + target_exe;
-  return ExecuteCommand(final_cmd).first;
+  std::vector<std::string> argv{(is_absolute_path ? "" : "./") + target_exe};
+  AppendFlags(argv, {exe_args});
+
+  ProcessSpec spec{argv};
+  spec.SetEnv(GetEnv());
+  spec.SetTimeoutInMsec(exec_timeout_in_msec_);
+  LimitDriverResources(spec);
+  return ProcessSupervisor::Run(spec).GetReturnCode();
 }
 // https://stackoverflow.com/questions/38875615/gcovr-giving-empty-results-zero-percent-in-mac
 // gcovr root directory (-r) must be the directory where .cpp files exist
@@ -278,8 +384,8 @@ CoverageReport CoverageObserver::MeasureCoverage() {
       const std::string &additional_flags = "";
       // https://github.com/gcovr/gcovr/issues/169 OUCH :(
       const std::string &command = "gcovr -r " + source_files_dir_ + " -f " + source_files_dir_
-        + " --branch -s" + ' ' + additional_flags + ' ' + object_files_dir_ + " --gcov-executable gcov_for_clang.sh";
-      const std::pair<int, std::string> &execution_res = ExecuteCommand(command);
+        + " --branch -s" + ' ' + additional_flags + ' ' + GetGcdaDir() + " --gcov-executable gcov_for_clang.sh";
+      const std::pair<int, std::string> &execution_res = ExecuteArgs(command);
       int rc = execution_res.first;
       if (rc != EXIT_SUCCESS) {
         std::cerr << "[CoverageObserver::MeasureCoverage] Coverage measurement failed. Return code = " << rc << '\n';
@@ -289,7 +395,8 @@ CoverageReport CoverageObserver::MeasureCoverage() {
       return ParseFromGcovrOutput(output);
     }
     case CoverageMeasurementTool::kLCOV:
-    case CoverageMeasurementTool::kLCOVFILT: {
+    case CoverageMeasurementTool::kLCOVFILT:
+    case CoverageMeasurementTool::kSharedMemory: {
       const std::string &tool = "lcov-filt";
       const std::string &additional_flags = "--filter branch,line";
       const std::string &filename1 = output_dir_ + "/lcov.info";
@@ -297,15 +404,16 @@ CoverageReport CoverageObserver::MeasureCoverage() {
       const char *lcov_branch_cov = "--rc lcov_branch_coverage=1";
       const char *ignore_empty = " --ignore-errors empty ";
       const char *gcov_tool = " --gcov-tool gcov_for_clang.sh";
-      const char *suppress_stderr = " 2> /dev/null";
       const std::string &cmd1 =
-        tool + ignore_empty + " -c -d " + object_files_dir_ + " -o " + filename1 + ' ' + lcov_branch_cov + gcov_tool
-          + suppress_stderr;
+        tool + ignore_empty + " -c -d " + GetGcdaDir() + " -o " + filename1 + ' ' + lcov_branch_cov + gcov_tool;
       const std::string &cmd2 =
         tool + ignore_empty + ' ' + additional_flags + ' ' + lcov_branch_cov + " -o " + filename2
-          + " -r " + filename1 + " '/usr/include/*' '/usr/lib/*'" + suppress_stderr;
-      const std::string &command = cmd1 + " && " + cmd2;
-      const std::pair<int, std::string> &execution_res = ExecuteCommand(command);
+          + " -r " + filename1 + " '/usr/include/*' '/usr/lib/*'";
+      std::pair<int, std::string> execution_res = ExecuteArgs(cmd1, false);
+      if (execution_res.first == EXIT_SUCCESS) {
+        const std::pair<int, std::string> &filter_res = ExecuteArgs(cmd2, false);
+        execution_res = std::make_pair(filter_res.first, execution_res.second + filter_res.second);
+      }
       int rc = execution_res.first;
       if (rc != EXIT_SUCCESS) {
         std::cerr << "[CoverageObserver::MeasureCoverage] Coverage measurement failed. Return code = " << rc << '\n';
@@ -314,32 +422,227 @@ CoverageReport CoverageObserver::MeasureCoverage() {
       const std::string &output = execution_res.second;
       return ParseFromLCOVOutput(output);
     }
+    case CoverageMeasurementTool::kNativeGcov: {
+      last_sites_ = std::make_shared<GcovCoverage>(gcov_reader_->Read(GetGcdaDir()));
+      return last_sites_->ToReport();
+    }
   }
 }
 
-ExecutionResult CoverageObserver::ExecuteAndMeasureCov(const std::string &target_exe) {
-  int rc = Execute(target_exe);
+// Counters are reset before each run, so that the measured sites are the sites of this run only; the campaign
+// coverage lives in the baseline.
+// Also removes the crash report of the previous run, a report always belongs to the last run.
+void CoverageObserver::ResetCounters() {
+  if (shm_map_ != nullptr)
+    shm_map_->Reset();
+  if (measurement_tool_ == CoverageMeasurementTool::kNativeGcov)
+    gcov_reader_->RemoveCounters(GetGcdaDir());
+  if (!crash_report_file_.empty())
+    std::remove(crash_report_file_.c_str());
+}
+ExecutionResult CoverageObserver::ExecuteAndMeasureCov(const std::string &target_exe, const std::string &exe_args) {
+  ResetCounters();
+  WallClock execute_clock;
+  int rc = Execute(target_exe, exe_args);
+  long long int exec_time_in_usec = execute_clock.MeasureElapsedInUsec();
+  PipelineStats::GetInstance()->RecordStage(PipelineStage::kExecute, exec_time_in_usec);
+  StageTimer coverage_timer{PipelineStage::kCoverage};
+  ExecutionResult result = MeasureAfterExecution(rc);
+  result.SetExecTimeInUsec(exec_time_in_usec);
+  return result;
+}
+ExecutionResult CoverageObserver::ExecuteAndMeasureCov(ForkServerClient &fork_server, int request) {
+  ResetCounters();
+  WallClock execute_clock;
+  int rc = fork_server.Run(exec_timeout_in_msec_, request);
+  long long int exec_time_in_usec = execute_clock.MeasureElapsedInUsec();
+  PipelineStats::GetInstance()->RecordStage(PipelineStage::kExecute, exec_time_in_usec);
+  StageTimer coverage_timer{PipelineStage::kCoverage};
+  ExecutionResult result = MeasureAfterExecution(rc);
+  result.SetExecTimeInUsec(exec_time_in_usec);
+  return result;
+}
+ExecutionResult CoverageObserver::MeasureAfterExecution(int rc) {
   if (rc != EXIT_SUCCESS && rc != ExecutionResult::kExceptionReturnCode)
     return ExecutionResult{rc, bpstd::nullopt, false};
 
-  const CoverageReport &report = MeasureCoverage();
-  int curr_line = report.GetLineCov(), pline_cov = prev_success_.GetLineCov();
-  int curr_branch = report.GetBranchCov(), pbranch_cov = prev_success_.GetBranchCov();
-  int curr_func = report.GetFuncCov(), pfunc_cov = prev_success_.GetFuncCov();
+  CoverageDelta delta;
+  if (shm_map_ != nullptr) {
+    // Edges are reported as branches, there is no line/function information in the map.
+    std::lock_guard<std::mutex> lock(baseline_->GetMutex());
+    baseline_->MergeEdges(shm_map_->GetEdges(), SharedCoverageMap::kMapSize, &delta.GetEdges());
+    CoverageReport report{0, baseline_->GetSeenEdgeCount(), 0, shm_map_->GetGuardCount(), 0, 0};
+    bool is_interesting = !delta.IsEmpty();
+    ExecutionResult result{rc, bpstd::make_optional(report), is_interesting, std::move(delta)};
+    if (is_interesting) {
+      baseline_->SetReport(report);
+      result.SetCoveredSites(CollectCoveredSites());
+    }
+    return result;
+  }
+
+  const CoverageReport &worker_report = MeasureCoverage();
+  if (last_sites_ != nullptr) {
+    std::lock_guard<std::mutex> lock(baseline_->GetMutex());
+    // Interesting as soon as one site was never covered before, even if the totals do not grow.
+    const CoverageReport &report = baseline_->MergeSites(*last_sites_, &delta);
+    bool is_interesting = !delta.IsEmpty();
+    ExecutionResult result{rc, bpstd::make_optional(report), is_interesting, std::move(delta)};
+    if (is_interesting) {
+      baseline_->SetReport(report);
+      result.SetCoveredSites(CollectCoveredSites());
+    }
+    return result;
+  }
+  const CoverageReport &report = baseline_->IsMergedFromWorkers() ? MergeIntoBaseline(worker_report) : worker_report;
+  std::lock_guard<std::mutex> lock(baseline_->GetMutex());
+  const CoverageReport &prev_success = baseline_->GetReport();
+  int curr_line = report.GetLineCov(), pline_cov = prev_success.GetLineCov();
+  int curr_branch = report.GetBranchCov(), pbranch_cov = prev_success.GetBranchCov();
+  int curr_func = report.GetFuncCov(), pfunc_cov = prev_success.GetFuncCov();
   bool is_interesting = curr_line > pline_cov || curr_branch > pbranch_cov || curr_func > pfunc_cov;
   if (is_interesting)
-    prev_success_ = report; // Assume using gcovr
+    baseline_->SetReport(report); // Assume using gcovr
 
   return ExecutionResult{rc, bpstd::make_optional(report), is_interesting};
 }
+// Every site of the last run: nonzero edges of the map, or the sites of the last kNativeGcov measurement.
+CoverageDelta CoverageObserver::CollectCoveredSites() const {
+  CoverageDelta covered_sites;
+  if (shm_map_ != nullptr) {
+    const unsigned char *edges = shm_map_->GetEdges();
+    for (size_t edge = 0; edge < SharedCoverageMap::kMapSize; ++edge) {
+      if (edges[edge] != 0)
+        covered_sites.GetEdges().push_back((int) edge);
+    }
+  } else if (last_sites_ != nullptr) {
+    covered_sites.GetLines() = last_sites_->GetLines().GetSetSites();
+    covered_sites.GetBranches() = last_sites_->GetBranches().GetSetSites();
+    covered_sites.GetFunctions() = last_sites_->GetFunctions().GetSetSites();
+  }
+  return covered_sites;
+}
+// Runs without merging into the baseline, e.g. to compare a reduced test case with its original. Sites are
+// only collected with per-site measurement (shared memory or native gcov).
+ExecutionResult CoverageObserver::ExecuteAndCollectSites(const std::string &target_exe, const std::string &exe_args) {
+  ResetCounters();
+  int rc = Execute(target_exe, exe_args);
+  ExecutionResult result{rc, bpstd::nullopt, false};
+  if (rc != EXIT_SUCCESS && rc != ExecutionResult::kExceptionReturnCode)
+    return result;
+  if (measurement_tool_ == CoverageMeasurementTool::kNativeGcov)
+    MeasureCoverage(); // reads the counters into last_sites_
+  result.SetCoveredSites(CollectCoveredSites());
+  return result;
+}
+// Takes the baseline mutex itself. lcov-filt runs outside of it into a tracefile of this worker, which then
+// replaces the baseline tracefile if no other worker replaced it meanwhile; otherwise the merge is repeated.
+// A failed merge leaves the baseline unchanged and returns the report of this worker.
+const int kMaxOptimisticMerges = 3;
+CoverageReport CoverageObserver::MergeIntoBaseline(const CoverageReport &report) {
+  switch (measurement_tool_) {
+    case CoverageMeasurementTool::kGCOVR: {
+      return report; // gcovr summaries cannot be merged
+    }
+    case CoverageMeasurementTool::kLCOV:
+    case CoverageMeasurementTool::kLCOVFILT:
+    case CoverageMeasurementTool::kSharedMemory: {
+      const std::string &worker_tracefile = output_dir_ + "/lcov2.info";
+      const std::string &merged_tracefile = output_dir_ + "/lcov-merged.info";
+      const std::string &tracefile = baseline_->GetTracefile();
+      const std::string &command =
+        "lcov-filt --ignore-errors empty --rc lcov_branch_coverage=1 -a " + tracefile + " -a " + worker_tracefile
+          + " -o " + merged_tracefile;
+      for (int attempt = 1;; ++attempt) {
+        std::unique_lock<std::mutex> lock(baseline_->GetMutex());
+        if (!std::experimental::filesystem::exists(tracefile)) {
+          std::experimental::filesystem::copy_file(worker_tracefile, tracefile);
+          baseline_->ReplaceTracefile("");
+          return report;
+        }
+        int version = baseline_->GetTracefileVersion();
+        bool is_last_attempt = attempt >= kMaxOptimisticMerges; // under contention, merges in the lock
+        if (!is_last_attempt)
+          lock.unlock();
+        const std::pair<int, std::string> &execution_res = ExecuteArgs(command, false);
+        int rc = execution_res.first;
+        if (rc != EXIT_SUCCESS) {
+          const std::string &msg = "Coverage merging failed. Return code = " + std::to_string(rc);
+          Logger::Error("[CoverageObserver::MergeIntoBaseline]", msg, true);
+          return report;
+        }
+        if (!is_last_attempt)
+          lock.lock();
+        if (baseline_->GetTracefileVersion() != version)
+          continue; // merged with an outdated baseline
+        baseline_->ReplaceTracefile(merged_tracefile);
+        return ParseFromLCOVOutput(execution_res.second);
+      }
+    }
+    case CoverageMeasurementTool::kNativeGcov: {
+      std::lock_guard<std::mutex> lock(baseline_->GetMutex());
+      return baseline_->MergeSites(*last_sites_);
+    }
+  }
+}
+// gcov/lcov report of this worker, merged with the other workers when a baseline tracefile is shared.
+CoverageReport CoverageObserver::MeasureFinalReport() {
+  const CoverageReport &report = MeasureCoverage();
+  if (!baseline_->IsMergedFromWorkers())
+    return report;
+  return MergeIntoBaseline(report);
+}
 void CoverageObserver::CleanCovInfo() {
-  const std::string &command = "find " + object_files_dir_ + R"( -name "*.gcda" -exec rm -f {} \;)";
-  ExecuteCommand(command);
-  prev_success_ = CoverageReport();
+  const std::string &command = "find " + GetGcdaDir() + R"( -name "*.gcda" -exec rm -f {} \;)";
+  ExecuteArgs(command);
+  if (!baseline_->IsMergedFromWorkers())
+    baseline_->SetReport(CoverageReport());
+}
+std::string CoverageObserver::GetGcdaDir() const {
+  return gcov_prefix_.empty() ? object_files_dir_ : gcov_prefix_ + object_files_dir_;
+}
+const std::shared_ptr<CoverageBaseline> &CoverageObserver::GetBaseline() const {
+  return baseline_;
+}
+// Drivers must be linked with the CrashReportRuntime object.
+void CoverageObserver::EnableCrashReport() {
+  crash_report_file_ = output_dir_ + "/crash_report";
+}
+long long int CoverageObserver::GetExecTimeoutInMsec() const {
+  return exec_timeout_in_msec_;
+}
+void CoverageObserver::SetExecTimeoutInMsec(long long int exec_timeout_in_msec) {
+  exec_timeout_in_msec_ = exec_timeout_in_msec;
+}
+std::map<std::string, std::string> CoverageObserver::GetEnv() const {
+  std::map<std::string, std::string> env;
+  if (!gcov_prefix_.empty()) {
+    env["GCOV_PREFIX"] = gcov_prefix_;
+    env["GCOV_PREFIX_STRIP"] = "0";
+  }
+  if (shm_map_ != nullptr)
+    env[SharedCoverageMap::kShmEnvVar] = std::to_string(shm_map_->GetShmId());
+  if (!crash_report_file_.empty())
+    env[CrashReportRuntime::kReportEnvVar] = crash_report_file_;
+  return env;
+}
+// With GCOV_PREFIX, gcda files land in a mirror of the object directory, lcov expects the gcno files next to them.
+void CoverageObserver::PrepareGcovPrefix() {
+  if (gcov_prefix_.empty())
+    return;
+  namespace fs = std::experimental::filesystem;
+  for (const auto &entry : fs::recursive_directory_iterator(object_files_dir_)) {
+    const fs::path &gcno = entry.path();
+    if (gcno.extension() != ".gcno")
+      continue;
+    const fs::path &mirrored = gcov_prefix_ + gcno.string();
+    fs::create_directories(mirrored.parent_path());
+    fs::copy_file(gcno, mirrored, fs::copy_options::overwrite_existing);
+  }
 }
 bool CoverageObserver::IsGCNOFileExisted() {
   const std::string &command = "find " + object_files_dir_ + R"( -name "*.gcno")";
-  const std::pair<int, std::string> &execution_result = ExecuteCommand(command);
+  const std::pair<int, std::string> &execution_result = ExecuteArgs(command);
   if (execution_result.first != EXIT_SUCCESS)
     return false;
   if (execution_result.second.empty())
@@ -351,20 +654,650 @@ CoverageObserver::CoverageObserver(
   std::string object_files_dir,
   std::string source_files_dir,
   CoverageMeasurementTool measurement_tool,
-  long long int exec_timeout_in_msec
+  long long int exec_timeout_in_msec,
+  std::string gcov_prefix,
+  std::shared_ptr<CoverageBaseline> baseline,
+  std::shared_ptr<GcovCoverageReader> gcov_reader
 )
   : output_dir_(std::move(output_dir)),
     object_files_dir_(std::move(object_files_dir)),
     source_files_dir_(std::move(source_files_dir)),
     measurement_tool_(measurement_tool),
-    exec_timeout_in_msec_(exec_timeout_in_msec) {}
+    exec_timeout_in_msec_(exec_timeout_in_msec),
+    gcov_prefix_(std::move(gcov_prefix)),
+    baseline_(baseline != nullptr ? std::move(baseline) : std::make_shared<CoverageBaseline>()),
+    shm_map_(),
+    gcov_reader_(std::move(gcov_reader)),
+    last_sites_(),
+    crash_report_file_() {
+  if (measurement_tool_ == CoverageMeasurementTool::kNativeGcov && gcov_reader_ == nullptr)
+    Logger::Error("CoverageObserver", "Native gcov measurement requires a loaded GcovCoverageReader");
+  if (measurement_tool_ != CoverageMeasurementTool::kSharedMemory)
+    return;
+  shm_map_ = std::make_shared<SharedCoverageMap>();
+  if (!shm_map_->IsAttached())
+    Logger::Error("CoverageObserver", "Cannot allocate the shared memory coverage map");
+}
+
+// ##########
+// # ExecTimeoutCalibrator
+// #####
+
+const long long int ExecTimeoutCalibrator::kTimeoutMultiplier = 5LL;
+const long long int ExecTimeoutCalibrator::kMinTimeoutInMsec = 100LL;
+const size_t ExecTimeoutCalibrator::kMinSamples = 20;
+const size_t ExecTimeoutCalibrator::kMaxSamples = 1000;
+
+ExecTimeoutCalibrator::ExecTimeoutCalibrator(long long int max_timeout_in_msec)
+  : max_timeout_in_msec_(max_timeout_in_msec),
+    mutex_(),
+    run_times_in_usec_(),
+    timeout_in_msec_(max_timeout_in_msec) {}
+void ExecTimeoutCalibrator::RecordSeedRunTime(long long int exec_time_in_usec) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  run_times_in_usec_.push_back(exec_time_in_usec);
+  if (run_times_in_usec_.size() > kMaxSamples)
+    run_times_in_usec_.pop_front();
+  if (run_times_in_usec_.size() < kMinSamples)
+    return;
+  std::vector<long long int> sorted{run_times_in_usec_.begin(), run_times_in_usec_.end()};
+  size_t p99_idx = (sorted.size() * 99 - 1) / 100;
+  std::nth_element(sorted.begin(), sorted.begin() + p99_idx, sorted.end());
+  long long int timeout_in_msec = (sorted[p99_idx] * kTimeoutMultiplier + 999LL) / 1000LL;
+  timeout_in_msec_ = std::min(max_timeout_in_msec_, std::max(kMinTimeoutInMsec, timeout_in_msec));
+}
+long long int ExecTimeoutCalibrator::GetTimeoutInMsec() const {
+  return timeout_in_msec_;
+}
+long long int ExecTimeoutCalibrator::GetMaxTimeoutInMsec() const {
+  return max_timeout_in_msec_;
+}
+
+// ##########
+// # CoverageBaseline
+// #####
+
+CoverageBaseline::CoverageBaseline() : CoverageBaseline("") {}
+CoverageBaseline::CoverageBaseline(std::string tracefile)
+  : mutex_(),
+    tracefile_(std::move(tracefile)),
+    tracefile_version_(0),
+    report_(),
+    sites_(),
+    seen_edges_(),
+    seen_edge_count_(0) {}
+std::mutex &CoverageBaseline::GetMutex() {
+  return mutex_;
+}
+const std::string &CoverageBaseline::GetTracefile() const {
+  return tracefile_;
+}
+bool CoverageBaseline::IsMergedFromWorkers() const {
+  return !tracefile_.empty();
+}
+// Caller must hold the mutex. Bumped each time the tracefile changes, merges made from an older one are stale.
+int CoverageBaseline::GetTracefileVersion() const {
+  return tracefile_version_;
+}
+// Caller must hold the mutex. An empty merged_tracefile means the tracefile was written in place.
+void CoverageBaseline::ReplaceTracefile(const std::string &merged_tracefile) {
+  if (!merged_tracefile.empty())
+    std::experimental::filesystem::rename(merged_tracefile, tracefile_);
+  ++tracefile_version_;
+}
+const CoverageReport &CoverageBaseline::GetReport() const {
+  return report_;
+}
+void CoverageBaseline::SetReport(const CoverageReport &report) {
+  report_ = report;
+}
+// Caller must hold the mutex. Returns the number of edges hit by the trace that were never seen before.
+int CoverageBaseline::MergeEdges(const unsigned char *trace, size_t size, std::vector<int> *added) {
+  if (seen_edges_.size() < size)
+    seen_edges_.resize(size, 0);
+  unsigned char *seen = seen_edges_.data();
+  int new_edges = 0;
+  size_t i = 0;
+#if defined(__SSE2__)
+  const __m128i zero = _mm_setzero_si128();
+  for (; i + 16 <= size; i += 16) {
+    const __m128i t = _mm_loadu_si128(reinterpret_cast<const __m128i *>(trace + i));
+    int untouched = _mm_movemask_epi8(_mm_cmpeq_epi8(t, zero));
+    if (untouched == 0xFFFF)
+      continue; // a single run only touches a few blocks of the map
+    const __m128i s = _mm_loadu_si128(reinterpret_cast<const __m128i *>(seen + i));
+    int unseen = _mm_movemask_epi8(_mm_cmpeq_epi8(s, zero));
+    int fresh = ~untouched & unseen & 0xFFFF;
+    if (fresh == 0)
+      continue;
+    new_edges += __builtin_popcount((unsigned int) fresh);
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(seen + i), _mm_or_si128(s, t));
+    if (added == nullptr)
+      continue;
+    for (unsigned int bits = fresh; bits != 0; bits &= bits - 1)
+      added->push_back((int) i + __builtin_ctz(bits));
+  }
+#endif
+  for (; i < size; ++i) {
+    if (trace[i] != 0 && seen[i] == 0) {
+      seen[i] = 1;
+      ++new_edges;
+      if (added != nullptr)
+        added->push_back((int) i);
+    }
+  }
+  seen_edge_count_ += new_edges;
+  return new_edges;
+}
+int CoverageBaseline::GetSeenEdgeCount() const {
+  return seen_edge_count_;
+}
+// Caller must hold the mutex.
+CoverageReport CoverageBaseline::MergeSites(const GcovCoverage &sites, CoverageDelta *delta) {
+  if (sites_ == nullptr)
+    sites_ = std::make_shared<GcovCoverage>();
+  sites_->MergeFrom(sites, delta);
+  return sites_->ToReport();
+}
+// Caller must hold the mutex. Every site seen so far, in the encoding of CoverageDelta.
+CoverageDelta CoverageBaseline::GetCoveredSites() const {
+  CoverageDelta sites;
+  if (sites_ != nullptr) {
+    sites.GetLines() = sites_->GetLines().GetSetSites();
+    sites.GetBranches() = sites_->GetBranches().GetSetSites();
+    sites.GetFunctions() = sites_->GetFunctions().GetSetSites();
+  }
+  for (size_t edge = 0; edge < seen_edges_.size(); ++edge) {
+    if (seen_edges_[edge] != 0)
+      sites.GetEdges().push_back((int) edge);
+  }
+  return sites;
+}
+// Caller must hold the mutex. Sites outside of the totals of the report are dropped.
+void CoverageBaseline::RestoreCoveredSites(const CoverageDelta &sites, const CoverageReport &report) {
+  bool has_gcov_sites = !sites.GetLines().empty() || !sites.GetBranches().empty() || !sites.GetFunctions().empty();
+  if (has_gcov_sites) {
+    GcovCoverage restored{(size_t) report.GetLineTot(), (size_t) report.GetBranchTot(), (size_t) report.GetFuncTot()};
+    const auto &restore = [](SiteBitset &bitset, const std::vector<int> &set_sites) {
+      for (int site : set_sites) {
+        if (site >= 0 && (size_t) site < bitset.GetSize())
+          bitset.Set((size_t) site);
+      }
+    };
+    restore(restored.GetLines(), sites.GetLines());
+    restore(restored.GetBranches(), sites.GetBranches());
+    restore(restored.GetFunctions(), sites.GetFunctions());
+    MergeSites(restored);
+  }
+  if (!sites.GetEdges().empty()) {
+    std::vector<unsigned char> trace(SharedCoverageMap::kMapSize, 0);
+    for (int edge : sites.GetEdges()) {
+      if (edge >= 0 && (size_t) edge < trace.size())
+        trace[edge] = 1;
+    }
+    MergeEdges(trace.data(), trace.size());
+  }
+  report_ = report;
+}
+
+// ##########
+// # SharedCoverageMap
+// #####
+
+const std::string &SharedCoverageMap::kShmEnvVar = "CXXFOOZZ_SHM_ID";
+const size_t SharedCoverageMap::kMapSize = 1u << 16u;
+const size_t kShmHeaderSize = 64; // must match the offset used by kGuardRuntimeSource
+// Compiled once without instrumentation and linked with the target objects. Guard ids wrap around the map size,
+// the guard count lands in the header so that the fuzzer can report the total number of edges.
+const std::string &SharedCoverageMap::kGuardRuntimeSource = R"SHMCOV(
+#include <cstdint>
+#include <cstdlib>
+#include <sys/shm.h>
+
+static unsigned char cxxfoozz_local_map[64 + 65536];
+static unsigned char *cxxfoozz_region = cxxfoozz_local_map;
+static uint32_t cxxfoozz_guard_count = 0;
+
+extern "C" void __sanitizer_cov_trace_pc_guard_init(uint32_t *start, uint32_t *stop) {
+  if (start == stop || *start != 0)
+    return;
+  if (cxxfoozz_region == cxxfoozz_local_map) {
+    const char *shm_id = getenv("CXXFOOZZ_SHM_ID");
+    void *attached = shm_id != nullptr ? shmat(atoi(shm_id), nullptr, 0) : (void *) -1;
+    if (attached != (void *) -1)
+      cxxfoozz_region = (unsigned char *) attached;
+  }
+  for (uint32_t *guard = start; guard < stop; ++guard)
+    *guard = 1 + cxxfoozz_guard_count++ % 65535;
+  *(uint32_t *) cxxfoozz_region = cxxfoozz_guard_count;
+}
+
+extern "C" void __sanitizer_cov_trace_pc_guard(uint32_t *guard) {
+  if (*guard == 0)
+    return;
+  cxxfoozz_region[64 + *guard] = 1;
+}
+)SHMCOV";
+SharedCoverageMap::SharedCoverageMap() {
+  shm_id_ = shmget(IPC_PRIVATE, kShmHeaderSize + kMapSize, IPC_CREAT | IPC_EXCL | 0600);
+  if (shm_id_ < 0)
+    return;
+  void *attached = shmat(shm_id_, nullptr, 0);
+  if (attached == (void *) -1) {
+    shmctl(shm_id_, IPC_RMID, nullptr);
+    shm_id_ = -1;
+    return;
+  }
+  region_ = static_cast<unsigned char *>(attached);
+  // Removed right away: the segment lives until the fuzzer and the last target detach from it.
+  shmctl(shm_id_, IPC_RMID, nullptr);
+  std::fill(region_, region_ + kShmHeaderSize + kMapSize, 0);
+}
+SharedCoverageMap::~SharedCoverageMap() {
+  if (region_ != nullptr)
+    shmdt(region_);
+}
+bool SharedCoverageMap::IsAttached() const {
+  return region_ != nullptr;
+}
+int SharedCoverageMap::GetShmId() const {
+  return shm_id_;
+}
+// Only the edges are cleared, a fork server keeps the guard count it wrote at startup.
+void SharedCoverageMap::Reset() {
+  std::fill(region_ + kShmHeaderSize, region_ + kShmHeaderSize + kMapSize, 0);
+}
+const unsigned char *SharedCoverageMap::GetEdges() const {
+  return region_ + kShmHeaderSize;
+}
+int SharedCoverageMap::GetGuardCount() const {
+  return *reinterpret_cast<const int *>(region_);
+}
+std::string SharedCoverageMap::BuildRuntime(const std::string &cxx_compiler, const std::string &output_dir) {
+  const std::string &runtime_cpp = output_dir + "/shm_cov_runtime.cpp";
+  const std::string &runtime_o = output_dir + "/shm_cov_runtime.o";
+  std::ofstream out(runtime_cpp);
+  out << kGuardRuntimeSource;
+  out.close();
+  const ProcessSpec spec{{cxx_compiler, "-O2", "-c", "-o", runtime_o, runtime_cpp}};
+  if (ProcessSupervisor::Run(spec).GetReturnCode() != EXIT_SUCCESS)
+    return "";
+  return runtime_o;
+}
+
+// ##########
+// # CrashReportRuntime
+// #####
+
+const std::string &CrashReportRuntime::kReportEnvVar = "CXXFOOZZ_CRASH_REPORT";
+// Report: "<signal> <fault address>", then "<offset> <module>" per frame from the crashing one outwards, then
+// "end". Offsets are relative to the load bias of the module, the main executable has an empty module name.
+// dl_iterate_phdr takes the loader lock, so the module table is built once at startup and the handler only reads
+// it; frames in modules loaded later are reported as "?". The unwinder is the remaining caveat: libgcc also looks
+// up unwind tables through dl_iterate_phdr, a crash while the loader lock is held (e.g. inside dlopen) can still
+// deadlock the handler, and the run then ends as a timeout.
+const std::string &CrashReportRuntime::kHandlerRuntimeSource = R"CRASHRT(
+#include <csignal>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <link.h>
+#include <unistd.h>
+#include <unwind.h>
+
+static const int kCxxfoozzMaxFrames = 64;
+static char cxxfoozz_report_file[4096];
+static char cxxfoozz_alt_stack[1 << 16];
+static uintptr_t cxxfoozz_frames[kCxxfoozzMaxFrames];
+static int cxxfoozz_frame_count = 0;
+static int cxxfoozz_signal_frame = -1;
+
+static const int kCxxfoozzMaxSegments = 256;
+static const int kCxxfoozzNamePoolSize = 1 << 15;
+
+struct CxxfoozzSegment {
+  uintptr_t begin;
+  uintptr_t end;
+  uintptr_t bias;
+  const char *name;
+};
+static CxxfoozzSegment cxxfoozz_segments[kCxxfoozzMaxSegments];
+static int cxxfoozz_segment_count = 0;
+static char cxxfoozz_name_pool[kCxxfoozzNamePoolSize];
+static size_t cxxfoozz_name_pool_used = 0;
+
+static _Unwind_Reason_Code cxxfoozz_collect_frame(struct _Unwind_Context *context, void *) {
+  if (cxxfoozz_frame_count >= kCxxfoozzMaxFrames)
+    return _URC_END_OF_STACK;
+  int before_insn = 0;
+  uintptr_t ip = _Unwind_GetIPInfo(context, &before_insn);
+  if (ip == 0)
+    return _URC_END_OF_STACK;
+  if (before_insn != 0 && cxxfoozz_signal_frame < 0)
+    cxxfoozz_signal_frame = cxxfoozz_frame_count; // the interrupted frame, the ones before belong to the handler
+  cxxfoozz_frames[cxxfoozz_frame_count++] = before_insn != 0 ? ip : ip - 1; // return addresses -> call sites
+  return _URC_NO_REASON;
+}
+
+static int cxxfoozz_record_module(struct dl_phdr_info *info, size_t, void *) {
+  const char *name = "?";
+  size_t name_size = strlen(info->dlpi_name) + 1;
+  if (cxxfoozz_name_pool_used + name_size <= sizeof(cxxfoozz_name_pool)) {
+    name = cxxfoozz_name_pool + cxxfoozz_name_pool_used;
+    memcpy(cxxfoozz_name_pool + cxxfoozz_name_pool_used, info->dlpi_name, name_size);
+    cxxfoozz_name_pool_used += name_size;
+  }
+  for (int idx = 0; idx < info->dlpi_phnum && cxxfoozz_segment_count < kCxxfoozzMaxSegments; ++idx) {
+    const ElfW(Phdr) &phdr = info->dlpi_phdr[idx];
+    if (phdr.p_type != PT_LOAD)
+      continue;
+    uintptr_t begin = info->dlpi_addr + phdr.p_vaddr;
+    cxxfoozz_segments[cxxfoozz_segment_count++] = CxxfoozzSegment{begin, begin + phdr.p_memsz, info->dlpi_addr, name};
+  }
+  return 0;
+}
+
+static const CxxfoozzSegment *cxxfoozz_find_segment(uintptr_t pc) {
+  for (int idx = 0; idx < cxxfoozz_segment_count; ++idx) {
+    if (pc >= cxxfoozz_segments[idx].begin && pc < cxxfoozz_segments[idx].end)
+      return &cxxfoozz_segments[idx];
+  }
+  return nullptr;
+}
+
+static void cxxfoozz_write(int fd, const char *text) {
+  if (write(fd, text, strlen(text)) < 0)
+    return;
+}
+
+static void cxxfoozz_write_hex(int fd, uintptr_t value) {
+  char buf[3 + 2 * sizeof(uintptr_t)];
+  int pos = sizeof(buf);
+  buf[--pos] = '\0';
+  do {
+    buf[--pos] = "0123456789abcdef"[value & 15];
+    value >>= 4;
+  } while (value != 0);
+  buf[--pos] = 'x';
+  buf[--pos] = '0';
+  cxxfoozz_write(fd, buf + pos);
+}
+
+static void cxxfoozz_crash_handler(int signum, siginfo_t *info, void *) {
+  int fd = open(cxxfoozz_report_file, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+  if (fd >= 0) {
+    _Unwind_Backtrace(cxxfoozz_collect_frame, nullptr);
+    cxxfoozz_write_hex(fd, (uintptr_t) signum);
+    cxxfoozz_write(fd, " ");
+    cxxfoozz_write_hex(fd, (uintptr_t) info->si_addr);
+    cxxfoozz_write(fd, "\n");
+    for (int idx = cxxfoozz_signal_frame < 0 ? 1 : cxxfoozz_signal_frame; idx < cxxfoozz_frame_count; ++idx) {
+      const CxxfoozzSegment *segment = cxxfoozz_find_segment(cxxfoozz_frames[idx]);
+      cxxfoozz_write_hex(fd, cxxfoozz_frames[idx] - (segment != nullptr ? segment->bias : 0));
+      cxxfoozz_write(fd, " ");
+      cxxfoozz_write(fd, segment != nullptr ? segment->name : "?");
+      cxxfoozz_write(fd, "\n");
+    }
+    cxxfoozz_write(fd, "end\n");
+    close(fd);
+  }
+  raise(signum); // SA_RESETHAND restored the default action, it terminates the driver once the handler returns
+}
+
+__attribute__((constructor)) static void cxxfoozz_install_crash_handler() {
+  const char *report_file = getenv("CXXFOOZZ_CRASH_REPORT");
+  if (report_file == nullptr || strlen(report_file) >= sizeof(cxxfoozz_report_file))
+    return;
+  strcpy(cxxfoozz_report_file, report_file);
+  dl_iterate_phdr(cxxfoozz_record_module, nullptr);
+  stack_t alt_stack{};
+  alt_stack.ss_sp = cxxfoozz_alt_stack;
+  alt_stack.ss_size = sizeof(cxxfoozz_alt_stack);
+  sigaltstack(&alt_stack, nullptr); // stack overflows are reported as well
+  struct sigaction action{};
+  action.sa_sigaction = cxxfoozz_crash_handler;
+  action.sa_flags = SA_SIGINFO | SA_ONSTACK | SA_RESETHAND;
+  sigemptyset(&action.sa_mask);
+  const int signals[] = {SIGSEGV, SIGBUS, SIGFPE, SIGILL, SIGABRT};
+  for (int signum : signals)
+    sigaction(signum, &action, nullptr);
+}
+)CRASHRT";
+std::string CrashReportRuntime::BuildRuntime(const std::string &cxx_compiler, const std::string &output_dir) {
+  const std::string &runtime_cpp = output_dir + "/crash_report_runtime.cpp";
+  const std::string &runtime_o = output_dir + "/crash_report_runtime.o";
+  std::ofstream out(runtime_cpp);
+  out << kHandlerRuntimeSource;
+  out.close();
+  const ProcessSpec spec{{cxx_compiler, "-O2", "-c", "-o", runtime_o, runtime_cpp}};
+  if (ProcessSupervisor::Run(spec).GetReturnCode() != EXIT_SUCCESS)
+    return "";
+  return runtime_o;
+}
+
+// ##########
+// # ForkServerClient
+// #####
+
+const std::string &ForkServerClient::kForkServerEnvVar = "CXXFOOZZ_FORKSRV";
+const int ForkServerClient::kTimeoutReturnCode = 124; // same as timeout(1)
+const int ForkServerClient::kServerFailureReturnCode = -1;
+const int ForkServerClient::kOwnArgsRequest = -1;
+// Appended after the driver body. Without the env var the driver behaves like a plain one-shot executable.
+const std::string &ForkServerClient::kForkServerDriverSource = R"FORKSRV(
+#include <cstdio>
+#include <cstdlib>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+static int cxxfoozz_fork_server(int (*body)(int, char **), int argc, char **argv) {
+  if (getenv("CXXFOOZZ_FORKSRV") == nullptr)
+    return body(argc, argv);
+  const int ctl_fd = 198, st_fd = 199;
+  int msg = 0;
+  if (write(st_fd, &msg, 4) != 4)
+    return body(argc, argv);
+  while (true) {
+    if (read(ctl_fd, &msg, 4) != 4)
+      _exit(0);
+    pid_t child = fork();
+    if (child < 0)
+      _exit(1);
+    if (child == 0) {
+      setpgid(0, 0); // killed with whatever it started on timeout
+      close(ctl_fd);
+      close(st_fd);
+      if (msg < 0)
+        exit(body(argc, argv)); // exit, not _exit: gcov dumps its counters at exit
+      char tc_idx[16]; // batch drivers select the test case from argv[1]
+      snprintf(tc_idx, sizeof(tc_idx), "%d", msg);
+      char *served_argv[] = {argv[0], tc_idx, nullptr};
+      exit(body(2, served_argv));
+    }
+    setpgid(child, child); // also here, the group must exist once the fuzzer knows the pid
+    int child_pid = (int) child, status = 0;
+    if (write(st_fd, &child_pid, 4) != 4 || waitpid(child, &status, 0) < 0 || write(st_fd, &status, 4) != 4)
+      _exit(1);
+  }
+}
+
+int main(int argc, char **argv) {
+  return cxxfoozz_fork_server(cxxfoozz_body, argc, argv);
+}
+)FORKSRV";
+const int kForkServerCtlFd = 198;
+const int kForkServerStFd = 199;
+const long long int kForkServerHandshakeTimeoutInMsec = 10000LL;
+
+// Signals of the fuzzer itself (SIGUSR1, SIGINT) interrupt poll and read, they are retried until the deadline.
+bool ReadIntWithTimeout(int fd, int &value, long long int timeout_in_msec) {
+  const auto &deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_in_msec);
+  struct pollfd pfd{fd, POLLIN, 0};
+  while (true) {
+    const auto &remaining = std::chrono::duration_cast<std::chrono::milliseconds>(
+      deadline - std::chrono::steady_clock::now()).count();
+    int ready = poll(&pfd, 1, (int) std::max(0LL, (long long int) remaining));
+    if (ready > 0)
+      break;
+    if (ready == 0 || errno != EINTR)
+      return false;
+  }
+  ssize_t read_size = 0;
+  do {
+    read_size = read(fd, &value, 4);
+  } while (read_size < 0 && errno == EINTR);
+  return read_size == 4;
+}
+// A dead server must not take the fuzzer down: SIGPIPE is blocked for this thread during the write and consumed if
+// the write raised it, the disposition of the process is left alone.
+bool WriteIntRetrying(int fd, int value) {
+  sigset_t sigpipe_set, old_set;
+  sigemptyset(&sigpipe_set);
+  sigaddset(&sigpipe_set, SIGPIPE);
+  pthread_sigmask(SIG_BLOCK, &sigpipe_set, &old_set);
+  ssize_t written_size = 0;
+  do {
+    written_size = write(fd, &value, 4);
+  } while (written_size < 0 && errno == EINTR);
+  if (written_size < 0 && errno == EPIPE) {
+    struct timespec no_wait{0, 0};
+    sigtimedwait(&sigpipe_set, nullptr, &no_wait);
+  }
+  pthread_sigmask(SIG_SETMASK, &old_set, nullptr);
+  return written_size == 4;
+}
+
+ForkServerClient::ForkServerClient(
+  std::string target_exe,
+  std::vector<std::string> args,
+  std::map<std::string, std::string> env
+)
+  : target_exe_(std::move(target_exe)), args_(std::move(args)), env_(std::move(env)) {}
+ForkServerClient::~ForkServerClient() {
+  Stop();
+}
+bool ForkServerClient::Start() {
+  Stop();
+  int ctl_pipe[2], st_pipe[2];
+  if (pipe2(ctl_pipe, O_CLOEXEC) != 0)
+    return false;
+  if (pipe2(st_pipe, O_CLOEXEC) != 0) {
+    close(ctl_pipe[0]);
+    close(ctl_pipe[1]);
+    return false;
+  }
+
+  // Everything the child needs is prepared before fork, other fuzzing workers may hold locks meanwhile.
+  std::vector<char *> argv;
+  argv.push_back(const_cast<char *>(target_exe_.c_str()));
+  for (const auto &arg : args_)
+    argv.push_back(const_cast<char *>(arg.c_str()));
+  argv.push_back(nullptr);
+
+  std::map<std::string, std::string> env_vars = env_;
+  env_vars[kForkServerEnvVar] = "1";
+  std::vector<std::string> env_strings;
+  for (char **it = environ; *it != nullptr; ++it) {
+    const std::string &entry = *it;
+    if (env_vars.count(entry.substr(0, entry.find('='))) == 0)
+      env_strings.push_back(entry);
+  }
+  for (const auto &entry : env_vars)
+    env_strings.push_back(entry.first + '=' + entry.second);
+  std::vector<char *> envp;
+  for (const auto &entry : env_strings)
+    envp.push_back(const_cast<char *>(entry.c_str()));
+  envp.push_back(nullptr);
+  ProcessSpec spec{{target_exe_}};
+  LimitDriverResources(spec);
+  const ChildProcessSetup child_setup{spec};
+
+  // The server is set up like a child of ProcessSupervisor, its runs inherit the limits and the signal state.
+  pid_t pid = fork();
+  if (pid == 0) {
+    if (dup2(ctl_pipe[0], kForkServerCtlFd) < 0 || dup2(st_pipe[1], kForkServerStFd) < 0)
+      _exit(1);
+    if (child_setup.Apply(-1, -1) != 0)
+      _exit(1);
+    execve(target_exe_.c_str(), argv.data(), envp.data());
+    _exit(1);
+  }
+  close(ctl_pipe[0]);
+  close(st_pipe[1]);
+  if (pid < 0) {
+    close(ctl_pipe[1]);
+    close(st_pipe[0]);
+    return false;
+  }
+  server_pid_ = pid;
+  ctl_fd_ = ctl_pipe[1];
+  st_fd_ = st_pipe[0];
+
+  int hello = 0;
+  if (!ReadIntWithTimeout(st_fd_, hello, kForkServerHandshakeTimeoutInMsec)) {
+    Stop();
+    return false;
+  }
+  return true;
+}
+void ForkServerClient::Stop() {
+  if (ctl_fd_ >= 0)
+    close(ctl_fd_);
+  if (st_fd_ >= 0)
+    close(st_fd_);
+  if (server_pid_ > 0) {
+    kill(server_pid_, SIGKILL);
+    waitpid(server_pid_, nullptr, 0);
+  }
+  server_pid_ = ctl_fd_ = st_fd_ = -1;
+}
+bool ForkServerClient::IsAlive() const {
+  return server_pid_ > 0;
+}
+// A non-negative request is passed to the child as argv[1] instead of the arguments the server was started with.
+int ForkServerClient::Run(long long int timeout_in_msec, int request) {
+  if (!IsAlive())
+    return kServerFailureReturnCode;
+  const auto &started_at = std::chrono::steady_clock::now();
+  int child_pid = 0, status = 0;
+  bool forked = WriteIntRetrying(ctl_fd_, request)
+    && ReadIntWithTimeout(st_fd_, child_pid, kForkServerHandshakeTimeoutInMsec);
+  if (!forked) {
+    Stop();
+    return kServerFailureReturnCode;
+  }
+  bool finished = ReadIntWithTimeout(st_fd_, status, timeout_in_msec);
+  if (!finished) {
+    kill(-child_pid, SIGKILL);
+    kill(child_pid, SIGKILL);
+    if (!ReadIntWithTimeout(st_fd_, status, kForkServerHandshakeTimeoutInMsec)) {
+      Stop();
+      return kServerFailureReturnCode;
+    }
+  }
+  const auto &elapsed = std::chrono::steady_clock::now() - started_at;
+  last_run_latency_in_usec_ = std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count();
+
+  if (!finished)
+    return kTimeoutReturnCode;
+  if (WIFEXITED(status))
+    return WEXITSTATUS(status);
+  if (WIFSIGNALED(status))
+    return 128 + WTERMSIG(status); // same as a shell would report
+  return kServerFailureReturnCode;
+}
+long long int ForkServerClient::GetLastRunLatencyInUsec() const {
+  return last_run_latency_in_usec_;
+}
 
 // ##########
 // # CrashTCHandler
 // #####
 
 void CrashTCHandler::WriteGDBCommandFile() {
-  if (std::ofstream target{"test.gdb"}) {
+  if (std::ofstream target{gdb_command_file_}) {
     target << "run\n"
               "\n"
               "bt";
@@ -405,12 +1338,17 @@ bool InvokingOnNullptrCheck(const std::vector<std::string> &gdb_output_ss) {
   std::vector<std::string> temp_vc(gdb_output_ss);
   std::reverse(temp_vc.begin(), temp_vc.end());
 
-  const std::vector<std::string>::iterator &main_it = std::find_if(
-    temp_vc.begin(), temp_vc.end(), [](const std::string &item) {
+  const auto &at_driver = [](const std::string &item) {
+    return item.find(SourceCompiler::kTmpDriverCppFilename) != std::string::npos;
+  };
+  std::vector<std::string>::iterator main_it = std::find_if(
+    temp_vc.begin(), temp_vc.end(), [&at_driver](const std::string &item) {
       bool is_main = item.find("main") != std::string::npos;
-      bool at_driver = item.find(SourceCompiler::kTmpDriverCppFilename) != std::string::npos;
-      return is_main && at_driver;
+      return is_main && at_driver(item);
     });
+  // Test case functions of batch drivers and the fork server entry point sit between main and the statement
+  while (main_it != temp_vc.end() && main_it + 1 != temp_vc.end() && at_driver(*(main_it + 1)))
+    ++main_it;
   if (main_it != temp_vc.end() && (main_it + 1 != temp_vc.end())) {
     const std::string &invoke = *(main_it + 1);
     bool is_nullptr = invoke.find("this=0x0") != std::string::npos;
@@ -419,12 +1357,38 @@ bool InvokingOnNullptrCheck(const std::vector<std::string> &gdb_output_ss) {
   return false;
 }
 
-TCMemo CrashTCHandler::ExecuteInGDBEnv(const std::string &target_exe, const std::string &src_dir) {
-  std::stringstream ss;
-  ss << "timeout 5 gdb --batch --command=test.gdb --args " << target_exe;
-  const std::pair<int, std::string> &execution_result = ExecuteCommand(ss.str());
+const long long int kGdbTimeoutInMsec = 5000LL;
+// Crashes reported by the driver itself are symbolized right away, the others are run again under gdb.
+TCMemo CrashTCHandler::TriageCrash(
+  const std::string &target_exe,
+  const std::string &src_dir,
+  const std::map<std::string, std::string> &env,
+  const std::string &exe_args
+) {
+  StageTimer triage_timer{PipelineStage::kCrashTriage};
+  const auto &report_it = env.find(CrashReportRuntime::kReportEnvVar);
+  if (report_it != env.end()) {
+    const bpstd::optional<TCMemo> &memo = ReadCrashReport(report_it->second, target_exe, src_dir);
+    if (memo.has_value())
+      return memo.value();
+  }
+  return ExecuteInGDBEnv(target_exe, src_dir, env, exe_args);
+}
 
-  const std::string &gdb_output = execution_result.second;
+TCMemo CrashTCHandler::ExecuteInGDBEnv(
+  const std::string &target_exe,
+  const std::string &src_dir,
+  const std::map<std::string, std::string> &env,
+  const std::string &exe_args
+) {
+  std::vector<std::string> argv{"gdb", "--batch", "--command=" + gdb_command_file_, "--args", target_exe};
+  AppendFlags(argv, {exe_args});
+  ProcessSpec spec{argv};
+  spec.SetEnv(env);
+  spec.SetTimeoutInMsec(kGdbTimeoutInMsec);
+  const ProcessResult &execution_result = ProcessSupervisor::Run(spec);
+
+  const std::string &gdb_output = execution_result.GetOutput();
 //  std::cout << "## YOUR GDB OUTPUT" << '\n';
 //  std::cout << gdb_output << '\n';
 //  std::cout << "## END OF GDB OUTPUT" << '\n' << '\n';
@@ -438,9 +1402,7 @@ TCMemo CrashTCHandler::ExecuteInGDBEnv(const std::string &target_exe, const std:
     return memo;
   }
 
-  std::string first_location, main_location;
-  std::vector<std::string> final_stack_trace;
-  bool found_first_tgt_loc = false;
+  std::vector<std::string> locations;
   bool is_stack_trace = false;
   for (const auto &gdb_line : gdb_output_ss) {
     const std::string &stripped = StringStrip(gdb_line);
@@ -453,34 +1415,161 @@ TCMemo CrashTCHandler::ExecuteInGDBEnv(const std::string &target_exe, const std:
 
     if (is_stack_trace) {
 //      const std::string &st_loc = ParseLocation(stripped);
-      const std::string &loc = ParseLocation(stripped);
-      if (loc.rfind(src_dir, 0) == 0) {
-        final_stack_trace.push_back(loc);
-        if (!found_first_tgt_loc) {
-          first_location = loc;
-        }
-        found_first_tgt_loc = true;
+      locations.push_back(ParseLocation(stripped));
+    }
+  }
+  TCMemo memo = BuildMemoFromLocations(locations, src_dir);
+  memo.SetGdbOutput({gdb_output});
+  return memo;
+}
+
+// locations holds the file:line of each frame from the crashing one outwards, empty for frames without one.
+TCMemo CrashTCHandler::BuildMemoFromLocations(const std::vector<std::string> &locations, const std::string &src_dir) {
+  std::string first_location, main_location, driver_location;
+  std::vector<std::string> final_stack_trace;
+  bool found_first_tgt_loc = false;
+  for (const auto &loc : locations) {
+    if (loc.rfind(src_dir, 0) == 0) {
+      final_stack_trace.push_back(loc);
+      if (!found_first_tgt_loc) {
+        first_location = loc;
       }
-      main_location = loc;
+      found_first_tgt_loc = true;
     }
+    if (driver_location.empty() && loc.find(SourceCompiler::kTmpDriverCppFilename) != std::string::npos)
+      driver_location = loc; // innermost driver frame, i.e. the statement being executed
+    main_location = loc;
   }
   TCMemo memo;
   const std::string &squashed_stack_trace = SquashStackTrace(final_stack_trace);
   memo.SetFingerprint({squashed_stack_trace});
 
-  memo.SetGdbOutput({gdb_output});
   if (found_first_tgt_loc)
     memo.SetLocation({first_location});
   else
     memo.SetValidCrash(false); // crash did not occur in src directory
 
+  if (!driver_location.empty())
+    main_location = driver_location;
   if (!main_location.empty() && main_location.find(':') != std::string::npos) {
     const std::vector<std::string> &locs = SplitStringIntoVector(main_location, ":");
-    int line_num = std::stoi(locs[1]);
-    memo.SetCrashLineNum({line_num});
+    bool has_line_num = locs.size() > 1 && !locs[1].empty() && locs[1].size() < 10
+      && std::all_of(locs[1].begin(), locs[1].end(), [](char c) { return std::isdigit((unsigned char) c) != 0; });
+    if (has_line_num) // addr2line prints "file:?" when the line is unknown
+      memo.SetCrashLineNum({std::stoi(locs[1])});
   }
   return memo;
 }
+const long long int kSymbolizerTimeoutInMsec = 5000LL;
+const unsigned long long int kNullPageSize = 4096ULL;
+
+// The report may be cut short by a second fault or a kill, every token is checked before it is converted.
+bpstd::optional<unsigned long long int> ParseCrashReportHex(const std::string &token) {
+  size_t digits_begin = token.rfind("0x", 0) == 0 ? 2 : 0;
+  size_t digit_count = token.size() - digits_begin;
+  if (digit_count == 0 || digit_count > 2 * sizeof(unsigned long long int))
+    return {};
+  for (size_t idx = digits_begin; idx < token.size(); ++idx) {
+    if (std::isxdigit((unsigned char) token[idx]) == 0)
+      return {};
+  }
+  return std::stoull(token, nullptr, 16);
+}
+
+// Frames of the main executable are symbolized by one addr2line run, inlined calls expand into several frames
+// like in a gdb backtrace. Returns nothing for incomplete reports and for null dereferences right below the
+// driver, which may be calls on a null object that only gdb can tell from the frame arguments.
+bpstd::optional<TCMemo> CrashTCHandler::ReadCrashReport(
+  const std::string &report_file,
+  const std::string &target_exe,
+  const std::string &src_dir
+) {
+  std::ifstream report{report_file};
+  unsigned long long int signum = 0, fault_addr = 0;
+  std::string header;
+  if (!std::getline(report, header))
+    return {};
+  const std::vector<std::string> &header_tokens = SplitStringIntoVector(header, " ");
+  if (header_tokens.size() != 2)
+    return {};
+  const bpstd::optional<unsigned long long int> &opt_signum = ParseCrashReportHex(header_tokens[0]);
+  const bpstd::optional<unsigned long long int> &opt_fault_addr = ParseCrashReportHex(header_tokens[1]);
+  if (!opt_signum.has_value() || !opt_fault_addr.has_value())
+    return {};
+  signum = opt_signum.value();
+  fault_addr = opt_fault_addr.value();
+
+  std::vector<std::string> offsets; // empty for frames outside of the main executable
+  bool complete = false;
+  for (std::string line; std::getline(report, line);) {
+    if (line == "end") {
+      complete = true;
+      break;
+    }
+    size_t space = line.find(' ');
+    if (space == std::string::npos || !ParseCrashReportHex(line.substr(0, space)).has_value())
+      return {};
+    bool in_main_exe = space + 1 == line.size();
+    offsets.push_back(in_main_exe ? line.substr(0, space) : "");
+  }
+  if (!complete || offsets.empty())
+    return {};
+
+  std::vector<std::string> argv{"addr2line", "-e", target_exe, "-a", "-f", "-i", "-C"};
+  for (const auto &offset : offsets) {
+    if (!offset.empty())
+      argv.push_back(offset);
+  }
+  std::map<unsigned long long int, std::vector<std::pair<std::string, std::string>>> symbolized;
+  if (argv.size() > 7) {
+    ProcessSpec spec{argv};
+    spec.SetTimeoutInMsec(kSymbolizerTimeoutInMsec);
+    spec.SetCaptureStderr(false);
+    const ProcessResult &result = ProcessSupervisor::Run(spec);
+    if (result.GetReturnCode() != EXIT_SUCCESS)
+      return {};
+    const std::vector<std::string> &lines = SplitStringIntoVector(result.GetOutput(), "\n");
+    std::vector<std::pair<std::string, std::string>> *frames = nullptr;
+    for (size_t idx = 0; idx < lines.size(); ++idx) {
+      const bpstd::optional<unsigned long long int> &address =
+        lines[idx].rfind("0x", 0) == 0 ? ParseCrashReportHex(lines[idx]) : bpstd::nullopt;
+      if (address.has_value()) {
+        frames = &symbolized[address.value()];
+      } else if (frames != nullptr && idx + 1 < lines.size()) {
+        std::string location = lines[idx + 1].substr(0, lines[idx + 1].find(" ("));
+        if (location.rfind("??", 0) == 0)
+          location.clear();
+        frames->emplace_back(lines[idx], location);
+        ++idx;
+      }
+    }
+  }
+
+  std::vector<std::string> locations;
+  std::stringstream backtrace;
+  for (const auto &offset : offsets) {
+    std::vector<std::pair<std::string, std::string>> frames{{"??", ""}};
+    const auto &it = offset.empty() ? symbolized.end() : symbolized.find(ParseCrashReportHex(offset).value());
+    if (it != symbolized.end())
+      frames = it->second;
+    for (const auto &frame : frames) {
+      backtrace << '#' << locations.size() << "  " << frame.first;
+      if (!frame.second.empty())
+        backtrace << " at " << frame.second;
+      backtrace << '\n';
+      locations.push_back(frame.second);
+    }
+  }
+  bool null_deref = (signum == SIGSEGV || signum == SIGBUS) && fault_addr < kNullPageSize;
+  bool called_by_driver =
+    locations.size() > 1 && locations[1].find(SourceCompiler::kTmpDriverCppFilename) != std::string::npos;
+  if (null_deref && called_by_driver)
+    return {};
+
+  TCMemo memo = BuildMemoFromLocations(locations, src_dir);
+  memo.SetGdbOutput({"Program received signal " + std::to_string(signum) + "\n" + backtrace.str()});
+  return memo;
+}
 std::string CrashTCHandler::SquashStackTrace(const std::vector<std::string> &stack_trace_ids) {
   std::stringstream joined;
   bool first_elmt = true;
@@ -500,14 +1589,19 @@ bool CrashTCHandler::RegisterIfNewCrash(const std::string &squashed_stack_trace)
   }
   return false;
 }
-CrashTCHandler::CrashTCHandler() {
+const std::set<std::string> &CrashTCHandler::GetUniqueCrashes() const {
+  return unique_crashes_;
+}
+CrashTCHandler::CrashTCHandler() : CrashTCHandler("test.gdb") {}
+CrashTCHandler::CrashTCHandler(std::string gdb_command_file)
+  : gdb_command_file_(std::move(gdb_command_file)), unique_crashes_() {
   WriteGDBCommandFile();
 }
 CrashTCHandler::~CrashTCHandler() {
   DeleteGDBCommandFile();
 }
 void CrashTCHandler::DeleteGDBCommandFile() {
-  std::remove("test.gdb");
+  std::remove(gdb_command_file_.c_str());
 }
 
 // ##########
@@ -519,9 +1613,123 @@ void CrashTCHandler::DeleteGDBCommandFile() {
 std::string ObjectFileLocator::Lookup(const std::string &target_dir, int max_depth) {
   assert(max_depth > 0);
   const std::string &md_string = std::to_string(max_depth);
-  const std::string &command = "echo -n $(find " + target_dir + " -maxdepth " + md_string + " -type f -name \"*.o\")";
-  const std::pair<int, std::string> &execution_result = ExecuteCommand(command);
-  return execution_result.second;
+  const std::string &command = "find " + target_dir + " -maxdepth " + md_string + " -type f -name \"*.o\"";
+  const std::pair<int, std::string> &execution_result = ExecuteArgs(command);
+  std::vector<std::string> object_files = SplitStringIntoVector(execution_result.second, "\n");
+  object_files.erase(std::remove(object_files.begin(), object_files.end(), ""), object_files.end());
+  return StringJoin(object_files, " ");
+}
+
+// ##########
+// # ObjectPrelinker
+// #####
+
+const std::string &ObjectPrelinker::kPrelinkedObjectPrefix = "prelinked_";
+ObjectPrelinker::ObjectPrelinker(std::string cache_dir) : cache_dir_(std::move(cache_dir)) {}
+bpstd::optional<std::string> ObjectPrelinker::Prelink(const std::string &object_files) {
+  std::vector<std::string> objects;
+  for (const auto &object : SplitStringIntoVector(object_files, " ")) {
+    bool is_cached_artifact = object.rfind(cache_dir_ + "/", 0) == 0; // target dir may contain the cache
+    if (!object.empty() && !is_cached_artifact)
+      objects.push_back(object);
+  }
+  if (objects.empty())
+    return {};
+  std::sort(objects.begin(), objects.end());
+  const bpstd::optional<std::string> &key = ComputeKey(objects);
+  if (!key.has_value())
+    return {};
+
+  const std::string &prelinked = cache_dir_ + "/" + kPrelinkedObjectPrefix + key.value() + ".o";
+  if (std::experimental::filesystem::exists(prelinked)) {
+    Logger::Info("Reusing prelinked target objects: " + prelinked);
+    return prelinked;
+  }
+  std::error_code ec;
+  std::experimental::filesystem::create_directories(cache_dir_, ec);
+
+  // Written under a temporary name, so that an interrupted link never leaves a valid-looking artifact
+  const std::string &tmp_prelinked = prelinked + ".tmp";
+  std::vector<std::string> argv{"ld", "-r", "-o", tmp_prelinked};
+  argv.insert(argv.end(), objects.begin(), objects.end());
+  const ProcessResult &result = ProcessSupervisor::Run(ProcessSpec{argv});
+  if (result.GetReturnCode() != EXIT_SUCCESS) {
+    Logger::Warn("ObjectPrelinker", "Cannot prelink the target objects:\n" + result.GetOutput());
+    std::experimental::filesystem::remove(tmp_prelinked, ec);
+    return {};
+  }
+  std::experimental::filesystem::rename(tmp_prelinked, prelinked, ec);
+  if (ec)
+    return {};
+  Logger::Info("Prelinked " + std::to_string(objects.size()) + " target objects into: " + prelinked);
+  return prelinked;
+}
+bpstd::optional<std::string> ObjectPrelinker::ComputeKey(const std::vector<std::string> &objects) const {
+  uint64_t hash = kFnv1aOffsetBasis;
+  std::vector<char> buffer(1 << 16);
+  for (const auto &object : objects) {
+    std::error_code ec;
+    const auto &mtime = std::experimental::filesystem::last_write_time(object, ec);
+    if (ec)
+      return {};
+    long long int mtime_count = (long long int) mtime.time_since_epoch().count();
+    hash = Fnv1aHash(object, hash);
+    hash = Fnv1aHash((const char *) &mtime_count, sizeof(mtime_count), hash);
+
+    std::ifstream in{object, std::ios::binary};
+    if (!in)
+      return {};
+    while (in.read(buffer.data(), (std::streamsize) buffer.size()) || in.gcount() > 0)
+      hash = Fnv1aHash(buffer.data(), (size_t) in.gcount(), hash);
+  }
+  return ToHexString(hash);
+}
+
+// ##########
+// # TextInterner
+// #####
+
+const size_t kInternCleanupInterval = 1024;
+
+const std::shared_ptr<TextInterner> &TextInterner::GetInstance() {
+  static const std::shared_ptr<TextInterner> instance = std::make_shared<TextInterner>(); // memos of all threads
+  return instance;
+}
+std::shared_ptr<const std::string> TextInterner::Intern(const std::string &text) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (++interned_since_cleanup_ >= kInternCleanupInterval)
+    RemoveExpired();
+  std::vector<std::weak_ptr<const std::string>> &bucket = texts_[std::hash<std::string>()(text)];
+  for (const auto &weak_text : bucket) {
+    const std::shared_ptr<const std::string> &interned = weak_text.lock();
+    if (interned != nullptr && *interned == text)
+      return interned;
+  }
+  const std::shared_ptr<const std::string> &interned = std::make_shared<const std::string>(text);
+  bucket.push_back(interned);
+  return interned;
+}
+size_t TextInterner::GetTextCount() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  RemoveExpired();
+  size_t count = 0;
+  for (const auto &entry : texts_)
+    count += entry.second.size();
+  return count;
+}
+// Caller must hold the mutex.
+void TextInterner::RemoveExpired() {
+  interned_since_cleanup_ = 0;
+  for (auto it = texts_.begin(); it != texts_.end();) {
+    std::vector<std::weak_ptr<const std::string>> &bucket = it->second;
+    bucket.erase(
+      std::remove_if(
+        bucket.begin(), bucket.end(), [](const std::weak_ptr<const std::string> &item) {
+          return item.expired();
+        }),
+      bucket.end());
+    it = bucket.empty() ? texts_.erase(it) : std::next(it);
+  }
 }
 
 // ##########
@@ -531,7 +1739,7 @@ std::string ObjectFileLocator::Lookup(const std::string &target_dir, int max_dep
 const bpstd::optional<std::string> &TCMemo::GetFingerprint() const {
   return fingerprint_;
 }
-const bpstd::optional<std::string> &TCMemo::GetGdbOutput() const {
+const std::shared_ptr<const std::string> &TCMemo::GetGdbOutput() const {
   return gdb_output_;
 }
 const bpstd::optional<std::string> &TCMemo::GetLocation() const {
@@ -541,7 +1749,7 @@ void TCMemo::SetFingerprint(const bpstd::optional<std::string> &fingerprint) {
   fingerprint_ = fingerprint;
 }
 void TCMemo::SetGdbOutput(const bpstd::optional<std::string> &gdb_output) {
-  gdb_output_ = gdb_output;
+  gdb_output_ = gdb_output.has_value() ? TextInterner::GetInstance()->Intern(gdb_output.value()) : nullptr;
 }
 void TCMemo::SetLocation(const bpstd::optional<std::string> &location) {
   location_ = location;
@@ -559,13 +1767,186 @@ void TCMemo::SetValidCrash(bool valid_crash) {
   valid_crash_ = valid_crash;
 }
 void TCMemo::SetCompilationOutput(const bpstd::optional<std::string> &compilation_output) {
-  compilation_output_ = compilation_output;
+  compilation_output_ =
+    compilation_output.has_value() ? TextInterner::GetInstance()->Intern(compilation_output.value()) : nullptr;
 }
-const bpstd::optional<std::string> &TCMemo::GetCompilationOutput() const {
+const std::shared_ptr<const std::string> &TCMemo::GetCompilationOutput() const {
   return compilation_output_;
 }
 TCMemo::TCMemo() = default;
 
+// ##########
+// # CachedDriverBuild
+// #####
+
+CachedDriverBuild::CachedDriverBuild(CompilationResult compile_result, std::string compile_output)
+  : compile_result_(compile_result), compile_output_(std::move(compile_output)) {}
+CompilationResult CachedDriverBuild::GetCompileResult() const {
+  return compile_result_;
+}
+const std::string &CachedDriverBuild::GetCompileOutput() const {
+  return compile_output_;
+}
+const std::string &CachedDriverBuild::GetExecutable() const {
+  return executable_;
+}
+void CachedDriverBuild::SetExecutable(const std::string &executable) {
+  executable_ = executable;
+}
+unsigned long long int CachedDriverBuild::GetSizeInBytes() const {
+  return size_in_bytes_;
+}
+void CachedDriverBuild::SetSizeInBytes(unsigned long long int size_in_bytes) {
+  size_in_bytes_ = size_in_bytes;
+}
+const bpstd::optional<int> &CachedDriverBuild::GetReturnCode() const {
+  return return_code_;
+}
+const bpstd::optional<TCMemo> &CachedDriverBuild::GetCrashMemo() const {
+  return crash_memo_;
+}
+void CachedDriverBuild::SetExecution(int return_code, const bpstd::optional<TCMemo> &crash_memo) {
+  return_code_ = return_code;
+  crash_memo_ = crash_memo;
+}
+
+// ##########
+// # DriverBuildCache
+// #####
+
+const std::string &DriverBuildCache::kTmpfsDir = "/dev/shm";
+DriverBuildCache::DriverBuildCache(std::string cache_dir, unsigned long long int max_size_in_bytes)
+  : cache_dir_(std::move(cache_dir)), max_size_in_bytes_(max_size_in_bytes) {
+  std::error_code ec;
+  std::experimental::filesystem::create_directories(cache_dir_, ec);
+}
+DriverBuildCache::~DriverBuildCache() {
+  std::error_code ec;
+  std::experimental::filesystem::remove_all(cache_dir_, ec);
+}
+// Executables are written and read back on every miss and hit, a tmpfs keeps that off the disk.
+std::string DriverBuildCache::SelectCacheDir(const std::string &fallback_dir) {
+  struct statfs fs_info{};
+  bool is_tmpfs = statfs(kTmpfsDir.c_str(), &fs_info) == 0 && fs_info.f_type == TMPFS_MAGIC;
+  if (is_tmpfs && access(kTmpfsDir.c_str(), W_OK) == 0)
+    return kTmpfsDir + "/cxxfoozz_build_cache_" + std::to_string(getpid());
+  return fallback_dir + "/build_cache";
+}
+bpstd::optional<std::string> DriverBuildCache::ComputeKey(
+  const std::string &driver_cpp,
+  const std::string &build_signature
+) const {
+  std::ifstream in{driver_cpp, std::ios::binary};
+  if (!in)
+    return {};
+  std::stringstream source;
+  source << in.rdbuf();
+  const std::string &content = source.str();
+  uint64_t hash = Fnv1aHash(content, Fnv1aHash(build_signature));
+  return ToHexString(hash) + "_" + std::to_string(content.size()); // the size makes collisions even less likely
+}
+bpstd::optional<CachedDriverBuild> DriverBuildCache::Lookup(const std::string &key) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = entries_.find(key);
+  if (it == entries_.end()) {
+    ++misses_;
+    Logger::Debug("DriverBuildCache", "Miss: " + key);
+    return {};
+  }
+  ++hits_;
+  Logger::Debug("DriverBuildCache", "Hit: " + key);
+  Touch(key);
+  return it->second;
+}
+void DriverBuildCache::StoreBuild(
+  const std::string &key,
+  CompilationResult compile_result,
+  const std::string &compile_output,
+  const std::string &target_exe
+) {
+  CachedDriverBuild build{compile_result, compile_output};
+  unsigned long long int size_in_bytes = compile_output.size();
+  if (compile_result == CompilationResult::kSuccess) {
+    // Copied outside of the lock, the name is unique to the key and workers never build the same key at once
+    // unless their drivers are identical, in which case either copy will do.
+    const std::string &cached_exe = cache_dir_ + "/" + key;
+    std::error_code ec;
+    std::experimental::filesystem::copy_file(
+      target_exe, cached_exe, std::experimental::filesystem::copy_options::overwrite_existing, ec);
+    unsigned long long int exe_size = ec ? 0 : std::experimental::filesystem::file_size(cached_exe, ec);
+    if (!ec && exe_size <= max_size_in_bytes_) {
+      build.SetExecutable(cached_exe);
+      size_in_bytes += exe_size;
+    } else {
+      std::experimental::filesystem::remove(cached_exe, ec);
+    }
+  }
+  build.SetSizeInBytes(size_in_bytes);
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  Erase(key);
+  entries_.emplace(key, build);
+  size_in_bytes_ += size_in_bytes;
+  Touch(key);
+  EvictIfNeeded();
+}
+// Hangs and fork server failures depend on the load of the machine, so such drivers are run again on a hit.
+void DriverBuildCache::StoreExecution(
+  const std::string &key,
+  int return_code,
+  const bpstd::optional<TCMemo> &crash_memo
+) {
+  if (return_code < 0 || return_code == ProcessResult::kTimeoutReturnCode)
+    return;
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = entries_.find(key);
+  if (it != entries_.end())
+    it->second.SetExecution(return_code, crash_memo);
+}
+bool DriverBuildCache::RestoreExecutable(const CachedDriverBuild &build, const std::string &target_exe) const {
+  if (build.GetExecutable().empty())
+    return false;
+  std::error_code ec;
+  std::experimental::filesystem::copy_file(
+    build.GetExecutable(), target_exe, std::experimental::filesystem::copy_options::overwrite_existing, ec);
+  return !ec;
+}
+std::string DriverBuildCache::ToPrettyString() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  long long int lookups = hits_ + misses_;
+  long long int hit_rate = lookups == 0 ? 0 : hits_ * 100 / lookups;
+  return "hits = " + std::to_string(hits_) + ", misses = " + std::to_string(misses_)
+    + " (" + std::to_string(hit_rate) + "% hit rate), " + std::to_string(entries_.size()) + " entries, "
+    + std::to_string(size_in_bytes_ / 1024) + " KiB in " + cache_dir_;
+}
+void DriverBuildCache::Touch(const std::string &key) {
+  auto it = last_used_.find(key);
+  if (it != last_used_.end())
+    lru_.erase(it->second);
+  last_used_[key] = ++tick_;
+  lru_[tick_] = key;
+}
+// Keeps the executable, which a rebuild of the same key has just overwritten.
+void DriverBuildCache::Erase(const std::string &key) {
+  auto it = entries_.find(key);
+  if (it == entries_.end())
+    return;
+  size_in_bytes_ -= it->second.GetSizeInBytes();
+  lru_.erase(last_used_[key]);
+  last_used_.erase(key);
+  entries_.erase(it);
+}
+void DriverBuildCache::EvictIfNeeded() {
+  while (size_in_bytes_ > max_size_in_bytes_ && !lru_.empty()) {
+    const std::string key = lru_.begin()->second;
+    const std::string &executable = entries_.at(key).GetExecutable();
+    std::error_code ec;
+    if (!executable.empty())
+      std::experimental::filesystem::remove(executable, ec);
+    Erase(key);
+  }
+}
+
 // ##########
 // # SysProcessReport
 // #####
@@ -1,4 +1,5 @@
 
+#include "compile-failure-cache.hpp"
 #include "func/api.hpp"
 #include "function-selector.hpp"
 #include "random.hpp"
@@ -10,7 +11,7 @@ namespace cxxfoozz {
 FunctionSelector::FunctionSelector(
   std::vector<std::shared_ptr<Executable>> executables,
   FunctionSelectorMode mode
-) : executables_(std::move(executables)), mode_(mode) {}
+) : executables_(CompileFailureCache::GetInstance()->FilterBlocked(executables)), mode_(mode) {}
 std::shared_ptr<Executable> FunctionSelector::NextExecutable() {
   if (mode_ == FunctionSelectorMode::kRandom || kGlobalSummary.empty()) {
     const std::shared_ptr<Random> &r = Random::GetInstance();
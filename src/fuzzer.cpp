@@ -1,19 +1,32 @@
+#include <algorithm>
+#include <cmath>
 #include <csignal>
+#include <fstream>
 #include <string>
 #include <iostream>
 #include <queue>
+#include <unordered_set>
 #include <sstream>
 #include <utility>
 #include <experimental/filesystem>
 
+#include "checkpoint.hpp"
 #include "clock.hpp"
+#include "compile-failure-cache.hpp"
 #include "execution.hpp"
 #include "function-selector.hpp"
+#include "gcov.hpp"
 #include "fuzzer.hpp"
+#include "harness.hpp"
 #include "logger.hpp"
+#include "minimizer.hpp"
 #include "mutator.hpp"
+#include "pipeline-stats.hpp"
+#include "process.hpp"
+#include "queue-store.hpp"
 #include "random.hpp"
 #include "sequencegen.hpp"
+#include "triage.hpp"
 #include "writer.hpp"
 #include "type.hpp"
 #include "util.hpp"
@@ -73,30 +86,55 @@ std::string HARDCODED_ReplaceBuildWithLibfuzzerDir(const std::string &target_dir
   return ReplaceFirstOccurrence(target_dir, "/build/", "/build_libfuzzer/");
 }
 
+void WriteReplayManifests(
+  const std::string &working_dir,
+  ScaffoldingHPPFileWriter &scaff_writer,
+  const std::string &dir_name
+) {
+  scaff_writer.WriteToFile(dir_name + "/out_scaffolding.hpp");
+  std::experimental::filesystem::copy(
+    working_dir + "/scripts/batch_libfuzzer.py", dir_name + "/batch_libfuzzer.py",
+    std::experimental::filesystem::copy_options::overwrite_existing);
+}
+
 void PartitionByTimestamp(
   TestCaseQueue &queue,
   const std::string &working_dir,
   const std::string &output_dir,
   ReplayDriverWriter &replay_writer,
   ScaffoldingHPPFileWriter &scaff_writer,
-  const std::string &folder_name
+  const std::string &folder_name,
+  bool minimize_corpus
 ) {
   /* BEGIN PARTITIONING BY TIMESTAMP */
   const auto &h_to_sec = [](int x) { return 3600 * x; };
-  int configs[5] = {1, 3, 6, 12, 24};
-  for (const auto conf : configs) {
+  for (const auto conf : ReplayDriverWriter::kPartitionHours) {
     int last_timestamp = h_to_sec(conf);
     std::vector<FlushableTestCase> subqueue = queue.GetValidByTimestamp(last_timestamp);
+    if (minimize_corpus)
+      subqueue = CorpusMinimizer::Minimize(subqueue); // covers what was reached by then, not the final corpus
     const std::string &subfolder_name = folder_name + '/' + std::to_string(conf);
     const std::string &wd_subfolder = GetWDOutputFilename(subfolder_name, output_dir);
     replay_writer.WriteToDirectory(subqueue, wd_subfolder);
-
-    scaff_writer.WriteToFile(wd_subfolder + "/out_scaffolding.hpp");
-    std::experimental::filesystem::copy(working_dir + "/scripts/batch_libfuzzer.py", wd_subfolder + "/batch_libfuzzer.py");
+    WriteReplayManifests(working_dir, scaff_writer, wd_subfolder);
   }
   /* END */
 }
 
+// The libfuzzer drivers link the objects of the build_libfuzzer twin of the target dir.
+std::string PrelinkLibFuzzerObjects(
+  const std::string &target_dir,
+  int max_traversal_depth,
+  ObjectPrelinker *prelinker,
+  const std::string &prelinked_object
+) {
+  const std::string &libfuzzer_target_dir = HARDCODED_ReplaceBuildWithLibfuzzerDir(target_dir);
+  if (prelinker == nullptr || libfuzzer_target_dir == target_dir)
+    return prelinked_object;
+  const std::string &libfuzzer_objects = ObjectFileLocator().Lookup(libfuzzer_target_dir, max_traversal_depth);
+  return prelinker->Prelink(libfuzzer_objects).value_or("");
+}
+
 void FlushQueue(
   TestCaseQueue &queue,
   const std::shared_ptr<ImportWriter> &import_writer,
@@ -107,9 +145,26 @@ void FlushQueue(
   const std::vector<std::string> &ld_flags,
   int max_traversal_depth,
   const std::shared_ptr<ProgramContext> &prog_ctx,
-  const std::string &target_filename
+  const std::string &target_filename,
+  ObjectPrelinker *prelinker,
+  const std::string &prelinked_object,
+  bool minimize_corpus,
+  StreamingQueueWriter *streaming_writer
 ) {
-  GoogleTestWriter gtest_writer{import_writer, target_dir, cxx_flags, ld_flags, max_traversal_depth, prog_ctx};
+  if (minimize_corpus) {
+    if (CorpusMinimizer::HasCoveredSites(queue.GetValid())) {
+      size_t valid_count = queue.GetValid().size();
+      size_t removed = queue.MinimizeValid();
+      Logger::Info(
+        "Corpus minimization kept " + std::to_string(valid_count - removed) + " of " + std::to_string(valid_count)
+          + " valid test cases.");
+    } else {
+      Logger::Warn("FlushQueue", "Corpus minimization needs per-site coverage (native gcov or --shm-cov), skipped.");
+    }
+  }
+  GoogleTestWriter gtest_writer{
+    import_writer, target_dir, cxx_flags, ld_flags, max_traversal_depth, prog_ctx, prelinked_object};
+  gtest_writer.SetSpillStore(queue.GetSpillStore());
 
 //  static int kFlushCounter = 0;
 //  int idx = ++kFlushCounter;
@@ -117,19 +172,41 @@ void FlushQueue(
 //  std::string suffix = '_' + std::to_string(idx) + ext;
   const std::string &suffix = ext;
 
-  std::string valid_tcs = "out_valid" + suffix;
-  const std::string &wd_valid = GetWDOutputFilename(valid_tcs, output_dir);
-  gtest_writer.WriteToFile(queue.GetValid(), wd_valid);
+  if (streaming_writer != nullptr) {
+    streaming_writer->Finish(queue, minimize_corpus);
+  } else {
+    std::string valid_tcs = "out_valid" + suffix;
+    const std::string &wd_valid = GetWDOutputFilename(valid_tcs, output_dir);
+    gtest_writer.WriteToFile(queue.GetValid(), wd_valid);
 
-  std::string crash_tcs = "out_crash" + suffix;
-  const std::string &wd_crash = GetWDOutputFilename(crash_tcs, output_dir);
-  gtest_writer.WriteToFile(queue.GetCrashes(), wd_crash);
+    std::string crash_tcs = "out_crash" + suffix;
+    const std::string &wd_crash = GetWDOutputFilename(crash_tcs, output_dir);
+    gtest_writer.WriteToFile(queue.GetCrashes(), wd_crash);
+  }
 
   std::string uncompilable_tcs = "out_uncompilable" + suffix;
   const std::string &wd_uncompilable = GetWDOutputFilename(uncompilable_tcs, output_dir);
   gtest_writer.WriteToFile(queue.GetIncompilable(), wd_uncompilable);
 
+  std::string hang_tcs = "out_hang" + suffix;
+  const std::string &wd_hang = GetWDOutputFilename(hang_tcs, output_dir);
+  gtest_writer.WriteToFile(queue.GetHangs(), wd_hang);
+
+  // The drivers were written while fuzzing, only the files shared by each replay dir are left.
+  ScaffoldingHPPFileWriter scaff_writer{prog_ctx};
+  if (streaming_writer != nullptr) {
+    for (const char *folder_name : {"out_replay", "out_libfuzzer"}) {
+      const std::string &wd_folder = GetWDOutputFilename(folder_name, output_dir);
+      WriteReplayManifests(working_dir, scaff_writer, wd_folder);
+      for (int hours : ReplayDriverWriter::kPartitionHours)
+        WriteReplayManifests(working_dir, scaff_writer, wd_folder + '/' + std::to_string(hours));
+    }
+    return;
+  }
+
   const std::string &libfuzzer_target_dir = HARDCODED_ReplaceBuildWithLibfuzzerDir(target_dir);
+  const std::string &libfuzzer_prelinked_object =
+    PrelinkLibFuzzerObjects(target_dir, max_traversal_depth, prelinker, prelinked_object);
   ReplayDriverWriter replay_writer{
     import_writer,
     libfuzzer_target_dir,
@@ -137,15 +214,14 @@ void FlushQueue(
     ld_flags,
     max_traversal_depth,
     prog_ctx,
-    ReplayDriverPurpose::kNormalUse
+    ReplayDriverPurpose::kNormalUse,
+    libfuzzer_prelinked_object
   };
+  replay_writer.SetSpillStore(queue.GetSpillStore());
   const std::string &wd_replay = GetWDOutputFilename("out_replay", output_dir);
   replay_writer.WriteToDirectory(queue.GetValid(), wd_replay);
-
-  ScaffoldingHPPFileWriter scaff_writer{prog_ctx};
-  scaff_writer.WriteToFile(wd_replay + "/out_scaffolding.hpp");
-  std::experimental::filesystem::copy(working_dir + "/scripts/batch_libfuzzer.py", wd_replay + "/batch_libfuzzer.py");
-  PartitionByTimestamp(queue, working_dir, output_dir, replay_writer, scaff_writer, "out_replay");
+  WriteReplayManifests(working_dir, scaff_writer, wd_replay);
+  PartitionByTimestamp(queue, working_dir, output_dir, replay_writer, scaff_writer, "out_replay", minimize_corpus);
 
   assert(!Operand::IsKLibFuzzerMode());
   {
@@ -158,14 +234,15 @@ void FlushQueue(
       ld_flags,
       max_traversal_depth,
       prog_ctx,
-      ReplayDriverPurpose::kLibFuzzer
+      ReplayDriverPurpose::kLibFuzzer,
+      libfuzzer_prelinked_object
     };
+    libfuzzer_writer.SetSpillStore(queue.GetSpillStore());
     const std::string &wd_libfuzzer = GetWDOutputFilename("out_libfuzzer", output_dir);
     libfuzzer_writer.WriteToDirectory(queue.GetValid(), wd_libfuzzer);
-
-    scaff_writer.WriteToFile(wd_libfuzzer + "/out_scaffolding.hpp");
-    std::experimental::filesystem::copy(working_dir + "/scripts/batch_libfuzzer.py", wd_libfuzzer + "/batch_libfuzzer.py");
-    PartitionByTimestamp(queue, working_dir, output_dir, libfuzzer_writer, scaff_writer, "out_libfuzzer");
+    WriteReplayManifests(working_dir, scaff_writer, wd_libfuzzer);
+    PartitionByTimestamp(
+      queue, working_dir, output_dir, libfuzzer_writer, scaff_writer, "out_libfuzzer", minimize_corpus);
   }
   assert(!Operand::IsKLibFuzzerMode());
 }
@@ -211,34 +288,801 @@ bpstd::optional<TestCase> MainFuzzer::LoadTestCaseDeterministically(
 
 TestCase MainFuzzer::LoadTestCase(
   const TestCaseGenerator &tcgen,
-  const std::vector<std::shared_ptr<Executable>> &class_methods
+  const std::vector<std::shared_ptr<Executable>> &class_methods,
+  int &parent_id
 ) {
+  parent_id = -1;
   if (deterministic_mode) {
     const bpstd::optional<TestCase> &opt_tc = LoadTestCaseDeterministically(tcgen, class_methods);
     if (opt_tc.has_value())
       return opt_tc.value();
   }
 
-  std::vector<FlushableTestCase> &valid_seeds = queue_.GetValid();
-  unsigned long valid_size = valid_seeds.size();
   const std::shared_ptr<Random> &r = Random::GetInstance();
-  bool should_gen_from_scratch = valid_size == 0 || r->NextBoolean();
-  if (should_gen_from_scratch) {
-    const std::shared_ptr<TemplateTypeContext> &tt_ctx = TemplateTypeContext::New();
-    bool should_force_reuse_op = r->NextBoolean();
+  {
+    std::lock_guard<std::mutex> lock(queue_mutex_);
+    std::vector<FlushableTestCase> &valid_seeds = queue_.GetValid();
+    unsigned long valid_size = valid_seeds.size();
+    if (use_energy_schedule_) {
+      bool should_gen_from_scratch = seed_scheduler_.ShouldGenerateFromScratch(valid_seeds);
+      seed_scheduler_.RecordAttempt(should_gen_from_scratch);
+      FlushableTestCase *choosen =
+        should_gen_from_scratch ? nullptr : &valid_seeds[seed_scheduler_.SelectSeed(valid_seeds)];
+      if (choosen != nullptr && queue_.MakeResident(*choosen)) { // a seed that failed to load is generated anew
+        choosen->IncrementFuzzCount();
+        parent_id = choosen->GetId();
+        return choosen->GetTc();
+      }
+    } else {
+      bool should_gen_from_scratch = valid_size == 0 || r->NextBoolean();
+      if (!should_gen_from_scratch) {
+        seed_scheduling_counter_ %= valid_size;
+        FlushableTestCase &choosen = valid_seeds[seed_scheduling_counter_];
+        ++seed_scheduling_counter_;
+        if (queue_.MakeResident(choosen)) {
+          choosen.IncrementFuzzCount();
+          parent_id = choosen.GetId();
+          return choosen.GetTc();
+        }
+      }
+    }
+  }
 
-    FunctionSelector function_selector{class_methods, FunctionSelectorMode::kComplexityBased};
-    const std::shared_ptr<Executable> &selected_method = function_selector.NextExecutable();
+  const std::shared_ptr<TemplateTypeContext> &tt_ctx = TemplateTypeContext::New();
+  bool should_force_reuse_op = r->NextBoolean();
 
-    const seqgen::GenTCForMethodSpec &method_spec =
-      seqgen::GenTCForMethodSpec{selected_method, tt_ctx, should_force_reuse_op};
-    const TestCase &tc = tcgen.GenForMethod(method_spec);
-    return tc;
+  FunctionSelector function_selector{class_methods, FunctionSelectorMode::kComplexityBased};
+  const std::shared_ptr<Executable> &selected_method = function_selector.NextExecutable();
+
+  const seqgen::GenTCForMethodSpec &method_spec =
+    seqgen::GenTCForMethodSpec{selected_method, tt_ctx, should_force_reuse_op};
+  const TestCase &tc = tcgen.GenForMethod(method_spec);
+  return tc;
+}
+
+ExecutionResult MainFuzzer::ExecuteAndMeasureCov(
+  CoverageObserver &observer,
+  ForkServerClient *fork_server,
+  const std::string &target_exe,
+  const std::string &exe_args,
+  int server_request
+) {
+  const auto &run = [&]() {
+    if (fork_server == nullptr)
+      return observer.ExecuteAndMeasureCov(target_exe, exe_args);
+    const ExecutionResult &exec_result = observer.ExecuteAndMeasureCov(*fork_server, server_request);
+    if (!fork_server->IsAlive()) // the server went down during the run, which is repeated without it
+      return observer.ExecuteAndMeasureCov(target_exe, exe_args);
+    ++served_runs_;
+    served_run_latency_in_usec_ += fork_server->GetLastRunLatencyInUsec();
+    return exec_result;
+  };
+  if (timeout_calibrator_ == nullptr)
+    return run();
+  // A run over the calibrated timeout is a hang, it is not run again with the configured one.
+  observer.SetExecTimeoutInMsec(timeout_calibrator_->GetTimeoutInMsec());
+  const ExecutionResult &exec_result = run();
+  if (exec_result.IsTimedOut() && observer.GetExecTimeoutInMsec() < exec_timeout_in_msec_)
+    ++early_hangs_;
+  return exec_result;
+}
+
+// Coverage found by a test case, credited to the seed it was mutated from. Line-count-only reports have no delta,
+// a new test case then counts as one site.
+long long int CountCoverageGain(const CoverageDelta &delta) {
+  long long int gain = (long long int) (delta.GetLines().size() + delta.GetBranches().size()
+    + delta.GetFunctions().size() + delta.GetEdges().size());
+  return std::max(1LL, gain);
+}
+
+void MainFuzzer::HandleNormalExecution(
+  const TestCase &mutation,
+  const ExecutionResult &exec_result,
+  CoverageLogger &cov_logger,
+  const WallClock &fuzzing_clock,
+  int parent_id,
+  long long int cost_in_usec
+) {
+  if (!exec_result.IsInteresting())
+    return;
+  const bpstd::optional<CoverageReport> &opt_cov_report = exec_result.GetCovReport();
+  const CoverageReport &cov_report = opt_cov_report.value();
+
+  std::lock_guard<std::mutex> lock(queue_mutex_);
+  FlushableTestCase &ftc = queue_.AddValid(mutation);
+  Logger::Info("Found interesting test case with ID = " + std::to_string(ftc.GetId()));
+  Logger::Info("Current coverage score: " + cov_report.ToPrettyString());
+  if (!exec_result.GetDelta().IsEmpty())
+    Logger::Info("New coverage: " + exec_result.GetDelta().ToPrettyString());
+
+  int return_code = exec_result.GetReturnCode();
+  ftc.SetReturnCode(return_code);
+  ftc.SetCoverageDelta(exec_result.GetDelta());
+  ftc.SetParentId(parent_id);
+  ftc.SetCostInUsec(cost_in_usec);
+  ftc.SetCoveredSites(exec_result.GetCoveredSites());
+  FlushableTestCase *parent = parent_id >= 0 ? queue_.FindValid(parent_id) : nullptr;
+  if (parent != nullptr)
+    parent->AddChildrenCoverage(CountCoverageGain(exec_result.GetDelta()));
+  seed_scheduler_.RecordFind(parent_id < 0);
+  if (timeout_calibrator_ != nullptr)
+    timeout_calibrator_->RecordSeedRunTime(exec_result.GetExecTimeInUsec());
+  if (minimizer_ != nullptr && minimize_seeds_)
+    pending_seed_minimizations_.push_back(ftc.GetId());
+
+  long long int timestamp = fuzzing_clock.MeasureElapsedInMsec() / 1000ll;
+  ftc.SetTimestamp((int) timestamp);
+  cov_logger.AppendEntry(
+    timestamp,
+    cov_report.GetLineCov(),
+    cov_report.GetBranchCov(),
+    cov_report.GetLineTot(),
+    cov_report.GetBranchTot(),
+    cov_report.GetFuncCov(),
+    cov_report.GetFuncTot());
+}
+
+void MainFuzzer::HandleCrashingExecution(
+  const TestCase &mutation,
+  const TCMemo &memo,
+  CrashTCHandler &crash_tc_handler
+) {
+  const std::string &fingerprint = *memo.GetFingerprint();
+
+  std::lock_guard<std::mutex> lock(queue_mutex_);
+  bool crash_in_source = memo.IsValidCrash() && memo.GetLocation().has_value();
+  bool is_new_unique_crash = crash_in_source && crash_tc_handler.RegisterIfNewCrash(fingerprint);
+  if (crash_in_source && is_new_unique_crash) {
+    FlushableTestCase &ftc = queue_.AddCrashes(mutation, memo);
+    Logger::Info("Found new crashing test case with ID = " + std::to_string(ftc.GetId()));
+//                + "\n Fingerprint: " + fingerprint);
+    if (minimizer_ != nullptr)
+      pending_crash_minimizations_.push_back(ftc.GetId());
+  }
+}
+
+// Hangs leave no stack behind, they are told apart by the executables they call. Never replayed under gdb.
+void MainFuzzer::HandleHangingExecution(const TestCase &mutation) {
+  std::set<std::string> called;
+  for (const auto &stmt : mutation.GetStatements()) {
+    if (stmt->GetVariant() == StatementVariant::kCall)
+      called.insert(std::static_pointer_cast<CallStatement>(stmt)->GetTarget()->GetQualifiedName());
+  }
+  const std::vector<std::string> called_vc{called.begin(), called.end()};
+  const std::string &fingerprint = "hang: " + StringJoin(called_vc, " ");
+
+  std::lock_guard<std::mutex> lock(queue_mutex_);
+  if (!queue_.IsNewHang(fingerprint))
+    return;
+  TCMemo memo;
+  memo.SetFingerprint({fingerprint});
+  FlushableTestCase &ftc = queue_.AddHang(mutation, memo);
+  ftc.SetReturnCode(ProcessResult::kTimeoutReturnCode);
+  Logger::Info("Found new hanging test case with ID = " + std::to_string(ftc.GetId()));
+}
+
+// Error lines are lines of a one-shot driver of the test case.
+void MainFuzzer::LearnCompileFailure(
+  const TestCase &mutation,
+  TestCaseWriter &tc_writer,
+  const std::vector<int> &error_lines
+) {
+  const std::shared_ptr<CompileFailureCache> &failure_cache = CompileFailureCache::GetInstance();
+  if (!failure_cache->IsEnabled())
+    return;
+  for (int error_line : error_lines) {
+    const bpstd::optional<std::shared_ptr<Statement>> &stmt =
+      tc_writer.GetStatementByLineNumber(mutation, error_line, false);
+    if (stmt.has_value())
+      failure_cache->RecordFailure(stmt.value());
+  }
+}
+
+// Drops the statement of the first compile error and every statement depending on it, then rebuilds, as long as
+// the repair budget allows. Statements are blanked in the driver text, which keeps the line numbers of the others
+// and never renders statements that may be shared with test cases on the dispatching thread.
+bpstd::optional<TestCase> MainFuzzer::RepairTestCase(
+  FuzzingWorker &worker,
+  const TestCase &mutation,
+  SourceCompiler &compiler,
+  TestCaseWriter &tc_writer,
+  std::pair<CompilationResult, std::string> &build_result,
+  std::vector<bool> &dropped
+) {
+  const std::string &temporary_cpp = worker.GetTmpDriverCpp();
+  const std::vector<std::shared_ptr<Statement>> &statements = mutation.GetStatements();
+  int import_line_count = tc_writer.GetImportWriter()->GetLineUsage();
+  dropped.assign(statements.size(), false);
+  std::set<std::shared_ptr<Statement>> dropped_stmts;
+  for (int retry = 0; retry < repair_budget_ && build_result.first == CompilationResult::kCompileFailed; ++retry) {
+    const std::vector<int> &error_lines = CompileFailureCache::ExtractErrorLines(build_result.second, temporary_cpp);
+    if (retry > 0)
+      LearnCompileFailure(mutation, tc_writer, error_lines);
+    if (error_lines.empty())
+      return {};
+    int culprit = TestCaseWriter::LineNumberToStmtIdx(error_lines.front(), import_line_count, false);
+    if (culprit < 0 || culprit >= (int) statements.size() || dropped[culprit])
+      return {};
+
+    // Same ref tracking as InplaceMutationByCleanup, but forward: statements reading a dropped one go as well.
+    std::set<int> newly_dropped{culprit};
+    dropped[culprit] = true;
+    dropped_stmts.insert(statements[culprit]);
+    for (int idx = culprit + 1; idx < (int) statements.size(); ++idx) {
+      if (dropped[idx])
+        continue;
+      for (const auto &operand : statements[idx]->GetStatementOperands()) {
+        bool is_ref = operand.GetOperandType() == OperandType::kRefOperand;
+        if (is_ref && dropped_stmts.count(operand.GetRef()) != 0) {
+          newly_dropped.insert(idx);
+          dropped[idx] = true;
+          dropped_stmts.insert(statements[idx]);
+          break;
+        }
+      }
+    }
+    if (dropped_stmts.size() == statements.size())
+      return {};
+    tc_writer.BlankStatements(temporary_cpp, newly_dropped);
+    build_result = compiler.CompileAndLink(temporary_cpp, worker.GetTmpDriverObject(), worker.GetTmpDriverExe());
+  }
+  if (build_result.first != CompilationResult::kSuccess)
+    return {};
+
+  std::vector<std::shared_ptr<Statement>> kept;
+  for (size_t idx = 0; idx < statements.size(); ++idx) {
+    if (!dropped[idx])
+      kept.push_back(statements[idx]);
+  }
+  ++repaired_tcs_;
+  return TestCase{kept, mutation.GetTemplateTypeContext()};
+}
+
+// Crash lines of a repaired driver still count the blanked statements.
+int RebaseRepairedLine(int src_linenum, int import_line_count, const std::vector<bool> &dropped) {
+  int stmt_idx = TestCaseWriter::LineNumberToStmtIdx(src_linenum, import_line_count, false);
+  int dropped_before = 0;
+  for (int idx = 0; idx < stmt_idx && idx < (int) dropped.size(); ++idx)
+    dropped_before += dropped[idx] ? 1 : 0;
+  return src_linenum - dropped_before;
+}
+
+// Queue sizes are only consistent under the queue mutex, the stage timings carry their own lock.
+void MainFuzzer::WriteFuzzerStats(const std::string &stats_filename, int jobs, int batch_size) {
+  std::vector<std::pair<std::string, std::string>> queue_entries;
+  {
+    std::lock_guard<std::mutex> lock(queue_mutex_);
+    queue_entries.emplace_back("valid_tcs", std::to_string(queue_.GetValid().size()));
+    queue_entries.emplace_back("crashes", std::to_string(queue_.GetCrashes().size()));
+    queue_entries.emplace_back("incompilable_tcs", std::to_string(queue_.GetIncompilable().size()));
+    queue_entries.emplace_back("hangs", std::to_string(queue_.GetHangs().size()));
+  }
+  queue_entries.emplace_back("jobs", std::to_string(jobs));
+  queue_entries.emplace_back("batch_size", std::to_string(batch_size));
+  if (!PipelineStats::GetInstance()->WriteStatsFile(stats_filename, queue_entries))
+    Logger::Warn("MainFuzzer", "Cannot write the fuzzer stats to: " + stats_filename);
+}
+
+const std::string &kCheckpointMagic = "cxxfoozz-checkpoint";
+const int kCheckpointVersion = 3;
+
+// Test cases calling executables that are not part of the ProgramContext are left out. Spilled test cases are
+// copied from the spill store as they were written there, at the locations taken with the snapshot.
+void WriteCheckpointTestCases(
+  CheckpointWriter &writer,
+  const std::vector<FlushableTestCase> &tcs,
+  const std::map<int, std::pair<long long int, long long int>> &spilled_locations,
+  const std::shared_ptr<TestCaseSpillStore> &spill_store
+) {
+  std::vector<std::pair<const FlushableTestCase *, bpstd::optional<std::string>>> writable;
+  for (const auto &ftc : tcs) {
+    if (ftc.IsSpilled()) {
+      const auto &it = spilled_locations.find(ftc.GetId());
+      if (it == spilled_locations.end())
+        continue;
+      const bpstd::optional<std::string> &encoded = spill_store->ReadEncodedAt(it->second);
+      if (encoded.has_value())
+        writable.emplace_back(&ftc, encoded);
+    } else if (writer.CanWriteTestCase(ftc.GetTc())) {
+      writable.emplace_back(&ftc, bpstd::nullopt);
+    }
+  }
+  writer.WriteInt((long long int) writable.size());
+  for (const auto &entry : writable) {
+    const FlushableTestCase *ftc = entry.first;
+    writer.WriteInt(ftc->GetId());
+    writer.WriteInt(ftc->GetTimestamp());
+    writer.WriteInt(ftc->GetReturnCode());
+    writer.WriteInt(ftc->GetParentId());
+    writer.WriteInt(ftc->GetCostInUsec());
+    writer.WriteInt(ftc->GetFuzzCount());
+    writer.WriteInt(ftc->GetChildrenCoverage());
+    if (entry.second.has_value()) {
+      writer.WriteRaw(entry.second.value());
+    } else {
+      writer.WriteTestCase(ftc->GetTc());
+      writer.WriteMemo(ftc->GetMemo());
+    }
+    writer.WriteSites(ftc->GetCoverageDelta());
+    writer.WriteSites(ftc->GetCoveredSites());
+  }
+}
+void ReadCheckpointTestCases(CheckpointReader &reader, std::vector<FlushableTestCase> &tcs) {
+  long long int count = reader.ReadInt();
+  for (long long int idx = 0; idx < count && reader.IsGood(); ++idx) {
+    int id = (int) reader.ReadInt();
+    int timestamp = (int) reader.ReadInt();
+    int return_code = (int) reader.ReadInt();
+    int parent_id = (int) reader.ReadInt();
+    long long int cost_in_usec = reader.ReadInt();
+    int fuzz_count = (int) reader.ReadInt();
+    long long int children_coverage = reader.ReadInt();
+    const TestCase &tc = reader.ReadTestCase();
+    const TCMemo &memo = reader.ReadMemo();
+    const CoverageDelta &coverage_delta = reader.ReadSites();
+    const CoverageDelta &covered_sites = reader.ReadSites();
+    if (!reader.IsGood())
+      return;
+    FlushableTestCase ftc{id, tc, memo};
+    ftc.SetTimestamp(timestamp);
+    ftc.SetReturnCode(return_code);
+    ftc.SetParentId(parent_id);
+    ftc.SetCostInUsec(cost_in_usec);
+    ftc.SetFuzzCount(fuzz_count);
+    ftc.AddChildrenCoverage(children_coverage);
+    ftc.SetCoverageDelta(coverage_delta);
+    ftc.SetCoveredSites(covered_sites);
+    tcs.push_back(ftc);
+  }
+}
+
+// Runs on the dispatching thread, which owns the rendering of queued test cases and the random engine. The state is
+// copied under the queue mutex, encoding and I/O happen after it is released: the spill file is append-only, the
+// copies of spilled test cases stay where the snapshot found them. Written to a temporary file first and renamed,
+// a crash while saving keeps the last checkpoint.
+bool MainFuzzer::WriteCheckpoint(
+  const std::string &checkpoint_filename,
+  const std::shared_ptr<ProgramContext> &program_ctx,
+  CoverageBaseline &baseline,
+  const CrashTCHandler &crash_tc_handler,
+  const CoverageLogger &cov_logger,
+  long long int elapsed_in_msec
+) {
+  CoverageReport report;
+  CoverageDelta sites;
+  std::set<std::string> unique_crashes;
+  std::vector<CoverageLoggingEntry> entries;
+  TestCaseQueue queue;
+  std::map<int, std::pair<long long int, long long int>> spilled_locations;
+  int last_tc_id = 0;
+  {
+    std::lock_guard<std::mutex> lock(queue_mutex_);
+    {
+      std::lock_guard<std::mutex> baseline_lock(baseline.GetMutex());
+      report = baseline.GetReport();
+      sites = baseline.GetCoveredSites();
+    }
+    unique_crashes = crash_tc_handler.GetUniqueCrashes();
+    entries = cov_logger.GetEntries();
+    queue = queue_;
+    for (auto *tcs : {&queue.GetValid(), &queue.GetSubsumed(), &queue.GetCrashes(), &queue.GetIncompilable(),
+                      &queue.GetHangs()}) {
+      for (const auto &ftc : *tcs) {
+        if (!ftc.IsSpilled())
+          continue;
+        const auto &location = queue_.GetSpillStore()->FindEncoded(ftc.GetId());
+        if (location.has_value())
+          spilled_locations[ftc.GetId()] = location.value();
+      }
+    }
+    last_tc_id = FlushableTestCase::GetLastId();
+  }
+
+  const std::string &tmp_filename = checkpoint_filename + ".tmp";
+  std::ofstream checkpoint_file{tmp_filename};
+  CheckpointWriter writer{checkpoint_file, program_ctx};
+  writer.WriteString(kCheckpointMagic);
+  writer.WriteInt(kCheckpointVersion);
+  writer.WriteInt(elapsed_in_msec);
+  writer.WriteString(Random::GetInstance()->SaveState());
+  writer.WriteInt(last_tc_id);
+  writer.WriteReport(report);
+  writer.WriteSites(sites);
+  writer.WriteInt((long long int) unique_crashes.size());
+  for (const auto &crash : unique_crashes)
+    writer.WriteString(crash);
+  writer.WriteInt((long long int) entries.size());
+  for (const auto &entry : entries) {
+    writer.WriteInt(entry.GetTimestamp());
+    writer.WriteReport(
+      CoverageReport{
+        entry.GetLineCov(), entry.GetBranchCov(), entry.GetLineTot(), entry.GetBranchTot(), entry.GetFuncCov(),
+        entry.GetFuncTot()});
+  }
+  const std::shared_ptr<TestCaseSpillStore> &spill_store = queue.GetSpillStore();
+  WriteCheckpointTestCases(writer, queue.GetValid(), spilled_locations, spill_store);
+  WriteCheckpointTestCases(writer, queue.GetSubsumed(), spilled_locations, spill_store);
+  WriteCheckpointTestCases(writer, queue.GetCrashes(), spilled_locations, spill_store);
+  WriteCheckpointTestCases(writer, queue.GetIncompilable(), spilled_locations, spill_store);
+  WriteCheckpointTestCases(writer, queue.GetHangs(), spilled_locations, spill_store);
+  checkpoint_file.close();
+  if (!checkpoint_file.good())
+    return false;
+  return std::rename(tmp_filename.c_str(), checkpoint_filename.c_str()) == 0;
+}
+
+// Called before the fuzzing loop starts. Nothing is restored unless the whole checkpoint could be read.
+bool MainFuzzer::ReadCheckpoint(
+  const std::string &checkpoint_filename,
+  const std::shared_ptr<ProgramContext> &program_ctx,
+  CoverageBaseline &baseline,
+  CrashTCHandler &crash_tc_handler,
+  CoverageLogger &cov_logger,
+  long long int &elapsed_in_msec
+) {
+  std::ifstream checkpoint_file{checkpoint_filename};
+  if (!checkpoint_file.good())
+    return false;
+  CheckpointReader reader{checkpoint_file, program_ctx};
+  if (reader.ReadString() != kCheckpointMagic || reader.ReadInt() != kCheckpointVersion) {
+    reader.Fail("unknown format");
+    return false;
+  }
+  long long int checkpoint_elapsed = reader.ReadInt();
+  const std::string &random_state = reader.ReadString();
+  int last_tc_id = (int) reader.ReadInt();
+  const CoverageReport &report = reader.ReadReport();
+  const CoverageDelta &sites = reader.ReadSites();
+  std::vector<std::string> unique_crashes;
+  long long int crash_count = reader.ReadInt();
+  for (long long int idx = 0; idx < crash_count && reader.IsGood(); ++idx)
+    unique_crashes.push_back(reader.ReadString());
+  std::vector<std::pair<long long int, CoverageReport>> entries;
+  long long int entry_count = reader.ReadInt();
+  for (long long int idx = 0; idx < entry_count && reader.IsGood(); ++idx) {
+    long long int timestamp = reader.ReadInt();
+    entries.emplace_back(timestamp, reader.ReadReport());
+  }
+  TestCaseQueue queue;
+  ReadCheckpointTestCases(reader, queue.GetValid());
+  ReadCheckpointTestCases(reader, queue.GetSubsumed());
+  ReadCheckpointTestCases(reader, queue.GetCrashes());
+  ReadCheckpointTestCases(reader, queue.GetIncompilable());
+  ReadCheckpointTestCases(reader, queue.GetHangs());
+  if (!reader.IsGood())
+    return false;
+
+  std::lock_guard<std::mutex> lock(queue_mutex_);
+  {
+    std::lock_guard<std::mutex> baseline_lock(baseline.GetMutex());
+    baseline.RestoreCoveredSites(sites, report);
+  }
+  for (const auto &crash : unique_crashes)
+    crash_tc_handler.RegisterIfNewCrash(crash);
+  for (const auto &entry : entries) {
+    const CoverageReport &entry_report = entry.second;
+    cov_logger.AppendEntry(
+      entry.first, entry_report.GetLineCov(), entry_report.GetBranchCov(), entry_report.GetLineTot(),
+      entry_report.GetBranchTot(), entry_report.GetFuncCov(), entry_report.GetFuncTot());
+  }
+  queue_ = queue;
+  FlushableTestCase::SetLastId(last_tc_id);
+  if (!Random::GetInstance()->RestoreState(random_state))
+    Logger::Warn("MainFuzzer", "Cannot restore the random engine from the checkpoint, it keeps its fresh seed");
+  elapsed_in_msec = checkpoint_elapsed;
+  return true;
+}
+
+// Statements of queued test cases may be shared with the mutants being rendered, so they are cloned here on the
+// dispatching thread before the minimizer gets them.
+void MainFuzzer::SubmitMinimizationJobs() {
+  if (minimizer_ == nullptr)
+    return;
+  std::vector<MinimizationJob> jobs;
+  {
+    std::lock_guard<std::mutex> lock(queue_mutex_);
+    for (int tc_id : pending_crash_minimizations_) {
+      FlushableTestCase *ftc = queue_.FindCrash(tc_id);
+      if (ftc != nullptr && queue_.MakeResident(*ftc))
+        jobs.emplace_back(
+          tc_id, MinimizationTarget::kCrash, TestCaseMinimizer::DeepClone(ftc->GetTc()), ftc->GetMemo());
+    }
+    for (int tc_id : pending_seed_minimizations_) {
+      FlushableTestCase *ftc = queue_.FindValid(tc_id);
+      if (ftc != nullptr && queue_.MakeResident(*ftc))
+        jobs.emplace_back(tc_id, MinimizationTarget::kSeed, TestCaseMinimizer::DeepClone(ftc->GetTc()), TCMemo());
+    }
+    pending_crash_minimizations_.clear();
+    pending_seed_minimizations_.clear();
+  }
+  for (const auto &job : jobs)
+    minimizer_->Submit(job);
+}
+// Runs on the minimizer thread. Seeds keep the covered sites of their original run, which the reduced test case
+// covers as well.
+void MainFuzzer::ApplyMinimization(const MinimizationJob &job) {
+  std::lock_guard<std::mutex> lock(queue_mutex_);
+  bool is_crash = job.GetTarget() == MinimizationTarget::kCrash;
+  FlushableTestCase *ftc = is_crash ? queue_.FindCrash(job.GetTcId()) : queue_.FindValid(job.GetTcId());
+  if (ftc == nullptr)
+    return; // dropped by a corpus minimization meanwhile
+  size_t original_size = ftc->GetStatementCount();
+  if (!is_crash && !queue_.MakeResident(*ftc))
+    return; // the seed must keep its memo, which only its spilled copy has
+  ftc->SetTc(job.GetTc());
+  if (is_crash)
+    ftc->SetMemo(job.GetMemo());
+  Logger::Info(
+    "Minimized test case with ID = " + std::to_string(job.GetTcId()) + " from " + std::to_string(original_size)
+      + " to " + std::to_string(job.GetTc().GetStatements().size()) + " statements");
+}
+
+// Copies are written outside of the queue mutex, on the dispatching thread like the rendering of mutants. Subsumed
+// test cases are streamed as well, a seed may be subsumed before it was ever written out.
+void MainFuzzer::StreamQueue(StreamingQueueWriter &streaming_writer) {
+  std::vector<FlushableTestCase> valid, crashes;
+  {
+    std::lock_guard<std::mutex> lock(queue_mutex_);
+    // Spilled entries are loaded into the copy only, the queue keeps them on disk.
+    const auto &collect = [this](std::vector<FlushableTestCase> &tcs, std::vector<FlushableTestCase> &collected) {
+      for (auto &ftc : tcs) {
+        if (ftc.IsFlushed())
+          continue;
+        ResidentTestCaseScope resident{ftc, queue_.GetSpillStore().get()};
+        if (!resident.IsResident())
+          continue;
+        ftc.SetFlushed(true);
+        collected.push_back(ftc);
+      }
+    };
+    collect(queue_.GetValid(), valid);
+    collect(queue_.GetSubsumed(), valid);
+    collect(queue_.GetCrashes(), crashes);
+  }
+  if (!valid.empty() || !crashes.empty())
+    streaming_writer.Append(valid, crashes);
+}
+
+void MainFuzzer::RunAttempt(
+  FuzzingWorker &worker,
+  const TestCase &mutation,
+  SourceCompiler &compiler,
+  TestCaseWriter &tc_writer,
+  CrashTCHandler &crash_tc_handler,
+  CoverageLogger &cov_logger,
+  const WallClock &fuzzing_clock,
+  const std::string &src_dir_abs,
+  const std::shared_ptr<InterpreterHarness> &harness
+) {
+  WallClock attempt_clock;
+  const std::string &temporary_cpp = worker.GetTmpDriverCpp();
+  const std::string &temporary_o = worker.GetTmpDriverObject();
+  const std::string &temporary_exe = worker.GetTmpDriverExe();
+  CoverageObserver &observer = worker.GetObserver();
+  int parent_id = worker.GetParentIds().empty() ? -1 : worker.GetParentIds().front();
+
+  if (harness != nullptr && worker.IsHarnessInputReady()) {
+    const std::string &harness_exe = harness->GetExecutable();
+    ForkServerClient *harness_server = use_fork_server_ ? worker.AcquireHarnessServer(harness_exe) : nullptr;
+    const ExecutionResult &exec_result =
+      ExecuteAndMeasureCov(observer, harness_server, harness_exe, worker.GetHarnessInput());
+    if (exec_result.IsSuccessful() || exec_result.HasCaughtException()) {
+      long long int cost_in_usec = attempt_clock.MeasureElapsedInUsec();
+      HandleNormalExecution(mutation, exec_result, cov_logger, fuzzing_clock, parent_id, cost_in_usec);
+      return;
+    }
+    // Crashes and hangs are replayed through a compiled driver, so that triage sees the statements of tmp.cpp.
+  }
+
+  // A byte-identical driver already ran: its coverage is merged and its crash registered, only the
+  // bookkeeping of this test case is left.
+  std::string cache_key;
+  bpstd::optional<CachedDriverBuild> cached_build;
+  if (build_cache_ != nullptr)
+    cache_key = build_cache_->ComputeKey(temporary_cpp, compiler.GetBuildSignature()).value_or("");
+  if (!cache_key.empty())
+    cached_build = build_cache_->Lookup(cache_key);
+  std::pair<CompilationResult, std::string> build_result;
+  if (cached_build.has_value() && cached_build->GetCompileResult() != CompilationResult::kSuccess) {
+    build_result = {cached_build->GetCompileResult(), cached_build->GetCompileOutput()};
+  } else if (cached_build.has_value() && cached_build->GetReturnCode().has_value()) {
+    if (cached_build->GetCrashMemo().has_value())
+      HandleCrashingExecution(mutation, cached_build->GetCrashMemo().value(), crash_tc_handler);
+    return;
+  } else if (cached_build.has_value() && build_cache_->RestoreExecutable(cached_build.value(), temporary_exe)) {
+    build_result = {CompilationResult::kSuccess, ""};
   } else {
-    seed_scheduling_counter_ %= valid_size;
-    const FlushableTestCase &choosen = valid_seeds[seed_scheduling_counter_];
-    ++seed_scheduling_counter_;
-    return choosen.GetTc();
+    build_result = compiler.CompileAndLink(temporary_cpp, temporary_o, temporary_exe);
+    if (!cache_key.empty())
+      build_cache_->StoreBuild(cache_key, build_result.first, build_result.second, temporary_exe);
+  }
+  // Incompilable test cases that were repaired run without their dropped statements
+  bpstd::optional<TestCase> repaired;
+  std::vector<bool> dropped;
+  if (build_result.first == CompilationResult::kCompileFailed) {
+    LearnCompileFailure(
+      mutation, tc_writer, CompileFailureCache::ExtractErrorLines(build_result.second, temporary_cpp));
+    if (repair_budget_ > 0)
+      repaired = RepairTestCase(worker, mutation, compiler, tc_writer, build_result, dropped);
+    if (repaired.has_value())
+      cache_key.clear(); // the executable is not built from the cached source anymore
+  }
+  const TestCase &attempted = repaired.has_value() ? repaired.value() : mutation;
+
+  CompilationResult compile_result = build_result.first;
+  static long long int kDiscardUncompilableTCsAfter = 3600000LL;
+  switch (compile_result) {
+    case CompilationResult::kSuccess: {
+      CompileFailureCache::GetInstance()->RecordSuccess(attempted);
+      const ExecutionResult &exec_result = ExecuteAndMeasureCov(observer, nullptr, temporary_exe);
+      bool normal_execution = exec_result.IsSuccessful();
+      bool has_exception = exec_result.HasCaughtException();
+      if (normal_execution || has_exception) {
+        long long int cost_in_usec = attempt_clock.MeasureElapsedInUsec();
+        HandleNormalExecution(attempted, exec_result, cov_logger, fuzzing_clock, parent_id, cost_in_usec);
+        if (!cache_key.empty())
+          build_cache_->StoreExecution(cache_key, exec_result.GetReturnCode());
+      } else if (exec_result.IsTimedOut()) {
+        HandleHangingExecution(attempted);
+      } else { // !normal_execution && !has_exception
+        bool is_repaired = repaired.has_value();
+        int import_line_count = tc_writer.GetImportWriter()->GetLineUsage();
+        int return_code = exec_result.GetReturnCode();
+        const CrashTriageJob::ResultFn &on_triaged =
+          [this, attempted, is_repaired, import_line_count, dropped, cache_key, return_code, &crash_tc_handler](
+            const TCMemo &triaged) {
+            TCMemo memo = triaged;
+            if (is_repaired && memo.GetCrashLineNum().has_value())
+              memo.SetCrashLineNum(RebaseRepairedLine(*memo.GetCrashLineNum(), import_line_count, dropped));
+            HandleCrashingExecution(attempted, memo, crash_tc_handler);
+            if (!cache_key.empty())
+              build_cache_->StoreExecution(cache_key, return_code, memo);
+          };
+        if (triage_pool_ != nullptr)
+          triage_pool_->Submit(temporary_exe, observer.GetEnv(), "", on_triaged);
+        else
+          on_triaged(crash_tc_handler.TriageCrash(temporary_exe, src_dir_abs, observer.GetEnv()));
+      }
+      break;
+    }
+    case CompilationResult::kCompileFailed: {
+      long long int curr_elapsed = fuzzing_clock.MeasureElapsedInMsec();
+      if (curr_elapsed < kDiscardUncompilableTCsAfter) {
+        const std::string &error_msg = build_result.second;
+        TCMemo memo;
+        memo.SetCompilationOutput({error_msg});
+        std::lock_guard<std::mutex> lock(queue_mutex_);
+        FlushableTestCase &ftc = queue_.AddIncompilable(mutation, memo);
+//          Logger::Warn("Found incompilable test case with ID = " + std::to_string(ftc.GetId()));
+        break;
+      }
+    }
+    case CompilationResult::kLinkingFailed: {
+      long long int curr_elapsed = fuzzing_clock.MeasureElapsedInMsec();
+      if (curr_elapsed < kDiscardUncompilableTCsAfter) {
+        Logger::Warn("Found linking error");
+      }
+      break;
+    }
+  }
+}
+
+// Diagnostics are attributed to test case functions through their line numbers. Functions with errors are blanked
+// out (keeping the line layout) and the batch is rebuilt without them.
+void MainFuzzer::RunBatchAttempt(
+  FuzzingWorker &worker,
+  const std::vector<TestCase> &mutations,
+  SourceCompiler &compiler,
+  TestCaseWriter &tc_writer,
+  CrashTCHandler &crash_tc_handler,
+  CoverageLogger &cov_logger,
+  const WallClock &fuzzing_clock,
+  const std::string &src_dir_abs
+) {
+  const std::string &temporary_cpp = worker.GetTmpDriverCpp();
+  const std::string &temporary_o = worker.GetTmpDriverObject();
+  const std::string &temporary_exe = worker.GetTmpDriverExe();
+  const std::vector<int> &first_lines = worker.GetBatchFirstLines();
+  CoverageObserver &observer = worker.GetObserver();
+  if (first_lines.size() != mutations.size())
+    return;
+
+  static long long int kDiscardUncompilableTCsAfter = 3600000LL;
+  const std::vector<int> &parent_ids = worker.GetParentIds();
+  WallClock build_clock;
+  std::set<int> excluded;
+  while (true) {
+    const auto &build_result = compiler.CompileAndLink(temporary_cpp, temporary_o, temporary_exe);
+    if (build_result.first == CompilationResult::kSuccess)
+      break;
+    if (build_result.first == CompilationResult::kLinkingFailed) {
+      if (fuzzing_clock.MeasureElapsedInMsec() < kDiscardUncompilableTCsAfter)
+        Logger::Warn("Found linking error");
+      return;
+    }
+
+    const std::string &error_msg = build_result.second;
+    const std::string &driver_loc_prefix = temporary_cpp + ':';
+    std::set<int> failed;
+    for (const auto &diag : SplitStringIntoVector(error_msg, "\n")) {
+      size_t loc_pos = diag.find(driver_loc_prefix);
+      if (loc_pos == std::string::npos)
+        continue;
+      int src_linenum = std::atoi(diag.c_str() + loc_pos + driver_loc_prefix.size());
+      const bpstd::optional<std::pair<int, int>> &located = tc_writer.LocateBatchLine(first_lines, src_linenum);
+      if (!located.has_value() || excluded.count(located->first) > 0)
+        continue;
+      const TestCase &failed_tc = mutations[located->first];
+      // false: the one-shot layout of temporary drivers, with its "try {" line
+      if (tc_writer.GetStatementByLineNumber(failed_tc, located->second, false).has_value())
+        failed.insert(located->first);
+    }
+    if (failed.empty()) {
+      Logger::Warn("MainFuzzer", "Cannot attribute the compilation errors of a batch, dropping the whole batch");
+      return;
+    }
+    std::map<int, std::vector<int>> error_lines; // test case index -> error lines in its one-shot driver
+    for (int src_linenum : CompileFailureCache::ExtractErrorLines(error_msg, temporary_cpp)) {
+      const bpstd::optional<std::pair<int, int>> &located = tc_writer.LocateBatchLine(first_lines, src_linenum);
+      if (located.has_value() && failed.count(located->first) > 0)
+        error_lines[located->first].push_back(located->second);
+    }
+    for (const auto &entry : error_lines)
+      LearnCompileFailure(mutations[entry.first], tc_writer, entry.second);
+    if (fuzzing_clock.MeasureElapsedInMsec() < kDiscardUncompilableTCsAfter) {
+      TCMemo memo;
+      memo.SetCompilationOutput({error_msg});
+      std::lock_guard<std::mutex> lock(queue_mutex_);
+      for (int tc_idx : failed)
+        queue_.AddIncompilable(mutations[tc_idx], memo);
+    }
+    excluded.insert(failed.begin(), failed.end());
+    if (excluded.size() == mutations.size())
+      return;
+    tc_writer.BlankBatchFunctions(temporary_cpp, first_lines, failed);
+  }
+
+  // The build is shared by the test cases of the batch, each of them is charged an equal part.
+  long long int build_share_in_usec = build_clock.MeasureElapsedInUsec() / (long long int) mutations.size();
+  // One server per batch executable, each test case of the batch is then a fork instead of an exec.
+  ForkServerClient batch_server{temporary_exe, {}, observer.GetEnv()};
+  if (use_fork_server_)
+    batch_server.Start();
+  for (int tc_idx = 0; tc_idx < (int) mutations.size(); ++tc_idx) {
+    if (excluded.count(tc_idx) > 0)
+      continue;
+    const TestCase &mutation = mutations[tc_idx];
+    CompileFailureCache::GetInstance()->RecordSuccess(mutation);
+    const std::string &exe_args = std::to_string(tc_idx);
+    WallClock exec_clock;
+    const ExecutionResult &exec_result =
+      ExecuteAndMeasureCov(observer, batch_server.IsAlive() ? &batch_server : nullptr, temporary_exe, exe_args, tc_idx);
+    if (exec_result.IsSuccessful() || exec_result.HasCaughtException()) {
+      int parent_id = tc_idx < (int) parent_ids.size() ? parent_ids[tc_idx] : -1;
+      long long int cost_in_usec = build_share_in_usec + exec_clock.MeasureElapsedInUsec();
+      HandleNormalExecution(mutation, exec_result, cov_logger, fuzzing_clock, parent_id, cost_in_usec);
+      continue;
+    }
+    if (exec_result.IsTimedOut()) {
+      HandleHangingExecution(mutation);
+      continue;
+    }
+    // LocateBatchLine only reads the header count of the import writer, which never changes.
+    const CrashTriageJob::ResultFn &on_triaged =
+      [this, mutation, first_lines, &tc_writer, &crash_tc_handler](const TCMemo &triaged) {
+        TCMemo memo = triaged;
+        const bpstd::optional<int> &crash_line_num = memo.GetCrashLineNum();
+        if (crash_line_num.has_value()) {
+          const bpstd::optional<std::pair<int, int>> &located =
+            tc_writer.LocateBatchLine(first_lines, *crash_line_num);
+          memo.SetCrashLineNum(located.has_value() ? bpstd::make_optional(located->second) : bpstd::nullopt);
+        }
+        HandleCrashingExecution(mutation, memo, crash_tc_handler);
+      };
+    if (triage_pool_ != nullptr)
+      triage_pool_->Submit(temporary_exe, observer.GetEnv(), exe_args, on_triaged);
+    else
+      on_triaged(crash_tc_handler.TriageCrash(temporary_exe, src_dir_abs, observer.GetEnv(), exe_args));
   }
 }
 
@@ -279,7 +1123,12 @@ void MainFuzzer::MainLoop(const FuzzingMainLoopSpec &spec) {
   const std::shared_ptr<ImportWriter> &import_writer = std::make_shared<ImportWriter>(include_paths_vc);
 //  const std::shared_ptr<ImportWriter> &import_writer =
 //    ImportWriter::ExtractImportWriterFromSourceLoc(compiler_instance, target_class_type->GetModel());
-  TestCaseWriter tc_writer{import_writer, program_ctx};
+  use_fork_server_ = parsed_args.IsUseForkServer();
+  exec_timeout_in_msec_ = parsed_args.GetExecTimeoutInMsec();
+  if (parsed_args.IsUseAdaptiveTimeout())
+    timeout_calibrator_ = std::make_shared<ExecTimeoutCalibrator>(exec_timeout_in_msec_);
+  TmpDriverPurpose tmp_driver_purpose = use_fork_server_ ? TmpDriverPurpose::kForkServer : TmpDriverPurpose::kOneShot;
+  TestCaseWriter tc_writer{import_writer, program_ctx, tmp_driver_purpose};
 
   const std::string &out_prefix = parsed_args.GetOutputPrefix();
   const std::string &working_dir = parsed_args.GetWorkingDir();
@@ -307,9 +1156,6 @@ void MainFuzzer::MainLoop(const FuzzingMainLoopSpec &spec) {
   int max_depth = parsed_args.GetMaxDepth();
   ObjectFileLocator obj_file_locator;
   const std::string &object_files = obj_file_locator.Lookup(obj_dir_abs, max_depth);
-  const std::string &temporary_cpp = output_dir + "/" + SourceCompiler::kTmpDriverCppFilename;
-  const std::string &temporary_o = output_dir + "/" + SourceCompiler::kTmpDriverObjectFilename;
-  const std::string &temporary_exe = output_dir + "/" + SourceCompiler::kTmpDriverExeFilename;
   const std::string &scaffolding_hpp = output_dir + "/" + ScaffoldingHPPFileWriter::kScaffoldingHPPFilename;
   scaff_writer.WriteToFile(scaffolding_hpp);
 
@@ -327,105 +1173,394 @@ void MainFuzzer::MainLoop(const FuzzingMainLoopSpec &spec) {
   if (!xtra_ld_flags.empty())
     ld_flags.push_back(xtra_ld_flags);
 
-  SourceCompiler compiler{"clang++", object_files, cxx_flags, ld_flags};
-  CoverageObserver observer{output_dir, obj_dir_abs, src_dir_abs, CoverageMeasurementTool::kLCOVFILT};
+  bool use_shm_cov = parsed_args.IsUseShmCov();
+  CoverageMeasurementTool cov_tool = CoverageMeasurementTool::kSharedMemory;
+  std::shared_ptr<GcovCoverageReader> gcov_reader;
+  if (!use_shm_cov && parsed_args.GetCovTool() == "lcov") {
+    cov_tool = CoverageMeasurementTool::kLCOVFILT;
+  } else if (!use_shm_cov) {
+    // gcno files are parsed once here, each measurement then only reads the gcda counters.
+    gcov_reader = std::make_shared<GcovCoverageReader>(obj_dir_abs);
+    cov_tool = CoverageMeasurementTool::kNativeGcov;
+    if (!gcov_reader->Load()) {
+      Logger::Warn(
+        "MainFuzzer", "Cannot load the gcno files natively, falling back to lcov-filt as with --cov-tool=lcov.");
+      gcov_reader = nullptr;
+      cov_tool = CoverageMeasurementTool::kLCOVFILT;
+    }
+  }
+  std::string linked_object_files = object_files;
+  std::shared_ptr<ObjectPrelinker> prelinker;
+  std::string prelinked_object;
+  if (parsed_args.IsUsePrelink()) {
+    prelinker = std::make_shared<ObjectPrelinker>(working_dir + "/.cxxfoozz_cache");
+    prelinked_object = prelinker->Prelink(object_files).value_or("");
+    if (!prelinked_object.empty())
+      linked_object_files = prelinked_object;
+  }
+  if (use_shm_cov) {
+    const std::string &shm_cov_runtime = SharedCoverageMap::BuildRuntime("clang++", output_dir);
+    if (shm_cov_runtime.empty())
+      Logger::Error("Cannot build the shared memory coverage runtime in: " + output_dir);
+    linked_object_files += ' ' + shm_cov_runtime;
+  }
+  bool use_crash_report = parsed_args.IsUseCrashReport();
+  if (use_crash_report) {
+    const std::string &crash_report_runtime = CrashReportRuntime::BuildRuntime("clang++", output_dir);
+    if (crash_report_runtime.empty())
+      Logger::Error("Cannot build the crash report runtime in: " + output_dir);
+    linked_object_files += ' ' + crash_report_runtime;
+  }
 
-  if (!observer.IsGCNOFileExisted()) {
+  SourceCompiler compiler{"clang++", linked_object_files, cxx_flags, ld_flags};
+  if (parsed_args.IsUseMinimalIncludes()) {
+    import_writer->EnableMinimalIncludes(
+      &compiler_instance.getSourceManager(),
+      [&compiler](const std::string &header_file) { return compiler.CheckHeader(header_file).IsSuccess(); },
+      {ScaffoldingHPPFileWriter::kScaffoldingHPPFilename});
+  }
+  const std::shared_ptr<CoverageObserver> &observer = std::make_shared<CoverageObserver>(
+    output_dir, obj_dir_abs, src_dir_abs, cov_tool, exec_timeout_in_msec_, "", nullptr, gcov_reader);
+  if (use_crash_report)
+    observer->EnableCrashReport();
+
+  bool has_gcno = observer->IsGCNOFileExisted();
+  if (!has_gcno && !use_shm_cov) {
     Logger::Error("Cannot find GCNO files in the target directory: " + obj_dir_abs);
   }
 
-  observer.CleanCovInfo();
-  WallClock cov_clock;
-  const CoverageReport &report = observer.MeasureCoverage();
-  long long int cov_measure_time = cov_clock.MeasureElapsedInMsec();
-  Logger::Info("Coverage measurement time = " + std::to_string(cov_measure_time) + "ms.");
+  // A resumed campaign keeps the gcda files and the baseline tracefile, lcov coverage lives in them.
+  bool resume = parsed_args.IsResume();
+  const std::string &checkpoint_filename = output_dir + "/checkpoint";
+  if (resume && !std::experimental::filesystem::exists(checkpoint_filename))
+    Logger::Error("Cannot find the checkpoint to resume from: " + checkpoint_filename);
+  if (!resume)
+    observer->CleanCovInfo();
+  if (!use_shm_cov) {
+    WallClock cov_clock;
+    const CoverageReport &report = observer->MeasureCoverage();
+    long long int cov_measure_time = cov_clock.MeasureElapsedInMsec();
+    Logger::Info("Coverage measurement time = " + std::to_string(cov_measure_time) + "ms.");
+  }
+
+  int jobs = parsed_args.GetJobs();
+  std::vector<std::shared_ptr<FuzzingWorker>> workers;
+  if (jobs == 1) {
+    workers.push_back(std::make_shared<FuzzingWorker>(0, output_dir, observer));
+  } else {
+    // Each worker compiles into its own scratch dir and dumps gcda files under its own GCOV_PREFIX,
+    // coverage is merged into one baseline tracefile shared by all workers.
+    const std::string &baseline_tracefile = output_dir + "/lcov_baseline.info";
+    if (!resume)
+      std::experimental::filesystem::remove(baseline_tracefile);
+    const std::shared_ptr<CoverageBaseline> &baseline = std::make_shared<CoverageBaseline>(baseline_tracefile);
+    for (int worker_id = 0; worker_id < jobs; ++worker_id) {
+      const std::string &scratch_dir = output_dir + "/worker_" + std::to_string(worker_id);
+      const std::string &gcov_prefix = scratch_dir + "/gcov";
+      std::experimental::filesystem::create_directories(scratch_dir);
+      scaff_writer.WriteToFile(scratch_dir + "/" + ScaffoldingHPPFileWriter::kScaffoldingHPPFilename);
+
+      const std::shared_ptr<CoverageObserver> &worker_observer = std::make_shared<CoverageObserver>(
+        scratch_dir, obj_dir_abs, src_dir_abs, cov_tool, exec_timeout_in_msec_, gcov_prefix, baseline, gcov_reader);
+      worker_observer->PrepareGcovPrefix();
+      worker_observer->CleanCovInfo();
+      if (use_crash_report)
+        worker_observer->EnableCrashReport();
+      workers.push_back(std::make_shared<FuzzingWorker>(worker_id, scratch_dir, worker_observer));
+    }
+    Logger::Info("Fuzzing with " + std::to_string(jobs) + " workers.");
+  }
+
+  if (parsed_args.IsUsePch()) {
+    const std::string &prelude_hpp = output_dir + "/" + SourceCompiler::kPreludeHPPFilename;
+    const std::string &prelude_pch = output_dir + "/" + SourceCompiler::kPreludePCHFilename;
+    std::ofstream prelude{prelude_hpp};
+    import_writer->WriteHeader(prelude);
+    prelude.close();
+    WallClock pch_clock;
+    const SysProcessReport &pch_report = compiler.BuildPrecompiledHeader(prelude_hpp, prelude_pch);
+    if (pch_report.IsSuccess())
+      Logger::Info("Driver prelude precompiled in " + std::to_string(pch_clock.MeasureElapsedInMsec()) + "ms.");
+    else
+      Logger::Warn("MainFuzzer", "Cannot precompile the driver prelude:\n" + pch_report.GetOutput());
+  }
+
+  int build_cache_size_in_mib = parsed_args.GetBuildCacheSizeInMiB();
+  if (build_cache_size_in_mib > 0) {
+    const std::string &cache_dir = DriverBuildCache::SelectCacheDir(output_dir);
+    build_cache_ = std::make_shared<DriverBuildCache>(cache_dir, build_cache_size_in_mib * 1024ULL * 1024ULL);
+    Logger::Info("Caching driver builds in: " + cache_dir);
+  }
+
+  std::shared_ptr<InterpreterHarness> harness;
+  if (parsed_args.IsUseHarness()) {
+    harness = std::make_shared<InterpreterHarness>(import_writer, program_ctx, output_dir);
+    if (!harness->Build(compiler))
+      harness = nullptr;
+  }
 
   WallClock fuzzing_clock;
   signal(SIGINT, MainFuzzer::SignalHandling);
   signal(SIGTERM, MainFuzzer::SignalHandling);
   signal(SIGABRT, MainFuzzer::SignalHandling);
+  signal(SIGUSR1, MainFuzzer::MinimizationSignalHandling);
   CoverageLogger cov_logger;
   CrashTCHandler crash_tc_handler;
+  CoverageBaseline &baseline = *workers[0]->GetObserver().GetBaseline(); // shared by all workers when jobs > 1
+  if (resume) {
+    long long int resumed_elapsed = 0LL;
+    if (!ReadCheckpoint(checkpoint_filename, program_ctx, baseline, crash_tc_handler, cov_logger, resumed_elapsed))
+      Logger::Error("Cannot resume from the checkpoint: " + checkpoint_filename);
+    fuzzing_clock.Rewind(resumed_elapsed);
+    Logger::Info(
+      "Resumed after " + std::to_string(resumed_elapsed / 1000LL) + "s with " + std::to_string(queue_.GetValid().size())
+        + " valid test cases and " + std::to_string(queue_.GetCrashes().size()) + " crashes.");
+  }
+
+  // Enabled after the resume, which replaces the queue. Resumed test cases start resident and are spilled as usual.
+  static const long long int kSpillIntervalInMsec = 1000LL;
+  int queue_memory_in_mib = parsed_args.GetQueueMemoryInMiB();
+  long long int last_spill = 0LL;
+  if (queue_memory_in_mib > 0) {
+    const std::string &spill_filename = output_dir + "/queue_spill";
+    queue_.EnableSpill(
+      std::make_shared<TestCaseSpillStore>(spill_filename, program_ctx), queue_memory_in_mib * 1024ULL * 1024ULL);
+    Logger::Info("Spilling the queue over " + std::to_string(queue_memory_in_mib) + "MiB to: " + spill_filename);
+  }
+
+  // Valid and crashing test cases are written out as they are found, FlushQueue then only completes the outputs.
+  std::shared_ptr<StreamingQueueWriter> streaming_writer;
+  if (parsed_args.IsStreamOutput()) {
+    const std::string &libfuzzer_target_dir = HARDCODED_ReplaceBuildWithLibfuzzerDir(obj_dir_abs);
+    const std::string &libfuzzer_prelinked_object =
+      PrelinkLibFuzzerObjects(obj_dir_abs, max_depth, prelinker.get(), prelinked_object);
+    streaming_writer = std::make_shared<StreamingQueueWriter>(
+      GoogleTestWriter{import_writer, obj_dir_abs, cxx_flags, ld_flags, max_depth, program_ctx, prelinked_object},
+      ReplayDriverWriter{
+        import_writer, libfuzzer_target_dir, cxx_flags, ld_flags, max_depth, program_ctx,
+        ReplayDriverPurpose::kNormalUse, libfuzzer_prelinked_object},
+      ReplayDriverWriter{
+        import_writer, libfuzzer_target_dir, cxx_flags, ld_flags, max_depth, program_ctx,
+        ReplayDriverPurpose::kLibFuzzer, libfuzzer_prelinked_object},
+      output_dir);
+    streaming_writer->Open();
+    cov_logger.StreamTo(output_dir);
+  }
 
   int timeout_in_seconds = parsed_args.GetFuzzTimeoutInSeconds();
   long long int timeout_in_msec = timeout_in_seconds * 1000LL;
   long long int total_attempts = 0LL;
 
+  int batch_size = parsed_args.GetBatchSize();
+  if (batch_size > 1 && harness != nullptr) {
+    Logger::Warn("MainFuzzer", "--batch has no effect together with --harness");
+    batch_size = 1;
+  }
+
+  CompileFailureCache::GetInstance()->SetEnabled(parsed_args.IsUseLearnCompileFailures());
+  repair_budget_ = parsed_args.GetRepairBudget();
+  use_energy_schedule_ = parsed_args.IsUseEnergySchedule();
+
+  int triage_workers = parsed_args.GetTriageWorkers();
+  if (triage_workers > 0) {
+    // Copies of the crashing executables and the gcda files of their replays, kept out of the campaign coverage.
+    const std::string &scratch_dir = output_dir + "/triage";
+    std::experimental::filesystem::create_directories(scratch_dir);
+    triage_pool_ = std::make_shared<CrashTriagePool>(scratch_dir, src_dir_abs, triage_workers);
+    Logger::Info("Triaging crashes on " + std::to_string(triage_workers) + " background threads.");
+  }
+
+  int minimize_budget = parsed_args.GetMinimizeBudget();
+  if (minimize_budget > 0) {
+    // Own scratch dir, gcda files and baseline: minimizer runs never count as campaign coverage.
+    const std::string &scratch_dir = output_dir + "/minimizer";
+    std::experimental::filesystem::create_directories(scratch_dir);
+    scaff_writer.WriteToFile(scratch_dir + "/" + ScaffoldingHPPFileWriter::kScaffoldingHPPFilename);
+    const std::shared_ptr<CoverageObserver> &minimizer_observer = std::make_shared<CoverageObserver>(
+      scratch_dir, obj_dir_abs, src_dir_abs, cov_tool, exec_timeout_in_msec_, scratch_dir + "/gcov", nullptr,
+      gcov_reader);
+    minimizer_observer->PrepareGcovPrefix();
+    minimizer_observer->CleanCovInfo();
+    if (use_crash_report)
+      minimizer_observer->EnableCrashReport();
+    // Plain one-shot drivers: the minimal includes caches are not thread-safe, the line layout is the same.
+    const std::shared_ptr<TestCaseWriter> &minimizer_writer = std::make_shared<TestCaseWriter>(
+      std::make_shared<ImportWriter>(include_paths_vc), program_ctx, TmpDriverPurpose::kOneShot);
+    minimizer_ = std::make_shared<TestCaseMinimizer>(
+      std::make_shared<FuzzingWorker>(-1, scratch_dir, minimizer_observer),
+      compiler,
+      minimizer_writer,
+      crash_tc_handler,
+      src_dir_abs,
+      minimize_budget,
+      [this](const MinimizationJob &job) { ApplyMinimization(job); });
+    minimize_seeds_ = cov_tool != CoverageMeasurementTool::kLCOVFILT;
+    if (!minimize_seeds_)
+      Logger::Warn("MainFuzzer", "Seed minimization needs per-site coverage (native gcov or --shm-cov), skipped.");
+  }
+
+  // Structural hashes of the mutants generated so far.
+  static const size_t kSeenMutantsCapacity = 1 << 20; // about 2.4MB of bits
+  static const double kSeenMutantsFalsePositiveRate = 1e-4;
+  static const int kMaxDuplicateDrawsPerMutant = 16;
+  std::shared_ptr<BloomFilter> seen_mutants;
+  long long int skipped_duplicates = 0LL;
+  if (parsed_args.IsUseDedupMutants())
+    seen_mutants = std::make_shared<BloomFilter>(kSeenMutantsCapacity, kSeenMutantsFalsePositiveRate);
+
+  const std::shared_ptr<PipelineStats> &pipeline_stats = PipelineStats::GetInstance();
+  int stats_interval_in_sec = parsed_args.GetStatsIntervalInSeconds();
+  const std::string &stats_filename = output_dir + "/fuzzer_stats";
+  long long int last_stats_write = 0LL;
+  int checkpoint_interval_in_sec = parsed_args.GetCheckpointIntervalInSeconds();
+  long long int last_checkpoint_write = fuzzing_clock.MeasureElapsedInMsec();
+  pipeline_stats->Start();
+
+  // Generation, mutation and rendering stay on this thread; only compile/execute runs on the workers.
+  FuzzingWorkerPool worker_pool{
+    workers, [&](FuzzingWorker &worker, const std::vector<TestCase> &mutations) {
+      if (mutations.size() == 1)
+        RunAttempt(
+          worker, mutations[0], compiler, tc_writer, crash_tc_handler, cov_logger, fuzzing_clock, src_dir_abs, harness);
+      else
+        RunBatchAttempt(
+          worker, mutations, compiler, tc_writer, crash_tc_handler, cov_logger, fuzzing_clock, src_dir_abs);
+    }};
   while (!interrupt && fuzzing_clock.MeasureElapsedInMsec() < timeout_in_msec) {
-    const TestCase &tc = LoadTestCase(tcgen, base_executables);
-    const TestCase &mutation = tcmut.MutateTestCase(tc, 20); // TODO: Try with/without deterministic mode.
-//    const TestCase &mutation = tc;
-    tc_writer.WriteToFile(mutation, temporary_cpp);
-//    Logger::Debug("Mutated TC has been written to: " + temporary_cpp);
-    ++total_attempts;
-    const auto &build_result = compiler.CompileAndLink(temporary_cpp, temporary_o, temporary_exe);
-    CompilationResult compile_result = build_result.first;
-    static long long int kDiscardUncompilableTCsAfter = 3600000LL;
-    switch (compile_result) {
-      case CompilationResult::kSuccess: {
-        const ExecutionResult &exec_result = observer.ExecuteAndMeasureCov(temporary_exe);
-        bool normal_execution = exec_result.IsSuccessful();
-        bool has_exception = exec_result.HasCaughtException();
-        if (normal_execution || has_exception) {
-          if (exec_result.IsInteresting()) {
-            const bpstd::optional<CoverageReport> &opt_cov_report = exec_result.GetCovReport();
-            const CoverageReport &cov_report = opt_cov_report.value();
-
-            FlushableTestCase &ftc = queue_.AddValid(mutation);
-            Logger::Info("Found interesting test case with ID = " + std::to_string(ftc.GetId()));
-            Logger::Info("Current coverage score: " + cov_report.ToPrettyString());
-
-            int return_code = exec_result.GetReturnCode();
-            ftc.SetReturnCode(return_code);
-
-            long long int timestamp = fuzzing_clock.MeasureElapsedInMsec() / 1000ll;
-            ftc.SetTimestamp((int) timestamp);
-            cov_logger.AppendEntry(
-              timestamp,
-              cov_report.GetLineCov(),
-              cov_report.GetBranchCov(),
-              cov_report.GetLineTot(),
-              cov_report.GetBranchTot(),
-              cov_report.GetFuncCov(),
-              cov_report.GetFuncTot());
-          }
-        } else { // !normal_execution && !has_exception
-          const TCMemo &memo = crash_tc_handler.ExecuteInGDBEnv(temporary_exe, src_dir_abs);
-          const std::string &fingerprint = *memo.GetFingerprint();
-
-          bool crash_in_source = memo.IsValidCrash() && memo.GetLocation().has_value();
-          bool is_new_unique_crash = crash_in_source && crash_tc_handler.RegisterIfNewCrash(fingerprint);
-          if (crash_in_source && is_new_unique_crash) {
-            FlushableTestCase &ftc = queue_.AddCrashes(mutation, memo);
-            Logger::Info("Found new crashing test case with ID = " + std::to_string(ftc.GetId()));
-//                + "\n Fingerprint: " + fingerprint);
-          }
-        }
-        break;
+    if (minimization_requested != 0) {
+      minimization_requested = 0;
+      std::lock_guard<std::mutex> lock(queue_mutex_);
+      if (CorpusMinimizer::HasCoveredSites(queue_.GetValid())) {
+        size_t removed = queue_.MinimizeValid();
+        Logger::Info("Corpus minimization removed " + std::to_string(removed) + " subsumed seeds.");
+      } else {
+        Logger::Warn("MainFuzzer", "Corpus minimization needs per-site coverage (native gcov or --shm-cov).");
       }
-      case CompilationResult::kCompileFailed: {
-        long long int curr_elapsed = fuzzing_clock.MeasureElapsedInMsec();
-        if (curr_elapsed < kDiscardUncompilableTCsAfter) {
-          const std::string &error_msg = build_result.second;
-          TCMemo memo;
-          memo.SetCompilationOutput({error_msg});
-          FlushableTestCase &ftc = queue_.AddIncompilable(mutation, memo);
-//          Logger::Warn("Found incompilable test case with ID = " + std::to_string(ftc.GetId()));
-          break;
-        }
-      }
-      case CompilationResult::kLinkingFailed: {
-        long long int curr_elapsed = fuzzing_clock.MeasureElapsedInMsec();
-        if (curr_elapsed < kDiscardUncompilableTCsAfter) {
-          Logger::Warn("Found linking error");
-        }
-        break;
+    }
+    SubmitMinimizationJobs();
+    const std::shared_ptr<FuzzingWorker> &worker = worker_pool.AcquireIdleWorker();
+    std::vector<TestCase> mutations;
+    std::vector<int> parent_ids;
+    for (int draws = 0; (int) mutations.size() < batch_size; ++draws) {
+      WallClock generate_clock;
+      int parent_id = -1;
+      const TestCase &tc = LoadTestCase(tcgen, base_executables, parent_id);
+      pipeline_stats->RecordStage(PipelineStage::kGenerate, generate_clock.MeasureElapsedInUsec());
+      WallClock mutate_clock;
+      const TestCase &mutation = tcmut.MutateTestCase(tc, 20); // TODO: Try with/without deterministic mode.
+      pipeline_stats->RecordStage(PipelineStage::kMutate, mutate_clock.MeasureElapsedInUsec());
+      // Tiny targets may run out of new mutants, the last draw then runs anyway instead of stalling the loop.
+      bool give_up = draws >= batch_size * kMaxDuplicateDrawsPerMutant;
+      if (seen_mutants != nullptr && !seen_mutants->Insert(mutation.ComputeStructuralHash()) && !give_up) {
+        ++skipped_duplicates;
+        continue;
       }
+      mutations.push_back(mutation);
+      parent_ids.push_back(parent_id);
+    }
+    if (seen_mutants != nullptr && seen_mutants->GetInsertedCount() >= seen_mutants->GetExpectedItems())
+      seen_mutants->Clear(); // keeps the false positive rate, i.e. wrongly skipped mutants, bounded
+    const std::string &temporary_cpp = worker->GetTmpDriverCpp();
+    WallClock write_clock;
+    if (batch_size == 1) {
+      const TestCase &mutation = mutations[0];
+      tc_writer.WriteToFile(mutation, temporary_cpp);
+      worker->SetHarnessInputReady(
+        harness != nullptr && harness->WriteBytecode(mutation, worker->GetHarnessInput()));
+    } else {
+      worker->SetBatchFirstLines(tc_writer.WriteBatchToFile(mutations, temporary_cpp));
+    }
+    pipeline_stats->RecordStage(PipelineStage::kWrite, write_clock.MeasureElapsedInUsec());
+    worker->SetParentIds(parent_ids);
+//    Logger::Debug("Mutated TC has been written to: " + temporary_cpp);
+    total_attempts += batch_size;
+    pipeline_stats->RecordAttempts(batch_size);
+    worker_pool.Dispatch(worker, mutations);
+
+    long long int elapsed = fuzzing_clock.MeasureElapsedInMsec();
+    if (stats_interval_in_sec > 0 && elapsed - last_stats_write >= stats_interval_in_sec * 1000LL) {
+      WriteFuzzerStats(stats_filename, jobs, batch_size);
+      last_stats_write = elapsed;
     }
+    if (checkpoint_interval_in_sec > 0 && elapsed - last_checkpoint_write >= checkpoint_interval_in_sec * 1000LL) {
+      if (!WriteCheckpoint(checkpoint_filename, program_ctx, baseline, crash_tc_handler, cov_logger, elapsed))
+        Logger::Warn("MainFuzzer", "Cannot write the checkpoint to: " + checkpoint_filename);
+      last_checkpoint_write = elapsed;
+    }
+    if (queue_memory_in_mib > 0 && elapsed - last_spill >= kSpillIntervalInMsec) {
+      std::lock_guard<std::mutex> lock(queue_mutex_);
+      queue_.SpillColdEntries();
+      last_spill = elapsed;
+    }
+    if (streaming_writer != nullptr)
+      StreamQueue(*streaming_writer);
+  }
+  worker_pool.Join();
+  if (triage_pool_ != nullptr) {
+    // Pending crashes are registered before they are minimized and checkpointed.
+    triage_pool_->Finish();
+    Logger::Info("Crashes triaged in background = " + std::to_string(triage_pool_->GetTriagedCount()));
+    triage_pool_ = nullptr;
+  }
+  if (minimizer_ != nullptr) {
+    // Unique crashes are minimized before they are written out, pending seeds are not waited for.
+    SubmitMinimizationJobs();
+    minimizer_->Finish();
+    Logger::Info(
+      "Minimized test cases = " + std::to_string(minimizer_->GetMinimizedCount()) + ", removed statements = "
+        + std::to_string(minimizer_->GetRemovedStatementCount()));
+    minimizer_ = nullptr;
+  }
+  pipeline_stats->Stop();
+  if (stats_interval_in_sec > 0)
+    WriteFuzzerStats(stats_filename, jobs, batch_size);
+  if (checkpoint_interval_in_sec > 0) {
+    long long int elapsed = std::min(fuzzing_clock.MeasureElapsedInMsec(), timeout_in_msec);
+    if (!WriteCheckpoint(checkpoint_filename, program_ctx, baseline, crash_tc_handler, cov_logger, elapsed))
+      Logger::Warn("MainFuzzer", "Cannot write the checkpoint to: " + checkpoint_filename);
   }
 
   Logger::InfoSection("Ended Fuzzing Loop");
   Logger::Info("Total attempts = " + std::to_string(total_attempts));
+  pipeline_stats->PrintSummary();
+  if (seen_mutants != nullptr)
+    Logger::Info("Skipped duplicate mutants = " + std::to_string(skipped_duplicates));
+  if (repair_budget_ > 0)
+    Logger::Info("Repaired incompilable test cases = " + std::to_string(repaired_tcs_));
+  if (CompileFailureCache::GetInstance()->IsEnabled()) {
+    size_t shape_count = CompileFailureCache::GetInstance()->GetShapeCount();
+    Logger::Info("Learned uncompilable call shapes = " + std::to_string(shape_count));
+  }
+  if (timeout_calibrator_ != nullptr) {
+    Logger::Info(
+      "Calibrated execution timeout = " + std::to_string(timeout_calibrator_->GetTimeoutInMsec())
+        + "ms, hangs caught before the configured timeout = " + std::to_string(early_hangs_));
+  }
+  if (served_runs_ > 0) {
+    long long int avg_latency = served_run_latency_in_usec_ / served_runs_;
+    Logger::Info("Fork server runs = " + std::to_string(served_runs_) + ", avg latency = "
+                   + std::to_string(avg_latency) + "us.");
+  }
+  if (build_cache_ != nullptr) {
+    Logger::Info("Build cache: " + build_cache_->ToPrettyString());
+    build_cache_ = nullptr;
+  }
+  if (queue_.GetSpillStore() != nullptr) {
+    const std::shared_ptr<TestCaseSpillStore> &spill_store = queue_.GetSpillStore();
+    Logger::Info(
+      "Spilled test cases = " + std::to_string(spill_store->GetEntryCount()) + ", spill file size = "
+        + std::to_string(spill_store->GetSizeInBytes() / 1024LL) + "KiB.");
+  }
+  if (streaming_writer != nullptr) {
+    StreamQueue(*streaming_writer); // the triaged and minimized test cases since the last iteration
+    Logger::Info("Test cases written while fuzzing = " + std::to_string(streaming_writer->GetStreamedCount()));
+  }
+  if (use_shm_cov && has_gcno) {
+    CoverageReport final_report;
+    for (const auto &worker : workers)
+      final_report = worker->GetObserver().MeasureFinalReport();
+    Logger::Info("Final coverage (lcov): " + final_report.ToPrettyString());
+  }
   queue_.PrintSummary();
   cov_logger.PrintSummary();
   long long int timeout_in_sec = timeout_in_msec / 1000LL;
@@ -446,7 +1581,11 @@ void MainFuzzer::MainLoop(const FuzzingMainLoopSpec &spec) {
     ld_flags,
     max_depth,
     program_ctx,
-    target_filename
+    target_filename,
+    prelinker.get(),
+    prelinked_object,
+    parsed_args.IsUseMinimizeCorpus(),
+    streaming_writer.get()
   );
 }
 
@@ -458,14 +1597,104 @@ void MainFuzzer::SignalHandling(int signum) {
   Logger::Info("[MainFuzzer]", "Performing cleanup due to signal: " + std::to_string(signum));
   interrupt = true;
 }
+// SIGUSR1: the main loop drops subsumed seeds before its next attempt.
+volatile std::sig_atomic_t MainFuzzer::minimization_requested = 0;
+void MainFuzzer::MinimizationSignalHandling(int signum) {
+  minimization_requested = 1;
+}
 MainFuzzer::MainFuzzer() : seed_scheduling_counter_(0) {}
 
+// ##########
+// # SeedScheduler
+// #####
+
+const double SeedScheduler::kMinScratchProbability = 0.1;
+const double SeedScheduler::kMaxScratchProbability = 0.9;
+const long long int SeedScheduler::kRateHalfLife = 2000LL; // attempts
+SeedScheduler::SeedScheduler() = default;
+
+// Same steps as the execution time factor of AFL's calculate_score.
+double ScaleEnergyByRatio(double ratio) {
+  if (ratio > 4.0)
+    return 0.25;
+  if (ratio > 2.0)
+    return 0.5;
+  if (ratio > 1.33)
+    return 0.75;
+  if (ratio < 0.25)
+    return 3.0;
+  if (ratio < 0.5)
+    return 2.0;
+  if (ratio < 0.75)
+    return 1.5;
+  return 1.0;
+}
+
+// Averages are taken over the queue, so the energy of a seed is relative to the others.
+double SeedScheduler::ComputeEnergy(const FlushableTestCase &seed, double avg_cost_in_usec, double avg_size) {
+  double energy = 1.0;
+  if (seed.GetCostInUsec() > 0 && avg_cost_in_usec > 0.0)
+    energy *= ScaleEnergyByRatio(seed.GetCostInUsec() / avg_cost_in_usec);
+  if (avg_size > 0.0)
+    energy *= ScaleEnergyByRatio(seed.GetStatementCount() / avg_size);
+  energy *= 1.0 + std::log2(1.0 + seed.GetChildrenCoverage());
+  energy /= std::sqrt(1.0 + seed.GetFuzzCount());
+  return energy;
+}
+size_t SeedScheduler::SelectSeed(const std::vector<FlushableTestCase> &seeds) {
+  double total_cost = 0.0, total_size = 0.0;
+  size_t costed = 0;
+  for (const auto &seed : seeds) {
+    total_size += seed.GetStatementCount();
+    if (seed.GetCostInUsec() > 0) {
+      total_cost += seed.GetCostInUsec();
+      ++costed;
+    }
+  }
+  double avg_cost_in_usec = costed > 0 ? total_cost / costed : 0.0;
+  double avg_size = total_size / seeds.size();
+
+  std::vector<double> cumulative_energy;
+  double total_energy = 0.0;
+  for (const auto &seed : seeds) {
+    total_energy += ComputeEnergy(seed, avg_cost_in_usec, avg_size);
+    cumulative_energy.push_back(total_energy);
+  }
+  double pick = Random::GetInstance()->NextDouble(0.0, total_energy);
+  size_t idx = std::upper_bound(cumulative_energy.begin(), cumulative_energy.end(), pick) - cumulative_energy.begin();
+  return std::min(idx, seeds.size() - 1);
+}
+// Compares the smoothed find rates of both origins; neither of them is ever starved.
+bool SeedScheduler::ShouldGenerateFromScratch(const std::vector<FlushableTestCase> &seeds) {
+  if (seeds.empty())
+    return true;
+  double scratch_rate = (scratch_finds_ + 1.0) / (scratch_attempts_ + 2.0);
+  double seed_rate = (seed_finds_ + 1.0) / (seed_attempts_ + 2.0);
+  double scratch_probability = scratch_rate / (scratch_rate + seed_rate);
+  scratch_probability = std::max(kMinScratchProbability, std::min(kMaxScratchProbability, scratch_probability));
+  return Random::GetInstance()->NextDouble() < scratch_probability;
+}
+void SeedScheduler::RecordAttempt(bool from_scratch) {
+  (from_scratch ? scratch_attempts_ : seed_attempts_) += 1.0;
+  if (scratch_attempts_ + seed_attempts_ >= kRateHalfLife) {
+    scratch_attempts_ /= 2.0;
+    scratch_finds_ /= 2.0;
+    seed_attempts_ /= 2.0;
+    seed_finds_ /= 2.0;
+  }
+}
+void SeedScheduler::RecordFind(bool from_scratch) {
+  (from_scratch ? scratch_finds_ : seed_finds_) += 1.0;
+}
+
 // ##########
 // # FlushableTestCase
 // #####
 int FlushableTestCase::kGlobalTCId = 0;
 FlushableTestCase::FlushableTestCase(TestCase tc)
-  : id_(++kGlobalTCId), flushed_(false), tc_(std::move(tc)), return_code_(0), timestamp_(0) {}
+  : id_(++kGlobalTCId), flushed_(false), tc_(std::move(tc)), return_code_(0), timestamp_(0) {
+  statement_count_ = tc_.GetStatements().size();
+}
 int FlushableTestCase::GetId() const {
   return id_;
 }
@@ -478,13 +1707,35 @@ void FlushableTestCase::SetFlushed(bool flushed) {
 const TestCase &FlushableTestCase::GetTc() const {
   return tc_;
 }
+void FlushableTestCase::SetTc(const TestCase &tc) {
+  tc_ = tc;
+  flushed_ = false;
+  statement_count_ = tc_.GetStatements().size();
+  spilled_ = false;
+  spilled_copy_ = false;
+}
 FlushableTestCase::FlushableTestCase(TestCase tc, const TCMemo &memo)
   : FlushableTestCase(std::move(tc)) {
   memo_ = memo;
 }
+// Restored from a checkpoint, which also restores the last id handed out.
+FlushableTestCase::FlushableTestCase(int id, TestCase tc, const TCMemo &memo)
+  : id_(id), timestamp_(0), flushed_(false), tc_(std::move(tc)), memo_(memo), return_code_(0) {
+  statement_count_ = tc_.GetStatements().size();
+}
+int FlushableTestCase::GetLastId() {
+  return kGlobalTCId;
+}
+void FlushableTestCase::SetLastId(int last_id) {
+  kGlobalTCId = last_id;
+}
 const TCMemo &FlushableTestCase::GetMemo() const {
   return memo_;
 }
+void FlushableTestCase::SetMemo(const TCMemo &memo) {
+  memo_ = memo;
+  spilled_copy_ = false;
+}
 int FlushableTestCase::GetReturnCode() const {
   return return_code_;
 }
@@ -497,6 +1748,189 @@ int FlushableTestCase::GetTimestamp() const {
 void FlushableTestCase::SetTimestamp(int timestamp) {
   timestamp_ = timestamp;
 }
+const CoverageDelta &FlushableTestCase::GetCoverageDelta() const {
+  return coverage_delta_;
+}
+void FlushableTestCase::SetCoverageDelta(const CoverageDelta &coverage_delta) {
+  coverage_delta_ = coverage_delta;
+}
+int FlushableTestCase::GetParentId() const {
+  return parent_id_;
+}
+void FlushableTestCase::SetParentId(int parent_id) {
+  parent_id_ = parent_id;
+}
+long long int FlushableTestCase::GetCostInUsec() const {
+  return cost_in_usec_;
+}
+void FlushableTestCase::SetCostInUsec(long long int cost_in_usec) {
+  cost_in_usec_ = cost_in_usec;
+}
+int FlushableTestCase::GetFuzzCount() const {
+  return fuzz_count_;
+}
+void FlushableTestCase::IncrementFuzzCount() {
+  ++fuzz_count_;
+}
+void FlushableTestCase::SetFuzzCount(int fuzz_count) {
+  fuzz_count_ = fuzz_count;
+}
+long long int FlushableTestCase::GetChildrenCoverage() const {
+  return children_coverage_;
+}
+void FlushableTestCase::AddChildrenCoverage(long long int coverage) {
+  children_coverage_ += coverage;
+}
+const CoverageDelta &FlushableTestCase::GetCoveredSites() const {
+  return covered_sites_;
+}
+void FlushableTestCase::SetCoveredSites(const CoverageDelta &covered_sites) {
+  covered_sites_ = covered_sites;
+}
+size_t FlushableTestCase::GetStatementCount() const {
+  return statement_count_;
+}
+bool FlushableTestCase::IsSpilled() const {
+  return spilled_;
+}
+// Keeps the id, the scheduling data and the fingerprint of the memo, i.e. what the queue reads without loading.
+void FlushableTestCase::Spill() {
+  tc_ = TestCase{{}, nullptr};
+  memo_.SetGdbOutput({});
+  memo_.SetCompilationOutput({});
+  spilled_ = true;
+}
+void FlushableTestCase::Restore(const TestCase &tc, const TCMemo &memo) {
+  tc_ = tc;
+  memo_ = memo;
+  spilled_ = false;
+}
+bool FlushableTestCase::HasSpilledCopy() const {
+  return spilled_copy_;
+}
+void FlushableTestCase::SetSpilledCopy(bool spilled_copy) {
+  spilled_copy_ = spilled_copy;
+}
+long long int FlushableTestCase::GetLastAccess() const {
+  return last_access_;
+}
+void FlushableTestCase::SetLastAccess(long long int last_access) {
+  last_access_ = last_access;
+}
+// A rough figure: statements are counted at a fixed size, shared texts are split among the memos sharing them.
+unsigned long long int FlushableTestCase::EstimateResidentBytes() const {
+  static const unsigned long long int kEstimatedBytesPerStatement = 512ULL;
+  const auto &site_bytes = [](const CoverageDelta &sites) {
+    return (sites.GetLines().size() + sites.GetBranches().size() + sites.GetFunctions().size()
+      + sites.GetEdges().size()) * sizeof(int);
+  };
+  const auto &text_bytes = [](const std::shared_ptr<const std::string> &text) {
+    return text == nullptr ? 0ULL : text->size() / (unsigned long long int) std::max(1L, text.use_count());
+  };
+  unsigned long long int bytes = sizeof(FlushableTestCase) + site_bytes(coverage_delta_) + site_bytes(covered_sites_);
+  if (spilled_)
+    return bytes;
+  return bytes + statement_count_ * kEstimatedBytesPerStatement + text_bytes(memo_.GetGdbOutput())
+    + text_bytes(memo_.GetCompilationOutput());
+}
+
+// ##########
+// # ResidentTestCaseScope
+// #####
+
+ResidentTestCaseScope::ResidentTestCaseScope(FlushableTestCase &ftc, TestCaseSpillStore *spill_store) : ftc_(ftc) {
+  if (!ftc_.IsSpilled())
+    return;
+  bpstd::optional<std::pair<TestCase, TCMemo>> loaded;
+  if (spill_store != nullptr)
+    loaded = spill_store->Load(ftc_.GetId());
+  if (!loaded.has_value()) {
+    const std::string &msg = "Cannot load the spilled test case with ID = " + std::to_string(ftc_.GetId());
+    Logger::Warn("ResidentTestCaseScope", msg);
+    return;
+  }
+  ftc_.Restore(loaded->first, loaded->second);
+  loaded_ = true;
+}
+ResidentTestCaseScope::~ResidentTestCaseScope() {
+  if (loaded_)
+    ftc_.Spill(); // its spilled copy is still in the store
+}
+bool ResidentTestCaseScope::IsResident() const {
+  return !ftc_.IsSpilled();
+}
+
+// ##########
+// # CorpusMinimizer
+// #####
+
+// Coverage measured from totals only (lcov, gcovr) leaves the sets empty, such a corpus is never minimized.
+bool CorpusMinimizer::HasCoveredSites(const std::vector<FlushableTestCase> &tcs) {
+  return std::all_of(
+    tcs.begin(), tcs.end(), [](const FlushableTestCase &ftc) {
+      return !ftc.GetCoveredSites().IsEmpty();
+    });
+}
+
+std::vector<uint64_t> ToSiteKeys(const CoverageDelta &sites) {
+  std::vector<uint64_t> keys;
+  const std::vector<int> *kinds[4] = {
+    &sites.GetLines(), &sites.GetBranches(), &sites.GetFunctions(), &sites.GetEdges()};
+  for (uint64_t kind = 0; kind < 4; ++kind) {
+    for (int site : *kinds[kind])
+      keys.push_back(kind << 32 | (uint32_t) site);
+  }
+  return keys;
+}
+
+// Lazy greedy: the gain of a test case only shrinks as sites get covered, so a popped candidate whose gain is
+// still up to date is the best one.
+std::vector<FlushableTestCase> CorpusMinimizer::Minimize(const std::vector<FlushableTestCase> &tcs) {
+  if (!HasCoveredSites(tcs))
+    return tcs;
+  std::vector<std::vector<uint64_t>> site_keys;
+  for (const auto &ftc : tcs)
+    site_keys.push_back(ToSiteKeys(ftc.GetCoveredSites()));
+
+  using Candidate = std::pair<size_t, size_t>; // gain, index
+  const auto &is_worse = [&tcs](const Candidate &lhs, const Candidate &rhs) {
+    if (lhs.first != rhs.first)
+      return lhs.first < rhs.first;
+    size_t lhs_size = tcs[lhs.second].GetStatementCount();
+    size_t rhs_size = tcs[rhs.second].GetStatementCount();
+    if (lhs_size != rhs_size)
+      return lhs_size > rhs_size;
+    return lhs.second > rhs.second;
+  };
+  std::priority_queue<Candidate, std::vector<Candidate>, decltype(is_worse)> candidates{is_worse};
+  for (size_t idx = 0; idx < tcs.size(); ++idx)
+    candidates.emplace(site_keys[idx].size(), idx);
+
+  std::unordered_set<uint64_t> covered;
+  std::vector<bool> kept(tcs.size(), false);
+  while (!candidates.empty()) {
+    Candidate top = candidates.top();
+    candidates.pop();
+    const std::vector<uint64_t> &keys = site_keys[top.second];
+    size_t gain = (size_t) std::count_if(
+      keys.begin(), keys.end(), [&covered](uint64_t key) { return covered.count(key) == 0; });
+    if (gain == 0)
+      continue;
+    if (gain < top.first) {
+      candidates.emplace(gain, top.second);
+      continue;
+    }
+    kept[top.second] = true;
+    covered.insert(keys.begin(), keys.end());
+  }
+
+  std::vector<FlushableTestCase> result;
+  for (size_t idx = 0; idx < tcs.size(); ++idx) {
+    if (kept[idx])
+      result.push_back(tcs[idx]);
+  }
+  return result;
+}
 
 // ##########
 // # TestCaseQueue
@@ -505,38 +1939,291 @@ void FlushableTestCase::SetTimestamp(int timestamp) {
 std::vector<FlushableTestCase> &TestCaseQueue::GetValid() {
   return valid_;
 }
+std::vector<FlushableTestCase> &TestCaseQueue::GetSubsumed() {
+  return subsumed_;
+}
 std::vector<FlushableTestCase> &TestCaseQueue::GetCrashes() {
   return crashes_;
 }
 std::vector<FlushableTestCase> &TestCaseQueue::GetIncompilable() {
   return incompilable_;
 }
+std::vector<FlushableTestCase> &TestCaseQueue::GetHangs() {
+  return hangs_;
+}
 FlushableTestCase &TestCaseQueue::AddValid(const TestCase &tc) {
   assert(tc.Verify());
   valid_.emplace_back(tc);
+  valid_.back().SetLastAccess(++access_tick_);
   return valid_[valid_.size() - 1];
 }
 FlushableTestCase &TestCaseQueue::AddCrashes(const TestCase &tc, const TCMemo &memo) {
   crashes_.emplace_back(tc, memo);
+  crashes_.back().SetLastAccess(++access_tick_);
   return crashes_[crashes_.size() - 1];
 }
 FlushableTestCase &TestCaseQueue::AddIncompilable(const TestCase &tc, const TCMemo &memo) {
   incompilable_.emplace_back(tc, memo);
+  incompilable_.back().SetLastAccess(++access_tick_);
   return incompilable_[incompilable_.size() - 1];
 }
+FlushableTestCase &TestCaseQueue::AddHang(const TestCase &tc, const TCMemo &memo) {
+  hangs_.emplace_back(tc, memo);
+  hangs_.back().SetLastAccess(++access_tick_);
+  return hangs_[hangs_.size() - 1];
+}
+bool TestCaseQueue::IsNewHang(const std::string &fingerprint) const {
+  return std::none_of(
+    hangs_.begin(), hangs_.end(), [&fingerprint](const FlushableTestCase &ftc) {
+      return ftc.GetMemo().GetFingerprint().value_or("") == fingerprint;
+    });
+}
+// Test cases are appended in id order.
+FlushableTestCase *FindTestCaseById(std::vector<FlushableTestCase> &tcs, int id) {
+  const auto &it = std::lower_bound(
+    tcs.begin(), tcs.end(), id, [](const FlushableTestCase &ftc, int target_id) {
+      return ftc.GetId() < target_id;
+    });
+  return it != tcs.end() && it->GetId() == id ? &*it : nullptr;
+}
+FlushableTestCase *TestCaseQueue::FindValid(int id) {
+  return FindTestCaseById(valid_, id);
+}
+FlushableTestCase *TestCaseQueue::FindCrash(int id) {
+  return FindTestCaseById(crashes_, id);
+}
 void TestCaseQueue::PrintSummary() {
   std::stringstream ss;
-  ss << valid_.size() << '/' << crashes_.size() << '/' << incompilable_.size();
-  Logger::Info("[Valid/Crash/Incompilable] = " + ss.str());
+  ss << valid_.size() << '/' << crashes_.size() << '/' << incompilable_.size() << '/' << hangs_.size();
+  Logger::Info("[Valid/Crash/Incompilable/Hang] = " + ss.str());
+}
+void TestCaseQueue::EnableSpill(
+  std::shared_ptr<TestCaseSpillStore> spill_store,
+  unsigned long long int memory_budget_in_bytes
+) {
+  spill_store_ = std::move(spill_store);
+  memory_budget_in_bytes_ = memory_budget_in_bytes;
+}
+const std::shared_ptr<TestCaseSpillStore> &TestCaseQueue::GetSpillStore() const {
+  return spill_store_;
+}
+// Also marks the test case as used, seeds picked recently are the last ones to be spilled.
+bool TestCaseQueue::MakeResident(FlushableTestCase &ftc) {
+  ftc.SetLastAccess(++access_tick_);
+  if (!ftc.IsSpilled())
+    return true;
+  bpstd::optional<std::pair<TestCase, TCMemo>> loaded;
+  if (spill_store_ != nullptr)
+    loaded = spill_store_->Load(ftc.GetId());
+  if (!loaded.has_value()) {
+    Logger::Warn("TestCaseQueue", "Cannot load the spilled test case with ID = " + std::to_string(ftc.GetId()));
+    return false;
+  }
+  ftc.Restore(loaded->first, loaded->second);
+  return true;
+}
+// Spills down to 3/4 of the budget, so that the next spill is not due right away: incompilables first, then the
+// subsumed seeds, hangs and crashes, and the seeds picked least recently at last.
+size_t TestCaseQueue::SpillColdEntries() {
+  if (spill_store_ == nullptr)
+    return 0;
+  unsigned long long int resident_bytes = 0;
+  std::vector<FlushableTestCase *> cold;
+  for (auto *tcs : {&incompilable_, &subsumed_, &hangs_, &crashes_, &valid_}) {
+    for (auto &ftc : *tcs) {
+      resident_bytes += ftc.EstimateResidentBytes();
+      cold.push_back(&ftc);
+    }
+  }
+  if (resident_bytes <= memory_budget_in_bytes_)
+    return 0;
+  std::stable_sort(
+    cold.end() - valid_.size(), cold.end(), [](const FlushableTestCase *lhs, const FlushableTestCase *rhs) {
+      return lhs->GetLastAccess() < rhs->GetLastAccess();
+    });
+  size_t spilled = 0;
+  for (FlushableTestCase *ftc : cold) {
+    if (resident_bytes <= memory_budget_in_bytes_ / 4 * 3)
+      break;
+    if (ftc->IsSpilled())
+      continue;
+    if (!ftc->HasSpilledCopy()) {
+      if (!spill_store_->CanStore(ftc->GetTc()) || !spill_store_->Store(ftc->GetId(), ftc->GetTc(), ftc->GetMemo()))
+        continue;
+      ftc->SetSpilledCopy(true);
+    }
+    unsigned long long int bytes = ftc->EstimateResidentBytes();
+    ftc->Spill();
+    resident_bytes -= bytes - ftc->EstimateResidentBytes();
+    ++spilled;
+  }
+  return spilled;
 }
+// Includes the subsumed test cases: a partition must reach the coverage of its time, not of the final corpus.
 std::vector<FlushableTestCase> TestCaseQueue::GetValidByTimestamp(int last_ts_in_sec) {
+  const std::vector<FlushableTestCase> &all_valid = GetAllValid();
   std::vector<FlushableTestCase> result;
   std::copy_if(
-    valid_.begin(), valid_.end(), std::back_inserter(result), [&](const auto &item) {
+    all_valid.begin(), all_valid.end(), std::back_inserter(result), [&](const auto &item) {
       return item.GetTimestamp() <= last_ts_in_sec;
     });
   return result;
 }
+std::vector<FlushableTestCase> TestCaseQueue::GetAllValid() const {
+  std::vector<FlushableTestCase> result{valid_};
+  result.insert(result.end(), subsumed_.begin(), subsumed_.end());
+  std::sort(
+    result.begin(), result.end(), [](const FlushableTestCase &lhs, const FlushableTestCase &rhs) {
+      return lhs.GetId() < rhs.GetId();
+    });
+  return result;
+}
+// Returns the number of valid test cases moved to subsumed_.
+size_t TestCaseQueue::MinimizeValid() {
+  const std::vector<FlushableTestCase> &minimized = CorpusMinimizer::Minimize(valid_);
+  if (minimized.size() == valid_.size())
+    return 0;
+  std::set<int> kept_ids;
+  for (const auto &ftc : minimized)
+    kept_ids.insert(ftc.GetId());
+  for (const auto &ftc : valid_) {
+    if (kept_ids.count(ftc.GetId()) == 0)
+      subsumed_.push_back(ftc);
+  }
+  size_t removed = valid_.size() - minimized.size();
+  valid_ = minimized;
+  return removed;
+}
+
+// ##########
+// # FuzzingWorker
+// #####
+
+FuzzingWorker::FuzzingWorker(int worker_id, std::string scratch_dir, std::shared_ptr<CoverageObserver> observer)
+  : worker_id_(worker_id), scratch_dir_(std::move(scratch_dir)), observer_(std::move(observer)) {}
+int FuzzingWorker::GetWorkerId() const {
+  return worker_id_;
+}
+const std::string &FuzzingWorker::GetScratchDir() const {
+  return scratch_dir_;
+}
+std::string FuzzingWorker::GetTmpDriverCpp() const {
+  return scratch_dir_ + "/" + SourceCompiler::kTmpDriverCppFilename;
+}
+std::string FuzzingWorker::GetTmpDriverObject() const {
+  return scratch_dir_ + "/" + SourceCompiler::kTmpDriverObjectFilename;
+}
+std::string FuzzingWorker::GetTmpDriverExe() const {
+  return scratch_dir_ + "/" + SourceCompiler::kTmpDriverExeFilename;
+}
+std::string FuzzingWorker::GetHarnessInput() const {
+  return scratch_dir_ + "/tc.bin";
+}
+CoverageObserver &FuzzingWorker::GetObserver() const {
+  return *observer_;
+}
+bool FuzzingWorker::IsHarnessInputReady() const {
+  return harness_input_ready_;
+}
+void FuzzingWorker::SetHarnessInputReady(bool harness_input_ready) {
+  harness_input_ready_ = harness_input_ready;
+}
+const std::vector<int> &FuzzingWorker::GetBatchFirstLines() const {
+  return batch_first_lines_;
+}
+void FuzzingWorker::SetBatchFirstLines(const std::vector<int> &batch_first_lines) {
+  batch_first_lines_ = batch_first_lines;
+}
+const std::vector<int> &FuzzingWorker::GetParentIds() const {
+  return parent_ids_;
+}
+void FuzzingWorker::SetParentIds(const std::vector<int> &parent_ids) {
+  parent_ids_ = parent_ids;
+}
+ForkServerClient *FuzzingWorker::AcquireHarnessServer(const std::string &harness_exe) {
+  if (harness_server_ == nullptr) {
+    std::vector<std::string> args{GetHarnessInput()};
+    harness_server_ = std::make_shared<ForkServerClient>(harness_exe, args, observer_->GetEnv());
+  }
+  if (!harness_server_->IsAlive() && !harness_server_->Start())
+    return nullptr;
+  return harness_server_.get();
+}
+
+// ##########
+// # FuzzingWorkerPool
+// #####
+
+FuzzingWorkerPool::FuzzingWorkerPool(std::vector<std::shared_ptr<FuzzingWorker>> workers, AttemptFn attempt_fn)
+  : workers_(std::move(workers)),
+    attempt_fn_(std::move(attempt_fn)),
+    threads_(),
+    mutex_(),
+    cv_(),
+    idle_(workers_.begin(), workers_.end()),
+    pending_() {
+  assert(!workers_.empty());
+  if (workers_.size() == 1)
+    return;
+  for (const auto &worker : workers_) {
+    threads_.emplace_back(&FuzzingWorkerPool::RunWorker, this, worker);
+  }
+}
+FuzzingWorkerPool::~FuzzingWorkerPool() {
+  Join();
+}
+std::shared_ptr<FuzzingWorker> FuzzingWorkerPool::AcquireIdleWorker() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  cv_.wait(lock, [this] { return !idle_.empty(); });
+  std::shared_ptr<FuzzingWorker> worker = idle_.front();
+  idle_.pop_front();
+  return worker;
+}
+void FuzzingWorkerPool::Dispatch(const std::shared_ptr<FuzzingWorker> &worker, const std::vector<TestCase> &tcs) {
+  if (threads_.empty()) {
+    attempt_fn_(*worker, tcs);
+    std::lock_guard<std::mutex> lock(mutex_);
+    idle_.push_back(worker);
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    pending_.emplace(worker->GetWorkerId(), tcs);
+  }
+  cv_.notify_all();
+}
+void FuzzingWorkerPool::Join() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    joining_ = true;
+  }
+  cv_.notify_all();
+  for (auto &thread : threads_) {
+    if (thread.joinable())
+      thread.join();
+  }
+}
+void FuzzingWorkerPool::RunWorker(const std::shared_ptr<FuzzingWorker> &worker) {
+  int worker_id = worker->GetWorkerId();
+  while (true) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    cv_.wait(lock, [&] { return joining_ || pending_.count(worker_id) > 0; });
+    const auto &it = pending_.find(worker_id);
+    if (it == pending_.end())
+      return; // joining and nothing left to run
+
+    std::vector<TestCase> tcs = it->second;
+    pending_.erase(it);
+    lock.unlock();
+
+    attempt_fn_(*worker, tcs);
+
+    lock.lock();
+    idle_.push_back(worker);
+    lock.unlock();
+    cv_.notify_all();
+  }
+}
 
 // ##########
 // # CompilationContext
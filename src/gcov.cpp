@@ -0,0 +1,499 @@
+#include "gcov.hpp"
+#include "logger.hpp"
+
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <utility>
+#include <experimental/filesystem>
+
+namespace cxxfoozz {
+
+// Record layout follows the gcov versions emitted by clang (4.2, 4.7/4.8, 8, 9 and 12 formats).
+const uint32_t kGcnoMagic = 0x67636e6f; // "gcno"
+const uint32_t kGcdaMagic = 0x67636461; // "gcda"
+const uint32_t kGcovTagFunction = 0x01000000;
+const uint32_t kGcovTagBlocks = 0x01410000;
+const uint32_t kGcovTagArcs = 0x01430000;
+const uint32_t kGcovTagLines = 0x01450000;
+const uint32_t kGcovTagCounterArcs = 0x01a10000;
+const uint32_t kGcovArcOnTree = 1;
+const uint32_t kGcovArcFake = 2;
+const int kGcovV407 = 407;
+const int kGcovV408 = 408;
+const int kGcovV800 = 800;
+const int kGcovV900 = 900;
+const int kGcovV1200 = 1200; // record lengths are in bytes, the header carries a checksum
+const size_t kNoArc = static_cast<size_t>(-1);
+
+struct GcovArcNotes {
+  uint32_t src;
+  uint32_t dst;
+  uint32_t flags;
+  bool exit_link; // synthetic exit -> entry arc closing the spanning tree, not a real arc
+  int branch_site;
+};
+
+struct GcovFunctionNotes {
+  uint32_t ident;
+  uint32_t lineno_checksum;
+  uint32_t cfg_checksum;
+  std::string filename;
+  uint32_t start_line;
+  int func_site;
+  std::vector<GcovArcNotes> arcs;
+  std::vector<size_t> counted_arcs; // arcs off the spanning tree, in the order of their gcda counters
+  std::vector<std::vector<size_t>> in_arcs;
+  std::vector<std::vector<size_t>> out_arcs;
+  std::vector<std::vector<int>> block_lines; // line sites of each block
+  std::vector<std::pair<std::string, uint32_t>> block_last_line; // where the branches of a block are reported
+};
+
+struct GcovNotesFile {
+  std::string gcda_relative_path;
+  int version;
+  uint32_t stamp;
+  std::vector<GcovFunctionNotes> functions;
+  std::map<uint32_t, size_t> function_index; // ident -> functions
+};
+
+// "408*" for gcov 4.8, "A93*" for gcov 9.3 and "B22*" for gcov 12.2.
+int DecodeGcovVersion(uint32_t word) {
+  int c0 = (int) (word >> 24u), c1 = (int) ((word >> 16u) & 0xffu), c2 = (int) ((word >> 8u) & 0xffu);
+  if (c0 >= 'A')
+    return ((c0 - 'A') * 10 + (c1 - '0')) * 100 + (c2 - '0');
+  return (c0 - '0') * 100 + (c1 - '0') * 10 + (c2 - '0');
+}
+
+// Recovers the counters of spanning tree arcs from flow conservation, see llvm/lib/ProfileData/GCOV.cpp.
+uint64_t PropagateArcCounts(
+  const GcovFunctionNotes &fn,
+  std::vector<uint64_t> &counts,
+  std::vector<bool> &visited,
+  size_t block,
+  size_t pred
+) {
+  if (visited[block])
+    return 0;
+  visited[block] = true;
+  uint64_t excess = 0;
+  for (size_t arc : fn.in_arcs[block]) {
+    if (arc == pred)
+      continue;
+    bool on_tree = fn.arcs[arc].flags & kGcovArcOnTree;
+    excess += on_tree ? PropagateArcCounts(fn, counts, visited, fn.arcs[arc].src, arc) : counts[arc];
+  }
+  for (size_t arc : fn.out_arcs[block]) {
+    if (arc == pred)
+      continue;
+    bool on_tree = fn.arcs[arc].flags & kGcovArcOnTree;
+    excess -= on_tree ? PropagateArcCounts(fn, counts, visited, fn.arcs[arc].dst, arc) : counts[arc];
+  }
+  if ((int64_t) excess < 0)
+    excess = -excess;
+  if (pred != kNoArc)
+    counts[pred] = excess;
+  return excess;
+}
+
+void MarkCoveredSites(const GcovFunctionNotes &fn, std::vector<uint64_t> &counts, GcovCoverage &coverage) {
+  size_t num_blocks = fn.block_lines.size();
+  std::vector<bool> visited(num_blocks, false);
+  for (size_t block = 0; block < num_blocks; ++block)
+    PropagateArcCounts(fn, counts, visited, block, kNoArc);
+
+  std::vector<uint64_t> block_counts(num_blocks, 0);
+  for (size_t arc = 0; arc < fn.arcs.size(); ++arc) {
+    const GcovArcNotes &arc_notes = fn.arcs[arc];
+    if (arc_notes.exit_link)
+      continue;
+    block_counts[arc_notes.src] += counts[arc];
+    if (arc_notes.branch_site >= 0 && counts[arc] > 0)
+      coverage.GetBranches().Set((size_t) arc_notes.branch_site);
+  }
+  for (size_t block = 0; block < num_blocks; ++block) {
+    if (block_counts[block] == 0)
+      continue;
+    for (int line_site : fn.block_lines[block])
+      coverage.GetLines().Set((size_t) line_site);
+  }
+  if (fn.func_site >= 0 && num_blocks > 0 && block_counts[0] > 0)
+    coverage.GetFunctions().Set((size_t) fn.func_site);
+}
+
+// ##########
+// # SiteBitset
+// #####
+
+SiteBitset::SiteBitset() : SiteBitset(0) {}
+SiteBitset::SiteBitset(size_t size) : size_(size), words_((size + 63) / 64, 0) {}
+size_t SiteBitset::GetSize() const {
+  return size_;
+}
+void SiteBitset::Set(size_t site) {
+  words_[site / 64] |= 1ull << (site % 64);
+}
+bool SiteBitset::Test(size_t site) const {
+  return site < size_ && (words_[site / 64] >> (site % 64)) & 1ull;
+}
+int SiteBitset::Count() const {
+  int count = 0;
+  for (uint64_t word : words_)
+    count += __builtin_popcountll(word);
+  return count;
+}
+std::vector<int> SiteBitset::GetSetSites() const {
+  std::vector<int> sites;
+  for (size_t i = 0; i < words_.size(); ++i) {
+    for (uint64_t bits = words_[i]; bits != 0; bits &= bits - 1)
+      sites.push_back((int) (i * 64 + __builtin_ctzll(bits)));
+  }
+  return sites;
+}
+int SiteBitset::MergeFrom(const SiteBitset &other, std::vector<int> *added) {
+  if (other.size_ > size_) {
+    size_ = other.size_;
+    words_.resize(other.words_.size(), 0);
+  }
+  int new_sites = 0;
+  for (size_t i = 0; i < other.words_.size(); ++i) {
+    uint64_t fresh = other.words_[i] & ~words_[i];
+    if (fresh == 0)
+      continue;
+    new_sites += __builtin_popcountll(fresh);
+    words_[i] |= fresh;
+    if (added == nullptr)
+      continue;
+    for (uint64_t bits = fresh; bits != 0; bits &= bits - 1)
+      added->push_back((int) (i * 64 + __builtin_ctzll(bits)));
+  }
+  return new_sites;
+}
+
+// ##########
+// # GcovCoverage
+// #####
+
+GcovCoverage::GcovCoverage() : GcovCoverage(0, 0, 0) {}
+GcovCoverage::GcovCoverage(size_t line_tot, size_t branch_tot, size_t func_tot)
+  : lines_(line_tot), branches_(branch_tot), functions_(func_tot) {}
+SiteBitset &GcovCoverage::GetLines() {
+  return lines_;
+}
+SiteBitset &GcovCoverage::GetBranches() {
+  return branches_;
+}
+SiteBitset &GcovCoverage::GetFunctions() {
+  return functions_;
+}
+const SiteBitset &GcovCoverage::GetLines() const {
+  return lines_;
+}
+const SiteBitset &GcovCoverage::GetBranches() const {
+  return branches_;
+}
+const SiteBitset &GcovCoverage::GetFunctions() const {
+  return functions_;
+}
+CoverageReport GcovCoverage::ToReport() const {
+  return {
+    lines_.Count(),
+    branches_.Count(),
+    (int) lines_.GetSize(),
+    (int) branches_.GetSize(),
+    functions_.Count(),
+    (int) functions_.GetSize(),
+  };
+}
+void GcovCoverage::MergeFrom(const GcovCoverage &other, CoverageDelta *delta) {
+  lines_.MergeFrom(other.lines_, delta != nullptr ? &delta->GetLines() : nullptr);
+  branches_.MergeFrom(other.branches_, delta != nullptr ? &delta->GetBranches() : nullptr);
+  functions_.MergeFrom(other.functions_, delta != nullptr ? &delta->GetFunctions() : nullptr);
+}
+
+// ##########
+// # GcovBuffer
+// #####
+
+GcovBuffer::GcovBuffer(std::vector<char> data) : data_(std::move(data)), pos_(0) {}
+bpstd::optional<GcovBuffer> GcovBuffer::FromFile(const std::string &filename) {
+  std::ifstream in(filename, std::ios::binary);
+  if (!in)
+    return bpstd::nullopt;
+  std::vector<char> data{std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>()};
+  return GcovBuffer{std::move(data)};
+}
+bool GcovBuffer::ReadWord(uint32_t &value) {
+  if (pos_ + 4 > data_.size())
+    return false;
+  std::memcpy(&value, data_.data() + pos_, 4);
+  pos_ += 4;
+  return true;
+}
+bool GcovBuffer::ReadInt64(uint64_t &value) {
+  uint32_t lo, hi;
+  if (!ReadWord(lo) || !ReadWord(hi))
+    return false;
+  value = ((uint64_t) hi << 32u) | lo;
+  return true;
+}
+bool GcovBuffer::ReadString(int version, std::string &value) {
+  uint32_t length;
+  if (!ReadWord(length))
+    return false;
+  size_t bytes = version >= kGcovV1200 ? length : 4ull * length;
+  if (pos_ + bytes > data_.size())
+    return false;
+  const char *begin = data_.data() + pos_;
+  value.assign(begin, strnlen(begin, bytes));
+  pos_ += bytes;
+  return true;
+}
+size_t GcovBuffer::Tell() const {
+  return pos_;
+}
+void GcovBuffer::Seek(size_t pos) {
+  pos_ = pos;
+}
+
+// ##########
+// # GcovCoverageReader
+// #####
+
+const std::vector<std::string> &GcovCoverageReader::kExcludedPathPrefixes = {"/usr/include/", "/usr/lib/"};
+GcovCoverageReader::GcovCoverageReader(std::string object_files_dir)
+  : object_files_dir_(std::move(object_files_dir)), notes_(), line_ids_(), branch_ids_(), func_ids_() {}
+GcovCoverageReader::~GcovCoverageReader() = default;
+size_t GcovCoverageReader::GetLineTot() const {
+  return line_ids_.size();
+}
+size_t GcovCoverageReader::GetBranchTot() const {
+  return branch_ids_.size();
+}
+size_t GcovCoverageReader::GetFuncTot() const {
+  return func_ids_.size();
+}
+int GcovCoverageReader::AssignSite(
+  std::map<std::string, size_t> &site_ids,
+  const std::string &filename,
+  const std::string &key
+) {
+  for (const auto &prefix : kExcludedPathPrefixes) {
+    if (filename.compare(0, prefix.size(), prefix) == 0)
+      return -1;
+  }
+  auto inserted = site_ids.emplace(filename + ':' + key, site_ids.size());
+  return (int) inserted.first->second;
+}
+bool GcovCoverageReader::Load() {
+  namespace fs = std::experimental::filesystem;
+  notes_.clear();
+  line_ids_.clear();
+  branch_ids_.clear();
+  func_ids_.clear();
+  const fs::path &root = object_files_dir_;
+  for (const auto &entry : fs::recursive_directory_iterator(root)) {
+    const fs::path &gcno = entry.path();
+    if (gcno.extension() != ".gcno")
+      continue;
+    std::string gcda_relative_path = gcno.string().substr(root.string().size());
+    if (gcda_relative_path.front() != '/')
+      gcda_relative_path.insert(0, 1, '/');
+    gcda_relative_path.replace(gcda_relative_path.size() - 5, 5, ".gcda");
+    if (!LoadNotes(gcno.string(), gcda_relative_path)) {
+      Logger::Warn("GcovCoverageReader", "Unsupported gcno file: " + gcno.string());
+      return false;
+    }
+  }
+  if (notes_.empty())
+    return false;
+  Logger::Info(
+    "Loaded " + std::to_string(notes_.size()) + " gcno files: " + std::to_string(GetLineTot()) + " lines, "
+      + std::to_string(GetBranchTot()) + " branches, " + std::to_string(GetFuncTot()) + " functions.");
+  return true;
+}
+bool GcovCoverageReader::LoadNotes(const std::string &gcno_path, const std::string &gcda_relative_path) {
+  bpstd::optional<GcovBuffer> opt_buf = GcovBuffer::FromFile(gcno_path);
+  if (!opt_buf.has_value())
+    return false;
+  GcovBuffer &buf = opt_buf.value();
+  uint32_t magic, version_word, stamp;
+  if (!buf.ReadWord(magic) || magic != kGcnoMagic || !buf.ReadWord(version_word) || !buf.ReadWord(stamp))
+    return false;
+  std::unique_ptr<GcovNotesFile> notes{new GcovNotesFile{gcda_relative_path, DecodeGcovVersion(version_word), stamp}};
+  int version = notes->version;
+  std::string cwd;
+  uint32_t checksum, has_unexecuted_blocks;
+  if (version >= kGcovV1200 && !buf.ReadWord(checksum))
+    return false;
+  if (version >= kGcovV900 && !buf.ReadString(version, cwd))
+    return false;
+  if (version >= kGcovV800 && !buf.ReadWord(has_unexecuted_blocks))
+    return false;
+
+  GcovFunctionNotes *fn = nullptr;
+  auto finish_function = [&]() {
+    if (fn == nullptr)
+      return;
+    size_t num_blocks = fn->block_lines.size();
+    if (num_blocks >= 2) {
+      uint32_t sink = version < kGcovV408 ? (uint32_t) num_blocks - 1 : 1;
+      fn->out_arcs[sink].push_back(fn->arcs.size());
+      fn->in_arcs[0].push_back(fn->arcs.size());
+      fn->arcs.push_back({sink, 0, kGcovArcOnTree, true, -1});
+    }
+    for (size_t block = 0; block < num_blocks; ++block) {
+      const std::pair<std::string, uint32_t> &last_line = fn->block_last_line[block];
+      std::vector<size_t> branch_arcs;
+      for (size_t arc : fn->out_arcs[block]) {
+        if (!fn->arcs[arc].exit_link && !(fn->arcs[arc].flags & kGcovArcFake))
+          branch_arcs.push_back(arc);
+      }
+      if (branch_arcs.size() < 2 || last_line.second == 0)
+        continue;
+      for (size_t i = 0; i < branch_arcs.size(); ++i) {
+        const std::string &key = std::to_string(last_line.second) + ':' + std::to_string(i);
+        fn->arcs[branch_arcs[i]].branch_site = AssignSite(branch_ids_, last_line.first, key);
+      }
+    }
+    fn = nullptr;
+  };
+
+  uint32_t tag, length;
+  while (buf.ReadWord(tag) && tag != 0 && buf.ReadWord(length)) {
+    size_t pos = buf.Tell();
+    size_t length_in_bytes = version >= kGcovV1200 ? length : 4ull * length;
+    if (tag == kGcovTagFunction) {
+      finish_function();
+      GcovFunctionNotes parsed{};
+      std::string name;
+      uint32_t ignored;
+      if (!buf.ReadWord(parsed.ident) || !buf.ReadWord(parsed.lineno_checksum))
+        return false;
+      if (version >= kGcovV407 && !buf.ReadWord(parsed.cfg_checksum))
+        return false;
+      if (!buf.ReadString(version, name))
+        return false;
+      if (version >= kGcovV800 && !buf.ReadWord(ignored)) // artificial
+        return false;
+      if (!buf.ReadString(version, parsed.filename) || !buf.ReadWord(parsed.start_line))
+        return false;
+      parsed.func_site = AssignSite(func_ids_, parsed.filename, std::to_string(parsed.start_line) + ':' + name);
+      notes->function_index[parsed.ident] = notes->functions.size();
+      notes->functions.push_back(std::move(parsed));
+      fn = &notes->functions.back();
+    } else if (tag == kGcovTagBlocks && fn != nullptr) {
+      uint32_t num_blocks = length_in_bytes / 4;
+      if (version >= kGcovV800 && !buf.ReadWord(num_blocks))
+        return false;
+      fn->in_arcs.resize(num_blocks);
+      fn->out_arcs.resize(num_blocks);
+      fn->block_lines.resize(num_blocks);
+      fn->block_last_line.resize(num_blocks, {"", 0});
+    } else if (tag == kGcovTagArcs && fn != nullptr) {
+      uint32_t src;
+      if (!buf.ReadWord(src) || src >= fn->block_lines.size())
+        return false;
+      for (size_t i = 0, e = (length_in_bytes / 4 - 1) / 2; i < e; ++i) {
+        uint32_t dst, flags;
+        if (!buf.ReadWord(dst) || !buf.ReadWord(flags) || dst >= fn->block_lines.size())
+          return false;
+        size_t arc = fn->arcs.size();
+        fn->arcs.push_back({src, dst, flags, false, -1});
+        fn->out_arcs[src].push_back(arc);
+        fn->in_arcs[dst].push_back(arc);
+        if (!(flags & kGcovArcOnTree))
+          fn->counted_arcs.push_back(arc);
+      }
+    } else if (tag == kGcovTagLines && fn != nullptr) {
+      uint32_t block, line;
+      if (!buf.ReadWord(block) || block >= fn->block_lines.size())
+        return false;
+      std::string filename = fn->filename;
+      while (buf.ReadWord(line)) {
+        if (line != 0) {
+          int line_site = AssignSite(line_ids_, filename, std::to_string(line));
+          if (line_site >= 0)
+            fn->block_lines[block].push_back(line_site);
+          fn->block_last_line[block] = {filename, line};
+          continue;
+        }
+        if (!buf.ReadString(version, filename))
+          return false;
+        if (filename.empty())
+          break;
+      }
+    }
+    buf.Seek(pos + length_in_bytes);
+  }
+  finish_function();
+  notes_.push_back(std::move(notes));
+  return true;
+}
+GcovCoverage GcovCoverageReader::Read(const std::string &gcda_dir) const {
+  GcovCoverage coverage{GetLineTot(), GetBranchTot(), GetFuncTot()};
+  for (const auto &notes : notes_)
+    ReadCounters(*notes, gcda_dir + notes->gcda_relative_path, coverage);
+  return coverage;
+}
+// Only the gcda files matching a loaded gcno file are removed, no directory walk.
+void GcovCoverageReader::RemoveCounters(const std::string &gcda_dir) const {
+  for (const auto &notes : notes_)
+    std::remove((gcda_dir + notes->gcda_relative_path).c_str());
+}
+// A missing or stale (stamp mismatch) gcda file simply contributes nothing.
+void GcovCoverageReader::ReadCounters(
+  const GcovNotesFile &notes,
+  const std::string &gcda_path,
+  GcovCoverage &coverage
+) const {
+  bpstd::optional<GcovBuffer> opt_buf = GcovBuffer::FromFile(gcda_path);
+  if (!opt_buf.has_value())
+    return;
+  GcovBuffer &buf = opt_buf.value();
+  uint32_t magic, version_word, stamp;
+  if (!buf.ReadWord(magic) || magic != kGcdaMagic || !buf.ReadWord(version_word) || !buf.ReadWord(stamp))
+    return;
+  if (stamp != notes.stamp)
+    return;
+  int version = notes.version;
+  uint32_t checksum;
+  if (version >= kGcovV1200 && !buf.ReadWord(checksum))
+    return;
+  const GcovFunctionNotes *fn = nullptr;
+  uint32_t tag, length;
+  while (buf.ReadWord(tag) && tag != 0 && buf.ReadWord(length)) {
+    size_t pos = buf.Tell();
+    if (version >= kGcovV1200 && (int32_t) length < 0) {
+      fn = nullptr; // all counters are zero, no payload follows
+      continue;
+    }
+    size_t length_in_bytes = version >= kGcovV1200 ? length : 4ull * length;
+    if (tag == kGcovTagFunction) {
+      fn = nullptr;
+      uint32_t ident, lineno_checksum, cfg_checksum = 0;
+      bool parsed = length_in_bytes >= 8 && buf.ReadWord(ident) && buf.ReadWord(lineno_checksum);
+      if (parsed && version >= kGcovV407)
+        parsed = buf.ReadWord(cfg_checksum);
+      auto it = parsed ? notes.function_index.find(ident) : notes.function_index.end();
+      if (it != notes.function_index.end()) {
+        const GcovFunctionNotes &candidate = notes.functions[it->second];
+        if (candidate.lineno_checksum == lineno_checksum && candidate.cfg_checksum == cfg_checksum)
+          fn = &candidate;
+      }
+    } else if (tag == kGcovTagCounterArcs && fn != nullptr) {
+      if (length_in_bytes == 8 * fn->counted_arcs.size()) {
+        std::vector<uint64_t> counts(fn->arcs.size(), 0);
+        bool complete = true;
+        for (size_t arc : fn->counted_arcs)
+          complete = complete && buf.ReadInt64(counts[arc]);
+        if (complete)
+          MarkCoveredSites(*fn, counts, coverage);
+      }
+      fn = nullptr;
+    }
+    buf.Seek(pos + length_in_bytes);
+  }
+}
+
+} // namespace cxxfoozz
@@ -0,0 +1,855 @@
+#include "harness.hpp"
+#include "logger.hpp"
+#include "statement.hpp"
+#include "type.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <fstream>
+#include <set>
+#include <sstream>
+#include <utility>
+
+namespace cxxfoozz {
+
+// ##########
+// # Bytecode
+// #####
+// Header: "CXFZ" u32:version u32:stmt_count, followed by one record per statement (1 slot each):
+//   kOpPrimitive u8:kind u8:op u8:argc operand*
+//   kOpCall      u32:stub u8:argc operand*   (the invoking object, if any, is the first operand)
+//   kOpString    u32:capacity u32:len bytes
+// Operand: kArgRef u32:slot | kArgConst u8:kind u64:payload | kArgNull | kArgString u32:len bytes
+
+const char *kBytecodeMagic = "CXFZ";
+const unsigned int kBytecodeVersion = 1;
+
+enum HarnessOpcode {
+  kOpPrimitive = 1,
+  kOpCall,
+  kOpString,
+};
+
+enum HarnessOperandTag {
+  kArgRef = 1,
+  kArgConst,
+  kArgNull,
+  kArgString,
+};
+
+// Must be kept in sync with the Kind enum of the harness runtime below.
+enum HarnessKind {
+  kKindNone = 0,
+  kKindBool, kKindChar, kKindUChar, kKindShort, kKindUShort, kKindInt, kKindUInt,
+  kKindLong, kKindULong, kKindLLong, kKindULLong, kKindFloat, kKindDouble, kKindWChar,
+  kKindCharArray,
+  kKindObject,
+};
+
+const char *kPrimitiveKindTypeNames[] = {
+  "", "bool", "char", "unsigned char", "short", "unsigned short", "int", "unsigned int",
+  "long", "unsigned long", "long long", "unsigned long long", "float", "double", "wchar_t",
+};
+
+void AppendU8(std::string &out, unsigned int value) {
+  out.push_back((char) (value & 0xffu));
+}
+void AppendU32(std::string &out, unsigned int value) {
+  for (int i = 0; i < 4; i++)
+    AppendU8(out, (value >> (8 * i)) & 0xffu);
+}
+void AppendU64(std::string &out, unsigned long long value) {
+  for (int i = 0; i < 8; i++)
+    AppendU8(out, (unsigned int) ((value >> (8 * i)) & 0xffull));
+}
+void AppendBytes(std::string &out, const std::string &bytes) {
+  AppendU32(out, (unsigned int) bytes.size());
+  out += bytes;
+}
+
+// ##########
+// # Type classification
+// #####
+
+unsigned long PointerDepth(const TypeWithModifier &twm) {
+  const std::multiset<Modifier> &mods = twm.GetModifiers();
+  return mods.count(Modifier::kPointer) + mods.count(Modifier::kArray);
+}
+
+HarnessKind PrimitiveKindOf(const TypeWithModifier &twm) {
+  if (!twm.IsPrimitiveType() || PointerDepth(twm) != 0)
+    return kKindNone;
+  bool is_unsigned = twm.IsUnsigned();
+  const std::shared_ptr<PrimitiveType> &primitive_type = std::static_pointer_cast<PrimitiveType>(twm.GetType());
+  switch (primitive_type->GetPrimitiveTypeVariant()) {
+    case PrimitiveTypeVariant::kVoid:
+    case PrimitiveTypeVariant::kNullptrType:
+      return kKindNone;
+    case PrimitiveTypeVariant::kBoolean:
+      return kKindBool;
+    case PrimitiveTypeVariant::kShort:
+      return is_unsigned ? kKindUShort : kKindShort;
+    case PrimitiveTypeVariant::kCharacter:
+      return is_unsigned ? kKindUChar : kKindChar;
+    case PrimitiveTypeVariant::kInteger:
+      return is_unsigned ? kKindUInt : kKindInt;
+    case PrimitiveTypeVariant::kLong:
+      return is_unsigned ? kKindULong : kKindLong;
+    case PrimitiveTypeVariant::kLongLong:
+      return is_unsigned ? kKindULLong : kKindLLong;
+    case PrimitiveTypeVariant::kFloat:
+      return kKindFloat;
+    case PrimitiveTypeVariant::kDouble:
+      return kKindDouble;
+    case PrimitiveTypeVariant::kWideCharacter:
+      return kKindWChar;
+  }
+  return kKindNone;
+}
+
+bool IsFloatingKind(HarnessKind kind) {
+  return kind == kKindFloat || kind == kKindDouble;
+}
+bool IsUnsignedKind(HarnessKind kind) {
+  return kind == kKindUChar || kind == kKindUShort || kind == kKindUInt || kind == kKindULong || kind == kKindULLong;
+}
+
+bool IsCharPointer(const TypeWithModifier &twm) {
+  return twm.GetType() == PrimitiveType::kCharacter && !twm.IsUnsigned() && PointerDepth(twm) == 1;
+}
+
+std::shared_ptr<ClassTypeModel> NonTemplatedClassOf(const TypeWithModifier &twm) {
+  if (!twm.IsClassType())
+    return nullptr;
+  const std::shared_ptr<ClassType> &class_type = std::static_pointer_cast<ClassType>(twm.GetType());
+  const std::shared_ptr<ClassTypeModel> &model = class_type->GetModel();
+  if (model == nullptr || model->IsTemplatedClass())
+    return nullptr;
+  return model;
+}
+
+TypeWithModifier TWMFromClangType(const clang::QualType &qual_type) {
+  const TWMSpec &twm_spec = TWMSpec::ByClangType(qual_type, nullptr);
+  return TypeWithModifier::FromSpec(twm_spec);
+}
+
+// Argument expression of a stub, reading the idx-th slot. Empty = unsupported argument type.
+bpstd::optional<std::string> ArgumentAsString(const TypeWithModifier &twm, int idx) {
+  const std::string &slot = "a[" + std::to_string(idx) + "]";
+  unsigned long depth = PointerDepth(twm);
+  HarnessKind kind = PrimitiveKindOf(twm);
+  if (kind != kKindNone) {
+    if (twm.IsReference() && !twm.IsConst())
+      return bpstd::nullopt; // would need a writable primitive of the exact type
+    return bpstd::make_optional("As<" + std::string(kPrimitiveKindTypeNames[kind]) + ">(" + slot + ")");
+  }
+  if (IsCharPointer(twm) && !twm.IsReference() && !twm.IsRValueReference())
+    return bpstd::make_optional("CStr(" + slot + ")");
+
+  const std::shared_ptr<ClassTypeModel> &model = NonTemplatedClassOf(twm);
+  if (model == nullptr)
+    return bpstd::nullopt;
+  const std::string &obj = "Obj< ::" + model->GetQualifiedName() + ">(" + slot + ")";
+  if (depth == 0) {
+    if (twm.IsRValueReference())
+      return bpstd::make_optional("std::move(*" + obj + ")");
+    return bpstd::make_optional('*' + obj);
+  } else if (depth == 1 && !twm.IsReference() && !twm.IsRValueReference()) {
+    return bpstd::make_optional(obj);
+  }
+  return bpstd::nullopt;
+}
+
+// ##########
+// # Harness runtime (emitted verbatim)
+// #####
+
+const char *kHarnessRuntimeHead = R"HARNESS(
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace cxxfoozz_harness {
+
+enum Kind {
+  kNone = 0,
+  kBool, kChar, kUChar, kShort, kUShort, kInt, kUInt,
+  kLong, kULong, kLLong, kULLong, kFloat, kDouble, kWChar,
+  kCharArray,
+  kObject,
+};
+
+struct Slot {
+  int kind;
+  long long s;
+  unsigned long long u;
+  double f;
+  std::shared_ptr<void> ptr;
+  Slot() : kind(kNone), s(0), u(0), f(0), ptr() {}
+};
+
+inline bool IsFloating(int kind) { return kind == kFloat || kind == kDouble; }
+inline bool IsUnsigned(int kind) {
+  return kind == kUChar || kind == kUShort || kind == kUInt || kind == kULong || kind == kULLong;
+}
+
+template<typename T>
+T As(const Slot &slot) {
+  if (IsFloating(slot.kind)) return (T) slot.f;
+  if (IsUnsigned(slot.kind)) return (T) slot.u;
+  return (T) slot.s;
+}
+template<typename T>
+Slot Make(int kind, T value) {
+  Slot slot;
+  slot.kind = kind;
+  if (IsFloating(kind)) slot.f = (double) value;
+  else if (IsUnsigned(kind)) slot.u = (unsigned long long) value;
+  else slot.s = (long long) value;
+  return slot;
+}
+template<typename T>
+Slot Own(T *obj) {
+  Slot slot;
+  slot.kind = kObject;
+  slot.ptr = std::shared_ptr<T>(obj);
+  return slot;
+}
+template<typename T>
+Slot Alias(const T *obj) {
+  Slot slot;
+  slot.kind = kObject;
+  slot.ptr = std::shared_ptr<void>(std::shared_ptr<void>(), const_cast<void *>(static_cast<const void *>(obj)));
+  return slot;
+}
+inline Slot AliasCStr(const char *str) {
+  Slot slot = Alias(str);
+  slot.kind = kCharArray;
+  return slot;
+}
+template<typename T>
+T *Obj(const Slot &slot) { return static_cast<T *>(slot.ptr.get()); }
+inline char *CStr(const Slot &slot) { return static_cast<char *>(slot.ptr.get()); }
+
+typedef Slot (*Stub)(Slot *a);
+
+)HARNESS";
+
+const char *kHarnessRuntimeTail = R"HARNESS(
+enum PrimitiveOp { kNop = 0, kAdd, kSub, kMul, kDiv, kMod, kMinus };
+
+template<typename T>
+T Mod(T lhs, T rhs, std::true_type) { return lhs % rhs; }
+template<typename T>
+T Mod(T lhs, T, std::false_type) { return lhs; } // never emitted for floating types
+
+template<typename T>
+Slot EvalAs(int kind, int op, const std::vector<Slot> &operands) {
+  T lhs = As<T>(operands[0]);
+  T rhs = operands.size() > 1 ? As<T>(operands[1]) : T();
+  switch (op) {
+    case kAdd: return Make<T>(kind, lhs + rhs);
+    case kSub: return Make<T>(kind, lhs - rhs);
+    case kMul: return Make<T>(kind, lhs * rhs);
+    case kDiv: return Make<T>(kind, lhs / rhs);
+    case kMod: return Make<T>(kind, Mod<T>(lhs, rhs, std::is_integral<T>()));
+    case kMinus: return Make<T>(kind, -lhs);
+    default: return Make<T>(kind, lhs);
+  }
+}
+inline Slot Eval(int kind, int op, const std::vector<Slot> &operands) {
+  switch (kind) {
+    case kBool: return EvalAs<bool>(kind, op, operands);
+    case kChar: return EvalAs<char>(kind, op, operands);
+    case kUChar: return EvalAs<unsigned char>(kind, op, operands);
+    case kShort: return EvalAs<short>(kind, op, operands);
+    case kUShort: return EvalAs<unsigned short>(kind, op, operands);
+    case kInt: return EvalAs<int>(kind, op, operands);
+    case kUInt: return EvalAs<unsigned int>(kind, op, operands);
+    case kLong: return EvalAs<long>(kind, op, operands);
+    case kULong: return EvalAs<unsigned long>(kind, op, operands);
+    case kLLong: return EvalAs<long long>(kind, op, operands);
+    case kULLong: return EvalAs<unsigned long long>(kind, op, operands);
+    case kFloat: return EvalAs<float>(kind, op, operands);
+    case kDouble: return EvalAs<double>(kind, op, operands);
+    case kWChar: return EvalAs<wchar_t>(kind, op, operands);
+    default: return Slot();
+  }
+}
+
+struct BadInput {};
+
+class Reader {
+ public:
+  explicit Reader(const std::string &input) : input_(input), pos_(0) {}
+  unsigned int U8() {
+    if (pos_ >= input_.size()) throw BadInput();
+    return (unsigned char) input_[pos_++];
+  }
+  unsigned int U32() {
+    unsigned int value = 0;
+    for (int i = 0; i < 4; i++) value |= U8() << (8 * i);
+    return value;
+  }
+  unsigned long long U64() {
+    unsigned long long value = 0;
+    for (int i = 0; i < 8; i++) value |= (unsigned long long) U8() << (8 * i);
+    return value;
+  }
+  std::string Bytes(unsigned int len) {
+    if (input_.size() - pos_ < len) throw BadInput();
+    std::string result = input_.substr(pos_, len);
+    pos_ += len;
+    return result;
+  }
+ private:
+  const std::string &input_;
+  size_t pos_;
+};
+
+inline Slot NewCharArray(unsigned int capacity, const std::string &content) {
+  std::shared_ptr<char> buffer(new char[capacity + 1](), std::default_delete<char[]>());
+  std::memcpy(buffer.get(), content.data(), std::min<size_t>(content.size(), capacity));
+  Slot slot;
+  slot.kind = kCharArray;
+  slot.ptr = buffer;
+  return slot;
+}
+
+inline Slot ReadOperand(Reader &reader, const std::vector<Slot> &slots) {
+  switch (reader.U8()) {
+    case 1: {
+      unsigned int idx = reader.U32();
+      if (idx >= slots.size()) throw BadInput();
+      return slots[idx];
+    }
+    case 2: {
+      int kind = (int) reader.U8();
+      unsigned long long payload = reader.U64();
+      Slot slot;
+      slot.kind = kind;
+      if (IsFloating(kind)) std::memcpy(&slot.f, &payload, sizeof(double));
+      else if (IsUnsigned(kind)) slot.u = payload;
+      else slot.s = (long long) payload;
+      return slot;
+    }
+    case 3: {
+      Slot slot;
+      slot.kind = kObject;
+      return slot;
+    }
+    case 4: {
+      const std::string &content = reader.Bytes(reader.U32());
+      return NewCharArray((unsigned int) content.size(), content);
+    }
+    default:
+      throw BadInput();
+  }
+}
+
+inline Slot Step(Reader &reader, const std::vector<Slot> &slots) {
+  switch (reader.U8()) {
+    case 1: {
+      int kind = (int) reader.U8();
+      int op = (int) reader.U8();
+      unsigned int argc = reader.U8();
+      std::vector<Slot> operands;
+      for (unsigned int i = 0; i < argc; i++) operands.push_back(ReadOperand(reader, slots));
+      if (operands.empty()) throw BadInput();
+      return Eval(kind, op, operands);
+    }
+    case 2: {
+      unsigned int stub = reader.U32();
+      unsigned int argc = reader.U8();
+      if (stub >= kStubCount) throw BadInput();
+      std::vector<Slot> args;
+      for (unsigned int i = 0; i < argc; i++) args.push_back(ReadOperand(reader, slots));
+      args.push_back(Slot()); // keeps data() valid for nullary stubs
+      return kStubs[stub](args.data());
+    }
+    case 3: {
+      unsigned int capacity = reader.U32();
+      const std::string &content = reader.Bytes(reader.U32());
+      return NewCharArray(capacity, content);
+    }
+    default:
+      throw BadInput();
+  }
+}
+
+inline int Run(const std::string &input) {
+  Reader reader(input);
+  std::vector<Slot> slots;
+  unsigned int stmt_count = 0;
+  try {
+    if (reader.Bytes(4) != "CXFZ" || reader.U32() != kBytecodeVersion) return kBadInputReturnCode;
+    stmt_count = reader.U32();
+  } catch (const BadInput &) {
+    return kBadInputReturnCode;
+  }
+  slots.reserve(stmt_count);
+  int return_code = 0;
+  try {
+    for (unsigned int i = 0; i < stmt_count; i++) slots.push_back(Step(reader, slots));
+  } catch (const BadInput &) {
+    return_code = kBadInputReturnCode;
+  } catch (...) {
+    return_code = kExceptionReturnCode;
+  }
+  while (!slots.empty()) slots.pop_back(); // destroy in reverse order, as locals of a driver would be
+  return return_code;
+}
+
+} // namespace cxxfoozz_harness
+
+int cxxfoozz_body(int argc, char **argv) {
+  std::FILE *in = argc > 1 ? std::fopen(argv[1], "rb") : stdin;
+  if (in == nullptr) return cxxfoozz_harness::kBadInputReturnCode;
+  std::string input;
+  char buffer[4096];
+  size_t n;
+  while ((n = std::fread(buffer, 1, sizeof(buffer), in)) > 0) input.append(buffer, n);
+  if (in != stdin) std::fclose(in);
+  return cxxfoozz_harness::Run(input);
+}
+)HARNESS";
+
+// Exit code for unreadable bytecode, reported like a crash so the attempt falls back to a compiled driver.
+const int kHarnessBadInputReturnCode = 3;
+
+int CountLines(const std::string &str) {
+  return (int) std::count(str.begin(), str.end(), '\n');
+}
+
+// ##########
+// # HarnessStub
+// #####
+
+HarnessStub::HarnessStub(std::shared_ptr<Executable> executable, bool has_invoking_obj, bool returns_value)
+  : executable_(std::move(executable)), has_invoking_obj_(has_invoking_obj), returns_value_(returns_value) {}
+const std::shared_ptr<Executable> &HarnessStub::GetExecutable() const {
+  return executable_;
+}
+bool HarnessStub::HasInvokingObj() const {
+  return has_invoking_obj_;
+}
+bool HarnessStub::IsReturnsValue() const {
+  return returns_value_;
+}
+
+// ##########
+// # InterpreterHarness
+// #####
+
+const std::string &InterpreterHarness::kHarnessCppFilename = "harness.cpp";
+const std::string &InterpreterHarness::kHarnessObjectFilename = "harness.o";
+const std::string &InterpreterHarness::kHarnessExeFilename = "harness";
+InterpreterHarness::InterpreterHarness(
+  std::shared_ptr<ImportWriter> import_writer,
+  std::shared_ptr<ProgramContext> program_ctx,
+  std::string harness_dir
+)
+  : import_writer_(std::move(import_writer)),
+    program_ctx_(std::move(program_ctx)),
+    harness_dir_(std::move(harness_dir)) {}
+bool InterpreterHarness::IsReady() const {
+  return ready_;
+}
+std::string InterpreterHarness::GetExecutable() const {
+  return harness_dir_ + "/" + kHarnessExeFilename;
+}
+int InterpreterHarness::GetStubCount() const {
+  return (int) stubs_.size();
+}
+
+void InterpreterHarness::CollectStubs() {
+  const std::vector<std::shared_ptr<Executable>> &executables = program_ctx_->GetExecutables();
+  std::vector<std::shared_ptr<Executable>> candidates(executables.begin(), executables.end());
+  for (const auto &creator : program_ctx_->GetCreators())
+    candidates.push_back(creator);
+
+  std::set<std::shared_ptr<Executable>> visited;
+  stubs_.clear();
+  for (const auto &executable : candidates) {
+    if (!visited.insert(executable).second)
+      continue;
+    const std::shared_ptr<ClassTypeModel> &owner = executable->GetOwner();
+    bool templated_owner = owner != nullptr && owner->IsTemplatedClass();
+    if (executable->IsTemplatedExecutable() || templated_owner || executable->IsConversionDecl()
+      || executable->IsExcluded())
+      continue;
+
+    bool is_ctor = executable->GetExecutableVariant() == ExecutableVariant::kConstructor;
+    bool has_invoking_obj = !is_ctor && executable->IsMember() && !executable->IsNotRequireInvokingObj();
+    bool returns_value = is_ctor;
+    const bpstd::optional<clang::QualType> &opt_ret_type = executable->GetReturnType();
+    if (!is_ctor && opt_ret_type.has_value()) {
+      const TypeWithModifier &ret_type = TWMFromClangType(opt_ret_type.value());
+      returns_value = PrimitiveKindOf(ret_type) != kKindNone || IsCharPointer(ret_type)
+        || (NonTemplatedClassOf(ret_type) != nullptr && PointerDepth(ret_type) <= 1);
+    }
+    HarnessStub stub{executable, has_invoking_obj, returns_value};
+    if (StubAsString(stub, 0).has_value())
+      stubs_.push_back(stub);
+  }
+}
+
+bpstd::optional<std::string> InterpreterHarness::StubAsString(const HarnessStub &stub, int stub_idx) const {
+  const std::shared_ptr<Executable> &executable = stub.GetExecutable();
+  const std::shared_ptr<ClassTypeModel> &owner = executable->GetOwner();
+  int first_arg_idx = stub.HasInvokingObj() ? 1 : 0;
+
+  std::stringstream arg_ss;
+  const std::vector<clang::QualType> &arguments = executable->GetArguments();
+  for (int i = 0; i < (int) arguments.size(); i++) {
+    const bpstd::optional<std::string> &arg = ArgumentAsString(TWMFromClangType(arguments[i]), first_arg_idx + i);
+    if (!arg.has_value())
+      return bpstd::nullopt;
+    arg_ss << (i == 0 ? "" : ", ") << arg.value();
+  }
+
+  std::stringstream call_ss;
+  bool is_ctor = executable->GetExecutableVariant() == ExecutableVariant::kConstructor;
+  if (is_ctor) {
+    if (owner == nullptr)
+      return bpstd::nullopt;
+    call_ss << "new ::" << owner->GetQualifiedName() << '{' << arg_ss.str() << '}';
+  } else if (stub.HasInvokingObj()) {
+    call_ss << "Obj< ::" << owner->GetQualifiedName() << ">(a[0])->" << executable->GetName()
+            << '(' << arg_ss.str() << ')';
+  } else if (owner != nullptr) {
+    call_ss << "::" << owner->GetQualifiedName() << "::" << executable->GetName() << '(' << arg_ss.str() << ')';
+  } else {
+    call_ss << "::" << executable->GetQualifiedName() << '(' << arg_ss.str() << ')';
+  }
+  const std::string &call = call_ss.str();
+
+  std::stringstream ss;
+  ss << "Slot stub_" << stub_idx << "(Slot *a) {\n";
+  if (is_ctor) {
+    ss << "  return Own(" << call << ");\n";
+  } else if (!stub.IsReturnsValue()) {
+    ss << "  " << call << ";\n";
+    ss << "  return Slot();\n";
+  } else {
+    const TypeWithModifier &ret_type = TWMFromClangType(executable->GetReturnType().value());
+    HarnessKind kind = PrimitiveKindOf(ret_type);
+    if (kind != kKindNone) {
+      ss << "  return Make<" << kPrimitiveKindTypeNames[kind] << ">(" << kind << ", " << call << ");\n";
+    } else if (IsCharPointer(ret_type)) {
+      ss << "  return AliasCStr(" << call << ");\n";
+    } else if (PointerDepth(ret_type) == 1) {
+      ss << "  return Alias(" << call << ");\n";
+    } else if (ret_type.IsReference() || ret_type.IsRValueReference()) {
+      ss << "  return Alias(std::addressof(" << call << "));\n";
+    } else {
+      const std::string &class_name = NonTemplatedClassOf(ret_type)->GetQualifiedName();
+      ss << "  return Own(new ::" << class_name << '(' << call << "));\n";
+    }
+  }
+  ss << "}\n";
+  return bpstd::make_optional(ss.str());
+}
+
+void InterpreterHarness::WriteToFile(const std::string &filename) {
+  std::ofstream target{filename};
+  if (!target) {
+    Logger::Error("[InterpreterHarness::WriteToFile]", "Problematic output file: " + filename + '\n');
+    return;
+  }
+  import_writer_->WriteHeader(target);
+  int line = import_writer_->GetLineUsage();
+
+  std::stringstream consts_ss;
+  consts_ss << "namespace cxxfoozz_harness {\n"
+            << "const int kExceptionReturnCode = " << ExecutionResult::kExceptionReturnCode << ";\n"
+            << "const int kBadInputReturnCode = " << kHarnessBadInputReturnCode << ";\n"
+            << "const unsigned int kBytecodeVersion = " << kBytecodeVersion << ";\n"
+            << "}\n";
+  const std::string &consts = consts_ss.str();
+  target << consts << kHarnessRuntimeHead;
+  line += CountLines(consts) + CountLines(kHarnessRuntimeHead);
+
+  stub_lines_.clear();
+  stub_index_.clear();
+  for (int idx = 0; idx < (int) stubs_.size(); idx++) {
+    const std::string stub_str = StubAsString(stubs_[idx], idx).value();
+    int stub_line_count = CountLines(stub_str);
+    stub_lines_.emplace_back(line + 1, line + stub_line_count);
+    stub_index_[stubs_[idx].GetExecutable()] = idx;
+    target << stub_str;
+    line += stub_line_count;
+  }
+
+  target << "\nconst Stub kStubs[] = {\n";
+  for (int idx = 0; idx < (int) stubs_.size(); idx++)
+    target << "  &stub_" << idx << ",\n";
+  target << "  nullptr,\n};\n";
+  target << "const unsigned int kStubCount = sizeof(kStubs) / sizeof(kStubs[0]) - 1;\n";
+  target << kHarnessRuntimeTail << ForkServerClient::kForkServerDriverSource;
+}
+
+// Compile errors are mapped back to stubs through the line numbers reported against the harness source,
+// link errors through the qualified name of the unresolved executable.
+bool InterpreterHarness::DropStubsByDiagnostics(CompilationResult result, const std::string &output) {
+  std::set<int> to_drop;
+  switch (result) {
+    case CompilationResult::kSuccess: {
+      return false;
+    }
+    case CompilationResult::kCompileFailed: {
+      const std::string &needle = kHarnessCppFilename + ":";
+      size_t pos = output.find(needle);
+      while (pos != std::string::npos) {
+        size_t num_begin = pos + needle.size();
+        size_t num_end = num_begin;
+        while (num_end < output.size() && isdigit((unsigned char) output[num_end]))
+          ++num_end;
+        if (num_end > num_begin) {
+          int line = std::stoi(output.substr(num_begin, num_end - num_begin));
+          for (int idx = 0; idx < (int) stub_lines_.size(); idx++) {
+            if (stub_lines_[idx].first <= line && line <= stub_lines_[idx].second)
+              to_drop.insert(idx);
+          }
+        }
+        pos = output.find(needle, num_end);
+      }
+      break;
+    }
+    case CompilationResult::kLinkingFailed: {
+      for (int idx = 0; idx < (int) stubs_.size(); idx++) {
+        const std::shared_ptr<Executable> &executable = stubs_[idx].GetExecutable();
+        const std::shared_ptr<ClassTypeModel> &owner = executable->GetOwner();
+        bool is_ctor = executable->GetExecutableVariant() == ExecutableVariant::kConstructor;
+        const std::string &qual_name = is_ctor && owner != nullptr
+                                       ? owner->GetQualifiedName() + "::" + executable->GetName()
+                                       : executable->GetQualifiedName();
+        if (output.find(qual_name + '(') != std::string::npos)
+          to_drop.insert(idx);
+      }
+      break;
+    }
+  }
+  for (auto it = to_drop.rbegin(); it != to_drop.rend(); ++it)
+    stubs_.erase(stubs_.begin() + *it);
+  return !to_drop.empty();
+}
+
+bool InterpreterHarness::Build(SourceCompiler &compiler, int max_attempts) {
+  CollectStubs();
+  const std::string &harness_cpp = harness_dir_ + "/" + kHarnessCppFilename;
+  const std::string &harness_o = harness_dir_ + "/" + kHarnessObjectFilename;
+  const std::string &harness_exe = GetExecutable();
+  for (int attempt = 0; attempt < max_attempts && !stubs_.empty(); attempt++) {
+    WriteToFile(harness_cpp);
+    const auto &build_result = compiler.CompileAndLink(harness_cpp, harness_o, harness_exe);
+    if (build_result.first == CompilationResult::kSuccess) {
+      ready_ = true;
+      Logger::Info("Interpreter harness is ready with " + std::to_string(stubs_.size()) + " call stubs.");
+      return true;
+    }
+    if (!DropStubsByDiagnostics(build_result.first, build_result.second)) {
+      Logger::Warn("[InterpreterHarness::Build]", "Unable to attribute build errors to call stubs:\n"
+        + build_result.second);
+      return false;
+    }
+  }
+  Logger::Warn("[InterpreterHarness::Build]", "Giving up on the interpreter harness, falling back to drivers.");
+  return false;
+}
+
+// ##########
+// # Bytecode encoding
+// #####
+
+bool InterpreterHarness::WriteBytecode(const TestCase &tc, const std::string &filename) const {
+  if (!ready_)
+    return false;
+  const std::vector<std::shared_ptr<Statement>> &statements = tc.GetStatements();
+  std::map<std::shared_ptr<Statement>, int> slots;
+  std::vector<bool> has_value;
+  std::string out{kBytecodeMagic};
+  AppendU32(out, kBytecodeVersion);
+  AppendU32(out, (unsigned int) statements.size());
+  for (const auto &stmt : statements) {
+    if (!EncodeStatement(stmt, slots, has_value, out))
+      return false;
+    slots[stmt] = (int) has_value.size() - 1;
+  }
+
+  std::ofstream target{filename, std::ios::binary};
+  if (!target)
+    return false;
+  target.write(out.data(), (std::streamsize) out.size());
+  return (bool) target;
+}
+
+bool InterpreterHarness::EncodeStatement(
+  const std::shared_ptr<Statement> &stmt,
+  const std::map<std::shared_ptr<Statement>, int> &slots,
+  std::vector<bool> &has_value,
+  std::string &out
+) const {
+  switch (stmt->GetVariant()) {
+    case StatementVariant::kPrimitiveAssignment: {
+      const std::shared_ptr<PrimitiveAssignmentStatement> &prim_stmt =
+        std::static_pointer_cast<PrimitiveAssignmentStatement>(stmt);
+      const TypeWithModifier &type = prim_stmt->GetType();
+      HarnessKind kind = PrimitiveKindOf(type);
+      GeneralPrimitiveOp op = prim_stmt->GetOp();
+      if (kind == kKindNone || (op == GeneralPrimitiveOp::kMod && IsFloatingKind(kind)))
+        return false;
+      const std::vector<Operand> &operands = prim_stmt->GetOperands();
+      AppendU8(out, kOpPrimitive);
+      AppendU8(out, kind);
+      AppendU8(out, (unsigned int) op);
+      AppendU8(out, (unsigned int) operands.size());
+      for (const auto &operand : operands) {
+        if (!EncodeOperand(operand, type, slots, has_value, out))
+          return false;
+      }
+      has_value.push_back(true);
+      return true;
+    }
+    case StatementVariant::kCall: {
+      const std::shared_ptr<CallStatement> &call_stmt = std::static_pointer_cast<CallStatement>(stmt);
+      const auto &it = stub_index_.find(call_stmt->GetTarget());
+      if (it == stub_index_.end())
+        return false;
+      const HarnessStub &stub = stubs_[it->second];
+      const bpstd::optional<Operand> &invoking_obj = call_stmt->GetInvokingObj();
+      if (stub.HasInvokingObj() != invoking_obj.has_value())
+        return false;
+
+      const std::shared_ptr<Executable> &executable = stub.GetExecutable();
+      const std::vector<clang::QualType> &arguments = executable->GetArguments();
+      const std::vector<Operand> &operands = call_stmt->GetOperands();
+      if (arguments.size() != operands.size())
+        return false;
+      AppendU8(out, kOpCall);
+      AppendU32(out, (unsigned int) it->second);
+      AppendU8(out, (unsigned int) (operands.size() + (invoking_obj.has_value() ? 1 : 0)));
+      if (invoking_obj.has_value()) {
+        const Operand &obj = invoking_obj.value();
+        const std::shared_ptr<ClassTypeModel> &owner = executable->GetOwner();
+        const std::shared_ptr<Statement> &ref = obj.GetRef();
+        if (ref == nullptr || ref->GetType().IsConst() || NonTemplatedClassOf(ref->GetType()) != owner)
+          return false; // constness of the method is unknown, and subclasses would need a cast
+        const TypeWithModifier &owner_twm = ref->GetType().StripAllModifiers();
+        if (!EncodeOperand(obj, owner_twm, slots, has_value, out))
+          return false;
+      }
+      for (int i = 0; i < (int) operands.size(); i++) {
+        if (!EncodeOperand(operands[i], TWMFromClangType(arguments[i]), slots, has_value, out))
+          return false;
+      }
+      has_value.push_back(stub.IsReturnsValue());
+      return true;
+    }
+    case StatementVariant::kArrayInitialization: {
+      const std::shared_ptr<ArrayInitStatement> &arr_stmt = std::static_pointer_cast<ArrayInitStatement>(stmt);
+      const bpstd::optional<Operand> &string_literal = arr_stmt->GetStringLiteral();
+      if (!string_literal.has_value() || !IsCharPointer(arr_stmt->GetType()))
+        return false;
+      const std::string &literal = string_literal.value().GetConstantLiteral().value();
+      int capacity = arr_stmt->GetCapacity().value_or((int) literal.size() + 1);
+      if (capacity < (int) literal.size() + 1 || literal.find('\\') != std::string::npos)
+        return false;
+      AppendU8(out, kOpString);
+      AppendU32(out, (unsigned int) capacity);
+      AppendBytes(out, literal);
+      has_value.push_back(true);
+      return true;
+    }
+    case StatementVariant::kSTLConstruction: {
+      return false;
+    }
+  }
+  return false;
+}
+
+bool InterpreterHarness::EncodeOperand(
+  const Operand &operand,
+  const TypeWithModifier &type_rq,
+  const std::map<std::shared_ptr<Statement>, int> &slots,
+  const std::vector<bool> &has_value,
+  std::string &out
+) const {
+  HarnessKind rq_kind = PrimitiveKindOf(type_rq);
+  bool rq_char_ptr = IsCharPointer(type_rq);
+  const std::shared_ptr<ClassTypeModel> &rq_class = NonTemplatedClassOf(type_rq);
+
+  if (operand.GetOperandType() == OperandType::kRefOperand) {
+    const auto &it = slots.find(operand.GetRef());
+    if (it == slots.end() || !has_value[it->second])
+      return false;
+    const TypeWithModifier &ref_type = operand.GetRef()->GetType();
+    if (rq_kind != kKindNone) {
+      if (PrimitiveKindOf(ref_type) == kKindNone)
+        return false;
+    } else if (rq_char_ptr) {
+      if (!IsCharPointer(ref_type))
+        return false;
+    } else if (rq_class != nullptr) {
+      if (NonTemplatedClassOf(ref_type) != rq_class || PointerDepth(ref_type) > 1)
+        return false;
+      bool rq_writable = (type_rq.IsReference() && !type_rq.IsConst()) || type_rq.IsRValueReference();
+      if (ref_type.IsConst() && rq_writable)
+        return false;
+    } else {
+      return false;
+    }
+    AppendU8(out, kArgRef);
+    AppendU32(out, (unsigned int) it->second);
+    return true;
+  }
+
+  const bpstd::optional<std::string> &opt_literal = operand.GetConstantLiteral();
+  if (!opt_literal.has_value())
+    return false;
+  const std::string &literal = opt_literal.value();
+  if (operand.IsNullPtr() || literal == "nullptr") {
+    if (!rq_char_ptr && (rq_class == nullptr || PointerDepth(type_rq) != 1))
+      return false;
+    AppendU8(out, kArgNull);
+    return true;
+  }
+  if (rq_char_ptr) {
+    if (!IsCharPointer(operand.GetType()) || literal.find('\\') != std::string::npos)
+      return false;
+    AppendU8(out, kArgString);
+    AppendBytes(out, literal);
+    return true;
+  }
+
+  HarnessKind kind = PrimitiveKindOf(operand.GetType());
+  if (rq_kind == kKindNone || kind == kKindNone)
+    return false;
+  unsigned long long payload = 0;
+  try {
+    if (kind == kKindBool && (literal == "true" || literal == "false")) {
+      payload = literal == "true" ? 1ull : 0ull;
+    } else if (IsFloatingKind(kind)) {
+      double value = std::stod(literal);
+      std::memcpy(&payload, &value, sizeof(double));
+    } else if (IsUnsignedKind(kind)) {
+      payload = std::stoull(literal);
+    } else {
+      payload = (unsigned long long) std::stoll(literal);
+    }
+  } catch (const std::exception &) {
+    return false; // e.g. enum constants or libFuzzer placeholders
+  }
+  AppendU8(out, kArgConst);
+  AppendU8(out, kind);
+  AppendU64(out, payload);
+  return true;
+}
+
+} // namespace cxxfoozz
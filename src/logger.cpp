@@ -133,6 +133,11 @@ void CoverageLogger::AppendEntry(
   int func_tot
 ) {
   entries_.emplace_back(timestamp, line_cov, branch_cov, line_tot, branch_tot, func_cov, func_tot);
+  if (stream_.is_open()) {
+    const CoverageLoggingEntry &entry = entries_.back();
+    stream_ << std::to_string(entry.GetTimestamp()) << ',' << entry.ToString(',') << '\n';
+    stream_.flush();
+  }
 }
 
 void CoverageLogger::PrintSummary() {
@@ -146,20 +151,42 @@ void CoverageLogger::PrintForPlotting(
   int time_gap,
   TestCaseQueue &queue
 ) {
+  if (stream_.is_open()) {
+    PrintFooter(stream_, max_timestamp_in_sec, queue);
+    stream_.close();
+    return;
+  }
   const std::string &filename = output_dir + "/out_report.csv";
   if (std::ofstream target{filename}) {
     target << "time, line, linetot, branch, branchtot, func, functot, linecov, branchcov, funccov\n";
     for (const auto &entry : entries_) {
       target << std::to_string(entry.GetTimestamp()) << ',' << entry.ToString(',') << '\n';
     }
-    if (!entries_.empty()) {
-      const CoverageLoggingEntry &last = entries_[entries_.size() - 1];
-      target << std::to_string(max_timestamp_in_sec) << ',' << last.ToString(',') << '\n';
-    }
-    target << "valid, crash, uncompilable\n";
-    target << queue.GetValid().size() << ',' << queue.GetCrashes().size() << ',' << queue.GetIncompilable().size()
-           << '\n';
+    PrintFooter(target, max_timestamp_in_sec, queue);
+  }
+}
+// Entries logged so far are written at once, e.g. those of a resumed campaign.
+void CoverageLogger::StreamTo(const std::string &output_dir) {
+  const std::string &filename = output_dir + "/out_report.csv";
+  stream_.open(filename, std::ios::trunc);
+  if (!stream_.good()) {
+    Logger::Warn("CoverageLogger", "Cannot open the coverage report: " + filename);
+    stream_.close();
+    return;
+  }
+  stream_ << "time, line, linetot, branch, branchtot, func, functot, linecov, branchcov, funccov\n";
+  for (const auto &entry : entries_)
+    stream_ << std::to_string(entry.GetTimestamp()) << ',' << entry.ToString(',') << '\n';
+  stream_.flush();
+}
+void CoverageLogger::PrintFooter(std::ofstream &target, long long int max_timestamp_in_sec, TestCaseQueue &queue) {
+  if (!entries_.empty()) {
+    const CoverageLoggingEntry &last = entries_[entries_.size() - 1];
+    target << std::to_string(max_timestamp_in_sec) << ',' << last.ToString(',') << '\n';
   }
+  target << "valid, crash, uncompilable\n";
+  target << queue.GetValid().size() << ',' << queue.GetCrashes().size() << ',' << queue.GetIncompilable().size()
+         << '\n';
 }
 
 //    int idx = 0, len = (int) entries_.size();
@@ -0,0 +1,262 @@
+#include "minimizer.hpp"
+#include "fuzzer.hpp"
+#include "writer.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <map>
+
+namespace cxxfoozz {
+
+// ##########
+// # MinimizationJob
+// #####
+
+MinimizationJob::MinimizationJob(int tc_id, MinimizationTarget target, TestCase tc, TCMemo memo)
+  : tc_id_(tc_id), target_(target), tc_(std::move(tc)), memo_(std::move(memo)) {}
+int MinimizationJob::GetTcId() const {
+  return tc_id_;
+}
+MinimizationTarget MinimizationJob::GetTarget() const {
+  return target_;
+}
+const TestCase &MinimizationJob::GetTc() const {
+  return tc_;
+}
+void MinimizationJob::SetTc(const TestCase &tc) {
+  tc_ = tc;
+}
+const TCMemo &MinimizationJob::GetMemo() const {
+  return memo_;
+}
+void MinimizationJob::SetMemo(const TCMemo &memo) {
+  memo_ = memo;
+}
+
+// ##########
+// # TestCaseMinimizer
+// #####
+
+TestCaseMinimizer::TestCaseMinimizer(
+  std::shared_ptr<FuzzingWorker> worker,
+  SourceCompiler &compiler,
+  std::shared_ptr<TestCaseWriter> tc_writer,
+  CrashTCHandler &crash_tc_handler,
+  std::string src_dir,
+  int budget,
+  ResultFn result_fn
+)
+  : worker_(std::move(worker)),
+    compiler_(compiler),
+    tc_writer_(std::move(tc_writer)),
+    crash_tc_handler_(crash_tc_handler),
+    src_dir_(std::move(src_dir)),
+    budget_(budget),
+    result_fn_(std::move(result_fn)),
+    mutex_(),
+    cv_(),
+    crash_jobs_(),
+    seed_jobs_(),
+    thread_() {
+  thread_ = std::thread([this] { Run(); });
+}
+TestCaseMinimizer::~TestCaseMinimizer() {
+  Finish();
+}
+
+// Statements are cloned in order and every reference is redirected to the clone, nothing is shared with the
+// input afterwards. Must run on the thread that renders the input, rendering renames the statements.
+TestCase TestCaseMinimizer::DeepClone(const TestCase &tc) {
+  std::vector<bool> kept(tc.GetStatements().size(), true);
+  return BuildCandidate(tc, kept);
+}
+
+// Readers of a removed statement read the closest earlier kept statement of the same type instead, the same
+// ReplaceRefOperand redirection as InplaceMutationByUpdate. Readers left without one are removed as well, which
+// is reported back through kept.
+TestCase TestCaseMinimizer::BuildCandidate(const TestCase &tc, std::vector<bool> &kept) {
+  const std::vector<std::shared_ptr<Statement>> &statements = tc.GetStatements();
+  const std::shared_ptr<TemplateTypeContext> &tt_ctx = tc.GetTemplateTypeContext();
+  std::map<std::shared_ptr<Statement>, std::shared_ptr<Statement>> repl_map;
+  std::vector<std::shared_ptr<Statement>> candidate;
+  for (size_t idx = 0; idx < statements.size(); ++idx) {
+    const std::shared_ptr<Statement> &stmt = statements[idx];
+    if (kept[idx]) {
+      for (const auto &operand : stmt->GetStatementOperands()) {
+        bool is_ref = operand.GetOperandType() == OperandType::kRefOperand;
+        if (is_ref && repl_map.count(operand.GetRef()) == 0) {
+          kept[idx] = false;
+          break;
+        }
+      }
+    }
+    if (kept[idx]) {
+      const std::shared_ptr<Statement> &cloned = stmt->ReplaceRefOperand(repl_map, tt_ctx).first;
+      repl_map[stmt] = cloned;
+      candidate.push_back(cloned);
+      continue;
+    }
+    for (size_t prev = idx; prev-- > 0;) {
+      if (kept[prev] && statements[prev]->GetType() == stmt->GetType()) {
+        repl_map[stmt] = repl_map.at(statements[prev]);
+        break;
+      }
+    }
+  }
+  // A test case without a context stays without one, it selects the minimal includes
+  return TestCase{candidate, tt_ctx == nullptr ? nullptr : TemplateTypeContext::Clone(tt_ctx)};
+}
+
+void TestCaseMinimizer::Submit(const MinimizationJob &job) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (finishing_)
+    return;
+  (job.GetTarget() == MinimizationTarget::kCrash ? crash_jobs_ : seed_jobs_).push_back(job);
+  cv_.notify_one();
+}
+// Queued crashes are still minimized, queued seeds are dropped.
+void TestCaseMinimizer::Finish() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    finishing_ = true;
+    seed_jobs_.clear();
+  }
+  cv_.notify_one();
+  if (thread_.joinable())
+    thread_.join();
+}
+long long int TestCaseMinimizer::GetMinimizedCount() const {
+  return minimized_count_;
+}
+long long int TestCaseMinimizer::GetRemovedStatementCount() const {
+  return removed_statement_count_;
+}
+
+void TestCaseMinimizer::Run() {
+  while (true) {
+    bpstd::optional<MinimizationJob> job;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      cv_.wait(lock, [this] { return finishing_ || !crash_jobs_.empty() || !seed_jobs_.empty(); });
+      if (crash_jobs_.empty() && seed_jobs_.empty())
+        return;
+      std::deque<MinimizationJob> &jobs = crash_jobs_.empty() ? seed_jobs_ : crash_jobs_;
+      job = jobs.front();
+      jobs.pop_front();
+    }
+    if (Minimize(job.value()))
+      result_fn_(job.value());
+  }
+}
+
+bpstd::optional<ExecutionResult> TestCaseMinimizer::BuildAndRun(const TestCase &tc) {
+  const std::string &temporary_exe = worker_->GetTmpDriverExe();
+  tc_writer_->WriteToFile(tc, worker_->GetTmpDriverCpp());
+  const auto &build_result =
+    compiler_.CompileAndLink(worker_->GetTmpDriverCpp(), worker_->GetTmpDriverObject(), temporary_exe);
+  if (build_result.first != CompilationResult::kSuccess)
+    return {};
+  return worker_->GetObserver().ExecuteAndCollectSites(temporary_exe);
+}
+
+// Both site lists are in ascending order.
+bool CoversAllSites(const CoverageDelta &sites, const CoverageDelta &reference) {
+  const auto &covers = [](const std::vector<int> &lhs, const std::vector<int> &rhs) {
+    return std::includes(lhs.begin(), lhs.end(), rhs.begin(), rhs.end());
+  };
+  return covers(sites.GetLines(), reference.GetLines()) && covers(sites.GetBranches(), reference.GetBranches())
+    && covers(sites.GetFunctions(), reference.GetFunctions()) && covers(sites.GetEdges(), reference.GetEdges());
+}
+
+// Seeds keep their return code and every site of the original run, crashes are triaged again and keep their
+// fingerprint. memo is the triage of the candidate.
+bool TestCaseMinimizer::IsReproduced(
+  const MinimizationJob &job,
+  const ExecutionResult &reference,
+  const ExecutionResult &exec_result,
+  TCMemo &memo
+) {
+  switch (job.GetTarget()) {
+    case MinimizationTarget::kSeed: {
+      bool same_return_code = exec_result.GetReturnCode() == reference.GetReturnCode();
+      return same_return_code && CoversAllSites(exec_result.GetCoveredSites(), reference.GetCoveredSites());
+    }
+    case MinimizationTarget::kCrash: {
+      if (exec_result.IsSuccessful() || exec_result.HasCaughtException() || exec_result.IsTimedOut())
+        return false;
+      const std::string &temporary_exe = worker_->GetTmpDriverExe();
+      memo = crash_tc_handler_.TriageCrash(temporary_exe, src_dir_, worker_->GetObserver().GetEnv());
+      const std::string &fingerprint = memo.GetFingerprint().value_or("");
+      bool crash_in_source = memo.IsValidCrash() && memo.GetLocation().has_value();
+      return crash_in_source && fingerprint == job.GetMemo().GetFingerprint().value_or("");
+    }
+  }
+  return false;
+}
+
+// Complement-only ddmin over the statement indices of the original: each round tries to remove one of n chunks,
+// and doubles n when none of them could go. The original runs first, so that flaky test cases and seeds whose
+// sites differ in this environment are left alone.
+bool TestCaseMinimizer::Minimize(MinimizationJob &job) {
+  const TestCase &original = job.GetTc();
+  int stmt_count = (int) original.GetStatements().size();
+  if (stmt_count < 2)
+    return false;
+  int builds_left = budget_ - 1;
+  const bpstd::optional<ExecutionResult> &reference = BuildAndRun(original);
+  TCMemo best_memo;
+  if (!reference.has_value() || !IsReproduced(job, reference.value(), reference.value(), best_memo))
+    return false;
+  if (job.GetTarget() == MinimizationTarget::kSeed && reference->GetCoveredSites().IsEmpty())
+    return false;
+
+  std::vector<int> units(stmt_count);
+  for (int idx = 0; idx < stmt_count; ++idx)
+    units[idx] = idx;
+  bpstd::optional<TestCase> best;
+  int chunk_count = 2;
+  while (units.size() >= 2 && builds_left > 0) {
+    int unit_count = (int) units.size();
+    int chunk_size = (unit_count + chunk_count - 1) / chunk_count;
+    bool reduced = false;
+    for (int begin = 0; begin < unit_count && builds_left > 0 && !reduced; begin += chunk_size) {
+      std::vector<bool> kept(stmt_count, false);
+      for (int unit_idx = 0; unit_idx < unit_count; ++unit_idx)
+        kept[units[unit_idx]] = unit_idx < begin || unit_idx >= begin + chunk_size;
+      const TestCase &candidate = BuildCandidate(original, kept);
+      if (candidate.GetStatements().empty())
+        continue;
+      assert(candidate.Verify());
+      --builds_left;
+      const bpstd::optional<ExecutionResult> &exec_result = BuildAndRun(candidate);
+      TCMemo memo;
+      if (!exec_result.has_value() || !IsReproduced(job, reference.value(), exec_result.value(), memo))
+        continue;
+      units.clear();
+      for (int idx = 0; idx < stmt_count; ++idx) {
+        if (kept[idx])
+          units.push_back(idx);
+      }
+      best = candidate;
+      best_memo = memo;
+      chunk_count = std::max(chunk_count - 1, 2);
+      reduced = true;
+    }
+    if (!reduced) {
+      if (chunk_count >= unit_count)
+        break;
+      chunk_count = std::min(unit_count, 2 * chunk_count);
+    }
+  }
+  if (!best.has_value())
+    return false;
+
+  removed_statement_count_ += stmt_count - (long long int) best->GetStatements().size();
+  ++minimized_count_;
+  job.SetTc(best.value());
+  if (job.GetTarget() == MinimizationTarget::kCrash)
+    job.SetMemo(best_memo);
+  return true;
+}
+
+} // namespace cxxfoozz
@@ -149,7 +149,8 @@ Executable::Executable(
     is_creator_(is_creator),
     is_not_require_invoking_obj_(is_not_require_invoking_obj),
     excluded_(false),
-    mangled_name_(std::move(mangled_name)) {}
+    mangled_name_(std::move(mangled_name)),
+    decl_location_() {}
 
 std::shared_ptr<Executable> Executable::MakeImplicitExecutable(
   const std::string &name,
@@ -201,6 +202,7 @@ std::shared_ptr<Executable> Executable::MakeMethodExecutable(
 
   bool is_conv_decl = llvm::isa<clang::CXXConversionDecl>(method);
   executable->SetIsConversionDecl(is_conv_decl);
+  executable->SetDeclLocation(method->getLocation());
 
   return executable;
 }
@@ -215,7 +217,7 @@ std::shared_ptr<Executable> Executable::MakeExternalExecutable(
   const bpstd::optional<clang::QualType> opt_return_type = bpstd::make_optional<clang::QualType>(return_type);
   const std::string &mangled_name = MangleFunctionDecl(func_decl, mangle_ctx);
 
-  return std::make_shared<Executable>(
+  const std::shared_ptr<Executable> &executable = std::make_shared<Executable>(
     name,
     qual_name,
     ExecutableVariant::kMethod,
@@ -226,6 +228,8 @@ std::shared_ptr<Executable> Executable::MakeExternalExecutable(
     true,
     mangled_name
   );
+  executable->SetDeclLocation(func_decl->getLocation());
+  return executable;
 }
 ExecutableVariant Executable::GetExecutableVariant() const {
   return executable_variant_;
@@ -293,6 +297,12 @@ void Executable::SetExcluded(bool excluded) {
 std::string Executable::GetMangledName() const {
   return mangled_name_;
 }
+const clang::SourceLocation &Executable::GetDeclLocation() const {
+  return decl_location_;
+}
+void Executable::SetDeclLocation(const clang::SourceLocation &decl_location) {
+  decl_location_ = decl_location;
+}
 Executable::~Executable() = default;
 
 
@@ -345,7 +355,7 @@ std::shared_ptr<Creator> Creator::MakeConstructorCreator(
   const std::string &name = class_type_model->GetName();
   const std::string &qual_name = class_type_model->GetQualifiedName();
   const std::string &mangled_name = "";
-  return std::make_shared<Creator>(
+  const std::shared_ptr<Creator> &creator = std::make_shared<Creator>(
     name,
     qual_name,
     ExecutableVariant::kConstructor,
@@ -357,6 +367,8 @@ std::shared_ptr<Creator> Creator::MakeConstructorCreator(
     false,
     mangled_name
   );
+  creator->SetDeclLocation(method->getLocation());
+  return creator;
 }
 
 std::shared_ptr<Creator> Creator::MakeExternalCreator(
@@ -371,7 +383,7 @@ std::shared_ptr<Creator> Creator::MakeExternalCreator(
   const bpstd::optional<clang::QualType> opt_return_type = bpstd::make_optional<clang::QualType>(return_type);
   const std::string &mangled_name = MangleFunctionDecl(func_decl, mangle_ctx);
 
-  return std::make_shared<Creator>(
+  const std::shared_ptr<Creator> &creator = std::make_shared<Creator>(
     name,
     qual_name,
     ExecutableVariant::kMethod,
@@ -383,6 +395,8 @@ std::shared_ptr<Creator> Creator::MakeExternalCreator(
     true,
     mangled_name
   );
+  creator->SetDeclLocation(func_decl->getLocation());
+  return creator;
 }
 
 std::shared_ptr<Creator> Creator::MakeStaticFactoryCreator(
@@ -399,7 +413,7 @@ std::shared_ptr<Creator> Creator::MakeStaticFactoryCreator(
   assert(opt_return_type.has_value());
   const std::string &mangled_name = MangleFunctionDecl(method, mangle_ctx);
 
-  return std::make_shared<Creator>(
+  const std::shared_ptr<Creator> &creator = std::make_shared<Creator>(
     name,
     qual_name,
     ExecutableVariant::kMethod,
@@ -411,6 +425,8 @@ std::shared_ptr<Creator> Creator::MakeStaticFactoryCreator(
     true,
     mangled_name
   );
+  creator->SetDeclLocation(method->getLocation());
+  return creator;
 }
 
 std::shared_ptr<Creator> Creator::MakeImplicitDefaultCtor(const std::shared_ptr<ClassTypeModel> &owner) {
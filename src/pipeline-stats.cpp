@@ -0,0 +1,231 @@
+#include "pipeline-stats.hpp"
+#include "logger.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+
+namespace cxxfoozz {
+
+// ##########
+// # DurationHistogram
+// #####
+
+DurationHistogram::DurationHistogram() = default;
+// Below 4us one bucket per microsecond, above that the two bits after the leading one select the bucket.
+int DurationHistogram::ToBucket(long long int elapsed_in_usec) {
+  unsigned long long int value = (unsigned long long int) std::max(0LL, elapsed_in_usec);
+  if (value < 4)
+    return (int) value;
+  int msb = 63 - __builtin_clzll(value);
+  return 4 * (msb - 1) + (int) ((value >> (msb - 2)) & 3ULL);
+}
+long long int DurationHistogram::BucketUpperBound(int bucket) {
+  if (bucket < 4)
+    return bucket;
+  int msb = bucket / 4 + 1;
+  int sub = bucket % 4;
+  return (long long int) (((5ULL + sub) << (msb - 2)) - 1);
+}
+void DurationHistogram::Record(long long int elapsed_in_usec) {
+  ++buckets_[ToBucket(elapsed_in_usec)];
+  ++count_;
+  total_in_usec_ += elapsed_in_usec;
+  max_in_usec_ = std::max(max_in_usec_, elapsed_in_usec);
+}
+long long int DurationHistogram::GetCount() const {
+  return count_;
+}
+long long int DurationHistogram::GetTotalInUsec() const {
+  return total_in_usec_;
+}
+long long int DurationHistogram::GetMaxInUsec() const {
+  return max_in_usec_;
+}
+// Upper bound of the bucket holding the percentile, never above the largest recorded duration.
+long long int DurationHistogram::GetPercentileInUsec(double percentile) const {
+  if (count_ == 0)
+    return 0;
+  long long int rank = std::max(1LL, (long long int) (percentile / 100.0 * count_ + 0.5));
+  long long int seen = 0;
+  for (int bucket = 0; bucket < kBucketCount; ++bucket) {
+    seen += buckets_[bucket];
+    if (seen >= rank)
+      return std::min(BucketUpperBound(bucket), max_in_usec_);
+  }
+  return max_in_usec_;
+}
+
+// ##########
+// # PipelineStats
+// #####
+
+std::shared_ptr<PipelineStats> PipelineStats::instance_ = nullptr;
+PipelineStats::PipelineStats() : mutex_(), campaign_clock_(), cpu_clock_(), stages_() {}
+const std::shared_ptr<PipelineStats> &PipelineStats::GetInstance() {
+  if (instance_ == nullptr)
+    instance_ = std::make_shared<PipelineStats>();
+  return instance_;
+}
+std::string PipelineStats::GetStageName(PipelineStage stage) {
+  switch (stage) {
+    case PipelineStage::kGenerate: return "generate";
+    case PipelineStage::kMutate: return "mutate";
+    case PipelineStage::kWrite: return "write";
+    case PipelineStage::kCompile: return "compile";
+    case PipelineStage::kLink: return "link";
+    case PipelineStage::kExecute: return "execute";
+    case PipelineStage::kCoverage: return "coverage";
+    case PipelineStage::kCrashTriage: return "crash_triage";
+  }
+  return "unknown";
+}
+bool PipelineStats::IsEnabled() const {
+  return enabled_;
+}
+// Stages only count between Start and Stop, i.e. the fuzzing loop, not the setup or the final flush.
+void PipelineStats::Start() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  enabled_ = true;
+  start_millis_ = WallClock::GetCurrentMillis();
+  campaign_clock_ = WallClock();
+  cpu_clock_ = CPUClock();
+  stages_.fill(DurationHistogram());
+  total_attempts_ = 0;
+  window_attempts_.fill(0);
+  window_second_.fill(0);
+}
+void PipelineStats::Stop() {
+  enabled_ = false;
+}
+void PipelineStats::RecordStage(PipelineStage stage, long long int elapsed_in_usec) {
+  if (!enabled_)
+    return;
+  std::lock_guard<std::mutex> lock(mutex_);
+  stages_[(int) stage].Record(elapsed_in_usec);
+}
+void PipelineStats::RecordAttempts(int attempts) {
+  if (!enabled_)
+    return;
+  std::lock_guard<std::mutex> lock(mutex_);
+  total_attempts_ += attempts;
+  long long int second = campaign_clock_.MeasureElapsedInMsec() / 1000LL;
+  int slot = (int) (second % kWindowSlots);
+  if (window_second_[slot] != second) {
+    window_second_[slot] = second;
+    window_attempts_[slot] = 0;
+  }
+  window_attempts_[slot] += attempts;
+}
+long long int PipelineStats::GetTotalAttempts() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return total_attempts_;
+}
+// window_in_sec = 0 averages over the whole campaign. Young campaigns divide by their age, not by the window.
+double PipelineStats::GetAttemptsPerSec(int window_in_sec) const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  double elapsed_in_sec = campaign_clock_.MeasureElapsedInUsec() / 1000000.0;
+  if (elapsed_in_sec <= 0.0)
+    return 0.0;
+  if (window_in_sec <= 0)
+    return total_attempts_ / elapsed_in_sec;
+
+  window_in_sec = std::min(window_in_sec, (int) kWindowSlots);
+  long long int now_second = (long long int) elapsed_in_sec;
+  long long int attempts = 0;
+  for (int slot = 0; slot < kWindowSlots; ++slot) {
+    if (window_second_[slot] > now_second - window_in_sec)
+      attempts += window_attempts_[slot];
+  }
+  return attempts / std::min((double) window_in_sec, elapsed_in_sec);
+}
+std::string FormatStatsDouble(double value) {
+  std::stringstream ss;
+  ss << std::fixed << std::setprecision(2) << value;
+  return ss.str();
+}
+
+// Written to a temporary file first and renamed, so that a scraper never reads a partial file.
+bool PipelineStats::WriteStatsFile(
+  const std::string &filename,
+  const std::vector<std::pair<std::string, std::string>> &extra_entries
+) const {
+  double per_sec = GetAttemptsPerSec(0);
+  double per_sec_1m = GetAttemptsPerSec(60);
+  double per_sec_5m = GetAttemptsPerSec(300);
+
+  std::vector<std::pair<std::string, std::string>> entries;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    long long int wall_in_msec = campaign_clock_.MeasureElapsedInMsec();
+    long long int cpu_in_msec = cpu_clock_.MeasureElapsedInMsec();
+    entries.emplace_back("start_time", std::to_string(start_millis_ / 1000LL));
+    entries.emplace_back("last_update", std::to_string(WallClock::GetCurrentMillis() / 1000LL));
+    entries.emplace_back("run_time_sec", std::to_string(wall_in_msec / 1000LL));
+    entries.emplace_back("fuzzer_cpu_time_sec", std::to_string(cpu_in_msec / 1000LL));
+    entries.emplace_back("total_attempts", std::to_string(total_attempts_));
+    entries.emplace_back("attempts_per_sec", FormatStatsDouble(per_sec));
+    entries.emplace_back("attempts_per_sec_1m", FormatStatsDouble(per_sec_1m));
+    entries.emplace_back("attempts_per_sec_5m", FormatStatsDouble(per_sec_5m));
+
+    long long int stages_in_usec = 0;
+    for (const auto &histogram : stages_)
+      stages_in_usec += histogram.GetTotalInUsec();
+    for (int stage_idx = 0; stage_idx < kStageCount; ++stage_idx) {
+      const DurationHistogram &histogram = stages_[stage_idx];
+      const std::string &prefix = "stage_" + GetStageName((PipelineStage) stage_idx);
+      double share = stages_in_usec > 0 ? 100.0 * histogram.GetTotalInUsec() / stages_in_usec : 0.0;
+      entries.emplace_back(prefix + "_count", std::to_string(histogram.GetCount()));
+      entries.emplace_back(prefix + "_total_ms", std::to_string(histogram.GetTotalInUsec() / 1000LL));
+      entries.emplace_back(prefix + "_share_pct", FormatStatsDouble(share));
+      entries.emplace_back(prefix + "_p50_us", std::to_string(histogram.GetPercentileInUsec(50.0)));
+      entries.emplace_back(prefix + "_p90_us", std::to_string(histogram.GetPercentileInUsec(90.0)));
+      entries.emplace_back(prefix + "_p99_us", std::to_string(histogram.GetPercentileInUsec(99.0)));
+      entries.emplace_back(prefix + "_max_us", std::to_string(histogram.GetMaxInUsec()));
+    }
+  }
+  entries.insert(entries.end(), extra_entries.begin(), extra_entries.end());
+
+  const std::string &tmp_filename = filename + ".tmp";
+  std::ofstream stats_file{tmp_filename};
+  for (const auto &entry : entries)
+    stats_file << std::left << std::setw(28) << entry.first << ": " << entry.second << '\n';
+  stats_file.close();
+  if (!stats_file.good())
+    return false;
+  return std::rename(tmp_filename.c_str(), filename.c_str()) == 0;
+}
+void PipelineStats::PrintSummary() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  long long int stages_in_usec = 0;
+  for (const auto &histogram : stages_)
+    stages_in_usec += histogram.GetTotalInUsec();
+  for (int stage_idx = 0; stage_idx < kStageCount; ++stage_idx) {
+    const DurationHistogram &histogram = stages_[stage_idx];
+    if (histogram.GetCount() == 0)
+      continue;
+    double share = stages_in_usec > 0 ? 100.0 * histogram.GetTotalInUsec() / stages_in_usec : 0.0;
+    std::stringstream ss;
+    ss << std::left << std::setw(13) << GetStageName((PipelineStage) stage_idx) << std::right
+       << " count = " << histogram.GetCount()
+       << ", total = " << histogram.GetTotalInUsec() / 1000LL << "ms ("
+       << std::fixed << std::setprecision(1) << share << "%)"
+       << ", p50 = " << histogram.GetPercentileInUsec(50.0) << "us"
+       << ", p90 = " << histogram.GetPercentileInUsec(90.0) << "us"
+       << ", p99 = " << histogram.GetPercentileInUsec(99.0) << "us";
+    Logger::Info("PipelineStats", ss.str());
+  }
+}
+
+// ##########
+// # StageTimer
+// #####
+
+StageTimer::StageTimer(PipelineStage stage) : stage_(stage), clock_() {}
+StageTimer::~StageTimer() {
+  PipelineStats::GetInstance()->RecordStage(stage_, clock_.MeasureElapsedInUsec());
+}
+
+} // namespace cxxfoozz
@@ -0,0 +1,353 @@
+#include "process.hpp"
+#include "util.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstring>
+#include <sstream>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+extern char **environ;
+
+namespace cxxfoozz {
+
+// ##########
+// # ProcessSpec
+// #####
+
+ProcessSpec::ProcessSpec(std::vector<std::string> argv) : argv_(std::move(argv)) {}
+// Only for commands relying on shell features (globs, pipes, command substitution).
+ProcessSpec ProcessSpec::FromShellCommand(const std::string &command) {
+  return ProcessSpec{{"/bin/sh", "-c", command}};
+}
+const std::vector<std::string> &ProcessSpec::GetArgv() const {
+  return argv_;
+}
+const std::map<std::string, std::string> &ProcessSpec::GetEnv() const {
+  return env_;
+}
+void ProcessSpec::SetEnv(const std::map<std::string, std::string> &env) {
+  env_ = env;
+}
+long long int ProcessSpec::GetTimeoutInMsec() const {
+  return timeout_in_msec_;
+}
+void ProcessSpec::SetTimeoutInMsec(long long int timeout_in_msec) {
+  timeout_in_msec_ = timeout_in_msec;
+}
+const std::vector<std::pair<int, unsigned long long int>> &ProcessSpec::GetResourceLimits() const {
+  return resource_limits_;
+}
+void ProcessSpec::AddResourceLimit(int resource, unsigned long long int limit) {
+  resource_limits_.emplace_back(resource, limit);
+}
+bool ProcessSpec::IsCaptureStderr() const {
+  return capture_stderr_;
+}
+void ProcessSpec::SetCaptureStderr(bool capture_stderr) {
+  capture_stderr_ = capture_stderr;
+}
+std::string ProcessSpec::ToString() const {
+  std::stringstream ss;
+  for (const auto &entry : env_)
+    ss << entry.first << '=' << entry.second << ' ';
+  ss << StringJoin(argv_, " ");
+  return ss.str();
+}
+
+// ##########
+// # ChildProcessSetup
+// #####
+
+ChildProcessSetup::ChildProcessSetup(const ProcessSpec &spec) : resource_limits_(spec.GetResourceLimits()) {}
+int ChildProcessSetup::Apply(int out_fd, int err_fd) const {
+  setpgid(0, 0);
+  struct sigaction default_action{};
+  default_action.sa_handler = SIG_DFL;
+  for (int sig = 1; sig < NSIG; ++sig)
+    sigaction(sig, &default_action, nullptr); // fails harmlessly for SIGKILL, SIGSTOP and reserved signals
+  sigset_t no_signals;
+  sigemptyset(&no_signals);
+  sigprocmask(SIG_SETMASK, &no_signals, nullptr);
+  // O_CLOEXEC: only the dup2 copies reach the target
+  int dev_null_in = open("/dev/null", O_RDONLY | O_CLOEXEC);
+  int dev_null_out = open("/dev/null", O_WRONLY | O_CLOEXEC);
+  out_fd = out_fd < 0 ? dev_null_out : out_fd;
+  err_fd = err_fd < 0 ? dev_null_out : err_fd;
+  if (dev_null_in < 0 || out_fd < 0 || err_fd < 0 || dup2(dev_null_in, STDIN_FILENO) < 0
+    || dup2(out_fd, STDOUT_FILENO) < 0 || dup2(err_fd, STDERR_FILENO) < 0)
+    return errno;
+  for (const auto &limit : resource_limits_) {
+    struct rlimit rl{(rlim_t) limit.second, (rlim_t) limit.second};
+    if (setrlimit((enum __rlimit_resource) limit.first, &rl) != 0)
+      return errno;
+  }
+  return 0;
+}
+
+// ##########
+// # ProcessResult
+// #####
+
+const int ProcessResult::kTimeoutReturnCode = 124; // same as timeout(1)
+const int ProcessResult::kSpawnFailureReturnCode = 127; // same as a shell for a missing command
+ProcessResult::ProcessResult(int return_code, bool timed_out, std::string output, long long int elapsed_in_usec)
+  : return_code_(return_code), timed_out_(timed_out), output_(std::move(output)), elapsed_in_usec_(elapsed_in_usec) {}
+int ProcessResult::GetReturnCode() const {
+  return return_code_;
+}
+bool ProcessResult::IsTimedOut() const {
+  return timed_out_;
+}
+const std::string &ProcessResult::GetOutput() const {
+  return output_;
+}
+long long int ProcessResult::GetElapsedInUsec() const {
+  return elapsed_in_usec_;
+}
+
+// ##########
+// # ProcessSupervisor
+// #####
+
+using SteadyTime = std::chrono::steady_clock::time_point;
+const int kReapPollIntervalInMsec = 1; // child closed its output, waiting for it to become reapable
+const int kIdlePollIntervalInMsec = 50; // catches children whose output is held open by a grandchild
+const size_t kReadChunkSize = 1 << 16;
+
+struct SupervisedProcess {
+  pid_t pid = -1;
+  int out_fd = -1; // read end of the stdout/stderr pipe, -1 once drained
+  bool spawned = false;
+  bool exited = false;
+  bool timed_out = false;
+  bool done = false;
+  int status = 0;
+  std::string output;
+  SteadyTime started_at;
+  SteadyTime deadline;
+  bool has_deadline = false;
+  long long int elapsed_in_usec = 0;
+};
+
+std::vector<std::string> BuildEnvironment(const std::map<std::string, std::string> &overrides) {
+  std::vector<std::string> env;
+  for (char **entry = environ; entry != nullptr && *entry != nullptr; ++entry) {
+    const std::string &item = *entry;
+    const std::string &name = item.substr(0, item.find('='));
+    if (overrides.count(name) == 0)
+      env.push_back(item);
+  }
+  for (const auto &entry : overrides)
+    env.push_back(entry.first + '=' + entry.second);
+  return env;
+}
+
+std::vector<char *> AsCStringArray(std::vector<std::string> &strings) {
+  std::vector<char *> result;
+  for (auto &item : strings)
+    result.push_back(&item[0]);
+  result.push_back(nullptr);
+  return result;
+}
+
+// Same lookup as execvp, done before fork so that the child only calls async-signal-safe functions.
+std::string ResolveExecutable(const std::string &name) {
+  if (name.find('/') != std::string::npos)
+    return name;
+  const char *path = getenv("PATH");
+  for (const auto &dir : SplitStringIntoVector(path != nullptr ? path : "/bin:/usr/bin", ":")) {
+    const std::string &candidate = (dir.empty() ? "." : dir) + '/' + name;
+    if (access(candidate.c_str(), X_OK) == 0)
+      return candidate;
+  }
+  return name;
+}
+
+// The child gets its own process group, so that a deadline also kills whatever it started. Resource limits are
+// set in the child between fork and exec, the target never runs without them.
+bool SpawnProcess(const ProcessSpec &spec, SupervisedProcess &process) {
+  if (spec.GetArgv().empty())
+    return false;
+  int fds[2], err_fds[2];
+  if (pipe2(fds, O_CLOEXEC) != 0) {
+    process.output = "pipe2: " + std::string(strerror(errno));
+    return false;
+  }
+  if (pipe2(err_fds, O_CLOEXEC) != 0) { // reports a failed exec, closed by a successful one
+    process.output = "pipe2: " + std::string(strerror(errno));
+    close(fds[0]);
+    close(fds[1]);
+    return false;
+  }
+  fcntl(fds[0], F_SETFL, fcntl(fds[0], F_GETFL) | O_NONBLOCK); // the child keeps a blocking write end
+
+  // Everything the child needs is prepared before fork, other threads may hold locks meanwhile.
+  const std::string &exe_path = ResolveExecutable(spec.GetArgv()[0]);
+  std::vector<std::string> argv_storage = spec.GetArgv();
+  std::vector<std::string> env_storage = BuildEnvironment(spec.GetEnv());
+  const std::vector<char *> &argv = AsCStringArray(argv_storage);
+  const std::vector<char *> &envp = AsCStringArray(env_storage);
+  const ChildProcessSetup child_setup{spec};
+  int err_fd = spec.IsCaptureStderr() ? fds[1] : -1;
+
+  process.started_at = std::chrono::steady_clock::now();
+  pid_t pid = fork();
+  if (pid == 0) {
+    int err = child_setup.Apply(fds[1], err_fd);
+    if (err == 0) {
+      execve(exe_path.c_str(), argv.data(), envp.data());
+      err = errno;
+    }
+    ssize_t ignored = write(err_fds[1], &err, sizeof(err));
+    (void) ignored;
+    _exit(ProcessResult::kSpawnFailureReturnCode);
+  }
+  close(fds[1]);
+  close(err_fds[1]);
+  if (pid < 0) {
+    process.output = "fork: " + std::string(strerror(errno));
+    close(fds[0]);
+    close(err_fds[0]);
+    return false;
+  }
+
+  int err = 0;
+  ssize_t err_size = 0;
+  do {
+    err_size = read(err_fds[0], &err, sizeof(err));
+  } while (err_size < 0 && errno == EINTR);
+  close(err_fds[0]);
+  if (err_size == (ssize_t) sizeof(err)) {
+    waitpid(pid, nullptr, 0);
+    close(fds[0]);
+    process.output = "exec: " + spec.GetArgv()[0] + ": " + std::string(strerror(err));
+    return false;
+  }
+  process.pid = pid;
+  process.out_fd = fds[0];
+  process.spawned = true;
+  if (spec.GetTimeoutInMsec() > 0) {
+    process.has_deadline = true;
+    process.deadline = process.started_at + std::chrono::milliseconds(spec.GetTimeoutInMsec());
+  }
+  return true;
+}
+
+void CloseOutput(int epoll_fd, SupervisedProcess &process) {
+  epoll_ctl(epoll_fd, EPOLL_CTL_DEL, process.out_fd, nullptr);
+  close(process.out_fd);
+  process.out_fd = -1;
+}
+
+void DrainOutput(int epoll_fd, SupervisedProcess &process, std::vector<char> &buffer) {
+  while (process.out_fd != -1) {
+    ssize_t n = read(process.out_fd, buffer.data(), buffer.size());
+    if (n > 0) {
+      process.output.append(buffer.data(), (size_t) n);
+    } else if (n < 0 && errno == EINTR) {
+      continue;
+    } else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      return;
+    } else {
+      CloseOutput(epoll_fd, process); // EOF or error
+    }
+  }
+}
+
+int ToReturnCode(const SupervisedProcess &process) {
+  if (!process.spawned)
+    return ProcessResult::kSpawnFailureReturnCode;
+  if (process.timed_out)
+    return ProcessResult::kTimeoutReturnCode;
+  if (WIFEXITED(process.status))
+    return WEXITSTATUS(process.status);
+  if (WIFSIGNALED(process.status))
+    return 128 + WTERMSIG(process.status); // same as a shell would report
+  return ProcessResult::kSpawnFailureReturnCode;
+}
+
+ProcessResult ProcessSupervisor::Run(const ProcessSpec &spec) {
+  return RunAll({spec}).front();
+}
+// All children run concurrently; the loop wakes up on output, at the nearest deadline, or to reap exited children.
+std::vector<ProcessResult> ProcessSupervisor::RunAll(const std::vector<ProcessSpec> &specs) {
+  std::vector<SupervisedProcess> processes(specs.size());
+  int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+  size_t remaining = 0;
+  for (size_t i = 0; i < specs.size(); ++i) {
+    SupervisedProcess &process = processes[i];
+    if (epoll_fd < 0 || !SpawnProcess(specs[i], process)) {
+      process.done = true;
+      continue;
+    }
+    struct epoll_event event{};
+    event.events = EPOLLIN;
+    event.data.u64 = i;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, process.out_fd, &event);
+    ++remaining;
+  }
+
+  std::vector<char> buffer(kReadChunkSize);
+  std::array<struct epoll_event, 32> events{};
+  while (remaining > 0) {
+    const SteadyTime &now = std::chrono::steady_clock::now();
+    long long int wait_in_msec = kIdlePollIntervalInMsec;
+    for (const auto &process : processes) {
+      if (process.done)
+        continue;
+      if (process.out_fd == -1 || process.timed_out)
+        wait_in_msec = std::min<long long int>(wait_in_msec, kReapPollIntervalInMsec);
+      if (process.has_deadline && !process.timed_out) {
+        long long int until_deadline =
+          std::chrono::duration_cast<std::chrono::milliseconds>(process.deadline - now).count();
+        wait_in_msec = std::max(0LL, std::min(wait_in_msec, until_deadline));
+      }
+    }
+
+    int n_events = epoll_wait(epoll_fd, events.data(), (int) events.size(), (int) wait_in_msec);
+    for (int i = 0; i < n_events; ++i)
+      DrainOutput(epoll_fd, processes[events[i].data.u64], buffer);
+
+    const SteadyTime &after_wait = std::chrono::steady_clock::now();
+    for (auto &process : processes) {
+      if (process.done)
+        continue;
+      if (!process.exited && waitpid(process.pid, &process.status, WNOHANG) == process.pid) {
+        process.exited = true;
+        process.elapsed_in_usec =
+          std::chrono::duration_cast<std::chrono::microseconds>(after_wait - process.started_at).count();
+      }
+      if (!process.exited && process.has_deadline && !process.timed_out && after_wait >= process.deadline) {
+        kill(-process.pid, SIGKILL);
+        kill(process.pid, SIGKILL);
+        process.timed_out = true;
+      }
+      if (process.exited && process.out_fd != -1) {
+        DrainOutput(epoll_fd, process, buffer);
+        if (process.out_fd != -1)
+          CloseOutput(epoll_fd, process); // still held open by a grandchild
+      }
+      if (process.exited && process.out_fd == -1) {
+        process.done = true;
+        --remaining;
+      }
+    }
+  }
+  if (epoll_fd >= 0)
+    close(epoll_fd);
+
+  std::vector<ProcessResult> results;
+  for (const auto &process : processes)
+    results.emplace_back(ToReturnCode(process), process.timed_out, process.output, process.elapsed_in_usec);
+  return results;
+}
+
+} // namespace cxxfoozz
@@ -0,0 +1,75 @@
+#include "queue-store.hpp"
+#include "logger.hpp"
+
+namespace cxxfoozz {
+
+// ##########
+// # TestCaseSpillStore
+// #####
+
+TestCaseSpillStore::TestCaseSpillStore(std::string filename, std::shared_ptr<ProgramContext> program_ctx)
+  : filename_(std::move(filename)),
+    program_ctx_(std::move(program_ctx)),
+    out_(filename_, std::ios::binary | std::ios::trunc),
+    in_(filename_, std::ios::binary),
+    writer_(out_, program_ctx_),
+    reader_(),
+    entries_() {
+  if (!out_.good() || !in_.good())
+    Logger::Warn("TestCaseSpillStore", "Cannot open the spill file: " + filename_);
+}
+bool TestCaseSpillStore::CanStore(const TestCase &tc) const {
+  return writer_.CanWriteTestCase(tc);
+}
+// A later copy of the same test case replaces the earlier one, which stays in the file unused.
+bool TestCaseSpillStore::Store(int tc_id, const TestCase &tc, const TCMemo &memo) {
+  long long int offset = out_.tellp();
+  writer_.WriteTestCase(tc);
+  writer_.WriteMemo(memo);
+  out_.flush();
+  if (offset < 0 || !out_.good())
+    return false;
+  entries_[tc_id] = std::make_pair(offset, (long long int) out_.tellp() - offset);
+  return true;
+}
+bpstd::optional<std::pair<TestCase, TCMemo>> TestCaseSpillStore::Load(int tc_id) {
+  const auto &it = entries_.find(tc_id);
+  if (it == entries_.end())
+    return {};
+  in_.clear();
+  in_.seekg(it->second.first);
+  if (reader_ == nullptr || !reader_->IsGood())
+    reader_ = std::unique_ptr<CheckpointReader>(new CheckpointReader(in_, program_ctx_));
+  const TestCase &tc = reader_->ReadTestCase();
+  const TCMemo &memo = reader_->ReadMemo();
+  if (!reader_->IsGood())
+    return {};
+  return std::make_pair(tc, memo);
+}
+// Offset and length of the current copy of a test case.
+bpstd::optional<std::pair<long long int, long long int>> TestCaseSpillStore::FindEncoded(int tc_id) const {
+  const auto &it = entries_.find(tc_id);
+  if (it == entries_.end())
+    return {};
+  return it->second;
+}
+// The copy as written, to be embedded into a checkpoint without rebuilding the test case. Reads through its own
+// stream: the file is append-only, so a location found under the queue mutex can be read without it.
+bpstd::optional<std::string> TestCaseSpillStore::ReadEncodedAt(
+  const std::pair<long long int, long long int> &location
+) const {
+  std::ifstream in{filename_, std::ios::binary};
+  std::string encoded((size_t) location.second, '\0');
+  in.seekg(location.first);
+  if (!in.read(&encoded[0], location.second))
+    return {};
+  return encoded;
+}
+size_t TestCaseSpillStore::GetEntryCount() const {
+  return entries_.size();
+}
+long long int TestCaseSpillStore::GetSizeInBytes() {
+  return out_.tellp();
+}
+
+} // namespace cxxfoozz
@@ -58,6 +58,22 @@ Random::Random() {
   Logger::Info("Just in case of emergency, here's your reproducible seed: " + std::to_string(seed));
   engine_ = std::default_random_engine(seed);
 }
+// The engine and its use count, a resumed campaign continues the same sequence, including the next reseed.
+std::string Random::SaveState() const {
+  std::stringstream ss;
+  ss << counter_ << ' ' << engine_;
+  return ss.str();
+}
+bool Random::RestoreState(const std::string &state) {
+  std::stringstream ss{state};
+  int counter = 0;
+  std::default_random_engine engine;
+  if (!(ss >> counter >> engine))
+    return false;
+  counter_ = counter;
+  engine_ = engine;
+  return true;
+}
 const std::shared_ptr<Random> &Random::GetInstance() {
   if (instance_ == nullptr || counter_ > kMaxUses) {
     instance_ = std::make_shared<Random>();
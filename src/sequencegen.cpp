@@ -1,13 +1,17 @@
 #include "sequencegen.hpp"
 
+#include <algorithm>
+#include <iterator>
 #include <set>
 #include <sstream>
 #include <utility>
 
+#include "compile-failure-cache.hpp"
 #include "logger.hpp"
 #include "mutator.hpp"
 #include "random.hpp"
 #include "type.hpp"
+#include "util.hpp"
 
 namespace cxxfoozz {
 
@@ -98,6 +102,112 @@ const std::shared_ptr<TemplateTypeContext> &TestCase::GetTemplateTypeContext() c
   return template_type_context_;
 }
 
+uint64_t HashValue(long long int value, uint64_t hash) {
+  return Fnv1aHash((const char *) &value, sizeof(value), hash);
+}
+
+// Types and executables are interned for the whole campaign, so their addresses identify them.
+uint64_t HashType(const TypeWithModifier &type, uint64_t hash) {
+  hash = HashValue((long long int) (uintptr_t) type.GetType().get(), hash);
+  for (const auto &modifier : type.GetModifiers())
+    hash = HashValue((int) modifier, hash);
+  return HashValue(-1, hash);
+}
+
+uint64_t HashOperand(
+  const Operand &operand,
+  const std::map<std::shared_ptr<Statement>, int> &live_indices,
+  uint64_t hash
+) {
+  hash = HashType(operand.GetType(), hash);
+  const std::shared_ptr<Statement> &ref = operand.GetRef();
+  if (ref != nullptr) {
+    const auto &it = live_indices.find(ref);
+    return HashValue(it == live_indices.end() ? -2 : it->second, hash);
+  }
+  const bpstd::optional<std::string> &literal = operand.GetConstantLiteral();
+  hash = HashValue(literal.has_value() ? -3 : -4, hash);
+  return Fnv1aHash(literal.value_or(""), hash);
+}
+
+// Division and modulo may raise SIGFPE, they count as side effects.
+bool IsSideEffectFreeStatement(const std::shared_ptr<Statement> &stmt) {
+  if (stmt->GetVariant() != StatementVariant::kPrimitiveAssignment)
+    return false;
+  GeneralPrimitiveOp op = std::static_pointer_cast<PrimitiveAssignmentStatement>(stmt)->GetOp();
+  return op != GeneralPrimitiveOp::kDiv && op != GeneralPrimitiveOp::kMod;
+}
+// Primitive assignments that no live statement reads have no effect on the target.
+std::vector<bool> FindLiveStatements(const std::vector<std::shared_ptr<Statement>> &statements) {
+  std::vector<bool> live(statements.size(), false);
+  std::set<std::shared_ptr<Statement>> read_stmts;
+  for (int idx = (int) statements.size() - 1; idx >= 0; --idx) {
+    const std::shared_ptr<Statement> &stmt = statements[idx];
+    live[idx] = !IsSideEffectFreeStatement(stmt) || read_stmts.count(stmt) != 0;
+    if (!live[idx])
+      continue;
+    for (const auto &operand : stmt->GetStatementOperands()) {
+      if (operand.GetOperandType() == OperandType::kRefOperand)
+        read_stmts.insert(operand.GetRef());
+    }
+  }
+  return live;
+}
+
+// Equal for test cases rendering to the same driver up to variable names and dead statements.
+// Ref operands are hashed by the position of the referenced statement among the live ones.
+uint64_t TestCase::ComputeStructuralHash() const {
+  const std::vector<bool> &live = FindLiveStatements(statements_);
+  std::map<std::shared_ptr<Statement>, int> live_indices;
+  uint64_t hash = kFnv1aOffsetBasis;
+  for (size_t idx = 0; idx < statements_.size(); ++idx) {
+    if (!live[idx])
+      continue;
+    const std::shared_ptr<Statement> &stmt = statements_[idx];
+    StatementVariant variant = stmt->GetVariant();
+    hash = HashValue((int) variant, hash);
+    hash = HashType(stmt->GetType(), hash);
+    switch (variant) {
+      case StatementVariant::kPrimitiveAssignment: {
+        const auto &primitive_stmt = std::static_pointer_cast<PrimitiveAssignmentStatement>(stmt);
+        hash = HashValue((int) primitive_stmt->GetOp(), hash);
+        break;
+      }
+      case StatementVariant::kCall: {
+        const auto &call_stmt = std::static_pointer_cast<CallStatement>(stmt);
+        hash = HashValue((long long int) (uintptr_t) call_stmt->GetTarget().get(), hash);
+        hash = HashValue(call_stmt->GetInvokingObj().has_value(), hash);
+        const std::shared_ptr<TemplateTypeContext> &tt_ctx = call_stmt->GetTemplateTypeContext();
+        if (tt_ctx != nullptr) {
+          for (const auto &binding : tt_ctx->GetMapping().GetInstMapping()) {
+            hash = Fnv1aHash(binding.first, hash);
+            hash = HashType(binding.second, hash);
+          }
+        }
+        break;
+      }
+      case StatementVariant::kSTLConstruction: {
+        const auto &stl_stmt = std::static_pointer_cast<STLStatement>(stmt);
+        hash = HashValue((long long int) (uintptr_t) stl_stmt->GetTarget().get(), hash);
+        hash = HashValue(stl_stmt->GetElements().IsKeyValueElements(), hash);
+        break;
+      }
+      case StatementVariant::kArrayInitialization: {
+        const auto &array_stmt = std::static_pointer_cast<ArrayInitStatement>(stmt);
+        hash = HashValue(array_stmt->GetCapacity().value_or(-1), hash);
+        hash = HashValue(array_stmt->GetStringLiteral().has_value(), hash);
+        break;
+      }
+    }
+    const std::vector<Operand> &operands = stmt->GetStatementOperands();
+    hash = HashValue((long long int) operands.size(), hash);
+    for (const auto &operand : operands)
+      hash = HashOperand(operand, live_indices, hash);
+    live_indices.emplace(stmt, (int) live_indices.size());
+  }
+  return hash;
+}
+
 // ##########
 // # TestCaseGenerator
 // #####
@@ -140,33 +250,50 @@ TestCase TestCaseGenerator::GenForMethod(const seqgen::GenTCForMethodSpec &spec)
   }
 
   const std::vector<clang::QualType> &arguments = target->GetArguments();
-  std::vector<std::shared_ptr<Statement>> statements(statement_ctx.begin(), statement_ctx.begin() + placement_idx);
-
-  OperandResolver operand_resolver{context_};
-  std::vector<Operand> operands;
-  for (const auto &arg : arguments) {
-    const TWMSpec &twm_spec = TWMSpec::ByClangType(arg, nullptr);
-    const TypeWithModifier &type_with_modifier = TypeWithModifier::FromSpec(twm_spec);
-    const seqgen::ResolveOperandSpec &operand_spec =
-      seqgen::ResolveOperandSpec{type_with_modifier, statements, tt_ctx, force_avail_op};
-    const Operand &operand = operand_resolver.ResolveOperand(operand_spec);
-    operands.push_back(operand);
-  }
-
   bool is_method_variant = target->GetExecutableVariant() == ExecutableVariant::kMethod;
   bool require_invoking_object = is_method_variant && owner != nullptr && !target->IsNotRequireInvokingObj();
 
+  // Operands are resolved again while the call, or a creator call made for its operands, has a shape the
+  // compiler already rejected.
+  static const int kMaxKnownFailureRetries = 3;
+  const std::shared_ptr<CompileFailureCache> &failure_cache = CompileFailureCache::GetInstance();
+  OperandResolver operand_resolver{context_};
+  std::vector<std::shared_ptr<Statement>> statements;
+  std::vector<Operand> operands;
   bpstd::optional<Operand> opt_invoking_obj;
-  if (require_invoking_object) {
-    const std::string &class_name = owner->GetQualifiedName();
-    const std::shared_ptr<ClassType> &class_type = ClassType::GetTypeByQualName(class_name);
+  for (int attempt = 0;; ++attempt) {
+    statements.assign(statement_ctx.begin(), statement_ctx.begin() + placement_idx);
+    operands.clear();
+    for (const auto &arg : arguments) {
+      const TWMSpec &twm_spec = TWMSpec::ByClangType(arg, nullptr);
+      const TypeWithModifier &type_with_modifier = TypeWithModifier::FromSpec(twm_spec);
+      const seqgen::ResolveOperandSpec &operand_spec =
+        seqgen::ResolveOperandSpec{type_with_modifier, statements, tt_ctx, force_avail_op};
+      const Operand &operand = operand_resolver.ResolveOperand(operand_spec);
+      operands.push_back(operand);
+    }
 
-    const TWMSpec &twm_spec = TWMSpec::ByType(class_type, nullptr);
-    const TypeWithModifier &type_with_modifier = TypeWithModifier::FromSpec(twm_spec);
-    const seqgen::ResolveOperandSpec &operand_spec =
-      seqgen::ResolveOperandSpec{type_with_modifier, statements, tt_ctx, force_avail_op};
-    const Operand &invoking_obj = operand_resolver.ResolveOperand(operand_spec);
-    opt_invoking_obj = bpstd::make_optional(invoking_obj);
+    opt_invoking_obj = bpstd::nullopt;
+    if (require_invoking_object) {
+      const std::string &class_name = owner->GetQualifiedName();
+      const std::shared_ptr<ClassType> &class_type = ClassType::GetTypeByQualName(class_name);
+
+      const TWMSpec &twm_spec = TWMSpec::ByType(class_type, nullptr);
+      const TypeWithModifier &type_with_modifier = TypeWithModifier::FromSpec(twm_spec);
+      const seqgen::ResolveOperandSpec &operand_spec =
+        seqgen::ResolveOperandSpec{type_with_modifier, statements, tt_ctx, force_avail_op};
+      const Operand &invoking_obj = operand_resolver.ResolveOperand(operand_spec);
+      opt_invoking_obj = bpstd::make_optional(invoking_obj);
+    }
+
+    if (!failure_cache->IsEnabled() || attempt >= kMaxKnownFailureRetries)
+      break;
+    bool has_known_failure = failure_cache->IsKnownFailure(
+      CallStatement::MakeExecutableCall(target, operands, opt_invoking_obj, tt_ctx));
+    for (auto it = statements.begin() + placement_idx; it != statements.end() && !has_known_failure; ++it)
+      has_known_failure = failure_cache->IsKnownFailure(*it);
+    if (!has_known_failure)
+      break;
   }
 
   const std::shared_ptr<Random> &r = Random::GetInstance();
@@ -635,6 +762,16 @@ Operand OperandResolver::ResolveOperandClassType(const seqgen::ResolveOperandSpe
     }
   }
 
+  const std::shared_ptr<CompileFailureCache> &failure_cache = CompileFailureCache::GetInstance();
+  std::vector<std::shared_ptr<Creator>> usable_creators;
+  std::copy_if(
+    type_creators.begin(), type_creators.end(), std::back_inserter(usable_creators),
+    [&failure_cache](const std::shared_ptr<Creator> &creator) {
+      return !failure_cache->IsBlocked(creator);
+    });
+  if (!usable_creators.empty())
+    type_creators = usable_creators;
+
   const std::shared_ptr<Random> &r = Random::GetInstance();
   int idx = r->NextInt((int) type_creators.size());
   std::shared_ptr<Creator> &selected_creator = type_creators[idx];
@@ -0,0 +1,140 @@
+#include "triage.hpp"
+#include "logger.hpp"
+
+#include <experimental/filesystem>
+
+namespace cxxfoozz {
+
+// ##########
+// # CrashTriageJob
+// #####
+
+CrashTriageJob::CrashTriageJob(
+  std::string target_exe,
+  std::string exe_args,
+  std::map<std::string, std::string> env,
+  ResultFn result_fn
+)
+  : target_exe_(std::move(target_exe)),
+    exe_args_(std::move(exe_args)),
+    env_(std::move(env)),
+    result_fn_(std::move(result_fn)) {}
+const std::string &CrashTriageJob::GetTargetExe() const {
+  return target_exe_;
+}
+const std::string &CrashTriageJob::GetExeArgs() const {
+  return exe_args_;
+}
+const std::map<std::string, std::string> &CrashTriageJob::GetEnv() const {
+  return env_;
+}
+const CrashTriageJob::ResultFn &CrashTriageJob::GetResultFn() const {
+  return result_fn_;
+}
+
+// ##########
+// # CrashTriagePool
+// #####
+
+const int CrashTriagePool::kQueueCapacityPerThread = 16;
+
+CrashTriagePool::CrashTriagePool(std::string scratch_dir, std::string src_dir, int thread_count)
+  : scratch_dir_(std::move(scratch_dir)),
+    src_dir_(std::move(src_dir)),
+    handlers_(),
+    mutex_(),
+    not_empty_cv_(),
+    not_full_cv_(),
+    jobs_(),
+    capacity_((size_t) (thread_count * kQueueCapacityPerThread)),
+    threads_() {
+  for (int thread_id = 0; thread_id < thread_count; ++thread_id) {
+    const std::string &gdb_command_file = scratch_dir_ + "/triage_" + std::to_string(thread_id) + ".gdb";
+    handlers_.push_back(std::unique_ptr<CrashTCHandler>(new CrashTCHandler(gdb_command_file)));
+  }
+  for (int thread_id = 0; thread_id < thread_count; ++thread_id)
+    threads_.emplace_back([this, thread_id] { Run(thread_id); });
+}
+CrashTriagePool::~CrashTriagePool() {
+  Finish();
+}
+
+// Runs on the fuzzing thread that found the crash, before it overwrites its executable and crash report. Replays
+// write their gcda files and crash reports under the scratch dir and stay out of the shared memory coverage map.
+void CrashTriagePool::Submit(
+  const std::string &target_exe,
+  const std::map<std::string, std::string> &env,
+  const std::string &exe_args,
+  const CrashTriageJob::ResultFn &result_fn
+) {
+  namespace fs = std::experimental::filesystem;
+  long long int job_id = 0;
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    not_full_cv_.wait(lock, [this] { return finishing_ || jobs_.size() < capacity_; });
+    if (finishing_)
+      return;
+    job_id = submitted_count_++;
+  }
+  const std::string &job_exe = scratch_dir_ + "/crash_" + std::to_string(job_id);
+  std::error_code ec;
+  fs::copy_file(target_exe, job_exe, fs::copy_options::overwrite_existing, ec);
+  if (ec) {
+    Logger::Warn("CrashTriagePool", "Cannot copy the crashing executable: " + target_exe);
+    return;
+  }
+  std::map<std::string, std::string> job_env{env};
+  job_env["GCOV_PREFIX"] = scratch_dir_ + "/gcov";
+  job_env["GCOV_PREFIX_STRIP"] = "0";
+  job_env.erase(SharedCoverageMap::kShmEnvVar);
+  const auto &report_it = env.find(CrashReportRuntime::kReportEnvVar);
+  if (report_it != env.end()) {
+    const std::string &job_report = job_exe + ".report";
+    fs::copy_file(report_it->second, job_report, fs::copy_options::overwrite_existing, ec);
+    job_env[CrashReportRuntime::kReportEnvVar] = job_report;
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  jobs_.emplace_back(job_exe, exe_args, job_env, result_fn);
+  not_empty_cv_.notify_one();
+}
+// Queued jobs are still triaged, their crashes are part of the campaign.
+void CrashTriagePool::Finish() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    finishing_ = true;
+  }
+  not_empty_cv_.notify_all();
+  not_full_cv_.notify_all();
+  for (auto &thread : threads_) {
+    if (thread.joinable())
+      thread.join();
+  }
+}
+long long int CrashTriagePool::GetTriagedCount() const {
+  return triaged_count_;
+}
+
+void CrashTriagePool::Run(int thread_id) {
+  CrashTCHandler &crash_tc_handler = *handlers_[thread_id];
+  while (true) {
+    bpstd::optional<CrashTriageJob> job;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      not_empty_cv_.wait(lock, [this] { return finishing_ || !jobs_.empty(); });
+      if (jobs_.empty())
+        return;
+      job = jobs_.front();
+      jobs_.pop_front();
+      not_full_cv_.notify_one();
+    }
+    const std::string &target_exe = job->GetTargetExe();
+    const TCMemo &memo = crash_tc_handler.TriageCrash(target_exe, src_dir_, job->GetEnv(), job->GetExeArgs());
+    job->GetResultFn()(memo);
+    std::error_code ec;
+    std::experimental::filesystem::remove(target_exe, ec);
+    std::experimental::filesystem::remove(target_exe + ".report", ec);
+    ++triaged_count_;
+  }
+}
+
+} // namespace cxxfoozz
@@ -1,4 +1,8 @@
 #include "util.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iomanip>
 #include <sstream>
 
 std::vector<std::string> SplitStringIntoVector(std::string target, const std::string &delimiter) {
@@ -41,4 +45,111 @@ std::string ReplaceFirstOccurrence(std::string input, const std::string &keyword
   if (pos == std::string::npos)
     return input;
   return input.replace(pos, keyword.length(), repl);
-}
\ No newline at end of file
+}
+
+std::vector<std::string> SplitCommandLine(const std::string &command_line) {
+  std::vector<std::string> result;
+  std::string token;
+  bool in_token = false;
+  char quote = '\0';
+  for (size_t i = 0; i < command_line.size(); ++i) {
+    char c = command_line[i];
+    if (quote == '\'') {
+      if (c == '\'')
+        quote = '\0';
+      else
+        token += c;
+    } else if (quote == '"') {
+      if (c == '"')
+        quote = '\0';
+      else if (c == '\\' && i + 1 < command_line.size() && std::strchr("\"\\$`", command_line[i + 1]) != nullptr)
+        token += command_line[++i];
+      else
+        token += c;
+    } else if (std::isspace(c)) {
+      if (in_token)
+        result.push_back(token);
+      token.clear();
+      in_token = false;
+    } else {
+      in_token = true;
+      if (c == '\'' || c == '"')
+        quote = c;
+      else if (c == '\\' && i + 1 < command_line.size())
+        token += command_line[++i];
+      else
+        token += c;
+    }
+  }
+  if (in_token)
+    result.push_back(token);
+  return result;
+}
+
+uint64_t Fnv1aHash(const char *data, size_t size, uint64_t hash) {
+  for (size_t i = 0; i < size; ++i) {
+    hash ^= (unsigned char) data[i];
+    hash *= 1099511628211ULL;
+  }
+  return hash;
+}
+
+uint64_t Fnv1aHash(const std::string &data, uint64_t hash) {
+  return Fnv1aHash(data.data(), data.size(), hash);
+}
+
+std::string ToHexString(uint64_t value) {
+  std::stringstream ss;
+  ss << std::hex << std::setw(16) << std::setfill('0') << value;
+  return ss.str();
+}
+
+BloomFilter::BloomFilter(size_t expected_items, double false_positive_rate)
+  : expected_items_(std::max<size_t>(1, expected_items)) {
+  const double ln2 = std::log(2.0);
+  double bits = -(double) expected_items_ * std::log(false_positive_rate) / (ln2 * ln2);
+  bit_count_ = std::max<size_t>(64, (size_t) std::ceil(bits));
+  probe_count_ = std::min(16, std::max(1, (int) std::lround(bits / (double) expected_items_ * ln2)));
+  words_.assign((bit_count_ + 63) / 64, 0);
+}
+bool BloomFilter::Contains(uint64_t hash) const {
+  for (int probe = 0; probe < probe_count_; ++probe) {
+    size_t bit = BitIndex(hash, probe);
+    if ((words_[bit / 64] & (1ULL << (bit % 64))) == 0)
+      return false;
+  }
+  return true;
+}
+bool BloomFilter::Insert(uint64_t hash) {
+  bool inserted = false;
+  for (int probe = 0; probe < probe_count_; ++probe) {
+    size_t bit = BitIndex(hash, probe);
+    uint64_t mask = 1ULL << (bit % 64);
+    inserted |= (words_[bit / 64] & mask) == 0;
+    words_[bit / 64] |= mask;
+  }
+  if (inserted)
+    ++inserted_count_;
+  return inserted;
+}
+size_t BloomFilter::GetInsertedCount() const {
+  return inserted_count_;
+}
+size_t BloomFilter::GetExpectedItems() const {
+  return expected_items_;
+}
+void BloomFilter::Clear() {
+  std::fill(words_.begin(), words_.end(), 0);
+  inserted_count_ = 0;
+}
+// Double hashing over two halves of the mixed hash. FNV-1a mixes the last bytes poorly, hence the
+// splitmix64 finalizer.
+size_t BloomFilter::BitIndex(uint64_t hash, int probe) const {
+  uint64_t mixed = hash;
+  mixed = (mixed ^ (mixed >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  mixed = (mixed ^ (mixed >> 27)) * 0x94d049bb133111ebULL;
+  mixed ^= mixed >> 31;
+  uint64_t h1 = mixed & 0xffffffffULL;
+  uint64_t h2 = (mixed >> 32) | 1ULL;
+  return (size_t) ((h1 + (uint64_t) probe * h2) % bit_count_);
+}
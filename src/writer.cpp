@@ -2,9 +2,12 @@
 #include "writer.hpp"
 #include "util.hpp"
 
+#include <algorithm>
 #include <experimental/filesystem>
 #include <fstream>
 #include <iostream>
+#include <limits>
+#include <set>
 #include <utility>
 
 namespace cxxfoozz {
@@ -39,10 +42,132 @@ std::shared_ptr<ImportWriter> ImportWriter::ExtractImportWriterFromSourceLoc(
 int ImportWriter::GetLineUsage() const {
   return (int) header_files_.size() + 1; // (+1) from an extra end-of-line.
 }
+void ImportWriter::EnableMinimalIncludes(
+  const clang::SourceManager *src_manager,
+  std::function<bool(const std::string &)> is_self_contained,
+  std::vector<std::string> always_included
+) {
+  src_manager_ = src_manager;
+  is_self_contained_ = std::move(is_self_contained);
+  always_included_ = std::move(always_included);
+}
+// Writes only the headers declaring what the test case uses, in the order of the full list. Unused lines
+// are left blank so that GetLineUsage (and the crash line mapping built on it) stays the same.
+void ImportWriter::WriteHeader(std::ofstream &out, const TestCase &tc) {
+  std::vector<clang::SourceLocation> locations;
+  if (src_manager_ == nullptr || !CollectDeclLocations(tc, locations)) {
+    WriteHeader(out);
+    return;
+  }
+  std::set<std::string> required{always_included_.begin(), always_included_.end()};
+  for (const auto &location : locations) {
+    const bpstd::optional<std::string> &header = ResolveHeader(location);
+    if (!header.has_value()) {
+      WriteHeader(out);
+      return;
+    }
+    required.insert(header.value());
+  }
+  for (const auto &header_file : header_files_) {
+    if (required.count(header_file) > 0)
+      out << "#include \"" << header_file << "\"";
+    out << '\n';
+  }
+  out << '\n';
+}
+// Template instantiations and STL types may need declarations we cannot attribute to a single header.
+bool ImportWriter::CollectDeclLocations(const TestCase &tc, std::vector<clang::SourceLocation> &locations) const {
+  if (tc.GetTemplateTypeContext() != nullptr)
+    return false;
+  for (const auto &stmt : tc.GetStatements()) {
+    const std::shared_ptr<Type> &type = stmt->GetType().GetType();
+    switch (type->GetVariant()) {
+      case TypeVariant::kPrimitive:
+        break;
+      case TypeVariant::kClass: {
+        const std::shared_ptr<ClassType> &class_type = std::static_pointer_cast<ClassType>(type);
+        clang::CXXRecordDecl *decl = class_type->GetModel()->GetClangDecl();
+        if (decl == nullptr)
+          return false;
+        locations.push_back(decl->getLocation());
+        break;
+      }
+      case TypeVariant::kEnum: {
+        const std::shared_ptr<EnumType> &enum_type = std::static_pointer_cast<EnumType>(type);
+        clang::EnumDecl *decl = enum_type->GetModel()->GetEnumDecl();
+        if (decl == nullptr)
+          return false;
+        locations.push_back(decl->getLocation());
+        break;
+      }
+      case TypeVariant::kTemplateTypename:
+      case TypeVariant::kTemplateTypenameSpc:
+      case TypeVariant::kSTL:
+        return false;
+    }
+    if (stmt->GetVariant() == StatementVariant::kSTLConstruction)
+      return false;
+    if (stmt->GetVariant() != StatementVariant::kCall)
+      continue;
+    const std::shared_ptr<CallStatement> &call_stmt = std::static_pointer_cast<CallStatement>(stmt);
+    const std::shared_ptr<Executable> &target = call_stmt->GetTarget();
+    if (target->IsTemplatedExecutable() || call_stmt->GetTemplateTypeContext() != nullptr)
+      return false;
+    if (target->GetDeclLocation().isValid()) {
+      locations.push_back(target->GetDeclLocation());
+    } else {
+      const std::shared_ptr<ClassTypeModel> &owner = target->GetOwner();
+      if (owner == nullptr || owner->GetClangDecl() == nullptr)
+        return false;
+      locations.push_back(owner->GetClangDecl()->getLocation()); // implicit members
+    }
+  }
+  return true;
+}
+// Climbs the include stack from the declaring file up to the first header in the full list that compiles
+// on its own. Headers that rely on a previous include are skipped in favor of the file including them.
+bpstd::optional<std::string> ImportWriter::ResolveHeader(const clang::SourceLocation &location) {
+  unsigned raw_location = location.getRawEncoding();
+  const auto &cached = resolved_headers_.find(raw_location);
+  if (cached != resolved_headers_.end())
+    return cached->second;
+
+  const clang::SourceManager &src_manager = *src_manager_;
+  const std::set<std::string> listed{header_files_.begin(), header_files_.end()};
+  bpstd::optional<std::string> result;
+  clang::FileID file_id = src_manager.getFileID(src_manager.getExpansionLoc(location));
+  while (file_id.isValid()) {
+    const clang::FileEntry *file_entry = src_manager.getFileEntryForID(file_id);
+    if (file_entry == nullptr)
+      break;
+    const std::string &filename = file_entry->getName().str();
+    if (listed.count(filename) > 0 && IsSelfContained(filename)) {
+      result = filename;
+      break;
+    }
+    const clang::SourceLocation &include_loc = src_manager.getIncludeLoc(file_id);
+    if (include_loc.isInvalid())
+      break;
+    file_id = src_manager.getFileID(include_loc);
+  }
+  resolved_headers_[raw_location] = result;
+  return result;
+}
+bool ImportWriter::IsSelfContained(const std::string &header_file) {
+  const auto &cached = self_contained_.find(header_file);
+  if (cached != self_contained_.end())
+    return cached->second;
+  bool self_contained = is_self_contained_ == nullptr || is_self_contained_(header_file);
+  if (!self_contained)
+    Logger::Warn("ImportWriter", "Header is not self-contained, including its parent instead: " + header_file);
+  self_contained_[header_file] = self_contained;
+  return self_contained;
+}
 
 // ##########
 // # TestCaseWriter
 // #####
+const std::string &TestCaseWriter::kBatchFunctionPrefix = "cxxfoozz_tc_";
 const int kIndentWidth = 2;
 const std::string kIndentString(kIndentWidth, ' ');
 void WriteStatementWithIndentation(
@@ -82,9 +207,10 @@ void EnsureResultDirInitialized() {
 
 TestCaseWriter::TestCaseWriter(
   std::shared_ptr<ImportWriter> import_writer,
-  const std::shared_ptr<ProgramContext> &context
+  const std::shared_ptr<ProgramContext> &context,
+  TmpDriverPurpose purpose
 )
-  : import_writer_(std::move(import_writer)), context_(context) {}
+  : import_writer_(std::move(import_writer)), context_(context), purpose_(purpose) {}
 const std::shared_ptr<ImportWriter> &TestCaseWriter::GetImportWriter() const {
   return import_writer_;
 }
@@ -117,6 +243,7 @@ void PrintStatements(
       WriteStatementWithIndentation(target, "/* PROGRAM CRASHED AT THE EXACT LINE BELOW */", true);
     }
     const std::string &stmt = stmt_writer.StmtAsString(statement, idx++);
+    assert(stmt.find('\n') == std::string::npos); // one line per statement, see LineNumberToStmtIdx
     WriteStatementWithIndentation(target, stmt);
   }
   if (try_catch_mode != TryCatchVariant::kNoTryCatch) {
@@ -130,7 +257,7 @@ void PrintStatements(
 void TestCaseWriter::WriteToFile(const TestCase &tc, const std::string &filename) {
   if (std::ofstream target{filename}) {
     if (import_writer_ != nullptr)
-      import_writer_->WriteHeader(target);
+      import_writer_->WriteHeader(target, tc);
 
     target << "int main() {\n";
     PrintStatements(target, tc, context_, {}, TryCatchVariant::kWithTryCatch); // for temporary driver files
@@ -141,6 +268,113 @@ void TestCaseWriter::WriteToFile(const TestCase &tc, const std::string &filename
     Logger::Error("[TestCaseWriter::WriteToFile]", "Problematic output file: " + filename + '\n');
   }
 }
+// Each test case becomes its own function, laid out like the main() of a one-shot driver, and argv[1]
+// selects the one to run. Returns the line of each function header.
+std::vector<int> TestCaseWriter::WriteBatchToFile(const std::vector<TestCase> &tcs, const std::string &filename) {
+  std::vector<int> first_lines;
+  if (std::ofstream target{filename}) {
+    if (import_writer_ != nullptr)
+      import_writer_->WriteHeader(target);
+
+    // One line per statement: the header, "try {", the statements, the catch, "return 0" and "}".
+    int line_num = import_writer_ != nullptr ? import_writer_->GetLineUsage() : 0;
+    int tc_idx = 0;
+    for (const auto &tc : tcs) {
+      first_lines.push_back(line_num + 1);
+      line_num += (int) tc.GetStatements().size() + 5;
+      target << "int " << kBatchFunctionPrefix << tc_idx++ << "() {\n";
+      PrintStatements(target, tc, context_, {}, TryCatchVariant::kWithTryCatch);
+      WriteStatementWithIndentation(target, "return 0");
+      target << "}\n";
+    }
+    // Served batch drivers get the fork server entry point after the dispatcher, line numbers stay the same
+    bool fork_server = purpose_ == TmpDriverPurpose::kForkServer;
+    target << "\n#include <cstdlib>\n\n";
+    target << (fork_server ? "int cxxfoozz_body(int argc, char **argv) {\n" : "int main(int argc, char **argv) {\n");
+    WriteStatementWithIndentation(target, "switch (argc > 1 ? std::atoi(argv[1]) : -1) {", true);
+    for (int i = 0; i < (int) tcs.size(); ++i) {
+      const std::string &idx = std::to_string(i);
+      WriteStatementWithIndentation(target, "case " + idx + ": return " + kBatchFunctionPrefix + idx + "();", true, 4);
+    }
+    WriteStatementWithIndentation(target, "}", true);
+    WriteStatementWithIndentation(target, "return 1");
+    target << "}\n";
+    if (fork_server)
+      target << ForkServerClient::kForkServerDriverSource;
+  } else {
+    Logger::Error("[TestCaseWriter::WriteBatchToFile]", "Problematic output file: " + filename + '\n');
+    first_lines.clear();
+  }
+  return first_lines;
+}
+// Maps a line of a batch driver to (test case index, the same line in a one-shot driver of that test case).
+bpstd::optional<std::pair<int, int>> TestCaseWriter::LocateBatchLine(
+  const std::vector<int> &first_lines,
+  int src_linenum
+) const {
+  const auto &it = std::upper_bound(first_lines.begin(), first_lines.end(), src_linenum);
+  if (it == first_lines.begin())
+    return {};
+  int tc_idx = (int) (it - first_lines.begin()) - 1;
+  int main_linenum = import_writer_->GetLineUsage() + 1;
+  return std::make_pair(tc_idx, src_linenum - first_lines[tc_idx] + main_linenum);
+}
+// Replaces the given test case functions and their dispatcher cases by empty lines, so that line numbers of the
+// remaining functions do not move. Done on the text since statements may be shared with other test cases.
+void TestCaseWriter::BlankBatchFunctions(
+  const std::string &filename,
+  const std::vector<int> &first_lines,
+  const std::set<int> &tc_idxs
+) {
+  std::vector<std::string> lines;
+  {
+    std::ifstream source{filename};
+    std::string line;
+    while (std::getline(source, line))
+      lines.push_back(line);
+  }
+  for (int tc_idx : tc_idxs) {
+    if (tc_idx < 0 || tc_idx >= (int) first_lines.size())
+      continue;
+    const std::string &idx = std::to_string(tc_idx);
+    const std::string &dispatch_line = "case " + idx + ": return " + kBatchFunctionPrefix + idx + "();";
+    bool in_function = false;
+    for (int line_num = first_lines[tc_idx]; line_num <= (int) lines.size(); ++line_num) {
+      std::string &line = lines[line_num - 1];
+      if (line_num == first_lines[tc_idx])
+        in_function = true;
+      if (in_function) {
+        in_function = line != "}";
+        line.clear();
+      } else if (StringStrip(line) == dispatch_line) {
+        line.clear();
+        break;
+      }
+    }
+  }
+  std::ofstream target{filename};
+  for (const auto &line : lines)
+    target << line << '\n';
+}
+// Same as BlankBatchFunctions for statements of a one-shot temporary driver.
+void TestCaseWriter::BlankStatements(const std::string &filename, const std::set<int> &stmt_idxs) {
+  std::vector<std::string> lines;
+  {
+    std::ifstream source{filename};
+    std::string line;
+    while (std::getline(source, line))
+      lines.push_back(line);
+  }
+  int first_stmt_linenum = import_writer_->GetLineUsage() + 3; // after "int main() {" and "try {"
+  for (int stmt_idx : stmt_idxs) {
+    int line_num = first_stmt_linenum + stmt_idx;
+    if (stmt_idx >= 0 && line_num <= (int) lines.size())
+      lines[line_num - 1].clear();
+  }
+  std::ofstream target{filename};
+  for (const auto &line : lines)
+    target << line << '\n';
+}
 int TestCaseWriter::LineNumberToStmtIdx(int src_linenum, int import_line_count, bool has_exception) {
   int tagged_line = src_linenum - import_line_count - 2; // 2: 1 for int main(), 1 to align with 0-based index
   if (!has_exception)
@@ -155,7 +389,7 @@ bpstd::optional<std::shared_ptr<Statement>> TestCaseWriter::GetStatementByLineNu
   int import_line_count = import_writer_->GetLineUsage();
   int stmt_idx = LineNumberToStmtIdx(src_linenum, import_line_count, has_exception);
   const std::vector<std::shared_ptr<Statement>> &stmts = tc.GetStatements();
-  if (stmt_idx < ((int) stmts.size()))
+  if (stmt_idx >= 0 && stmt_idx < ((int) stmts.size()))
     return {stmts[stmt_idx]};
   else
     return {};
@@ -171,8 +405,8 @@ inline bool SuffixCheck(const std::string &value, const std::string &ending) {
 }
 
 void GoogleTestWriter::AppendCompileInstruction(std::ofstream &target, const std::string &filename) {
-  const std::string &object_files =
-    "$(find " + target_dir_ + " -maxdepth " + std::to_string(max_depth_) + " -type f -name \"*.o\")";
+  const std::string &object_files = !prelinked_object_.empty() ? prelinked_object_
+    : "$(find " + target_dir_ + " -maxdepth " + std::to_string(max_depth_) + " -type f -name \"*.o\")";
 
   assert(SuffixCheck(filename, ".cpp"));
   std::string executable_name = filename;
@@ -223,13 +457,16 @@ GoogleTestWriter::GoogleTestWriter(
   std::vector<std::string> compile_flags,
   std::vector<std::string> ld_flags,
   int max_depth,
-  const std::shared_ptr<ProgramContext> &context
+  const std::shared_ptr<ProgramContext> &context,
+  std::string prelinked_object
 )
   : import_writer_(std::move(import_writer)),
     target_dir_(std::move(target_dir)),
     compile_flags_(std::move(compile_flags)),
     ld_flags_(std::move(ld_flags)),
-    max_depth_(max_depth), context_(context) {}
+    max_depth_(max_depth), context_(context),
+    prelinked_object_(std::move(prelinked_object)),
+    spill_store_() {}
 
 void GoogleTestWriter::WriteToFile(
   std::vector<FlushableTestCase> &flushable_tcs,
@@ -237,63 +474,79 @@ void GoogleTestWriter::WriteToFile(
   const std::string &suite_name
 ) {
   if (std::ofstream target{filename}) {
-    target << "#include <gtest/gtest.h>\n";
-
-    if (import_writer_ != nullptr)
-      import_writer_->WriteHeader(target);
+    WriteHeader(target);
 
     if (flushable_tcs.empty())
       target << "// CXXFOOZZ did not generate any test case here.\n\n";
 
     for (auto &ftc : flushable_tcs) {
-      const TestCase &tc = ftc.GetTc();
-      const TCMemo &memo = ftc.GetMemo();
-
-      target << "TEST(" << suite_name << ", tc_id_" << ftc.GetId() << ") {\n";
-      if (memo.GetLocation().has_value())
-        WriteStatementWithIndentation(target, "// location: " + memo.GetLocation().value(), true);
-      if (memo.GetFingerprint().has_value())
-        WriteStatementWithIndentation(target, "// crash fp: " + memo.GetFingerprint().value(), true);
-      if (memo.GetGdbOutput().has_value()) {
-        const std::string &gdb_output = memo.GetGdbOutput().value();
-        const std::string &gdb_san = SanitizeCxxBlockComment(gdb_output);
-        WriteStatementWithIndentation(target, "/* gdb output:\n" + gdb_san + "*/", true);
-      }
-      if (memo.GetCompilationOutput().has_value()) {
-        const std::string &compilation_output = memo.GetCompilationOutput().value();
-        const std::string &cmp_san = SanitizeCxxBlockComment(compilation_output);
-        WriteStatementWithIndentation(target, "/* compilation output:\n" + cmp_san + "*/", true);
-      }
-      bool has_exception = ftc.GetReturnCode() == ExecutionResult::kExceptionReturnCode;
-      int crash_tag_idx = -1;
-      if (memo.GetCrashLineNum().has_value()) {
-        const int &crash_line_num = memo.GetCrashLineNum().value();
-        int import_line_count = import_writer_->GetLineUsage();
-        crash_tag_idx = TestCaseWriter::LineNumberToStmtIdx(crash_line_num, import_line_count, has_exception);
-      }
-      PrintStatements(
-        target,
-        tc,
-        context_,
-        crash_tag_idx >= 0 ? bpstd::make_optional(crash_tag_idx) : bpstd::nullopt,
-        has_exception ? TryCatchVariant::kWithTryCatchNoReturnValue
-                      : TryCatchVariant::kNoTryCatch); // for the final GoogleTest-formatted Test Suite
-      ftc.SetFlushed(true);
-      target << "}\n\n";
+      ResidentTestCaseScope resident{ftc, spill_store_.get()};
+      if (resident.IsResident())
+        WriteTest(target, ftc, suite_name);
     }
 
-    target << "int main(int argc, char **argv) {\n";
-    WriteStatementWithIndentation(target, "testing::InitGoogleTest(&argc, argv)");
-    WriteStatementWithIndentation(target, "return RUN_ALL_TESTS()");
-    target << "}\n\n";
-
-    AppendCompileInstruction(target, filename);
+    WriteFooter(target, filename);
 
   } else {
     Logger::Error("[GoogleTestWriter::WriteToFile]", "Problematic output file: " + filename + '\n');
   }
 
 }
+void GoogleTestWriter::WriteHeader(std::ofstream &target) {
+  target << "#include <gtest/gtest.h>\n";
+
+  if (import_writer_ != nullptr)
+    import_writer_->WriteHeader(target);
+}
+void GoogleTestWriter::WriteTest(std::ofstream &target, FlushableTestCase &ftc, const std::string &suite_name) {
+  const TestCase &tc = ftc.GetTc();
+  const TCMemo &memo = ftc.GetMemo();
+
+  target << "TEST(" << suite_name << ", tc_id_" << ftc.GetId() << ") {\n";
+  if (!ftc.GetCoverageDelta().IsEmpty())
+    WriteStatementWithIndentation(target, "// new coverage: " + ftc.GetCoverageDelta().ToPrettyString(), true);
+  if (memo.GetLocation().has_value())
+    WriteStatementWithIndentation(target, "// location: " + memo.GetLocation().value(), true);
+  if (memo.GetFingerprint().has_value())
+    WriteStatementWithIndentation(target, "// crash fp: " + memo.GetFingerprint().value(), true);
+  if (memo.GetGdbOutput() != nullptr) {
+    const std::string &gdb_output = *memo.GetGdbOutput();
+    const std::string &gdb_san = SanitizeCxxBlockComment(gdb_output);
+    WriteStatementWithIndentation(target, "/* gdb output:\n" + gdb_san + "*/", true);
+  }
+  if (memo.GetCompilationOutput() != nullptr) {
+    const std::string &compilation_output = *memo.GetCompilationOutput();
+    const std::string &cmp_san = SanitizeCxxBlockComment(compilation_output);
+    WriteStatementWithIndentation(target, "/* compilation output:\n" + cmp_san + "*/", true);
+  }
+  bool has_exception = ftc.GetReturnCode() == ExecutionResult::kExceptionReturnCode;
+  int crash_tag_idx = -1;
+  if (memo.GetCrashLineNum().has_value()) {
+    const int &crash_line_num = memo.GetCrashLineNum().value();
+    int import_line_count = import_writer_->GetLineUsage();
+    crash_tag_idx = TestCaseWriter::LineNumberToStmtIdx(crash_line_num, import_line_count, has_exception);
+  }
+  PrintStatements(
+    target,
+    tc,
+    context_,
+    crash_tag_idx >= 0 ? bpstd::make_optional(crash_tag_idx) : bpstd::nullopt,
+    has_exception ? TryCatchVariant::kWithTryCatchNoReturnValue
+                  : TryCatchVariant::kNoTryCatch); // for the final GoogleTest-formatted Test Suite
+  ftc.SetFlushed(true);
+  target << "}\n\n";
+}
+void GoogleTestWriter::WriteFooter(std::ofstream &target, const std::string &filename) {
+  target << "int main(int argc, char **argv) {\n";
+  WriteStatementWithIndentation(target, "testing::InitGoogleTest(&argc, argv)");
+  WriteStatementWithIndentation(target, "return RUN_ALL_TESTS()");
+  target << "}\n\n";
+
+  AppendCompileInstruction(target, filename);
+}
+void GoogleTestWriter::SetSpillStore(const std::shared_ptr<TestCaseSpillStore> &spill_store) {
+  spill_store_ = spill_store;
+}
 
 // ##########
 // # ScaffoldingHPPFileWriter
@@ -452,6 +705,8 @@ std::string ScaffoldingHPPFileWriter::GetScaffoldingContent() {
 // # ReplayDriverWriter
 // #####
 
+const std::vector<int> ReplayDriverWriter::kPartitionHours = {1, 3, 6, 12, 24};
+
 ReplayDriverWriter::ReplayDriverWriter(
   std::shared_ptr<ImportWriter> import_writer,
   std::string target_dir,
@@ -459,14 +714,17 @@ ReplayDriverWriter::ReplayDriverWriter(
   std::vector<std::string> ld_flags,
   int max_depth,
   const std::shared_ptr<ProgramContext> &context,
-  ReplayDriverPurpose purpose
+  ReplayDriverPurpose purpose,
+  std::string prelinked_object
 )
   : import_writer_(std::move(import_writer)),
     target_dir_(std::move(target_dir)),
     compile_flags_(std::move(compile_flags)),
     ld_flags_(std::move(ld_flags)),
     max_depth_(max_depth),
-    context_(context), purpose_(purpose) {}
+    context_(context), purpose_(purpose),
+    prelinked_object_(std::move(prelinked_object)),
+    spill_store_() {}
 
 void ReplayDriverWriter::WriteToDirectory(
   std::vector<FlushableTestCase> &flushable_tcs,
@@ -477,52 +735,62 @@ void ReplayDriverWriter::WriteToDirectory(
   }
   std::experimental::filesystem::create_directory(dir_name);
 
+  for (auto &ftc : flushable_tcs) {
+    ResidentTestCaseScope resident{ftc, spill_store_.get()};
+    if (resident.IsResident())
+      WriteDriver(ftc, dir_name);
+  }
+}
+void ReplayDriverWriter::WriteDriver(const FlushableTestCase &ftc, const std::string &dir_name) {
   bool for_libfuzzer = purpose_ == ReplayDriverPurpose::kLibFuzzer;
-  for (const auto &ftc : flushable_tcs) {
-    const std::string &filename = "tc_" + std::to_string(ftc.GetId()) + ".cpp";
-    const std::string &fullpath = dir_name + '/' + filename;
-    if (std::ofstream target{fullpath}) {
-      if (import_writer_ != nullptr)
-        import_writer_->WriteHeader(target);
-
-      // Actually, clang++ does not require these lines
-//      target << "#include <stdint.h>\n";
-//      target << "#include <stddef.h>\n";
-
-      const TestCase &tc = ftc.GetTc();
-      const TCMemo &memo = ftc.GetMemo();
-
-      if (for_libfuzzer) {
-        AppendLibFuzzerHelperFunctions(target);
-        target << "extern \"C\" int LLVMFuzzerTestOneInput(const uint8_t *Data, size_t Size) {\n";
-        WriteStatementWithIndentation(target, "Init(Data, Size)");
-      } else {
-        target << "int main() {\n";
-      }
+  const std::string &filename = GetDriverFilename(ftc.GetId());
+  const std::string &fullpath = dir_name + '/' + filename;
+  if (std::ofstream target{fullpath}) {
+    if (import_writer_ != nullptr)
+      import_writer_->WriteHeader(target);
 
-      bool has_exception = ftc.GetReturnCode() == ExecutionResult::kExceptionReturnCode;
-      PrintStatements(
-        target,
-        tc,
-        context_,
-        bpstd::nullopt,
-        has_exception ? TryCatchVariant::kWithTryCatchNoReturnValue : TryCatchVariant::kNoTryCatch
-      ); // for the final GoogleTest-formatted Test Suite
+    // Actually, clang++ does not require these lines
+//    target << "#include <stdint.h>\n";
+//    target << "#include <stddef.h>\n";
 
-      WriteStatementWithIndentation(target, "return 0");
-      target << "}\n\n";
-
-      AppendCompileInstruction(target, filename);
+    const TestCase &tc = ftc.GetTc();
 
+    if (for_libfuzzer) {
+      AppendLibFuzzerHelperFunctions(target);
+      target << "extern \"C\" int LLVMFuzzerTestOneInput(const uint8_t *Data, size_t Size) {\n";
+      WriteStatementWithIndentation(target, "Init(Data, Size)");
     } else {
-      Logger::Error("[ReplayDriverWriter::WriteToDirectory]", "Problematic output file: " + fullpath + '\n');
+      target << "int main() {\n";
     }
+
+    bool has_exception = ftc.GetReturnCode() == ExecutionResult::kExceptionReturnCode;
+    PrintStatements(
+      target,
+      tc,
+      context_,
+      bpstd::nullopt,
+      has_exception ? TryCatchVariant::kWithTryCatchNoReturnValue : TryCatchVariant::kNoTryCatch
+    ); // for the final GoogleTest-formatted Test Suite
+
+    WriteStatementWithIndentation(target, "return 0");
+    target << "}\n\n";
+
+    AppendCompileInstruction(target, filename);
+
+  } else {
+    Logger::Error("[ReplayDriverWriter::WriteToDirectory]", "Problematic output file: " + fullpath + '\n');
   }
 }
+void ReplayDriverWriter::SetSpillStore(const std::shared_ptr<TestCaseSpillStore> &spill_store) {
+  spill_store_ = spill_store;
+}
+std::string ReplayDriverWriter::GetDriverFilename(int tc_id) {
+  return "tc_" + std::to_string(tc_id) + ".cpp";
+}
 void ReplayDriverWriter::AppendCompileInstruction(std::ofstream &target, const std::string &filename) {
   bool for_libfuzzer = purpose_ == ReplayDriverPurpose::kLibFuzzer;
-  const std::string &object_files =
-    "$(find " + target_dir_ + " -maxdepth " + std::to_string(max_depth_) + " -type f -name \"*.o\")";
+  const std::string &object_files = !prelinked_object_.empty() ? prelinked_object_
+    : "$(find " + target_dir_ + " -maxdepth " + std::to_string(max_depth_) + " -type f -name \"*.o\")";
 
   assert(SuffixCheck(filename, ".cpp"));
   std::string executable_name = filename;
@@ -595,4 +863,141 @@ void ReplayDriverWriter::AppendLibFuzzerHelperFunctions(std::ofstream &target) {
   target << "  else { return (T) 0; }\n";
   target << "}\n\n";
 }
+
+// ##########
+// # StreamingQueueWriter
+// #####
+
+StreamingQueueWriter::StreamingQueueWriter(
+  GoogleTestWriter gtest_writer,
+  ReplayDriverWriter replay_writer,
+  ReplayDriverWriter libfuzzer_writer,
+  std::string output_dir
+)
+  : gtest_writer_(std::move(gtest_writer)),
+    replay_writer_(std::move(replay_writer)),
+    libfuzzer_writer_(std::move(libfuzzer_writer)),
+    output_dir_(std::move(output_dir)),
+    valid_suite_(),
+    crash_suite_(),
+    valid_suite_ids_(),
+    crash_suite_ids_(),
+    streamed_drivers_() {}
+
+// Starts over from an empty output, a resumed campaign appends its whole queue again.
+void StreamingQueueWriter::Open() {
+  namespace fs = std::experimental::filesystem;
+  const std::string &valid_filename = output_dir_ + "/out_valid.cpp";
+  const std::string &crash_filename = output_dir_ + "/out_crash.cpp";
+  valid_suite_.open(valid_filename, std::ios::trunc);
+  crash_suite_.open(crash_filename, std::ios::trunc);
+  if (!valid_suite_.good())
+    Logger::Error("[StreamingQueueWriter::Open]", "Problematic output file: " + valid_filename + '\n');
+  if (!crash_suite_.good())
+    Logger::Error("[StreamingQueueWriter::Open]", "Problematic output file: " + crash_filename + '\n');
+  gtest_writer_.WriteHeader(valid_suite_);
+  gtest_writer_.WriteHeader(crash_suite_);
+  for (const std::string &dir_name : {output_dir_ + "/out_replay", output_dir_ + "/out_libfuzzer"}) {
+    if (fs::exists(dir_name))
+      fs::remove_all(dir_name);
+    fs::create_directory(dir_name);
+    for (int hours : ReplayDriverWriter::kPartitionHours)
+      fs::create_directory(dir_name + '/' + std::to_string(hours));
+  }
+}
+// Runs on the dispatching thread, with copies of the test cases taken under the queue mutex. A test case appended
+// again, e.g. after it was minimized, replaces its drivers.
+void StreamingQueueWriter::Append(std::vector<FlushableTestCase> &valid, std::vector<FlushableTestCase> &crashes) {
+  const auto &write_drivers = [](
+    ReplayDriverWriter &writer,
+    const std::string &dir_name,
+    const FlushableTestCase &ftc
+  ) {
+    writer.WriteDriver(ftc, dir_name);
+    for (int hours : ReplayDriverWriter::kPartitionHours) {
+      if (ftc.GetTimestamp() <= hours * 3600)
+        writer.WriteDriver(ftc, dir_name + '/' + std::to_string(hours));
+    }
+  };
+  for (auto &ftc : valid) {
+    AppendToSuite(valid_suite_, valid_suite_ids_, valid_suite_rewrite_, ftc);
+    write_drivers(replay_writer_, output_dir_ + "/out_replay", ftc);
+    streamed_drivers_[ftc.GetId()] = ftc.GetTimestamp();
+  }
+  if (!valid.empty()) {
+    assert(!Operand::IsKLibFuzzerMode());
+    Operand::LibFuzzerModeHacker _hack;
+    for (const auto &ftc : valid)
+      write_drivers(libfuzzer_writer_, output_dir_ + "/out_libfuzzer", ftc);
+  }
+  for (auto &ftc : crashes)
+    AppendToSuite(crash_suite_, crash_suite_ids_, crash_suite_rewrite_, ftc);
+  streamed_count_ += (long long int) (valid.size() + crashes.size());
+}
+// Expects the queue as written out, i.e. after its last Append and the corpus minimization.
+void StreamingQueueWriter::Finish(TestCaseQueue &queue, bool minimize_corpus) {
+  gtest_writer_.SetSpillStore(queue.GetSpillStore()); // a rewritten suite loads its spilled test cases one by one
+  std::vector<FlushableTestCase> &valid = queue.GetValid();
+  bool valid_rewrite = valid_suite_rewrite_ || valid_suite_ids_.size() != valid.size();
+  FinishSuite(valid_suite_, output_dir_ + "/out_valid.cpp", valid_rewrite, valid);
+  FinishSuite(crash_suite_, output_dir_ + "/out_crash.cpp", crash_suite_rewrite_, queue.GetCrashes());
+  for (const std::string &dir_name : {output_dir_ + "/out_replay", output_dir_ + "/out_libfuzzer"}) {
+    RemoveDrivers(dir_name, valid, std::numeric_limits<int>::max());
+    for (int hours : ReplayDriverWriter::kPartitionHours) {
+      std::vector<FlushableTestCase> subqueue = queue.GetValidByTimestamp(hours * 3600);
+      if (minimize_corpus)
+        subqueue = CorpusMinimizer::Minimize(subqueue);
+      RemoveDrivers(dir_name + '/' + std::to_string(hours), subqueue, hours * 3600);
+    }
+  }
+}
+long long int StreamingQueueWriter::GetStreamedCount() const {
+  return streamed_count_;
+}
+void StreamingQueueWriter::AppendToSuite(
+  std::ofstream &suite,
+  std::set<int> &suite_ids,
+  bool &suite_rewrite,
+  FlushableTestCase &ftc
+) {
+  // A changed test case cannot be appended twice, Finish rewrites the suite with it; new ones keep streaming.
+  if (!suite_ids.insert(ftc.GetId()).second) {
+    suite_rewrite = true;
+    return;
+  }
+  gtest_writer_.WriteTest(suite, ftc);
+  suite.flush();
+}
+void StreamingQueueWriter::FinishSuite(
+  std::ofstream &suite,
+  const std::string &filename,
+  bool suite_rewrite,
+  std::vector<FlushableTestCase> &tcs
+) {
+  if (suite_rewrite) {
+    suite.close();
+    gtest_writer_.WriteToFile(tcs, filename);
+    return;
+  }
+  if (tcs.empty())
+    suite << "// CXXFOOZZ did not generate any test case here.\n\n";
+  gtest_writer_.WriteFooter(suite, filename);
+  suite.close();
+}
+// The drivers of streamed test cases found by then that are not kept, i.e. dropped by a corpus minimization.
+void StreamingQueueWriter::RemoveDrivers(
+  const std::string &dir_name,
+  const std::vector<FlushableTestCase> &kept,
+  int last_ts_in_sec
+) {
+  std::set<int> kept_ids;
+  for (const auto &ftc : kept)
+    kept_ids.insert(ftc.GetId());
+  for (const auto &entry : streamed_drivers_) {
+    if (entry.second <= last_ts_in_sec && kept_ids.count(entry.first) == 0) {
+      std::error_code ec;
+      std::experimental::filesystem::remove(dir_name + '/' + ReplayDriverWriter::GetDriverFilename(entry.first), ec);
+    }
+  }
+}
 } // namespace cxxfoozz